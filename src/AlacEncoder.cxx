@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "AlacEncoder.hxx"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ALAC_VERBATIM_SSE2
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#define ALAC_VERBATIM_NEON
+#endif
+
+/**
+ * The element tag of a "channel pair element" (stereo).
+ */
+static constexpr unsigned ALAC_ID_CPE = 1;
+
+/**
+ * The element tag which terminates a frame.
+ */
+static constexpr unsigned ALAC_ID_END = 7;
+
+/**
+ * The number of bits of one residual in a channel pair element:
+ * the sample size plus one bit for the side channel.
+ */
+static constexpr unsigned ALAC_CHANNEL_BITS = 16 + 1;
+
+static constexpr unsigned ALAC_MAX_LPC_ORDER = 8;
+
+/**
+ * The coefficient precision in bits; this is what Apple's and
+ * FFmpeg's encoders use, and it keeps the predictor sum far away
+ * from 32 bit overflow.
+ */
+static constexpr unsigned ALAC_LPC_PRECISION = 9;
+static constexpr unsigned ALAC_MAX_LPC_SHIFT = 9;
+
+/**
+ * Writes bits MSB first.  If #p is nullptr, bits are only counted.
+ */
+class AlacBitWriter {
+	uint8_t *p;
+	uint64_t accumulator;
+	unsigned pending;
+	size_t n_bits;
+
+public:
+	explicit AlacBitWriter(void *dest)
+		:p((uint8_t *)dest), accumulator(0), pending(0), n_bits(0) {}
+
+	size_t GetBitCount() const {
+		return n_bits;
+	}
+
+	void Put(unsigned n, uint32_t value) {
+		assert(n > 0 && n <= 32);
+
+		n_bits += n;
+		if (p == nullptr)
+			return;
+
+		accumulator = (accumulator << n) |
+			(value & (uint32_t(-1) >> (32 - n)));
+		pending += n;
+
+		while (pending >= 8) {
+			pending -= 8;
+			*p++ = uint8_t(accumulator >> pending);
+		}
+	}
+
+	/**
+	 * Pads the last byte with zero bits.
+	 *
+	 * @return the total number of bytes
+	 */
+	size_t Flush() {
+		if (p != nullptr && pending > 0) {
+			*p++ = uint8_t(accumulator << (8 - pending));
+			pending = 0;
+		}
+
+		return (n_bits + 7) / 8;
+	}
+};
+
+gcc_const
+static inline int32_t
+sign_extend(int32_t value, unsigned bits)
+{
+	const unsigned shift = 32 - bits;
+	return int32_t(uint32_t(value) << shift) >> shift;
+}
+
+gcc_const
+static inline int
+sign_of(int32_t value)
+{
+	return (value > 0) - (value < 0);
+}
+
+gcc_const
+static inline unsigned
+log2_floor(uint32_t value)
+{
+	return value > 0 ? 31 - __builtin_clz(value) : 0;
+}
+
+/**
+ * Write the common part of the frame header.
+ */
+static void
+alac_write_header(AlacBitWriter &w, bool escape)
+{
+	w.Put(3, ALAC_ID_CPE);
+	w.Put(4, 0); /* element instance tag */
+	w.Put(12, 0); /* unused */
+	w.Put(1, 0); /* has size: no, the frame length is fixed */
+	w.Put(2, 0); /* number of "shifted" bytes */
+	w.Put(1, escape);
+}
+
+/*
+ * An uncompressed frame is the 23 bit header followed by the samples
+ * in big-endian byte order, i.e. the payload is misaligned by 7 bits.
+ * Starting at byte 3, each 16 bit big-endian word of the output is
+ * (s[i] << 1) | (s[i + 1] >> 15), which can be computed in parallel
+ * for all samples.
+ */
+
+static inline uint16_t
+alac_verbatim_word(uint16_t a, uint16_t b)
+{
+	return uint16_t((a << 1) | (b >> 15));
+}
+
+#ifdef ALAC_VERBATIM_SSE2
+
+static unsigned
+alac_verbatim_simd(uint8_t *dest, const uint16_t *src, unsigned n)
+{
+	unsigned i = 0;
+	for (; i + 8 < n; i += 8) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 1));
+		__m128i w = _mm_or_si128(_mm_slli_epi16(a, 1),
+					 _mm_srli_epi16(b, 15));
+		w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+		_mm_storeu_si128((__m128i *)(dest + i * 2), w);
+	}
+
+	return i;
+}
+
+#elif defined(ALAC_VERBATIM_NEON)
+
+static unsigned
+alac_verbatim_simd(uint8_t *dest, const uint16_t *src, unsigned n)
+{
+	unsigned i = 0;
+	for (; i + 8 < n; i += 8) {
+		const uint16x8_t a = vld1q_u16(src + i);
+		const uint16x8_t b = vld1q_u16(src + i + 1);
+		const uint16x8_t w = vorrq_u16(vshlq_n_u16(a, 1),
+					       vshrq_n_u16(b, 15));
+		vst1q_u8(dest + i * 2, vrev16q_u8(vreinterpretq_u8_u16(w)));
+	}
+
+	return i;
+}
+
+#endif
+
+size_t
+alac_encode_verbatim(void *_dest, const int16_t *_src, unsigned n_frames)
+{
+	assert(n_frames <= ALAC_FRAME_LENGTH);
+
+	uint8_t *dest = (uint8_t *)_dest;
+	const uint16_t *src = (const uint16_t *)_src;
+	const unsigned n = n_frames * 2;
+
+	/* ID_CPE, zero instance tag and unused bits, no size, no
+	   shift, escape flag set */
+	dest[0] = ALAC_ID_CPE << 5;
+	dest[1] = 0;
+
+	if (n == 0) {
+		dest[2] = 0x02;
+		return 3;
+	}
+
+	dest[2] = 0x02 | (src[0] >> 15);
+	dest += 3;
+
+#if defined(ALAC_VERBATIM_SSE2) || defined(ALAC_VERBATIM_NEON)
+	unsigned i = alac_verbatim_simd(dest, src, n);
+#else
+	unsigned i = 0;
+#endif
+
+	for (; i + 1 < n; ++i) {
+		const uint16_t w = alac_verbatim_word(src[i], src[i + 1]);
+		dest[i * 2] = uint8_t(w >> 8);
+		dest[i * 2 + 1] = uint8_t(w);
+	}
+
+	/* the last sample is followed by zero padding */
+	const uint16_t w = alac_verbatim_word(src[i], 0);
+	dest[i * 2] = uint8_t(w >> 8);
+	dest[i * 2 + 1] = uint8_t(w);
+
+	return 3 + n * 2;
+}
+
+struct AlacLpc {
+	unsigned order;
+	unsigned shift;
+	int16_t coefs[ALAC_MAX_LPC_ORDER];
+};
+
+/**
+ * Calculate LPC coefficients with the Levinson-Durbin recursion on
+ * a Welch-windowed copy of the signal.  The coefficients are stored
+ * in ALAC order: coefs[0] applies to the most recent sample.
+ */
+static void
+alac_compute_lpc(const int32_t *x, unsigned n, unsigned order, AlacLpc &lpc)
+{
+	assert(order <= ALAC_MAX_LPC_ORDER);
+
+	lpc.order = 0;
+	lpc.shift = 0;
+
+	if (n <= order + 1)
+		return;
+
+	double windowed[ALAC_FRAME_LENGTH];
+	const double c = 2.0 / (n - 1.0);
+	for (unsigned i = 0; i < n; ++i) {
+		const double w = c * i - 1.0;
+		windowed[i] = x[i] * (1.0 - w * w);
+	}
+
+	double r[ALAC_MAX_LPC_ORDER + 1];
+	for (unsigned lag = 0; lag <= order; ++lag) {
+		double sum = 0;
+		for (unsigned i = lag; i < n; ++i)
+			sum += windowed[i] * windowed[i - lag];
+		r[lag] = sum;
+	}
+
+	if (r[0] <= 0)
+		/* digital silence */
+		return;
+
+	double a[ALAC_MAX_LPC_ORDER + 1] = { 0 };
+	double error = r[0] * (1.0 + 1e-9);
+	for (unsigned i = 1; i <= order; ++i) {
+		double k = r[i];
+		for (unsigned j = 1; j < i; ++j)
+			k -= a[j] * r[i - j];
+		k /= error;
+
+		double tmp[ALAC_MAX_LPC_ORDER + 1];
+		for (unsigned j = 1; j < i; ++j)
+			tmp[j] = a[j] - k * a[i - j];
+		for (unsigned j = 1; j < i; ++j)
+			a[j] = tmp[j];
+		a[i] = k;
+
+		error *= 1.0 - k * k;
+		if (error <= 0)
+			return;
+	}
+
+	double cmax = 0;
+	for (unsigned i = 1; i <= order; ++i)
+		if (fabs(a[i]) > cmax)
+			cmax = fabs(a[i]);
+
+	if (cmax <= 0)
+		return;
+
+	constexpr int qmax = (1 << (ALAC_LPC_PRECISION - 1)) - 1;
+	unsigned shift = ALAC_MAX_LPC_SHIFT;
+	while (shift > 1 && cmax * (1 << shift) > qmax)
+		--shift;
+
+	for (unsigned i = 0; i < order; ++i) {
+		long q = lrint(a[i + 1] * (1 << shift));
+		if (q > qmax)
+			q = qmax;
+		else if (q < -qmax - 1)
+			q = -qmax - 1;
+		lpc.coefs[i] = int16_t(q);
+	}
+
+	lpc.order = order;
+	lpc.shift = shift;
+}
+
+/**
+ * Calculate the prediction residual.  This mirrors the adaptive
+ * predictor of the decoder exactly, including its coefficient
+ * updates.
+ */
+static void
+alac_predict(const int32_t *x, int32_t *residual, unsigned n,
+	     const AlacLpc &lpc)
+{
+	const unsigned order = lpc.order;
+
+	if (n == 0)
+		return;
+
+	residual[0] = x[0];
+
+	if (order == 0) {
+		memcpy(residual + 1, x + 1, (n - 1) * sizeof(*x));
+		return;
+	}
+
+	unsigned i = 1;
+	for (; i <= order && i < n; ++i)
+		residual[i] = sign_extend(x[i] - x[i - 1], ALAC_CHANNEL_BITS);
+
+	int16_t coefs[ALAC_MAX_LPC_ORDER];
+	memcpy(coefs, lpc.coefs, sizeof(coefs));
+
+	const unsigned shift = lpc.shift;
+
+	for (; i < n; ++i) {
+		const int32_t top = x[i - order - 1];
+		const int32_t *const prev = x + i - 1;
+
+		/* the decoder accumulates in (wrapping) 32 bit */
+		uint32_t sum = 0;
+		for (unsigned k = 0; k < order; ++k)
+			sum += uint32_t(coefs[k] * (prev[-(int)k] - top));
+
+		const int32_t prediction = top +
+			int32_t((int64_t(int32_t(sum)) +
+				 (int64_t(1) << (shift - 1))) >> shift);
+
+		int32_t error = sign_extend(x[i] - prediction,
+					    ALAC_CHANNEL_BITS);
+		residual[i] = error;
+
+		/* adapt the coefficients, starting with the oldest
+		   sample */
+		const int error_sign = sign_of(error);
+		for (int k = order - 1; k >= 0 && error * error_sign > 0; --k) {
+			const int32_t delta = top - prev[-k];
+			const int sign = sign_of(delta) * error_sign;
+			coefs[k] -= sign;
+			error -= ((delta * sign) >> shift) * int(order - k);
+		}
+	}
+}
+
+/**
+ * Encode one adaptive Rice/Golomb code.
+ */
+static void
+alac_put_scalar(AlacBitWriter &w, uint32_t x, unsigned k, unsigned raw_bits)
+{
+	if (k > ALAC_RICE_LIMIT)
+		k = ALAC_RICE_LIMIT;
+
+	const uint32_t divisor = (1u << k) - 1;
+	const uint32_t q = x / divisor;
+	const uint32_t r = x % divisor;
+
+	if (q > 8) {
+		/* escape: nine one bits followed by the raw value */
+		w.Put(9, 0x1ff);
+		w.Put(raw_bits, x);
+		return;
+	}
+
+	if (q > 0)
+		w.Put(q, (1u << q) - 1);
+	w.Put(1, 0);
+
+	if (k != 1) {
+		if (r > 0)
+			w.Put(k, r + 1);
+		else
+			w.Put(k - 1, 0);
+	}
+}
+
+/**
+ * Entropy-code the residual of one channel.
+ */
+static void
+alac_put_residual(AlacBitWriter &w, const int32_t *residual, unsigned n)
+{
+	unsigned history = ALAC_RICE_INITIAL_HISTORY;
+	unsigned sign_modifier = 0;
+
+	for (unsigned i = 0; i < n;) {
+		const int32_t value = residual[i++];
+		const uint32_t x = value >= 0
+			? uint32_t(value) << 1
+			: (uint32_t(-value) << 1) - 1;
+
+		const unsigned k = log2_floor((history >> 9) + 3);
+		alac_put_scalar(w, x - sign_modifier, k, ALAC_CHANNEL_BITS);
+
+		history += x * ALAC_RICE_HISTORY_MULT -
+			((history * ALAC_RICE_HISTORY_MULT) >> 9);
+		sign_modifier = 0;
+		if (x > 0xffff)
+			history = 0xffff;
+
+		if (history < 128 && i < n) {
+			/* encode a run of zeroes */
+			const unsigned run_k = 7 - log2_floor(history) +
+				((history + 16) >> 6);
+
+			unsigned run = 0;
+			while (i < n && residual[i] == 0) {
+				++i;
+				++run;
+			}
+
+			alac_put_scalar(w, run, run_k, 16);
+			sign_modifier = run <= 0xffff;
+			history = 0;
+		}
+	}
+}
+
+static void
+alac_put_channel_header(AlacBitWriter &w, const AlacLpc &lpc)
+{
+	w.Put(4, 0); /* prediction type */
+	w.Put(4, lpc.shift);
+	w.Put(3, 4); /* Rice history multiplier, in 1/4 units */
+	w.Put(5, lpc.order);
+
+	for (unsigned i = 0; i < lpc.order; ++i)
+		w.Put(16, uint16_t(lpc.coefs[i]));
+}
+
+/**
+ * One channel after stereo decorrelation, with its chosen
+ * predictor and the resulting residual.
+ */
+struct AlacChannel {
+	int32_t samples[ALAC_FRAME_LENGTH];
+	int32_t residual[ALAC_FRAME_LENGTH];
+	AlacLpc lpc;
+
+	/**
+	 * The size of this channel's part of the frame in bits.
+	 */
+	size_t bits;
+};
+
+/**
+ * Calculate the residual for the given predictor order and
+ * determine its encoded size.
+ */
+static size_t
+alac_try_order(const int32_t *samples, int32_t *residual, unsigned n,
+	       unsigned order, AlacLpc &lpc)
+{
+	alac_compute_lpc(samples, n, order, lpc);
+	alac_predict(samples, residual, n, lpc);
+
+	AlacBitWriter counter(nullptr);
+	alac_put_channel_header(counter, lpc);
+	alac_put_residual(counter, residual, n);
+	return counter.GetBitCount();
+}
+
+/**
+ * Choose a predictor for the channel and calculate its residual.
+ */
+static void
+alac_analyze_channel(AlacChannel &ch, unsigned n, unsigned compression)
+{
+	ch.bits = alac_try_order(ch.samples, ch.residual, n, 4, ch.lpc);
+
+	if (compression < ALAC_COMPRESSION_BEST)
+		return;
+
+	int32_t residual[ALAC_FRAME_LENGTH];
+	AlacLpc lpc;
+	const size_t bits = alac_try_order(ch.samples, residual, n,
+					   ALAC_MAX_LPC_ORDER, lpc);
+	if (bits < ch.bits) {
+		memcpy(ch.residual, residual, n * sizeof(residual[0]));
+		ch.lpc = lpc;
+		ch.bits = bits;
+	}
+}
+
+/**
+ * A cheap estimate of how well a channel compresses: the sum of
+ * the absolute second order differences.
+ */
+gcc_pure
+static uint64_t
+alac_estimate(const int32_t *x, unsigned n)
+{
+	uint64_t sum = 0;
+	for (unsigned i = 2; i < n; ++i) {
+		const int64_t d = int64_t(x[i]) - 2 * int64_t(x[i - 1]) +
+			x[i - 2];
+		sum += d >= 0 ? d : -d;
+	}
+
+	return sum;
+}
+
+/**
+ * Split the interleaved input into left/right (#lr) and mid/side
+ * (#ms) channels.  The decoder restores left/right from mid/side
+ * with "mix bits" 1 and "mix res" 1.
+ */
+static void
+alac_deinterleave(AlacChannel *lr, AlacChannel *ms,
+		  const int16_t *src, unsigned n)
+{
+	for (unsigned i = 0; i < n; ++i) {
+		const int32_t left = src[i * 2], right = src[i * 2 + 1];
+
+		lr[0].samples[i] = left;
+		lr[1].samples[i] = right;
+		ms[0].samples[i] = (left + right) >> 1;
+		ms[1].samples[i] = left - right;
+	}
+}
+
+size_t
+alac_encode(void *dest, const int16_t *src, unsigned n_frames,
+	    unsigned compression)
+{
+	assert(n_frames <= ALAC_FRAME_LENGTH);
+
+	if (compression == ALAC_COMPRESSION_NONE ||
+	    n_frames <= ALAC_MAX_LPC_ORDER + 1)
+		return alac_encode_verbatim(dest, src, n_frames);
+
+	AlacChannel lr[2], ms[2];
+	alac_deinterleave(lr, ms, src, n_frames);
+
+	bool mid_side;
+	if (compression >= ALAC_COMPRESSION_BEST) {
+		for (unsigned i = 0; i < 2; ++i) {
+			alac_analyze_channel(lr[i], n_frames, compression);
+			alac_analyze_channel(ms[i], n_frames, compression);
+		}
+
+		mid_side = ms[0].bits + ms[1].bits < lr[0].bits + lr[1].bits;
+	} else {
+		mid_side = alac_estimate(ms[0].samples, n_frames) +
+			alac_estimate(ms[1].samples, n_frames) <
+			alac_estimate(lr[0].samples, n_frames) +
+			alac_estimate(lr[1].samples, n_frames);
+
+		AlacChannel *channels = mid_side ? ms : lr;
+		for (unsigned i = 0; i < 2; ++i)
+			alac_analyze_channel(channels[i], n_frames,
+					     compression);
+	}
+
+	const AlacChannel *channels = mid_side ? ms : lr;
+
+	/* header, mix parameters, both channels, end tag */
+	const size_t bits = 23 + 16 + channels[0].bits + channels[1].bits + 3;
+	const size_t verbatim_bits = 23 + n_frames * 32;
+	if (bits >= verbatim_bits)
+		return alac_encode_verbatim(dest, src, n_frames);
+
+	AlacBitWriter w(dest);
+	alac_write_header(w, false);
+	w.Put(8, mid_side); /* mix bits (interlacing shift) */
+	w.Put(8, mid_side); /* mix res (interlacing left weight) */
+
+	for (unsigned i = 0; i < 2; ++i)
+		alac_put_channel_header(w, channels[i].lpc);
+
+	for (unsigned i = 0; i < 2; ++i)
+		alac_put_residual(w, channels[i].residual, n_frames);
+
+	w.Put(3, ALAC_ID_END);
+
+	assert(w.GetBitCount() == bits);
+	return w.Flush();
+}
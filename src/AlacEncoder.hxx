@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A minimal Apple Lossless (ALAC) encoder for 16 bit stereo, as used
+ * by the RAOP output plugin.
+ */
+
+#ifndef MPD_ALAC_ENCODER_HXX
+#define MPD_ALAC_ENCODER_HXX
+
+#include "gcc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of frames in one ALAC packet.  This is announced to
+ * the receiver in the SDP "fmtp" line.
+ */
+static constexpr unsigned ALAC_FRAME_LENGTH = 352;
+
+/**
+ * The Rice coder parameters announced in the SDP "fmtp" line
+ * ("pb", "mb" and "kb" in Apple's reference implementation).  The
+ * encoder relies on exactly these values.
+ */
+static constexpr unsigned ALAC_RICE_HISTORY_MULT = 40;
+static constexpr unsigned ALAC_RICE_INITIAL_HISTORY = 10;
+static constexpr unsigned ALAC_RICE_LIMIT = 14;
+
+/**
+ * The maximum size of one encoded frame in bytes.  This is the size
+ * of an uncompressed frame: a 23 bit header followed by the raw
+ * samples.
+ */
+static constexpr size_t ALAC_MAX_FRAME_SIZE = 3 + ALAC_FRAME_LENGTH * 4;
+
+/**
+ * No compression, emit uncompressed ("escape") frames only.
+ */
+static constexpr unsigned ALAC_COMPRESSION_NONE = 0;
+
+/**
+ * Fast compression: 4th order prediction, stereo mode guessed from
+ * a cheap estimate.
+ */
+static constexpr unsigned ALAC_COMPRESSION_FAST = 1;
+
+/**
+ * Best compression: up to 8th order prediction, all candidates are
+ * measured exactly.
+ */
+static constexpr unsigned ALAC_COMPRESSION_BEST = 2;
+
+/**
+ * Writes an uncompressed ALAC frame.
+ *
+ * @param dest the destination buffer, at least #ALAC_MAX_FRAME_SIZE
+ * bytes
+ * @param src interleaved 16 bit stereo samples in host byte order
+ * @param n_frames the number of frames in #src, must not be larger
+ * than #ALAC_FRAME_LENGTH
+ * @return the number of bytes written to #dest
+ */
+gcc_nonnull_all
+size_t
+alac_encode_verbatim(void *dest, const int16_t *src, unsigned n_frames);
+
+/**
+ * Encodes one ALAC frame.  If compression does not make the frame
+ * smaller, an uncompressed frame is written instead.
+ *
+ * @param dest the destination buffer, at least #ALAC_MAX_FRAME_SIZE
+ * bytes
+ * @param src interleaved 16 bit stereo samples in host byte order
+ * @param n_frames the number of frames in #src, must not be larger
+ * than #ALAC_FRAME_LENGTH
+ * @param compression one of the ALAC_COMPRESSION_* constants
+ * @return the number of bytes written to #dest
+ */
+gcc_nonnull_all
+size_t
+alac_encode(void *dest, const int16_t *src, unsigned n_frames,
+	    unsigned compression);
+
+#endif
@@ -112,6 +112,7 @@ static const struct command commands[] = {
 	{ "password", PERMISSION_NONE, 1, 1, handle_password },
 	{ "pause", PERMISSION_CONTROL, 0, 1, handle_pause },
 	{ "ping", PERMISSION_NONE, 0, 0, handle_ping },
+	{ "pipelinestats", PERMISSION_READ, 0, 0, handle_pipelinestats },
 	{ "play", PERMISSION_CONTROL, 0, 1, handle_play },
 	{ "playid", PERMISSION_CONTROL, 0, 1, handle_playid },
 	{ "playlist", PERMISSION_READ, 0, 0, handle_playlist },
@@ -51,7 +51,9 @@ enum ConfigOption {
 	CONF_REPLAYGAIN_LIMIT,
 	CONF_VOLUME_NORMALIZATION,
 	CONF_SAMPLERATE_CONVERTER,
+	CONF_SAMPLERATE_THREADS,
 	CONF_AUDIO_BUFFER_SIZE,
+	CONF_AUDIO_CHUNK_SIZE,
 	CONF_BUFFER_BEFORE_PLAY,
 	CONF_HTTP_PROXY_HOST,
 	CONF_HTTP_PROXY_PORT,
@@ -51,7 +51,9 @@ const ConfigTemplate config_templates[] = {
 	{ "replaygain_limit", false, false },
 	{ "volume_normalization", false, false },
 	{ "samplerate_converter", false, false },
+	{ "samplerate_threads", false, false },
 	{ "audio_buffer_size", false, false },
+	{ "audio_chunk_size", false, false },
 	{ "buffer_before_play", false, false },
 	{ "http_proxy_host", false, false },
 	{ "http_proxy_port", false, false },
@@ -99,6 +99,7 @@ unsigned cross_fade_calc(float duration, float total_time,
 			 char *mixramp_start, char *mixramp_prev_end,
 			 const struct audio_format *af,
 			 const struct audio_format *old_format,
+			 size_t chunk_size,
 			 unsigned max_chunks)
 {
 	unsigned int chunks = 0;
@@ -113,7 +114,7 @@ unsigned cross_fade_calc(float duration, float total_time,
 	assert(duration >= 0);
 	assert(audio_format_valid(af));
 
-	chunks_f = (float)audio_format_time_to_size(af) / (float)CHUNK_SIZE;
+	chunks_f = (float)audio_format_time_to_size(af) / (float)chunk_size;
 
 	if (std::isnan(mixramp_delay) || !mixramp_start || !mixramp_prev_end) {
 		chunks = (chunks_f * duration + 0.5);
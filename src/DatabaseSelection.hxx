@@ -49,6 +49,13 @@ struct DatabaseSelection {
 		assert(uri != NULL);
 	}
 
+	/**
+	 * Does this select all songs of the database?
+	 */
+	bool IsEverything() const {
+		return *uri == 0 && recursive && filter == nullptr;
+	}
+
 	gcc_pure
 	bool Match(const song &song) const;
 };
@@ -23,6 +23,8 @@
 #include "MusicPipe.hxx"
 #include "MusicBuffer.hxx"
 #include "MusicChunk.hxx"
+#include "PipelineStats.hxx"
+#include "clock.h"
 #include "tag.h"
 
 #include <assert.h>
@@ -77,6 +79,7 @@ decoder_get_chunk(struct decoder *decoder)
 	do {
 		decoder->chunk = music_buffer_allocate(dc->buffer);
 		if (decoder->chunk != NULL) {
+			decoder->chunk->time_stamp = monotonic_clock_us();
 			decoder->chunk->replay_gain_serial =
 				decoder->replay_gain_serial;
 			if (decoder->replay_gain_serial != 0)
@@ -104,8 +107,14 @@ decoder_flush_chunk(struct decoder *decoder)
 
 	if (decoder->chunk->IsEmpty())
 		music_buffer_return(dc->buffer, decoder->chunk);
-	else
+	else {
+		const uint64_t now = monotonic_clock_us();
+		pipeline_stats.decode_time.Record(now -
+						  decoder->chunk->time_stamp);
+		decoder->chunk->time_stamp = now;
+
 		music_pipe_push(dc->pipe, decoder->chunk);
+	}
 
 	decoder->chunk = NULL;
 }
@@ -23,6 +23,7 @@
 #include "PlaylistVector.hxx"
 #include "DatabaseLock.hxx"
 #include "SongSort.hxx"
+#include "TagIndex.hxx"
 
 extern "C" {
 #include "song.h"
@@ -50,6 +51,25 @@ Directory::Allocate(const char *path)
 	return directory;
 }
 
+/**
+ * Removes one entry from a multimap (there may be others with the
+ * same key).
+ */
+template<typename M, typename V>
+static void
+erase_value(M &map, const char *key, V value)
+{
+	auto range = map.equal_range(key);
+	for (auto i = range.first; i != range.second; ++i) {
+		if (i->second == value) {
+			map.erase(i);
+			return;
+		}
+	}
+
+	assert(false);
+}
+
 Directory::Directory()
 {
 	INIT_LIST_HEAD(&children);
@@ -69,8 +89,10 @@ Directory::Directory(const char *_path)
 Directory::~Directory()
 {
 	struct song *song, *ns;
-	directory_for_each_song_safe(song, ns, this)
+	directory_for_each_song_safe(song, ns, this) {
+		db_tag_index.Remove(*song);
 		song_free(song);
+	}
 
 	Directory *child, *n;
 	directory_for_each_child_safe(child, n, this)
@@ -103,6 +125,7 @@ Directory::Delete()
 	assert(holding_db_lock());
 	assert(parent != nullptr);
 
+	erase_value(parent->child_index, GetName(), this);
 	list_del(&siblings);
 	Free();
 }
@@ -143,6 +166,7 @@ Directory::CreateChild(const char *name_utf8)
 	g_free(allocated);
 
 	list_add_tail(&child->siblings, &children);
+	child_index.emplace(child->GetName(), child);
 	return child;
 }
 
@@ -151,12 +175,10 @@ Directory::FindChild(const char *name) const
 {
 	assert(holding_db_lock());
 
-	const Directory *child;
-	directory_for_each_child(child, this)
-		if (strcmp(child->GetName(), name) == 0)
-			return child;
-
-	return NULL;
+	auto i = child_index.find(name);
+	return i != child_index.end()
+		? i->second
+		: NULL;
 }
 
 void
@@ -215,6 +237,8 @@ Directory::AddSong(struct song *song)
 	assert(song->parent == this);
 
 	list_add_tail(&song->siblings, &songs);
+	song_index.emplace(song->uri, song);
+	db_tag_index.Add(*song);
 }
 
 void
@@ -225,6 +249,8 @@ Directory::RemoveSong(struct song *song)
 	assert(song->parent == this);
 
 	list_del(&song->siblings);
+	erase_value(song_index, song->uri, song);
+	db_tag_index.Remove(*song);
 }
 
 const song *
@@ -233,15 +259,12 @@ Directory::FindSong(const char *name_utf8) const
 	assert(holding_db_lock());
 	assert(name_utf8 != NULL);
 
-	struct song *song;
-	directory_for_each_song(song, this) {
-		assert(song->parent == this);
-
-		if (strcmp(song->uri, name_utf8) == 0)
-			return song;
-	}
+	auto i = song_index.find(name_utf8);
+	if (i == song_index.end())
+		return NULL;
 
-	return NULL;
+	assert(i->second->parent == this);
+	return i->second;
 }
 
 struct song *
@@ -27,7 +27,10 @@
 #include "PlaylistVector.hxx"
 #include "gerror.h"
 
+#include <unordered_map>
+
 #include <stdbool.h>
+#include <string.h>
 #include <sys/types.h>
 
 #define DEVICE_INARCHIVE (dev_t)(-1)
@@ -50,10 +53,31 @@ struct db_visitor;
 class SongFilter;
 
 struct Directory {
+	/**
+	 * Hash function for the name indexes.
+	 */
+	struct NameHash {
+		gcc_pure
+		size_t operator()(const char *p) const {
+			size_t hash = 5381;
+			while (*p != 0)
+				hash = (hash << 5) + hash + (unsigned char)*p++;
+			return hash;
+		}
+	};
+
+	struct NameEqual {
+		gcc_pure
+		bool operator()(const char *a, const char *b) const {
+			return strcmp(a, b) == 0;
+		}
+	};
+
 	/**
 	 * Pointers to the siblings of this directory within the
 	 * parent directory.  It is unused (undefined) in the root
-	 * directory.
+	 * directory.  This must be the first attribute, see
+	 * directory_cmp().
 	 *
 	 * This attribute is protected with the global #db_mutex.
 	 * Read access in the update thread does not need protection.
@@ -76,6 +100,25 @@ struct Directory {
 	 */
 	struct list_head songs;
 
+	/**
+	 * Maps the names of the #children (see GetName()) to the
+	 * objects, so FindChild() doesn't need to scan the list.  The
+	 * keys are owned by the children.
+	 *
+	 * This attribute is protected like #children.
+	 */
+	std::unordered_multimap<const char *, Directory *,
+				NameHash, NameEqual> child_index;
+
+	/**
+	 * Maps the names of the #songs (song::uri) to the objects,
+	 * for FindSong().  The keys are owned by the songs.
+	 *
+	 * This attribute is protected like #songs.
+	 */
+	std::unordered_multimap<const char *, song *,
+				NameHash, NameEqual> song_index;
+
 	PlaylistVector playlists;
 
 	Directory *parent;
@@ -137,6 +180,10 @@ public:
 	Directory *CreateChild(const char *name_utf8);
 
 	/**
+	 * Looks up a sub directory by its name.  If there are several
+	 * with the same name, an arbitrary one is returned (not
+	 * necessarily the first one in #children).
+	 *
 	 * Caller must lock the #db_mutex.
 	 */
 	gcc_pure
@@ -197,7 +244,9 @@ public:
 	}
 
 	/**
-	 * Look up a song in this directory by its name.
+	 * Look up a song in this directory by its name.  If there are
+	 * several with the same name, an arbitrary one is returned
+	 * (not necessarily the first one in #songs).
 	 *
 	 * Caller must lock the #db_mutex.
 	 */
@@ -223,14 +272,15 @@ public:
 
 	/**
 	 * Add a song object to this directory.  Its "parent" attribute must
-	 * be set already.
+	 * be set already.  The song is added to #db_tag_index.
 	 */
 	void AddSong(song *song);
 
 	/**
 	 * Remove a song object from this directory (which effectively
 	 * invalidates the song object, because the "parent" attribute becomes
-	 * stale), but does not free it.
+	 * stale), but does not free it.  The song is removed from
+	 * #db_tag_index.
 	 */
 	void RemoveSong(song *song);
 
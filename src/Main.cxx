@@ -92,6 +92,7 @@ extern "C" {
 
 enum {
 	DEFAULT_BUFFER_SIZE = 2048,
+	MAX_CHUNK_SIZE = 1024,
 	DEFAULT_BUFFER_BEFORE_PLAY = 10,
 };
 
@@ -291,6 +292,7 @@ initialize_decoder_and_player(void)
 	char *test;
 	size_t buffer_size;
 	float perc;
+	size_t chunk_size;
 	unsigned buffered_chunks;
 	unsigned buffered_before_play;
 
@@ -306,7 +308,18 @@ initialize_decoder_and_player(void)
 
 	buffer_size *= 1024;
 
-	buffered_chunks = buffer_size / CHUNK_SIZE;
+	chunk_size = config_get_positive(CONF_AUDIO_CHUNK_SIZE,
+					 DEFAULT_CHUNK_SIZE / 1024);
+	if (chunk_size > MAX_CHUNK_SIZE)
+		MPD_ERROR("audio_chunk_size must not be larger than %u\n",
+			  (unsigned)MAX_CHUNK_SIZE);
+
+	chunk_size *= 1024;
+
+	buffered_chunks = buffer_size / chunk_size;
+	if (buffered_chunks == 0)
+		MPD_ERROR("buffer size \"%li\" is smaller than the chunk size\n",
+			  (long)buffer_size);
 
 	if (buffered_chunks >= 1 << 15)
 		MPD_ERROR("buffer size \"%li\" is too big\n", (long)buffer_size);
@@ -333,6 +346,7 @@ initialize_decoder_and_player(void)
 	instance->partition = new Partition(*instance,
 					    max_length,
 					    buffered_chunks,
+					    chunk_size,
 					    buffered_before_play);
 }
 
@@ -20,27 +20,45 @@
 #include "config.h"
 #include "MusicBuffer.hxx"
 #include "MusicChunk.hxx"
-#include "thread/Mutex.hxx"
 #include "util/SliceBuffer.hxx"
+#include "util/HugeAllocator.hxx"
 #include "mpd_error.h"
 
 #include <assert.h>
 
 struct music_buffer : public SliceBuffer<music_chunk>  {
-	/** a mutex which protects #available */
-	Mutex mutex;
+	/** the size of each chunk's #music_chunk::data */
+	const size_t chunk_size;
 
-	music_buffer(unsigned num_chunks)
-		:SliceBuffer(num_chunks) {
-		if (IsOOM())
+	/**
+	 * The payload of all chunks; the #music_chunk objects are
+	 * kept apart from it, so the chunk size may be chosen at
+	 * runtime.
+	 */
+	char *const chunk_data;
+
+	music_buffer(unsigned num_chunks, size_t _chunk_size)
+		:SliceBuffer(num_chunks), chunk_size(_chunk_size),
+		 chunk_data((char *)HugeAllocate(CalcDataSize())) {
+		if (IsOOM() || chunk_data == nullptr)
 			MPD_ERROR("Failed to allocate buffer");
 	}
+
+	~music_buffer() {
+		HugeFree(chunk_data, CalcDataSize());
+	}
+
+	size_t CalcDataSize() const {
+		return GetCapacity() * chunk_size;
+	}
 };
 
 struct music_buffer *
-music_buffer_new(unsigned num_chunks)
+music_buffer_new(unsigned num_chunks, size_t chunk_size)
 {
-	return new music_buffer(num_chunks);
+	assert(chunk_size > 0);
+
+	return new music_buffer(num_chunks, chunk_size);
 }
 
 void
@@ -55,11 +73,23 @@ music_buffer_size(const struct music_buffer *buffer)
 	return buffer->GetCapacity();
 }
 
+size_t
+music_buffer_chunk_size(const struct music_buffer *buffer)
+{
+	return buffer->chunk_size;
+}
+
 struct music_chunk *
 music_buffer_allocate(struct music_buffer *buffer)
 {
-	const ScopeLock protect(buffer->mutex);
-	return buffer->Allocate();
+	struct music_chunk *chunk = buffer->Allocate();
+	if (chunk != nullptr) {
+		chunk->data = buffer->chunk_data +
+			buffer->GetIndex(chunk) * buffer->chunk_size;
+		chunk->capacity = buffer->chunk_size;
+	}
+
+	return chunk;
 }
 
 void
@@ -68,8 +98,6 @@ music_buffer_return(struct music_buffer *buffer, struct music_chunk *chunk)
 	assert(buffer != NULL);
 	assert(chunk != NULL);
 
-	const ScopeLock protect(buffer->mutex);
-
 	if (chunk->other != nullptr) {
 		assert(chunk->other->other == nullptr);
 		buffer->Free(chunk->other);
@@ -77,3 +105,13 @@ music_buffer_return(struct music_buffer *buffer, struct music_chunk *chunk)
 
 	buffer->Free(chunk);
 }
+
+void
+music_buffer_discard(struct music_buffer *buffer)
+{
+	if (!buffer->IsEmpty())
+		return;
+
+	buffer->Discard();
+	HugeDiscard(buffer->chunk_data, buffer->CalcDataSize());
+}
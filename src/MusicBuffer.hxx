@@ -20,8 +20,11 @@
 #ifndef MPD_MUSIC_BUFFER_HXX
 #define MPD_MUSIC_BUFFER_HXX
 
+#include <stddef.h>
+
 /**
- * An allocator for #music_chunk objects.
+ * An allocator for #music_chunk objects.  It is lock-free, and it
+ * may be used by several threads at the same time.
  */
 struct music_buffer;
 
@@ -30,9 +33,10 @@ struct music_buffer;
  *
  * @param num_chunks the number of #music_chunk reserved in this
  * buffer
+ * @param chunk_size the size of each chunk's payload in bytes
  */
 struct music_buffer *
-music_buffer_new(unsigned num_chunks);
+music_buffer_new(unsigned num_chunks, size_t chunk_size);
 
 /**
  * Frees the #music_buffer object
@@ -48,6 +52,13 @@ music_buffer_free(struct music_buffer *buffer);
 unsigned
 music_buffer_size(const struct music_buffer *buffer);
 
+/**
+ * Returns the payload size of each chunk in bytes.  This is the same
+ * value which was passed to music_buffer_new().
+ */
+size_t
+music_buffer_chunk_size(const struct music_buffer *buffer);
+
 /**
  * Allocates a chunk from the buffer.  When it is not used anymore,
  * call music_buffer_return().
@@ -64,4 +75,11 @@ music_buffer_allocate(struct music_buffer *buffer);
 void
 music_buffer_return(struct music_buffer *buffer, struct music_chunk *chunk);
 
+/**
+ * Gives the memory of all chunks back to the kernel if none is in
+ * use.  No other thread may use the buffer meanwhile.
+ */
+void
+music_buffer_discard(struct music_buffer *buffer);
+
 #endif
@@ -58,7 +58,7 @@ music_chunk::Write(const struct audio_format &af,
 	}
 
 	const size_t frame_size = audio_format_frame_size(&af);
-	size_t num_frames = (sizeof(data) - length) / frame_size;
+	size_t num_frames = (capacity - length) / frame_size;
 	if (num_frames == 0)
 		return NULL;
 
@@ -75,10 +75,10 @@ music_chunk::Expand(const struct audio_format &af, size_t _length)
 {
 	const size_t frame_size = audio_format_frame_size(&af);
 
-	assert(length + _length <= sizeof(data));
+	assert(length + _length <= capacity);
 	assert(audio_format_equals(&audio_format, &af));
 
 	length += _length;
 
-	return length + frame_size > sizeof(data);
+	return length + frame_size > capacity;
 }
@@ -26,11 +26,17 @@
 #include "audio_format.h"
 #endif
 
+#include <atomic>
+
 #include <stdint.h>
 #include <stddef.h>
 
 enum {
-	CHUNK_SIZE = 4096,
+	/**
+	 * The default size of #music_chunk::data; it can be changed
+	 * with the "audio_chunk_size" setting.
+	 */
+	DEFAULT_CHUNK_SIZE = 4096,
 };
 
 struct audio_format;
@@ -40,8 +46,18 @@ struct audio_format;
  * music_pipe_append() caller.
  */
 struct music_chunk {
-	/** the next chunk in a linked list */
-	struct music_chunk *next;
+	/**
+	 * The next chunk in a linked list.  This is atomic because
+	 * the #music_pipe producer links a new chunk while the
+	 * consumer may be looking at its predecessor.
+	 */
+	std::atomic<struct music_chunk *> next;
+
+	/**
+	 * The position of this chunk in its #music_pipe, assigned by
+	 * music_pipe_push().  Used by #music_pipe_reader.
+	 */
+	unsigned serial;
 
 	/**
 	 * An optional chunk which should be mixed into this chunk.
@@ -56,7 +72,7 @@ struct music_chunk {
 	float mix_ratio;
 
 	/** number of bytes stored in this chunk */
-	uint16_t length;
+	uint32_t length;
 
 	/** current bit rate of the source file */
 	uint16_t bit_rate;
@@ -85,8 +101,23 @@ struct music_chunk {
 	 */
 	unsigned replay_gain_serial;
 
-	/** the data (probably PCM) */
-	char data[CHUNK_SIZE];
+	/**
+	 * The data (probably PCM).  It points into the memory of the
+	 * #music_buffer which this chunk was allocated from, and is
+	 * set by music_buffer_allocate().
+	 */
+	char *data;
+
+	/** the size of #data in bytes */
+	size_t capacity;
+
+	/**
+	 * The monotonic_clock_us() value when the decoder has
+	 * started filling this chunk, and after it has been
+	 * submitted, the time of submission.  0 means unknown.  Used
+	 * for #pipeline_stats.
+	 */
+	uint64_t time_stamp;
 
 #ifndef NDEBUG
 	struct audio_format audio_format;
@@ -96,7 +127,9 @@ struct music_chunk {
 		:other(nullptr),
 		 length(0),
 		 tag(nullptr),
-		 replay_gain_serial(0) {}
+		 replay_gain_serial(0),
+		 data(nullptr), capacity(0),
+		 time_stamp(0) {}
 
 	~music_chunk();
 
@@ -28,35 +28,61 @@
 #include <assert.h>
 
 struct music_pipe {
-	/** the first chunk */
-	struct music_chunk *head;
-
-	/** a pointer to the tail of the chunk */
-	struct music_chunk **tail_r;
+	/**
+	 * The first chunk.  It is modified by the consumer, and by
+	 * the producer only while the pipe is empty (i.e. #tail is
+	 * NULL).
+	 */
+	std::atomic<struct music_chunk *> head;
+
+	/**
+	 * The last chunk.  It is modified by the producer, and reset
+	 * by the consumer when it removes the last chunk.
+	 */
+	std::atomic<struct music_chunk *> tail;
 
 	/** the current number of chunks */
-	unsigned size;
+	std::atomic_uint size;
 
-	/** a mutex which protects #head and #tail_r */
-	mutable Mutex mutex;
+	/**
+	 * The #music_chunk::serial of the next chunk to be pushed.
+	 * Consumers read it to detect a push they might have missed.
+	 */
+	std::atomic_uint push_serial;
+
+	/**
+	 * Identifies this pipe, see music_pipe_generation().
+	 */
+	const unsigned generation;
 
 #ifndef NDEBUG
+	/** a mutex which protects #audio_format */
+	mutable Mutex mutex;
+
 	struct audio_format audio_format;
 #endif
 
 	music_pipe()
-		:head(nullptr), tail_r(&head), size(0) {
+		:head(nullptr), tail(nullptr), size(0), push_serial(0),
+		 generation(++last_generation) {
 #ifndef NDEBUG
 		audio_format_clear(&audio_format);
 #endif
 	}
 
+	/**
+	 * The generation of the most recently created pipe.
+	 */
+	static std::atomic_uint last_generation;
+
 	~music_pipe() {
 		assert(head == nullptr);
-		assert(tail_r == &head);
+		assert(tail == nullptr);
 	}
 };
 
+std::atomic_uint music_pipe::last_generation;
+
 struct music_pipe *
 music_pipe_new(void)
 {
@@ -78,6 +104,7 @@ music_pipe_check_format(const struct music_pipe *pipe,
 	assert(pipe != NULL);
 	assert(audio_format != NULL);
 
+	const ScopeLock protect(pipe->mutex);
 	return !audio_format_defined(&pipe->audio_format) ||
 		audio_format_equals(&pipe->audio_format, audio_format);
 }
@@ -86,8 +113,6 @@ bool
 music_pipe_contains(const struct music_pipe *mp,
 		    const struct music_chunk *chunk)
 {
-	const ScopeLock protect(mp->mutex);
-
 	for (const struct music_chunk *i = mp->head;
 	     i != NULL; i = i->next)
 		if (i == chunk)
@@ -98,6 +123,12 @@ music_pipe_contains(const struct music_pipe *mp,
 
 #endif
 
+unsigned
+music_pipe_generation(const struct music_pipe *mp)
+{
+	return mp->generation;
+}
+
 const struct music_chunk *
 music_pipe_peek(const struct music_pipe *mp)
 {
@@ -107,33 +138,46 @@ music_pipe_peek(const struct music_pipe *mp)
 struct music_chunk *
 music_pipe_shift(struct music_pipe *mp)
 {
-	const ScopeLock protect(mp->mutex);
-
 	struct music_chunk *chunk = mp->head;
-	if (chunk != NULL) {
-		assert(!chunk->IsEmpty());
-
-		mp->head = chunk->next;
-		--mp->size;
+	if (chunk == NULL)
+		/* empty, or the producer has not finished linking
+		   the first chunk */
+		return NULL;
 
-		if (mp->head == NULL) {
-			assert(mp->size == 0);
-			assert(mp->tail_r == &chunk->next);
+	assert(!chunk->IsEmpty());
 
-			mp->tail_r = &mp->head;
-		} else {
-			assert(mp->size > 0);
-			assert(mp->tail_r != &chunk->next);
+	struct music_chunk *next = chunk->next;
+	if (next == NULL) {
+		/* this seems to be the last chunk; clear the head
+		   before the tail, because the producer links the
+		   next chunk to the head once it sees an empty
+		   tail */
+		mp->head = NULL;
+
+		struct music_chunk *expected = chunk;
+		if (!mp->tail.compare_exchange_strong(expected, NULL)) {
+			/* a chunk is being pushed, and the producer
+			   is about to link it to this one; this is
+			   only the window between two stores in
+			   music_pipe_push() */
+			while ((next = chunk->next) == NULL)
+				g_thread_yield();
+
+			mp->head = next;
 		}
+	} else
+		mp->head = next;
 
 #ifndef NDEBUG
-		/* poison the "next" reference */
-		chunk->next = (struct music_chunk *)(void *)0x01010101;
+	/* poison the "next" reference */
+	chunk->next = (struct music_chunk *)(void *)0x01010101;
 
-		if (mp->size == 0)
-			audio_format_clear(&mp->audio_format);
+	const ScopeLock protect(mp->mutex);
+	if (--mp->size == 0)
+		audio_format_clear(&mp->audio_format);
+#else
+	--mp->size;
 #endif
-	}
 
 	return chunk;
 }
@@ -153,27 +197,218 @@ music_pipe_push(struct music_pipe *mp, struct music_chunk *chunk)
 	assert(!chunk->IsEmpty());
 	assert(chunk->length == 0 || audio_format_valid(&chunk->audio_format));
 
-	const ScopeLock protect(mp->mutex);
+#ifndef NDEBUG
+	{
+		const ScopeLock protect(mp->mutex);
 
-	assert(mp->size > 0 || !audio_format_defined(&mp->audio_format));
-	assert(!audio_format_defined(&mp->audio_format) ||
-	       chunk->CheckFormat(mp->audio_format));
+		assert(mp->size > 0 || !audio_format_defined(&mp->audio_format));
+		assert(!audio_format_defined(&mp->audio_format) ||
+		       chunk->CheckFormat(mp->audio_format));
 
-#ifndef NDEBUG
-	if (!audio_format_defined(&mp->audio_format) && chunk->length > 0)
-		mp->audio_format = chunk->audio_format;
+		if (!audio_format_defined(&mp->audio_format) &&
+		    chunk->length > 0)
+			mp->audio_format = chunk->audio_format;
+	}
 #endif
 
-	chunk->next = NULL;
-	*mp->tail_r = chunk;
-	mp->tail_r = &chunk->next;
+	chunk->next.store(NULL, std::memory_order_relaxed);
+	const unsigned serial =
+		mp->push_serial.load(std::memory_order_relaxed);
+	chunk->serial = serial;
 
+	/* count the chunk before it becomes visible, so
+	   music_pipe_shift() never makes the size negative */
 	++mp->size;
+
+	struct music_chunk *prev = mp->tail.exchange(chunk);
+	if (prev == NULL)
+		mp->head = chunk;
+	else
+		prev->next = chunk;
+
+	/* publish after linking: a reader which sees the new serial
+	   also sees the "next" pointer (the chunk itself must not be
+	   accessed anymore, the consumer may have shifted it
+	   already) */
+	mp->push_serial = serial + 1;
 }
 
 unsigned
 music_pipe_size(const struct music_pipe *mp)
 {
-	const ScopeLock protect(mp->mutex);
 	return mp->size;
 }
+
+/*
+ * The reader state is a chunk pointer; chunks are aligned, so the
+ * two lowest bits are used as tags.  An untagged pointer is the chunk
+ * which the reader plays next; it (and all chunks after it) must not
+ * be removed from the pipe.
+ */
+
+/**
+ * The reader has played the chunk, which was the tail of the pipe,
+ * and waits for the producer to hand over the next one.  The chunk
+ * is still protected.
+ */
+static constexpr uintptr_t READER_FINISHED = 0x1;
+
+/**
+ * Like #READER_FINISHED, but the producer has released the chunk; it
+ * may have been freed.
+ */
+static constexpr uintptr_t READER_RELEASED = 0x2;
+
+static constexpr uintptr_t READER_TAG_MASK = 0x3;
+
+/**
+ * Start with the chunk at the head of the pipe.
+ */
+static constexpr uintptr_t READER_AT_HEAD = 0;
+
+/**
+ * The reader does not need any chunks.
+ */
+static constexpr uintptr_t READER_CLOSED = READER_RELEASED;
+
+static inline const struct music_chunk *
+reader_chunk(uintptr_t state)
+{
+	return (const struct music_chunk *)(state & ~READER_TAG_MASK);
+}
+
+void
+music_pipe_reader_close(struct music_pipe_reader *reader)
+{
+	reader->state = READER_CLOSED;
+}
+
+void
+music_pipe_reader_rewind(struct music_pipe_reader *reader)
+{
+	reader->state = READER_AT_HEAD;
+}
+
+const struct music_chunk *
+music_pipe_reader_get(const struct music_pipe *mp,
+		      struct music_pipe_reader *reader)
+{
+	const uintptr_t state = reader->state;
+	assert(state != READER_CLOSED);
+
+	if (state == READER_AT_HEAD) {
+		/* the head is protected by READER_AT_HEAD, and it
+		   stays protected by the new state */
+		const struct music_chunk *chunk = music_pipe_peek(mp);
+		if (chunk != NULL)
+			reader->state = (uintptr_t)chunk;
+		return chunk;
+	}
+
+	if ((state & READER_TAG_MASK) != 0)
+		/* waiting for music_pipe_reader_hand_over() */
+		return NULL;
+
+	return reader_chunk(state);
+}
+
+void
+music_pipe_reader_consumed(const struct music_pipe *mp,
+			   struct music_pipe_reader *reader,
+			   const struct music_chunk *chunk)
+{
+	assert(reader->state == (uintptr_t)chunk);
+
+	/* checking #push_serial instead of the "next" pointer
+	   synchronizes with music_pipe_push(), which makes the next
+	   chunk's contents visible */
+	const unsigned serial = chunk->serial;
+	const struct music_chunk *next;
+	if (mp->push_serial != serial + 1) {
+		next = chunk->next;
+		assert(next != NULL);
+		reader->state = (uintptr_t)next;
+		return;
+	}
+
+	/* this was the tail; wait for the producer to hand over the
+	   next chunk */
+
+	uintptr_t expected = (uintptr_t)chunk | READER_FINISHED;
+	reader->state = expected;
+
+	/* if a chunk was pushed before the producer could see
+	   READER_FINISHED, it has not handed it over; take it back
+	   (the chunk is not the tail anymore, so the producer cannot
+	   have released it) */
+	if (mp->push_serial != serial + 1 &&
+	    reader->state.compare_exchange_strong(expected,
+						  (uintptr_t)chunk)) {
+		next = chunk->next;
+		assert(next != NULL);
+		reader->state = (uintptr_t)next;
+	}
+}
+
+void
+music_pipe_reader_hand_over(struct music_pipe_reader *reader,
+			    const struct music_chunk *chunk)
+{
+	uintptr_t state = reader->state;
+	if (state == READER_CLOSED || (state & READER_TAG_MASK) == 0)
+		return;
+
+	/* a reader which has marked an older chunk finished (because
+	   it had not seen the pushes since) continues by itself in
+	   music_pipe_reader_consumed(); a released chunk is always
+	   the predecessor of the next push */
+	if ((state & READER_FINISHED) != 0 &&
+	    reader_chunk(state)->serial + 1 != chunk->serial)
+		return;
+
+	/* this may fail if the reader has just seen the new chunk by
+	   itself */
+	reader->state.compare_exchange_strong(state, (uintptr_t)chunk);
+}
+
+unsigned
+music_pipe_reader_done(const struct music_pipe *mp,
+		       const struct music_pipe_reader *reader)
+{
+	const uintptr_t state = reader->state;
+	if (state == READER_AT_HEAD)
+		return 0;
+
+	if ((state & READER_RELEASED) != 0)
+		/* closed, or waiting for a new chunk */
+		return mp->size;
+
+	/* the chunk cannot be freed while we look at it: only the
+	   producer (the caller) frees chunks */
+	const struct music_chunk *chunk = reader_chunk(state);
+	assert(mp->head != NULL);
+	assert(music_pipe_contains(mp, chunk));
+
+	return chunk->serial - mp->head.load()->serial;
+}
+
+bool
+music_pipe_reader_is_finished(const struct music_pipe_reader *reader,
+			      const struct music_chunk *chunk)
+{
+	assert(chunk->next == NULL);
+
+	const uintptr_t state = reader->state;
+	return (state & READER_RELEASED) != 0 ||
+		state == ((uintptr_t)chunk | READER_FINISHED);
+}
+
+void
+music_pipe_reader_release(struct music_pipe_reader *reader,
+			  const struct music_chunk *chunk)
+{
+	uintptr_t expected = (uintptr_t)chunk | READER_FINISHED;
+	reader->state.compare_exchange_strong(expected,
+					      (uintptr_t)chunk |
+					      READER_RELEASED);
+}
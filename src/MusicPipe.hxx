@@ -22,6 +22,10 @@
 
 #include "gcc.h"
 
+#include <atomic>
+
+#include <stdint.h>
+
 #ifndef NDEBUG
 struct audio_format;
 #endif
@@ -32,6 +36,10 @@ struct music_buffer;
 /**
  * A queue of #music_chunk objects.  One party appends chunks at the
  * tail, and the other consumes them from the head.
+ *
+ * The pipe is lock-free: there may be one producer thread calling
+ * music_pipe_push() and one consumer thread calling
+ * music_pipe_shift() at the same time, without locking.
  */
 struct music_pipe;
 
@@ -67,16 +75,27 @@ music_pipe_contains(const struct music_pipe *mp,
 
 #endif
 
+/**
+ * Returns a number which identifies this pipe.  Unlike the pointer,
+ * it is not reused by a later pipe (until it wraps around), so it
+ * can be combined with #music_chunk::serial, which is only unique
+ * within one pipe.
+ */
+gcc_pure
+unsigned
+music_pipe_generation(const struct music_pipe *mp);
+
 /**
  * Returns the first #music_chunk from the pipe.  Returns NULL if the
- * pipe is empty.
+ * pipe is empty.  Consumer only.
  */
 gcc_pure
 const struct music_chunk *
 music_pipe_peek(const struct music_pipe *mp);
 
 /**
- * Removes the first chunk from the head, and returns it.
+ * Removes the first chunk from the head, and returns it.  Returns
+ * NULL if the pipe is empty.  Consumer only.
  */
 struct music_chunk *
 music_pipe_shift(struct music_pipe *mp);
@@ -90,13 +109,15 @@ void
 music_pipe_clear(struct music_pipe *mp, struct music_buffer *buffer);
 
 /**
- * Pushes a chunk to the tail of the pipe.
+ * Pushes a chunk to the tail of the pipe.  Producer only.
  */
 void
 music_pipe_push(struct music_pipe *mp, struct music_chunk *chunk);
 
 /**
- * Returns the number of chunks currently in this pipe.
+ * Returns the number of chunks currently in this pipe.  While a
+ * push is in progress, the result may include a chunk which
+ * music_pipe_shift() does not see yet.
  */
 gcc_pure
 unsigned
@@ -109,4 +130,91 @@ music_pipe_empty(const struct music_pipe *mp)
 	return music_pipe_size(mp) == 0;
 }
 
+/**
+ * The read position of one of several consumers (the audio outputs)
+ * of a #music_pipe.  It is owned by the consumer thread, and it is
+ * published with atomic operations, so the producer thread can
+ * determine which chunks have been consumed by all consumers without
+ * locking them.
+ *
+ * While a consumer is waiting at the tail of the pipe, the producer
+ * hands the next chunk over in music_pipe_reader_hand_over(), or
+ * releases the tail chunk in music_pipe_reader_release().
+ */
+struct music_pipe_reader {
+	/**
+	 * A pointer to the chunk which is played next, possibly with
+	 * tag bits; see MusicPipe.cxx.
+	 */
+	std::atomic<uintptr_t> state;
+};
+
+/**
+ * Consumer: the reader does not need any chunks anymore (e.g. the
+ * audio output has been closed).
+ */
+void
+music_pipe_reader_close(struct music_pipe_reader *reader);
+
+/**
+ * Consumer: start reading at the head of the pipe.  The producer
+ * must not remove chunks while this is called (i.e. it is waiting
+ * for an audio output command).
+ */
+void
+music_pipe_reader_rewind(struct music_pipe_reader *reader);
+
+/**
+ * Consumer: returns the chunk which shall be played next, or NULL if
+ * there is none.
+ */
+const struct music_chunk *
+music_pipe_reader_get(const struct music_pipe *mp,
+		      struct music_pipe_reader *reader);
+
+/**
+ * Consumer: the chunk returned by music_pipe_reader_get() has been
+ * played, and the reader advances to the next one.
+ */
+void
+music_pipe_reader_consumed(const struct music_pipe *mp,
+			   struct music_pipe_reader *reader,
+			   const struct music_chunk *chunk);
+
+/**
+ * Producer: a chunk has been pushed; if the reader is waiting at the
+ * (former) tail, it continues with this chunk.
+ */
+void
+music_pipe_reader_hand_over(struct music_pipe_reader *reader,
+			    const struct music_chunk *chunk);
+
+/**
+ * Producer: returns the number of chunks at the head of the pipe
+ * which this reader does not need anymore.  This does not include
+ * the tail chunk, see music_pipe_reader_is_finished().
+ */
+gcc_pure
+unsigned
+music_pipe_reader_done(const struct music_pipe *mp,
+		       const struct music_pipe_reader *reader);
+
+/**
+ * Producer: has the reader finished playing this chunk, which is the
+ * only one in the pipe?
+ */
+gcc_pure
+bool
+music_pipe_reader_is_finished(const struct music_pipe_reader *reader,
+			      const struct music_chunk *chunk);
+
+/**
+ * Producer: the reader does not reference the tail chunk anymore, and
+ * it may be removed from the pipe.  This must only be called if
+ * music_pipe_reader_is_finished() has returned true for all readers.
+ */
+void
+music_pipe_reader_release(struct music_pipe_reader *reader,
+			  const struct music_chunk *chunk);
+
 #endif
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 
 #ifdef WIN32
 #include <ws2tcpip.h>
@@ -45,41 +46,44 @@ fill_int(unsigned char *buffer, uint32_t value)
 	memcpy(buffer, &be, sizeof(be));
 }
 
-/*
- * Store time in the NTP format in the buffer
- */
-static void
-fill_time_buffer_with_time(unsigned char *buffer, struct timeval *tout)
+void
+ntp_fill_time(unsigned char *buffer, const struct timespec *time)
 {
-	unsigned long secs_to_baseline = 964697997;
-	double fraction;
-	unsigned long long_fraction;
-	unsigned long secs;
-
-	fraction = ((double) tout->tv_usec) / 1000000.0;
-	long_fraction = (unsigned long) (fraction * 256.0 * 256.0 * 256.0 * 256.0);
-	secs = secs_to_baseline + tout->tv_sec;
-	fill_int(buffer, secs);
-	fill_int(buffer + 4, long_fraction);
+	const uint32_t secs_to_baseline = 964697997;
+
+	/* 2^32 * nsec / 10^9, exact in 64 bit integers */
+	const uint32_t fraction =
+		((uint64_t)time->tv_nsec << 32) / 1000000000;
+
+	fill_int(buffer, secs_to_baseline + time->tv_sec);
+	fill_int(buffer + 4, fraction);
 }
 
 /*
  * Calculate the current NTP time, store it in the buffer.
  */
 static void
-fill_time_buffer(unsigned char *buffer)
+fill_time_buffer(unsigned char *buffer, struct timespec *now)
 {
-	struct timeval current_time;
+#ifdef WIN32
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	now->tv_sec = tv.tv_sec;
+	now->tv_nsec = tv.tv_usec * 1000;
+#else
+	clock_gettime(CLOCK_REALTIME, now);
+#endif
 
-	gettimeofday(&current_time,NULL);
-	fill_time_buffer_with_time(buffer, &current_time);
+	ntp_fill_time(buffer, now);
 }
 
 static void
 ntp_server_datagram(int fd, const void *data, size_t num_bytes,
 		    const struct sockaddr *source_address,
-		    size_t source_address_length, G_GNUC_UNUSED void *ctx)
+		    size_t source_address_length,
+		    const struct timespec *timestamp, void *ctx)
 {
+	struct ntp_server *ntp = (struct ntp_server *)ctx;
 	unsigned char buf[32];
 	int iter;
 
@@ -87,17 +91,25 @@ ntp_server_datagram(int fd, const void *data, size_t num_bytes,
 		num_bytes = sizeof(buf);
 	memcpy(buf, data, num_bytes);
 
-	fill_time_buffer(buf + 16);
+	/* the receive time is the kernel's time stamp, so the
+	   latency of the event loop does not distort the receiver's
+	   clock offset estimate */
+	ntp_fill_time(buf + 16, timestamp);
 	// set to response
 	buf[1] = 0xd3;
 	// copy request
 	for (iter = 0; iter < 8; iter++) {
 		buf[8 + iter] = buf[24 + iter];
 	}
-	fill_time_buffer(buf + 24);
+
+	struct timespec now;
+	fill_time_buffer(buf + 24, &now);
 
 	sendto(fd, (void *)buf, num_bytes, 0,
 	       source_address, source_address_length);
+
+	if (ntp->reply_callback != NULL)
+		ntp->reply_callback(timestamp, &now, ntp->reply_ctx);
 }
 
 static const struct udp_server_handler ntp_server_handler = {
@@ -109,6 +121,8 @@ ntp_server_init(struct ntp_server *ntp)
 {
 	ntp->port = 6002;
 	ntp->udp = NULL;
+	ntp->reply_callback = NULL;
+	ntp->reply_ctx = NULL;
 }
 
 bool
@@ -118,7 +132,12 @@ ntp_server_open(struct ntp_server *ntp, GError **error_r)
 
 	ntp->udp = udp_server_new(ntp->port, &ntp_server_handler, ntp,
 				  error_r);
-	return ntp->udp != NULL;
+	if (ntp->udp == NULL)
+		return false;
+
+	/* if the port was 0, the kernel has chosen one */
+	ntp->port = udp_server_get_port(ntp->udp);
+	return true;
 }
 
 void
@@ -23,15 +23,44 @@
 #include <glib.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
-struct timeval;
+struct timespec;
+
+/**
+ * Invoked after a timing request has been answered.
+ *
+ * @param received the kernel's time stamp of the request
+ * @param replied the time stamp sent in the reply
+ */
+typedef void (*ntp_reply_callback)(const struct timespec *received,
+				   const struct timespec *replied,
+				   void *ctx);
 
 struct ntp_server {
+	/**
+	 * The UDP port.  May be set to 0 before ntp_server_open(),
+	 * which then stores the port chosen by the kernel here.
+	 */
 	unsigned short port;
 
 	struct udp_server *udp;
+
+	/**
+	 * If not NULL, this is invoked after each reply, with
+	 * #reply_ctx.  Set by the caller after ntp_server_init().
+	 */
+	ntp_reply_callback reply_callback;
+	void *reply_ctx;
 };
 
+/**
+ * Store a CLOCK_REALTIME time stamp in the 64 bit NTP format used by
+ * RAOP (32 bit seconds, 32 bit fraction, big endian).
+ */
+void
+ntp_fill_time(unsigned char *buffer, const struct timespec *time);
+
 void
 ntp_server_init(struct ntp_server *ntp);
 
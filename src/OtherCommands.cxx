@@ -35,6 +35,7 @@
 #include "Volume.hxx"
 #include "util/UriUtil.hxx"
 #include "fs/Path.hxx"
+#include "PipelineStats.hxx"
 
 extern "C" {
 #include "stats.h"
@@ -245,6 +246,14 @@ handle_stats(Client *client,
 	return COMMAND_RETURN_OK;
 }
 
+enum command_return
+handle_pipelinestats(Client *client,
+		     G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
+{
+	pipeline_stats_print(client);
+	return COMMAND_RETURN_OK;
+}
+
 enum command_return
 handle_ping(G_GNUC_UNUSED Client *client,
 	    G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
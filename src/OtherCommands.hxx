@@ -54,6 +54,9 @@ handle_setvol(Client *client, int argc, char *argv[]);
 enum command_return
 handle_stats(Client *client, int argc, char *argv[]);
 
+enum command_return
+handle_pipelinestats(Client *client, int argc, char *argv[]);
+
 enum command_return
 handle_ping(Client *client, int argc, char *argv[]);
 
@@ -26,6 +26,7 @@
 #include "MusicBuffer.hxx"
 #include "MusicPipe.hxx"
 #include "MusicChunk.hxx"
+#include "PipelineStats.hxx"
 #include "mpd_error.h"
 #include "conf.h"
 #include "notify.hxx"
@@ -137,6 +138,26 @@ audio_output_all_init(struct player_control *pc)
 			}
 		}
 	}
+
+	/* an output whose filter chain is not shared with another one
+	   doesn't need the filter cache */
+	for (i = 0; i < num_audio_outputs; i++) {
+		struct audio_output *ao = audio_outputs[i];
+		if (ao->filter_cache_key == NULL)
+			continue;
+
+		bool shared = false;
+		for (unsigned j = 0; j < num_audio_outputs && !shared; j++)
+			shared = j != i &&
+				audio_outputs[j]->filter_cache_key != NULL &&
+				strcmp(audio_outputs[j]->filter_cache_key,
+				       ao->filter_cache_key) == 0;
+
+		if (!shared) {
+			g_free(ao->filter_cache_key);
+			ao->filter_cache_key = NULL;
+		}
+	}
 }
 
 void
@@ -283,9 +304,13 @@ audio_output_all_play(struct music_chunk *chunk, GError **error_r)
 	}
 
 	music_pipe_push(g_mp, chunk);
+	pipeline_stats.output_pipe_fill.Record(music_pipe_size(g_mp));
 
-	for (i = 0; i < num_audio_outputs; ++i)
+	for (i = 0; i < num_audio_outputs; ++i) {
+		music_pipe_reader_hand_over(&audio_outputs[i]->pipe_reader,
+					    chunk);
 		audio_output_play(audio_outputs[i]);
+	}
 
 	return true;
 }
@@ -348,119 +373,66 @@ audio_output_all_open(const struct audio_format *audio_format,
 }
 
 /**
- * Has the specified audio output already consumed this chunk?
+ * Removes the first chunk from the pipe (#g_mp) and returns it to
+ * the buffer.
  */
-static bool
-chunk_is_consumed_in(const struct audio_output *ao,
-		     const struct music_chunk *chunk)
+static void
+audio_output_all_shift(void)
 {
-	if (!ao->open)
-		return true;
-
-	if (ao->chunk == NULL)
-		return false;
+	struct music_chunk *chunk = music_pipe_shift(g_mp);
+	assert(chunk != NULL);
 
-	assert(chunk == ao->chunk || music_pipe_contains(g_mp, ao->chunk));
+	if (chunk->length > 0 && chunk->times >= 0.0)
+		/* only update elapsed_time if the chunk
+		   provides a defined value */
+		audio_output_all_elapsed_time = chunk->times;
 
-	if (chunk != ao->chunk) {
-		assert(chunk->next != NULL);
-		return true;
-	}
-
-	return ao->chunk_finished && chunk->next == NULL;
+	music_buffer_return(g_music_buffer, chunk);
 }
 
-/**
- * Has this chunk been consumed by all audio outputs?
- */
-static bool
-chunk_is_consumed(const struct music_chunk *chunk)
+unsigned
+audio_output_all_check(void)
 {
-	for (unsigned i = 0; i < num_audio_outputs; ++i) {
-		struct audio_output *ao = audio_outputs[i];
+	assert(g_music_buffer != NULL);
+	assert(g_mp != NULL);
 
-		const ScopeLock protect(ao->mutex);
-		if (!chunk_is_consumed_in(ao, chunk))
-			return false;
+	/* find the oldest chunk which is still needed by at least one
+	   audio output; this reads only the outputs' atomic read
+	   positions, and does not lock them */
+
+	unsigned n = music_pipe_size(g_mp);
+	for (unsigned i = 0; i < num_audio_outputs && n > 0; ++i) {
+		unsigned done =
+			music_pipe_reader_done(g_mp,
+					       &audio_outputs[i]->pipe_reader);
+		if (done < n)
+			n = done;
 	}
 
-	return true;
-}
+	/* return all chunks before it to the buffer */
 
-/**
- * There's only one chunk left in the pipe (#g_mp), and all audio
- * outputs have consumed it already.  Clear the reference.
- */
-static void
-clear_tail_chunk(G_GNUC_UNUSED const struct music_chunk *chunk, bool *locked)
-{
-	assert(chunk->next == NULL);
-	assert(music_pipe_contains(g_mp, chunk));
+	while (n-- > 0)
+		audio_output_all_shift();
 
-	for (unsigned i = 0; i < num_audio_outputs; ++i) {
-		struct audio_output *ao = audio_outputs[i];
+	const struct music_chunk *tail = music_pipe_peek(g_mp);
+	if (tail == NULL || tail->next != NULL)
+		return music_pipe_size(g_mp);
 
-		/* this mutex will be unlocked by the caller when it's
-		   ready */
-		ao->mutex.lock();
-		locked[i] = ao->open;
+	/* this is the tail of the pipe; it can be removed only after
+	   all audio outputs have let go of it */
 
-		if (!locked[i]) {
-			ao->mutex.unlock();
-			continue;
-		}
-
-		assert(ao->chunk == chunk);
-		assert(ao->chunk_finished);
-		ao->chunk = NULL;
-	}
-}
-
-unsigned
-audio_output_all_check(void)
-{
-	const struct music_chunk *chunk;
-	bool is_tail;
-	struct music_chunk *shifted;
-	bool locked[num_audio_outputs];
-
-	assert(g_music_buffer != NULL);
-	assert(g_mp != NULL);
+	for (unsigned i = 0; i < num_audio_outputs; ++i)
+		if (!music_pipe_reader_is_finished(&audio_outputs[i]->pipe_reader,
+						   tail))
+			/* at least one output is not finished
+			   playing this chunk */
+			return 1;
 
-	while ((chunk = music_pipe_peek(g_mp)) != NULL) {
-		assert(!music_pipe_empty(g_mp));
-
-		if (!chunk_is_consumed(chunk))
-			/* at least one output is not finished playing
-			   this chunk */
-			return music_pipe_size(g_mp);
-
-		if (chunk->length > 0 && chunk->times >= 0.0)
-			/* only update elapsed_time if the chunk
-			   provides a defined value */
-			audio_output_all_elapsed_time = chunk->times;
-
-		is_tail = chunk->next == NULL;
-		if (is_tail)
-			/* this is the tail of the pipe - clear the
-			   chunk reference in all outputs */
-			clear_tail_chunk(chunk, locked);
-
-		/* remove the chunk from the pipe */
-		shifted = music_pipe_shift(g_mp);
-		assert(shifted == chunk);
-
-		if (is_tail)
-			/* unlock all audio outputs which were locked
-			   by clear_tail_chunk() */
-			for (unsigned i = 0; i < num_audio_outputs; ++i)
-				if (locked[i])
-					audio_outputs[i]->mutex.unlock();
-
-		/* return the chunk to the buffer */
-		music_buffer_return(g_music_buffer, shifted);
-	}
+	for (unsigned i = 0; i < num_audio_outputs; ++i)
+		music_pipe_reader_release(&audio_outputs[i]->pipe_reader,
+					  tail);
 
+	audio_output_all_shift();
 	return 0;
 }
 
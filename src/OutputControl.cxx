@@ -160,7 +160,6 @@ audio_output_open(struct audio_output *ao,
 		       (ao->always_on && ao->pause));
 
 		if (ao->pause) {
-			ao->chunk = NULL;
 			ao->pipe = mp;
 
 			/* unpause with the CANCEL command; this is a
@@ -177,7 +176,6 @@ audio_output_open(struct audio_output *ao,
 	}
 
 	ao->in_audio_format = *audio_format;
-	ao->chunk = NULL;
 
 	ao->pipe = mp;
 
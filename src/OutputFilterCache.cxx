@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "OutputFilterCache.hxx"
+#include "OutputInternal.hxx"
+#include "MusicChunk.hxx"
+#include "MusicPipe.hxx"
+#include "pcm/pcm_buffer.h"
+#include "thread/Mutex.hxx"
+#include "thread/Cond.hxx"
+#include "clock.h"
+#include "gcc.h"
+
+#include <glib.h>
+
+#include <atomic>
+
+#include <assert.h>
+#include <string.h>
+
+enum {
+	/**
+	 * The maximum number of outputs sharing one cache.  More
+	 * outputs with the same configuration get another cache.
+	 */
+	FILTER_CACHE_MAX_MEMBERS = 16,
+
+	/**
+	 * The number of slots per cache.  Each member holds at most
+	 * one slot while playing, so there are always slots which
+	 * can be reused; the rest allows the members to drift apart
+	 * a little.
+	 */
+	FILTER_CACHE_SLOTS = 2 * FILTER_CACHE_MAX_MEMBERS,
+
+	/**
+	 * A member which is ahead of the owner waits for it only if
+	 * the owner is at most this number of chunks behind;
+	 * otherwise it runs its own filter chain.
+	 */
+	FILTER_CACHE_MAX_LEAD = 8,
+
+	/**
+	 * How long (in milliseconds) a member waits for the owner to
+	 * filter a chunk.  If the owner doesn't get there in time, it
+	 * is considered stalled (see output_filter_cache::stalled).
+	 */
+	FILTER_CACHE_WAIT_MS = 250,
+};
+
+struct output_filter_cache_entry {
+	/**
+	 * The chunk whose filtered data is stored here, or NULL if
+	 * this slot is unused.  The chunk pointer alone is not
+	 * unique, because chunks get recycled; see #sequence.
+	 */
+	const struct music_chunk *chunk;
+
+	/**
+	 * The position of #chunk in the output pipe, see
+	 * chunk_sequence().
+	 */
+	uint64_t sequence;
+
+	/**
+	 * Is the owner's filter chain still running?  Other members
+	 * wait for it to finish.
+	 */
+	bool filtering;
+
+	/**
+	 * The number of members which are currently playing the
+	 * data.  The slot must not be reused while this is non-zero.
+	 */
+	unsigned in_use;
+
+	/**
+	 * The number of members which have played (or are playing)
+	 * this slot.  Slots which all members have seen are reused
+	 * first.
+	 */
+	unsigned taken;
+
+	/**
+	 * Holds a copy of the filtered data, unless the filter chain
+	 * has returned the chunk's data unmodified.
+	 */
+	struct pcm_buffer buffer;
+
+	/**
+	 * The filtered data: either #buffer, or #music_chunk::data,
+	 * which remains valid until all members have consumed the
+	 * chunk.
+	 */
+	const void *data;
+
+	size_t length;
+
+	output_filter_cache_entry()
+		:chunk(nullptr), filtering(false), in_use(0), taken(0),
+		 data(nullptr), length(0) {
+		pcm_buffer_init(&buffer);
+	}
+
+	~output_filter_cache_entry() {
+		assert(in_use == 0);
+
+		pcm_buffer_deinit(&buffer);
+	}
+
+	bool IsReusable() const {
+		return !filtering && in_use == 0;
+	}
+};
+
+struct output_filter_cache {
+	/**
+	 * The next cache in the registry.
+	 */
+	struct output_filter_cache *next;
+
+	/**
+	 * Identifies the filter configuration; all members have the
+	 * same key (audio_output::filter_cache_key).
+	 */
+	char *key;
+
+	/**
+	 * The input and output audio formats of all members.
+	 */
+	struct audio_format in_audio_format, out_audio_format;
+
+	/**
+	 * The number of members.  Modified only while both
+	 * #registry_mutex and #mutex are locked; a single member
+	 * reads it without locking, to bypass the cache.
+	 */
+	std::atomic_uint members;
+
+	Mutex mutex;
+
+	/**
+	 * Wakes up members waiting for the owner.
+	 */
+	Cond cond;
+
+	/**
+	 * The member whose filter chain is used, or NULL if it has
+	 * left; the next member to call output_filter_cache_get()
+	 * takes over.  Only the owner's thread runs its filter chain.
+	 */
+	struct audio_output *owner;
+
+	/**
+	 * Has the owner's filter chain processed a chunk since it
+	 * became the owner?  If yes, #last_sequence is valid.
+	 */
+	bool have_last;
+
+	/**
+	 * Has a member given up waiting for the owner?  Until the
+	 * owner filters its next chunk, the other members don't wait
+	 * for it.
+	 */
+	bool stalled;
+
+	/**
+	 * The sequence of the last chunk passed to the owner's filter
+	 * chain.  Older chunks which are not in the cache anymore
+	 * must not be passed to it again.
+	 */
+	uint64_t last_sequence;
+
+	struct output_filter_cache_entry entries[FILTER_CACHE_SLOTS];
+
+	output_filter_cache(const struct audio_output *ao)
+		:key(g_strdup(ao->filter_cache_key)),
+		 in_audio_format(ao->in_audio_format),
+		 out_audio_format(ao->out_audio_format),
+		 members(1), owner(nullptr),
+		 have_last(false), stalled(false) {}
+
+	~output_filter_cache() {
+		assert(members == 0);
+
+		g_free(key);
+	}
+
+	gcc_pure
+	bool Matches(const struct audio_output *ao) const {
+		return strcmp(key, ao->filter_cache_key) == 0 &&
+			audio_format_equals(&in_audio_format,
+					    &ao->in_audio_format) &&
+			audio_format_equals(&out_audio_format,
+					    &ao->out_audio_format);
+	}
+
+	gcc_pure
+	struct output_filter_cache_entry *Find(const struct music_chunk *chunk,
+					       uint64_t sequence) {
+		for (auto &e : entries)
+			if (e.chunk == chunk && e.sequence == sequence)
+				return &e;
+
+		return nullptr;
+	}
+
+	/**
+	 * Shall a member which has not found the chunk in the cache
+	 * wait for the owner to filter it?  Not if the owner has
+	 * already passed it (the member is lagging behind), and not
+	 * if the owner is stalled or too far behind.
+	 */
+	gcc_pure
+	bool ShallWait(uint64_t sequence) const {
+		if (stalled)
+			return false;
+
+		if (!have_last)
+			/* the owner has not started yet */
+			return true;
+
+		if (sequence <= last_sequence)
+			return false;
+
+		/* the lead can only be measured within one pipe; after
+		   a new pipe has begun, the owner will follow soon */
+		return (sequence >> 32) != (last_sequence >> 32) ||
+			sequence - last_sequence <= FILTER_CACHE_MAX_LEAD;
+	}
+
+	/**
+	 * Finds a slot for a new chunk: an unused one, or the oldest
+	 * one which all members have seen, or the oldest one which is
+	 * not being played.
+	 */
+	struct output_filter_cache_entry *Allocate() {
+		struct output_filter_cache_entry *seen = nullptr, *oldest = nullptr;
+
+		for (auto &e : entries) {
+			if (e.chunk == nullptr)
+				return &e;
+
+			if (!e.IsReusable())
+				continue;
+
+			if (e.taken >= members &&
+			    (seen == nullptr || e.sequence < seen->sequence))
+				seen = &e;
+
+			if (oldest == nullptr || e.sequence < oldest->sequence)
+				oldest = &e;
+		}
+
+		return seen != nullptr ? seen : oldest;
+	}
+};
+
+/**
+ * Determines the position of a chunk in the output pipe.
+ * #music_chunk::serial alone restarts with every pipe, so the pipe's
+ * generation goes into the upper half; the result grows
+ * monotonically, and it is not shared by a recycled chunk.
+ */
+gcc_pure
+static uint64_t
+chunk_sequence(const struct music_pipe *pipe, const struct music_chunk *chunk)
+{
+	return ((uint64_t)music_pipe_generation(pipe) << 32) | chunk->serial;
+}
+
+static Mutex registry_mutex;
+static struct output_filter_cache *registry;
+
+struct output_filter_cache *
+output_filter_cache_acquire(struct audio_output *ao)
+{
+	if (ao->filter_cache_key == NULL)
+		return NULL;
+
+	const ScopeLock protect(registry_mutex);
+
+	for (struct output_filter_cache *cache = registry;
+	     cache != NULL; cache = cache->next) {
+		if (cache->members < FILTER_CACHE_MAX_MEMBERS &&
+		    cache->Matches(ao)) {
+			const ScopeLock protect2(cache->mutex);
+			++cache->members;
+			return cache;
+		}
+	}
+
+	struct output_filter_cache *cache = new output_filter_cache(ao);
+	cache->next = registry;
+	registry = cache;
+	return cache;
+}
+
+void
+output_filter_cache_release(struct output_filter_cache *cache,
+			    struct audio_output *ao)
+{
+	const ScopeLock protect(registry_mutex);
+
+	cache->mutex.lock();
+
+	if (cache->owner == ao) {
+		/* the owner's filter chain runs only in its own
+		   thread, i.e. not now; wake up the members waiting
+		   for it, one of them takes over */
+		cache->owner = NULL;
+		cache->have_last = false;
+		cache->stalled = false;
+		cache->cond.broadcast();
+	}
+
+	assert(cache->members > 0);
+	const unsigned members = --cache->members;
+	if (members == 1) {
+		/* the remaining member bypasses the cache from now
+		   on; when it shares again, it starts over as a
+		   regular member */
+		cache->owner = NULL;
+		cache->have_last = false;
+	}
+
+	cache->mutex.unlock();
+
+	if (members > 0)
+		return;
+
+	struct output_filter_cache **p = &registry;
+	while (*p != cache)
+		p = &(*p)->next;
+	*p = cache->next;
+
+	delete cache;
+}
+
+const void *
+output_filter_cache_get(struct output_filter_cache *cache,
+			struct audio_output *ao,
+			const struct music_pipe *pipe,
+			const struct music_chunk *chunk,
+			output_filter_func filter,
+			size_t *length_r,
+			struct output_filter_cache_entry **entry_r)
+{
+	*entry_r = NULL;
+
+	if (cache->members.load(std::memory_order_relaxed) < 2)
+		/* nobody to share with: run our own filter chain,
+		   without locking and without copying */
+		return filter(ao, chunk, length_r);
+
+	const uint64_t sequence = chunk_sequence(pipe, chunk);
+	const unsigned deadline = monotonic_clock_ms() + FILTER_CACHE_WAIT_MS;
+
+	cache->mutex.lock();
+
+	struct output_filter_cache_entry *e;
+	while (true) {
+		if (cache->owner == NULL)
+			/* the owner has left; take over */
+			cache->owner = ao;
+
+		e = cache->Find(chunk, sequence);
+		if (e != NULL && !e->filtering) {
+			++e->in_use;
+			++e->taken;
+			cache->mutex.unlock();
+
+			/* our own filter chain skips this chunk; it
+			   must be reset before it is used again */
+			ao->filter_stale = true;
+
+			*entry_r = e;
+			*length_r = e->length;
+			/* never return NULL for an empty chunk, that
+			   would be mistaken for an error */
+			return e->length > 0 ? e->data : (const void *)e;
+		}
+
+		if (cache->owner == ao) {
+			/* only we run our filter chain, so it can't be
+			   busy */
+			assert(e == NULL);
+			break;
+		}
+
+		if (e == NULL && !cache->ShallWait(sequence)) {
+			/* the owner has already passed this chunk, or
+			   it is not going to get there soon: play it
+			   unshared, with our own filter chain */
+			cache->mutex.unlock();
+			return filter(ao, chunk, length_r);
+		}
+
+		/* wait for the owner to filter this chunk */
+		const unsigned now = monotonic_clock_ms();
+		if ((int)(deadline - now) <= 0) {
+			cache->stalled = true;
+			cache->mutex.unlock();
+			return filter(ao, chunk, length_r);
+		}
+
+		cache->cond.timed_wait(cache->mutex, deadline - now);
+	}
+
+	/* we're the owner, and nobody has filtered this chunk yet */
+
+	if (gcc_unlikely(cache->have_last &&
+			 sequence <= cache->last_sequence)) {
+		/* our filter chain has seen newer chunks already; it
+		   must not get this one, unless it is reset first;
+		   don't share the result */
+		cache->mutex.unlock();
+		ao->filter_stale = true;
+		return filter(ao, chunk, length_r);
+	}
+
+	cache->have_last = true;
+	cache->last_sequence = sequence;
+	cache->stalled = false;
+
+	e = cache->Allocate();
+	assert(e != NULL);
+	e->chunk = chunk;
+	e->sequence = sequence;
+	e->filtering = true;
+	e->in_use = 1;
+	e->taken = 1;
+
+	cache->mutex.unlock();
+
+	size_t length;
+	const void *data = filter(ao, chunk, &length);
+
+	if (data == chunk->data)
+		/* pass-through: no copy needed */
+		e->data = data;
+	else if (data != NULL && length > 0) {
+		void *dest = pcm_buffer_get(&e->buffer, length);
+		memcpy(dest, data, length);
+		e->data = dest;
+	}
+
+	cache->mutex.lock();
+
+	e->filtering = false;
+
+	if (data != NULL)
+		e->length = length;
+	else {
+		e->chunk = NULL;
+		e->in_use = 0;
+		e = NULL;
+	}
+
+	cache->cond.broadcast();
+	cache->mutex.unlock();
+
+	if (e == NULL)
+		return NULL;
+
+	*entry_r = e;
+	*length_r = length;
+	return length > 0 ? e->data : (const void *)e;
+}
+
+void
+output_filter_cache_put(struct output_filter_cache *cache,
+			struct output_filter_cache_entry *entry)
+{
+	const ScopeLock protect(cache->mutex);
+
+	assert(entry->in_use > 0);
+	--entry->in_use;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_OUTPUT_FILTER_CACHE_HXX
+#define MPD_OUTPUT_FILTER_CACHE_HXX
+
+#include <stddef.h>
+
+struct audio_output;
+struct music_pipe;
+struct music_chunk;
+
+/**
+ * Shares the filtered data of a chunk among audio outputs with
+ * equivalent filter chains: same input and output audio format, same
+ * "filters" and "replay_gain_handler" settings, and no software
+ * mixer (whose volume is per output).
+ *
+ * The filter chain of one member (the "owner") is run once per
+ * chunk, by the owner's own thread; the result is kept in a reference
+ * counted slot, and the other outputs play it from there.  The
+ * owner's filter chain sees every chunk at most once and in order, so
+ * stateful filters (e.g. a resampler) keep working.  A member which
+ * is ahead of the owner waits for it; a member which lags behind so
+ * far that its chunk has been evicted, or whose owner is stalled,
+ * plays the chunk unshared with its own filter chain, after
+ * resetting it (see audio_output::filter_stale).  As long as an
+ * output is the only member of its cache, it runs its own filter
+ * chain directly.
+ */
+struct output_filter_cache;
+
+/**
+ * One slot of an #output_filter_cache.
+ */
+struct output_filter_cache_entry;
+
+/**
+ * Runs the whole filter chain of an audio output on a chunk; returns
+ * NULL on error.  It is always called in the thread of that output.
+ */
+typedef const void *(*output_filter_func)(struct audio_output *ao,
+					  const struct music_chunk *chunk,
+					  size_t *length_r);
+
+/**
+ * Joins the cache for the output's current audio formats, creating
+ * it if necessary.  Called by the output thread after the output has
+ * been opened.
+ *
+ * @return the cache, or NULL if the output cannot share its filter
+ * chain
+ */
+struct output_filter_cache *
+output_filter_cache_acquire(struct audio_output *ao);
+
+/**
+ * Leaves the cache.  Called by the output thread before the output's
+ * filter chain is closed or reopened.
+ */
+void
+output_filter_cache_release(struct output_filter_cache *cache,
+			    struct audio_output *ao);
+
+/**
+ * Returns the filtered data of the chunk, running the output's own
+ * filter if it is the owner or if the chunk cannot be shared.  May
+ * wait for the owner, so the caller should not hold the output's
+ * mutex.  The data remains valid until output_filter_cache_put() is
+ * called.
+ *
+ * @param pipe the pipe which contains the chunk
+ * @param entry_r the slot is returned here, to be passed to
+ * output_filter_cache_put(); NULL if the data was not cached
+ * @return the filtered data, or NULL on error
+ */
+const void *
+output_filter_cache_get(struct output_filter_cache *cache,
+			struct audio_output *ao,
+			const struct music_pipe *pipe,
+			const struct music_chunk *chunk,
+			output_filter_func filter,
+			size_t *length_r,
+			struct output_filter_cache_entry **entry_r);
+
+/**
+ * The output has finished playing the data returned by
+ * output_filter_cache_get().
+ */
+void
+output_filter_cache_put(struct output_filter_cache *cache,
+			struct output_filter_cache_entry *entry);
+
+#endif
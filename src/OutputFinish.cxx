@@ -38,6 +38,7 @@ ao_base_finish(struct audio_output *ao)
 	delete ao->replay_gain_filter;
 	delete ao->other_replay_gain_filter;
 	delete ao->filter;
+	g_free(ao->filter_cache_key);
 
 	pcm_buffer_deinit(&ao->cross_fade_buffer);
 }
@@ -28,6 +28,7 @@
 #include "MixerList.hxx"
 #include "MixerType.hxx"
 #include "MixerControl.hxx"
+#include "MixerInternal.hxx"
 #include "mixer/SoftwareMixerPlugin.hxx"
 #include "FilterPlugin.hxx"
 #include "FilterRegistry.hxx"
@@ -172,6 +173,7 @@ ao_base_init(struct audio_output *ao,
 	ao->enabled = config_get_block_bool(param, "enabled", true);
 	ao->really_enabled = false;
 	ao->open = false;
+	music_pipe_reader_close(&ao->pipe_reader);
 	ao->pause = false;
 	ao->allow_play = true;
 	ao->fail_timer = NULL;
@@ -213,6 +215,12 @@ ao_base_init(struct audio_output *ao,
 	ao->mixer = NULL;
 	ao->replay_gain_filter = NULL;
 	ao->other_replay_gain_filter = NULL;
+	ao->filter_cache_key = NULL;
+	ao->filter_cache = NULL;
+	ao->filter_stale = false;
+	ao->filter_passthrough = false;
+	ao->pipeline_stats.Reset();
+	ao->pipe_ran_dry = false;
 
 	/* done */
 
@@ -274,6 +282,20 @@ audio_output_setup(struct audio_output *ao, const struct config_param *param,
 		return false;
 	}
 
+	/* outputs with a software mixer have a different volume
+	   each, and the "mixer" replay gain handler modifies the
+	   mixer; all others may share the filtered data with outputs
+	   configured the same way */
+
+	if ((ao->mixer == NULL ||
+	     !ao->mixer->IsPlugin(software_mixer_plugin)) &&
+	    strcmp(replay_gain_handler, "mixer") != 0)
+		ao->filter_cache_key =
+			g_strdup_printf("%s\n%s", replay_gain_handler,
+					config_get_block_string(param,
+								AUDIO_FILTERS,
+								""));
+
 	/* the "convert" filter must be the last one in the chain */
 
 	ao->convert_filter = filter_new(&convert_filter_plugin, NULL, NULL);
@@ -21,6 +21,8 @@
 #define MPD_OUTPUT_INTERNAL_HXX
 
 #include "audio_format.h"
+#include "MusicPipe.hxx"
+#include "PipelineStats.hxx"
 #include "pcm/pcm_buffer.h"
 #include "thread/Mutex.hxx"
 #include "thread/Cond.hxx"
@@ -186,6 +188,43 @@ struct audio_output {
 	 */
 	unsigned other_replay_gain_serial;
 
+	/**
+	 * Identifies the filter configuration of this output for
+	 * sharing filtered data with other outputs (see
+	 * #output_filter_cache), or NULL if this output does not
+	 * share.  Allocated with g_malloc().
+	 */
+	char *filter_cache_key;
+
+	/**
+	 * The #output_filter_cache this output has joined while it
+	 * is open, or NULL.
+	 */
+	struct output_filter_cache *filter_cache;
+
+	/**
+	 * Has the filter chain skipped chunks, because they were
+	 * played from the #filter_cache?  Then it must be reset
+	 * (closed and opened again) before it gets the next chunk,
+	 * or its state (e.g. a resampler's) would not match.  If the
+	 * reset fails, this flag remains set, and the filter chain is
+	 * closed.
+	 */
+	bool filter_stale;
+
+	/**
+	 * Statistics collected by the output thread, printed by the
+	 * "pipelinestats" command.
+	 */
+	struct pipeline_output_stats pipeline_stats;
+
+	/**
+	 * Has ao_play() reached the end of the pipe?  If the next
+	 * chunk arrives before a command, it is counted in
+	 * pipeline_output_stats::underruns.
+	 */
+	bool pipe_ran_dry;
+
 	/**
 	 * The convert_filter_plugin instance of this audio output.
 	 * It is the last item in the filter chain, and is responsible
@@ -194,6 +233,15 @@ struct audio_output {
 	 */
 	Filter *convert_filter;
 
+	/**
+	 * Is the filter chain a no-op?  This is the case if it
+	 * contains only #convert_filter, and the output format equals
+	 * the input format.  Then the chain is skipped, and the
+	 * chunk data is passed to the plugin directly.  Determined
+	 * when the filter is opened.
+	 */
+	bool filter_passthrough;
+
 	/**
 	 * The thread handle, or NULL if the output thread isn't
 	 * running.
@@ -211,8 +259,7 @@ struct audio_output {
 	const struct music_pipe *pipe;
 
 	/**
-	 * This mutex protects #open, #fail_timer, #chunk and
-	 * #chunk_finished.
+	 * This mutex protects #open and #fail_timer.
 	 */
 	Mutex mutex;
 
@@ -229,17 +276,12 @@ struct audio_output {
 	struct player_control *player_control;
 
 	/**
-	 * The #music_chunk which is currently being played.  All
-	 * chunks before this one may be returned to the
-	 * #music_buffer, because they are not going to be used by
-	 * this output anymore.
-	 */
-	const struct music_chunk *chunk;
-
-	/**
-	 * Has the output finished playing #chunk?
+	 * The position of this output in #pipe.  All chunks before
+	 * it may be returned to the #music_buffer, because they are
+	 * not going to be used by this output anymore.  This is
+	 * updated without holding #mutex.
 	 */
-	bool chunk_finished;
+	struct music_pipe_reader pipe_reader;
 };
 
 /**
@@ -20,15 +20,19 @@
 #include "config.h"
 #include "OutputThread.hxx"
 #include "OutputInternal.hxx"
+#include "OutputFilterCache.hxx"
 #include "output_api.h"
 #include "pcm/PcmMix.hxx"
 #include "notify.hxx"
 #include "FilterInternal.hxx"
 #include "filter/ConvertFilterPlugin.hxx"
+#include "filter/ChainFilterPlugin.hxx"
 #include "filter/ReplayGainFilterPlugin.hxx"
 #include "PlayerControl.hxx"
 #include "MusicPipe.hxx"
 #include "MusicChunk.hxx"
+#include "PipelineStats.hxx"
+#include "clock.h"
 
 #include "mpd_error.h"
 #include "gcc.h"
@@ -46,6 +50,7 @@ static void ao_command_finished(struct audio_output *ao)
 {
 	assert(ao->command != AO_COMMAND_NONE);
 	ao->command = AO_COMMAND_NONE;
+	ao->pipe_ran_dry = false;
 
 	ao->mutex.unlock();
 	audio_output_client_notify.Signal();
@@ -112,11 +117,40 @@ ao_filter_open(struct audio_output *ao, audio_format &format,
 			ao->replay_gain_filter->Close();
 		if (ao->other_replay_gain_filter != NULL)
 			ao->other_replay_gain_filter->Close();
-	}
+	} else
+		ao->filter_stale = false;
 
 	return af;
 }
 
+/**
+ * Leave the #output_filter_cache; this must be done before the
+ * filter is closed or reopened.
+ */
+static void
+ao_leave_filter_cache(struct audio_output *ao)
+{
+	if (ao->filter_cache != NULL) {
+		output_filter_cache_release(ao->filter_cache, ao);
+		ao->filter_cache = NULL;
+	}
+}
+
+/**
+ * Configures the "convert" filter for the output format, after the
+ * filter chain has been opened.
+ */
+static void
+ao_filter_set_format(struct audio_output *ao)
+{
+	convert_filter_set(ao->convert_filter, ao->out_audio_format);
+
+	ao->filter_passthrough =
+		filter_chain_size(*ao->filter) == 1 &&
+		audio_format_equals(&ao->in_audio_format,
+				    &ao->out_audio_format);
+}
+
 static void
 ao_filter_close(struct audio_output *ao)
 {
@@ -137,7 +171,6 @@ ao_open(struct audio_output *ao)
 
 	assert(!ao->open);
 	assert(ao->pipe != NULL);
-	assert(ao->chunk == NULL);
 	assert(audio_format_valid(&ao->in_audio_format));
 
 	if (ao->fail_timer != NULL) {
@@ -190,9 +223,11 @@ ao_open(struct audio_output *ao)
 		return;
 	}
 
-	convert_filter_set(ao->convert_filter, ao->out_audio_format);
+	ao_filter_set_format(ao);
 
 	ao->open = true;
+	music_pipe_reader_rewind(&ao->pipe_reader);
+	ao->filter_cache = output_filter_cache_acquire(ao);
 
 	g_debug("opened plugin=%s name=\"%s\" "
 		"audio_format=%s",
@@ -213,7 +248,7 @@ ao_close(struct audio_output *ao, bool drain)
 
 	ao->pipe = NULL;
 
-	ao->chunk = NULL;
+	music_pipe_reader_close(&ao->pipe_reader);
 	ao->open = false;
 
 	ao->mutex.unlock();
@@ -224,6 +259,7 @@ ao_close(struct audio_output *ao, bool drain)
 		ao_plugin_cancel(ao);
 
 	ao_plugin_close(ao);
+	ao_leave_filter_cache(ao);
 	ao_filter_close(ao);
 
 	ao->mutex.lock();
@@ -231,12 +267,31 @@ ao_close(struct audio_output *ao, bool drain)
 	g_debug("closed plugin=%s name=\"%s\"", ao->plugin->name, ao->name);
 }
 
+/**
+ * Closes the output after its filter chain has failed to open again.
+ * Unlike ao_close(), this does not close the filter chain.
+ */
+static void
+ao_close_filter_failed(struct audio_output *ao)
+{
+	ao->pipe = NULL;
+
+	music_pipe_reader_close(&ao->pipe_reader);
+	ao->open = false;
+	ao->fail_timer = g_timer_new();
+
+	ao->mutex.unlock();
+	ao_plugin_close(ao);
+	ao->mutex.lock();
+}
+
 static void
 ao_reopen_filter(struct audio_output *ao)
 {
 	const struct audio_format *filter_audio_format;
 	GError *error = NULL;
 
+	ao_leave_filter_cache(ao);
 	ao_filter_close(ao);
 	filter_audio_format = ao_filter_open(ao, ao->in_audio_format, &error);
 	if (filter_audio_format == NULL) {
@@ -244,24 +299,12 @@ ao_reopen_filter(struct audio_output *ao)
 			  ao->name, ao->plugin->name, error->message);
 		g_error_free(error);
 
-		/* this is a little code duplication fro ao_close(),
-		   but we cannot call this function because we must
-		   not call filter_close(ao->filter) again */
-
-		ao->pipe = NULL;
-
-		ao->chunk = NULL;
-		ao->open = false;
-		ao->fail_timer = g_timer_new();
-
-		ao->mutex.unlock();
-		ao_plugin_close(ao);
-		ao->mutex.lock();
-
+		ao_close_filter_failed(ao);
 		return;
 	}
 
-	convert_filter_set(ao->convert_filter, ao->out_audio_format);
+	ao_filter_set_format(ao);
+	ao->filter_cache = output_filter_cache_acquire(ao);
 }
 
 static void
@@ -282,11 +325,14 @@ ao_reopen(struct audio_output *ao)
 					&ao->config_audio_format);
 	}
 
-	if (ao->open)
+	if (ao->open) {
 		/* the audio format has changed, and all filters have
 		   to be reconfigured */
 		ao_reopen_filter(ao);
-	else
+
+		if (ao->open)
+			music_pipe_reader_rewind(&ao->pipe_reader);
+	} else
 		ao_open(ao);
 }
 
@@ -395,35 +441,93 @@ ao_filter_chunk(struct audio_output *ao, const struct music_chunk *chunk,
 		if (length > other_length)
 			length = other_length;
 
+		/* mix directly into the buffer, instead of copying
+		   the "other" chunk there first */
 		void *dest = pcm_buffer_get(&ao->cross_fade_buffer,
 					    other_length);
-		memcpy(dest, other_data, other_length);
-		if (!pcm_mix(dest, data, length,
-			     sample_format(ao->in_audio_format.format),
-			     1.0 - chunk->mix_ratio)) {
+		if (!pcm_mix_to(dest, other_data, data, length,
+				sample_format(ao->in_audio_format.format),
+				1.0 - chunk->mix_ratio)) {
 			g_warning("Cannot cross-fade format %s",
 				  sample_format_to_string(sample_format(ao->in_audio_format.format)));
 			return NULL;
 		}
 
+		if (other_length > length)
+			memcpy((char *)dest + length,
+			       (const char *)other_data + length,
+			       other_length - length);
+
 		data = dest;
 		length = other_length;
 	}
 
 	/* apply filter chain */
 
-	data = ao->filter->FilterPCM(data, length, &length, &error);
-	if (data == NULL) {
-		g_warning("\"%s\" [%s] failed to filter: %s",
+	if (!ao->filter_passthrough) {
+		data = ao->filter->FilterPCM(data, length, &length, &error);
+		if (data == NULL) {
+			g_warning("\"%s\" [%s] failed to filter: %s",
+				  ao->name, ao->plugin->name, error->message);
+			g_error_free(error);
+			return NULL;
+		}
+	}
+
+	*length_r = length;
+	return data;
+}
+
+/**
+ * Closes and opens the filter chain, to bring it back to its initial
+ * state after it has skipped chunks (see audio_output::filter_stale).
+ */
+static bool
+ao_filter_reset(struct audio_output *ao)
+{
+	GError *error = NULL;
+
+	ao_filter_close(ao);
+	if (ao_filter_open(ao, ao->in_audio_format, &error) == NULL) {
+		g_warning("Failed to reopen filter for \"%s\" [%s]: %s",
 			  ao->name, ao->plugin->name, error->message);
 		g_error_free(error);
-		return NULL;
+		return false;
 	}
 
-	*length_r = length;
+	ao_filter_set_format(ao);
+	return true;
+}
+
+/**
+ * Runs the filter chain, and records its duration in the
+ * statistics.
+ */
+static const void *
+ao_run_filter(struct audio_output *ao, const struct music_chunk *chunk,
+	      size_t *length_r)
+{
+	if (ao->filter_stale && !ao_filter_reset(ao))
+		return NULL;
+
+	const uint64_t start = monotonic_clock_us();
+	const void *data = ao_filter_chunk(ao, chunk, length_r);
+	ao->pipeline_stats.filter_time.Record(monotonic_clock_us() - start);
 	return data;
 }
 
+/**
+ * The #output_filter_func for output_filter_cache_get(), which is
+ * called while the output's mutex is unlocked.
+ */
+static const void *
+ao_run_filter_locked(struct audio_output *ao, const struct music_chunk *chunk,
+		     size_t *length_r)
+{
+	const ScopeLock protect(ao->mutex);
+	return ao_run_filter(ao, chunk, length_r);
+}
+
 static bool
 ao_play_chunk(struct audio_output *ao, const struct music_chunk *chunk)
 {
@@ -438,13 +542,40 @@ ao_play_chunk(struct audio_output *ao, const struct music_chunk *chunk)
 		ao->mutex.lock();
 	}
 
+	uint64_t now = monotonic_clock_us();
+	if (chunk->time_stamp != 0)
+		ao->pipeline_stats.chunk_age.Record(now - chunk->time_stamp);
+
 	size_t size;
 #if GCC_CHECK_VERSION(4,7)
 	/* workaround -Wmaybe-uninitialized false positive */
 	size = 0;
 #endif
-	const char *data = (const char *)ao_filter_chunk(ao, chunk, &size);
+	struct output_filter_cache_entry *cache_entry = NULL;
+	const char *data;
+	if (ao->filter_cache != NULL) {
+		/* this may wait for another output; don't block
+		   commands meanwhile */
+		const struct music_pipe *pipe = ao->pipe;
+		ao->mutex.unlock();
+		data = (const char *)
+			output_filter_cache_get(ao->filter_cache, ao,
+						pipe, chunk,
+						ao_run_filter_locked,
+						&size, &cache_entry);
+		ao->mutex.lock();
+	} else
+		data = (const char *)ao_run_filter(ao, chunk, &size);
+
 	if (data == NULL) {
+		if (ao->filter_stale) {
+			/* the filter chain could not be reset, and is
+			   closed already */
+			ao_leave_filter_cache(ao);
+			ao_close_filter_failed(ao);
+			return false;
+		}
+
 		ao_close(ao, false);
 
 		/* don't automatically reopen this device for 10
@@ -460,7 +591,9 @@ ao_play_chunk(struct audio_output *ao, const struct music_chunk *chunk)
 			break;
 
 		ao->mutex.unlock();
+		now = monotonic_clock_us();
 		nbytes = ao_plugin_play(ao, data, size, &error);
+		ao->pipeline_stats.play_time.Record(monotonic_clock_us() - now);
 		ao->mutex.lock();
 		if (nbytes == 0) {
 			/* play()==0 means failure */
@@ -468,6 +601,10 @@ ao_play_chunk(struct audio_output *ao, const struct music_chunk *chunk)
 				  ao->name, ao->plugin->name, error->message);
 			g_error_free(error);
 
+			if (cache_entry != NULL)
+				output_filter_cache_put(ao->filter_cache,
+							cache_entry);
+
 			ao_close(ao, false);
 
 			/* don't automatically reopen this device for
@@ -485,17 +622,10 @@ ao_play_chunk(struct audio_output *ao, const struct music_chunk *chunk)
 		size -= nbytes;
 	}
 
-	return true;
-}
+	if (cache_entry != NULL)
+		output_filter_cache_put(ao->filter_cache, cache_entry);
 
-static const struct music_chunk *
-ao_next_chunk(struct audio_output *ao)
-{
-	return ao->chunk != NULL
-		/* continue the previous play() call */
-		? ao->chunk->next
-		/* get the first chunk from the pipe */
-		: music_pipe_peek(ao->pipe);
+	return true;
 }
 
 /**
@@ -514,29 +644,37 @@ ao_play(struct audio_output *ao)
 
 	assert(ao->pipe != NULL);
 
-	chunk = ao_next_chunk(ao);
+	chunk = music_pipe_reader_get(ao->pipe, &ao->pipe_reader);
 	if (chunk == NULL)
 		/* no chunk available */
 		return false;
 
-	ao->chunk_finished = false;
+	if (ao->pipe_ran_dry) {
+		/* the pipe has run dry while playing, and no command
+		   has arrived since: the player was late */
+		ao->pipe_ran_dry = false;
+		ao->pipeline_stats.underruns.Increment();
+	}
 
 	while (chunk != NULL && ao->command == AO_COMMAND_NONE) {
-		assert(!ao->chunk_finished);
-
-		ao->chunk = chunk;
-
 		success = ao_play_chunk(ao, chunk);
 		if (!success) {
-			assert(ao->chunk == NULL);
+			/* the output has been closed */
+			assert(!ao->open);
 			break;
 		}
 
-		assert(ao->chunk == chunk);
-		chunk = chunk->next;
+		/* after this, the player thread may free the chunk */
+		music_pipe_reader_consumed(ao->pipe, &ao->pipe_reader,
+					   chunk);
+		chunk = music_pipe_reader_get(ao->pipe, &ao->pipe_reader);
 	}
 
-	ao->chunk_finished = true;
+	if (chunk == NULL)
+		/* the pipe has run dry; this is an underrun if the
+		   next chunk arrives before a command (e.g. "drain" at
+		   the end of playback, or "pause") */
+		ao->pipe_ran_dry = true;
 
 	ao->mutex.unlock();
 	ao->player_control->LockSignal();
@@ -631,7 +769,6 @@ static gpointer audio_output_task(gpointer arg)
 
 		case AO_COMMAND_DRAIN:
 			if (ao->open) {
-				assert(ao->chunk == NULL);
 				assert(music_pipe_peek(ao->pipe) == NULL);
 
 				ao->mutex.unlock();
@@ -643,9 +780,11 @@ static gpointer audio_output_task(gpointer arg)
 			continue;
 
 		case AO_COMMAND_CANCEL:
-			ao->chunk = NULL;
-
 			if (ao->open) {
+				/* the player clears the pipe after
+				   this command */
+				music_pipe_reader_rewind(&ao->pipe_reader);
+
 				ao->mutex.unlock();
 				ao_plugin_cancel(ao);
 				ao->mutex.lock();
@@ -655,7 +794,6 @@ static gpointer audio_output_task(gpointer arg)
 			continue;
 
 		case AO_COMMAND_KILL:
-			ao->chunk = NULL;
 			ao_command_finished(ao);
 			ao->mutex.unlock();
 			return NULL;
@@ -39,9 +39,10 @@ struct Partition {
 	Partition(Instance &_instance,
 		  unsigned max_length,
 		  unsigned buffer_chunks,
+		  size_t chunk_size,
 		  unsigned buffered_before_play)
 		:instance(_instance), playlist(max_length),
-		 pc(buffer_chunks, buffered_before_play) {
+		 pc(buffer_chunks, chunk_size, buffered_before_play) {
 	}
 
 	void ClearQueue() {
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "PipelineStats.hxx"
+#include "OutputAll.hxx"
+#include "OutputInternal.hxx"
+#include "Client.hxx"
+#include "gcc.h"
+
+#include <glib.h>
+
+struct pipeline_stats pipeline_stats;
+
+gcc_const
+static unsigned
+bucket_of(uint64_t value)
+{
+	unsigned i = 0;
+	while (value > 0 && i < PipelineHistogram::N_BUCKETS - 1) {
+		value >>= 1;
+		++i;
+	}
+
+	return i;
+}
+
+/**
+ * Returns the upper bound of a bucket.
+ */
+gcc_const
+static uint64_t
+bucket_limit(unsigned i)
+{
+	return i == 0 ? 0 : (UINT64_C(1) << i) - 1;
+}
+
+void
+PipelineHistogram::Record(uint64_t value)
+{
+	/* single writer: plain load/store instead of the more
+	   expensive fetch_add() */
+
+	std::atomic<uint64_t> &bucket = buckets[bucket_of(value)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+		     std::memory_order_relaxed);
+
+	sum.store(sum.load(std::memory_order_relaxed) + value,
+		  std::memory_order_relaxed);
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+
+	count.store(count.load(std::memory_order_relaxed) + 1,
+		    std::memory_order_relaxed);
+}
+
+void
+PipelineHistogram::Reset()
+{
+	for (auto &i : buckets)
+		i.store(0, std::memory_order_relaxed);
+
+	count.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Determines the upper bound of the bucket containing the given
+ * percentile.
+ */
+gcc_pure
+static uint64_t
+histogram_percentile(const uint64_t *buckets, uint64_t count,
+		     unsigned percent)
+{
+	const uint64_t wanted = (count * percent + 99) / 100;
+	uint64_t n = 0;
+	for (unsigned i = 0; i < PipelineHistogram::N_BUCKETS; ++i) {
+		n += buckets[i];
+		if (n >= wanted)
+			return bucket_limit(i);
+	}
+
+	return bucket_limit(PipelineHistogram::N_BUCKETS - 1);
+}
+
+void
+PipelineHistogram::Print(Client *client, const char *name) const
+{
+	/* take a snapshot; the writer may be running, so the sum of
+	   the buckets may differ slightly from the count */
+
+	uint64_t b[N_BUCKETS], total = 0;
+	unsigned used = 0;
+	for (unsigned i = 0; i < N_BUCKETS; ++i) {
+		b[i] = buckets[i].load(std::memory_order_relaxed);
+		total += b[i];
+		if (b[i] > 0)
+			used = i + 1;
+	}
+
+	const uint64_t n = count.load(std::memory_order_relaxed);
+
+	client_printf(client,
+		      "%s_count: %" G_GUINT64_FORMAT "\n"
+		      "%s_avg: %" G_GUINT64_FORMAT "\n"
+		      "%s_max: %" G_GUINT64_FORMAT "\n"
+		      "%s_p50: %" G_GUINT64_FORMAT "\n"
+		      "%s_p99: %" G_GUINT64_FORMAT "\n",
+		      name, n,
+		      name, n > 0
+		      ? sum.load(std::memory_order_relaxed) / n
+		      : (uint64_t)0,
+		      name, max.load(std::memory_order_relaxed),
+		      name, histogram_percentile(b, total, 50),
+		      name, histogram_percentile(b, total, 99));
+
+	GString *line = g_string_sized_new(N_BUCKETS * 4);
+	for (unsigned i = 0; i < used; ++i)
+		g_string_append_printf(line, i > 0
+				       ? " %" G_GUINT64_FORMAT
+				       : "%" G_GUINT64_FORMAT,
+				       b[i]);
+
+	client_printf(client, "%s_histogram: %s\n", name, line->str);
+	g_string_free(line, true);
+}
+
+void
+pipeline_stats_print(Client *client)
+{
+	pipeline_stats.decode_time.Print(client, "decode_time");
+	pipeline_stats.decoder_pipe_fill.Print(client, "decoder_pipe_fill");
+	pipeline_stats.output_pipe_fill.Print(client, "output_pipe_fill");
+	client_printf(client, "underruns: %" G_GUINT64_FORMAT "\n",
+		      pipeline_stats.underruns.Get());
+
+	const unsigned n = audio_output_count();
+	for (unsigned i = 0; i < n; ++i) {
+		const struct audio_output *ao = audio_output_get(i);
+		const struct pipeline_output_stats &stats = ao->pipeline_stats;
+
+		client_printf(client,
+			      "outputid: %u\n"
+			      "outputname: %s\n",
+			      i, ao->name);
+		stats.filter_time.Print(client, "filter_time");
+		stats.play_time.Print(client, "play_time");
+		stats.chunk_age.Print(client, "chunk_age");
+		client_printf(client,
+			      "output_underruns: %" G_GUINT64_FORMAT "\n"
+			      "send_errors: %" G_GUINT64_FORMAT "\n",
+			      stats.underruns.Get(),
+			      stats.send_errors.Get());
+	}
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Counters and histograms for the decoder -> player -> output
+ * pipeline, printed by the "pipelinestats" command.
+ *
+ * Each object is updated by exactly one thread (the decoder thread,
+ * the player thread or one output thread), so recording needs no
+ * lock and no read-modify-write instruction: the values are atomic
+ * only to allow the client thread to read them at any time.
+ */
+
+#ifndef MPD_PIPELINE_STATS_HXX
+#define MPD_PIPELINE_STATS_HXX
+
+#include <atomic>
+
+#include <stdint.h>
+
+class Client;
+
+/**
+ * A counter which is incremented by one thread only.
+ */
+class PipelineCounter {
+	std::atomic<uint64_t> value;
+
+public:
+	PipelineCounter():value(0) {}
+
+	void Increment() {
+		value.store(value.load(std::memory_order_relaxed) + 1,
+			    std::memory_order_relaxed);
+	}
+
+	uint64_t Get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+
+	void Reset() {
+		value.store(0, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * A histogram with power-of-two buckets: bucket 0 counts the value
+ * 0, bucket i counts values from 2^(i-1) to 2^i-1, and the last
+ * bucket counts everything above.  Only one thread may record values.
+ */
+class PipelineHistogram {
+public:
+	static constexpr unsigned N_BUCKETS = 24;
+
+private:
+	std::atomic<uint64_t> buckets[N_BUCKETS];
+
+	std::atomic<uint64_t> count, sum, max;
+
+public:
+	PipelineHistogram() {
+		Reset();
+	}
+
+	void Record(uint64_t value);
+
+	/**
+	 * Prints the statistics as "NAME_count", "NAME_avg",
+	 * "NAME_max", "NAME_p50", "NAME_p99" and "NAME_histogram"
+	 * (the bucket counts separated by spaces, trailing zeroes
+	 * omitted).
+	 */
+	void Print(Client *client, const char *name) const;
+
+	void Reset();
+};
+
+/**
+ * Statistics collected by the decoder thread and the player thread.
+ */
+struct pipeline_stats {
+	/**
+	 * The time between allocating a chunk and submitting it to
+	 * the player [microseconds]; this includes waiting for the
+	 * input stream.
+	 */
+	PipelineHistogram decode_time;
+
+	/**
+	 * The number of decoded chunks waiting in the player's pipe,
+	 * sampled each time the player sends a chunk to the outputs.
+	 */
+	PipelineHistogram decoder_pipe_fill;
+
+	/**
+	 * The number of chunks in the output pipe, sampled each time
+	 * the player sends a chunk to the outputs.
+	 */
+	PipelineHistogram output_pipe_fill;
+
+	/**
+	 * How often the player had to send silence because the
+	 * decoder was too slow.
+	 */
+	PipelineCounter underruns;
+};
+
+/**
+ * Statistics collected by one output thread.
+ */
+struct pipeline_output_stats {
+	/**
+	 * The duration of the filter chain per chunk [microseconds],
+	 * measured when this output's thread runs it.  Chunks taken
+	 * from the #output_filter_cache are not counted.
+	 */
+	PipelineHistogram filter_time;
+
+	/**
+	 * The duration of each play() call of the output plugin
+	 * [microseconds].  This includes blocking on the device.
+	 */
+	PipelineHistogram play_time;
+
+	/**
+	 * The time between the decoder submitting a chunk and this
+	 * output starting to play it [microseconds].
+	 */
+	PipelineHistogram chunk_age;
+
+	/**
+	 * How often this output ran out of chunks while playing,
+	 * i.e. the next chunk arrived late.  Idle periods, pause and
+	 * the end of playback are not counted.
+	 */
+	PipelineCounter underruns;
+
+	/**
+	 * The number of packets which the output plugin could not
+	 * deliver to the device.  Only network outputs which keep
+	 * playing after a failed send (e.g. "raop") count them; the
+	 * plugin may increment it from one thread of its own.
+	 */
+	PipelineCounter send_errors;
+
+	void Reset() {
+		filter_time.Reset();
+		play_time.Reset();
+		chunk_age.Reset();
+		underruns.Reset();
+		send_errors.Reset();
+	}
+};
+
+extern struct pipeline_stats pipeline_stats;
+
+/**
+ * Prints the statistics of the decoder, the player and all audio
+ * outputs.
+ */
+void
+pipeline_stats_print(Client *client);
+
+#endif
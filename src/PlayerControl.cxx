@@ -33,8 +33,10 @@ static void
 pc_enqueue_song_locked(struct player_control *pc, struct song *song);
 
 player_control::player_control(unsigned _buffer_chunks,
+			       size_t _chunk_size,
 			       unsigned _buffered_before_play)
 	:buffer_chunks(_buffer_chunks),
+	 chunk_size(_chunk_size),
 	 buffered_before_play(_buffered_before_play),
 	 thread(nullptr),
 	 command(PLAYER_COMMAND_NONE),
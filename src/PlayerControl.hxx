@@ -92,6 +92,12 @@ struct player_status {
 struct player_control {
 	unsigned buffer_chunks;
 
+	/**
+	 * The size of each chunk's payload in bytes, see
+	 * music_buffer_new().
+	 */
+	size_t chunk_size;
+
 	unsigned int buffered_before_play;
 
 	/** the handle of the player thread, or NULL if the player
@@ -157,6 +163,7 @@ struct player_control {
 	bool border_pause;
 
 	player_control(unsigned buffer_chunks,
+		       size_t chunk_size,
 		       unsigned buffered_before_play);
 	~player_control();
 
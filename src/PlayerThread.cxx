@@ -33,6 +33,8 @@
 #include "tag.h"
 #include "Idle.hxx"
 #include "GlobalEvents.hxx"
+#include "PipelineStats.hxx"
+#include "clock.h"
 
 #include <cmath>
 
@@ -453,9 +455,10 @@ player_send_silence(struct player *player)
 		audio_format_frame_size(&player->play_audio_format);
 	/* this formula ensures that we don't send
 	   partial frames */
-	unsigned num_frames = sizeof(chunk->data) / frame_size;
+	unsigned num_frames = chunk->capacity / frame_size;
 
 	chunk->times = -1.0; /* undefined time stamp */
+	chunk->time_stamp = monotonic_clock_us();
 	chunk->length = num_frames * frame_size;
 	memset(chunk->data, 0, chunk->length);
 
@@ -812,6 +815,8 @@ play_next_chunk(struct player *player)
 
 	assert(chunk != NULL);
 
+	pipeline_stats.decoder_pipe_fill.Record(music_pipe_size(player->pipe));
+
 	/* insert the postponed tag if cross-fading is finished */
 
 	if (player->xfade != XFADE_ENABLED && player->cross_fade_tag != NULL) {
@@ -1020,6 +1025,7 @@ static void do_play(struct player_control *pc, struct decoder_control *dc)
 						dc->mixramp_prev_end,
 						&dc->out_audio_format,
 						&player.play_audio_format,
+						music_buffer_chunk_size(player_buffer),
 						music_buffer_size(player_buffer) -
 						pc->buffered_before_play);
 			if (player.cross_fade_chunks > 0) {
@@ -1068,6 +1074,7 @@ static void do_play(struct player_control *pc, struct decoder_control *dc)
 			/* the decoder is too busy and hasn't provided
 			   new PCM data in time: send silence (if the
 			   output pipe is empty) */
+			pipeline_stats.underruns.Increment();
 			if (!player_send_silence(&player))
 				break;
 		}
@@ -1111,7 +1118,7 @@ player_task(gpointer arg)
 	struct decoder_control *dc = new decoder_control();
 	decoder_thread_start(dc);
 
-	player_buffer = music_buffer_new(pc->buffer_chunks);
+	player_buffer = music_buffer_new(pc->buffer_chunks, pc->chunk_size);
 
 	pc->Lock();
 
@@ -1127,6 +1134,12 @@ player_task(gpointer arg)
 		case PLAYER_COMMAND_STOP:
 			pc->Unlock();
 			audio_output_all_cancel();
+
+			/* the decoder is stopped and all chunks have
+			   been returned; give the memory back to the
+			   kernel */
+			music_buffer_discard(player_buffer);
+
 			pc->Lock();
 
 			/* fall through */
@@ -1144,6 +1157,7 @@ player_task(gpointer arg)
 			pc->Unlock();
 
 			audio_output_all_release();
+			music_buffer_discard(player_buffer);
 
 			pc->Lock();
 			player_command_finished_locked(pc);
@@ -1153,7 +1167,8 @@ player_task(gpointer arg)
 			   music_chunk objects by freeing the
 			   music_buffer */
 			music_buffer_free(player_buffer);
-			player_buffer = music_buffer_new(pc->buffer_chunks);
+			player_buffer = music_buffer_new(pc->buffer_chunks,
+							 pc->chunk_size);
 #endif
 
 			break;
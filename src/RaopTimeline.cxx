@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "RaopTimeline.hxx"
+
+#include <assert.h>
+
+uint64_t
+RaopTimeline::FramesToMicroseconds(uint64_t frames)
+{
+	/* split both factors so the products fit into 64 bit */
+	const uint64_t whole = FRAME_DURATION >> 32;
+	const uint64_t fraction = FRAME_DURATION & 0xffffffff;
+
+	return frames * whole + (frames >> 32) * fraction
+		+ (((frames & 0xffffffff) * fraction) >> 32);
+}
+
+void
+RaopTimeline::Start(uint64_t now_monotonic, uint64_t now_realtime)
+{
+	anchor_position = position;
+	anchor_realtime = now_realtime;
+	offset = (int64_t)(now_realtime - now_monotonic);
+	started = true;
+}
+
+uint64_t
+RaopTimeline::GetRealtime(uint64_t p) const
+{
+	assert(started);
+	assert(p >= anchor_position);
+
+	return anchor_realtime + FramesToMicroseconds(p - anchor_position);
+}
+
+void
+RaopTimeline::Synchronize(uint64_t now_monotonic, uint64_t now_realtime,
+			  int64_t send_lag)
+{
+	assert(started);
+
+	const int64_t measured = (int64_t)(now_realtime - now_monotonic);
+	int64_t error = measured - offset;
+
+	if (error >= STEP_THRESHOLD || error <= -STEP_THRESHOLD) {
+		/* the wall clock was set: keep pacing as before, but
+		   announce the new time scale to the receivers */
+		anchor_realtime += error;
+		offset = measured;
+	} else {
+		if (error > MAX_SLEW)
+			error = MAX_SLEW;
+		else if (error < -MAX_SLEW)
+			error = -MAX_SLEW;
+
+		offset += error;
+	}
+
+	if (send_lag > MAX_SEND_LAG)
+		/* the sender could not keep up (e.g. the host was
+		   suspended); continue from here instead of sending a
+		   burst of late packets */
+		anchor_realtime += send_lag;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_RAOP_TIMELINE_HXX
+#define MPD_RAOP_TIMELINE_HXX
+
+#include "gcc.h"
+
+#include <stdint.h>
+
+/**
+ * Maps the frames of a RAOP stream to the wall clock (for the sync
+ * packets, which the receiver interprets with the clock it has
+ * synchronized with our timing server) and to the monotonic clock
+ * (for pacing the audio packets).
+ *
+ * The position is counted in 64 bit, so the 32 bit RTP time stamp
+ * may wrap around without disturbing the timeline.  Frame durations
+ * are 32.32 fixed point microseconds, so there is no rounding error
+ * accumulating over long sessions.
+ *
+ * The two clocks drift apart (the wall clock is adjusted by NTP, and
+ * may be set), so the offset between them is measured again with
+ * each sync packet; see Synchronize().
+ *
+ * All times are in microseconds.
+ */
+class RaopTimeline {
+public:
+	/**
+	 * The sample rate of all RAOP streams.
+	 */
+	static constexpr unsigned RATE = 44100;
+
+	/**
+	 * The duration of one frame in microseconds, 32.32 fixed
+	 * point.
+	 */
+	static constexpr uint64_t FRAME_DURATION =
+		(UINT64_C(1000000) << 32) / RATE;
+
+	/**
+	 * The maximum correction of the clock offset per
+	 * Synchronize() call (i.e. about per second).  Gradual drift
+	 * is followed at this rate.
+	 */
+	static constexpr int64_t MAX_SLEW = 500;
+
+	/**
+	 * An offset change larger than this is considered a step of
+	 * the wall clock.
+	 */
+	static constexpr int64_t STEP_THRESHOLD = 100000;
+
+	/**
+	 * If the sender is later than this, the timeline is moved
+	 * instead of trying to catch up.
+	 */
+	static constexpr int64_t MAX_SEND_LAG = 50000;
+
+private:
+	/**
+	 * The RTP time stamp of position 0.
+	 */
+	uint32_t rtp_base;
+
+	/**
+	 * The number of frames since Reset(); this never wraps
+	 * around.
+	 */
+	uint64_t position;
+
+	bool started;
+
+	/**
+	 * The wall clock time of frame #anchor_position.
+	 */
+	uint64_t anchor_position, anchor_realtime;
+
+	/**
+	 * The difference between wall clock and monotonic clock used
+	 * for pacing.
+	 */
+	int64_t offset;
+
+public:
+	RaopTimeline():rtp_base(0), position(0), started(false) {}
+
+	/**
+	 * Start a new stream.
+	 */
+	void Reset(uint32_t _rtp_base) {
+		rtp_base = _rtp_base;
+		position = 0;
+		started = false;
+	}
+
+	uint64_t GetPosition() const {
+		return position;
+	}
+
+	/**
+	 * Returns the RTP time stamp of the specified position.
+	 */
+	uint32_t GetRtpTime(uint64_t p) const {
+		return rtp_base + (uint32_t)p;
+	}
+
+	/**
+	 * Returns the RTP time stamp of the current position.
+	 */
+	uint32_t GetRtpTime() const {
+		return GetRtpTime(position);
+	}
+
+	void Advance(unsigned frames) {
+		position += frames;
+	}
+
+	bool IsStarted() const {
+		return started;
+	}
+
+	/**
+	 * Anchor the current position at the specified time.
+	 */
+	void Start(uint64_t now_monotonic, uint64_t now_realtime);
+
+	/**
+	 * Stop the timeline; the next Start() will anchor it again,
+	 * e.g. after a flush.
+	 */
+	void Stop() {
+		started = false;
+	}
+
+	/**
+	 * Returns the wall clock time of the specified position.
+	 * The timeline must be started.
+	 */
+	gcc_pure
+	uint64_t GetRealtime(uint64_t p) const;
+
+	/**
+	 * Returns the monotonic clock time at which the specified
+	 * position shall be sent.  The timeline must be started.
+	 */
+	gcc_pure
+	uint64_t GetDeadline(uint64_t p) const {
+		return (int64_t)GetRealtime(p) - offset;
+	}
+
+	gcc_pure
+	uint64_t GetDeadline() const {
+		return GetDeadline(position);
+	}
+
+	/**
+	 * Measure the clock offset again, called before each sync
+	 * packet.  Gradual drift between the clocks is followed
+	 * slowly, so the receiver sees a smooth pace; a step of the
+	 * wall clock moves the timeline to the new time scale without
+	 * disturbing the pace.
+	 *
+	 * @param send_lag how much later than its deadline the
+	 * sender thread has sent the most recent packet
+	 */
+	void Synchronize(uint64_t now_monotonic, uint64_t now_realtime,
+			 int64_t send_lag);
+
+	/**
+	 * Converts a number of frames to microseconds.
+	 */
+	gcc_const
+	static uint64_t FramesToMicroseconds(uint64_t frames);
+};
+
+#endif
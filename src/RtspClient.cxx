@@ -156,8 +156,10 @@ open_tcp_socket(char *hostname, unsigned short *port,
 {
 	int sd;
 
-	/* socket creation */
-	sd = socket(AF_INET, SOCK_STREAM, 0);
+	/* socket creation; it is non-blocking, so connect() returns
+	   immediately and the handshake requests are queued until
+	   the connection is established */
+	sd = socket_cloexec_nonblock(AF_INET, SOCK_STREAM, 0);
 	if (sd < 0) {
 		g_set_error(error_r, rtsp_client_quark(), errno,
 			    "failed to create TCP socket: %s",
@@ -196,38 +198,30 @@ get_sockaddr_by_host(const char *host, short destport,
 }
 
 /*
- * create tcp connection
- * as long as the socket is not non-blocking, this can block the process
- * nsport is network byte order
+ * start a tcp connection on a non-blocking socket; this does not wait
+ * for the connection to be established, errors are reported later by
+ * the tcp_socket handler
  */
 static bool
 get_tcp_connect(int sd, struct sockaddr_in dest_addr, GError **error_r)
 {
-	if (connect(sd, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr))){
-		g_usleep(100000);
-		// try one more time
-		if (connect(sd, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr))) {
-			g_set_error(error_r, rtsp_client_quark(), errno,
-				    "failed to connect to %s:%d: %s",
-				    inet_ntoa(dest_addr.sin_addr),
-				    ntohs(dest_addr.sin_port),
-				    g_strerror(errno));
-			return false;
-		}
+	if (connect(sd, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr)) &&
+#ifdef WIN32
+	    WSAGetLastError() != WSAEWOULDBLOCK
+#else
+	    errno != EINPROGRESS
+#endif
+	    ) {
+		g_set_error(error_r, rtsp_client_quark(), errno,
+			    "failed to connect to %s:%d: %s",
+			    inet_ntoa(dest_addr.sin_addr),
+			    ntohs(dest_addr.sin_port),
+			    g_strerror(errno));
+		return false;
 	}
 	return true;
 }
 
-static bool
-get_tcp_connect_by_host(int sd, const char *host, short destport,
-			GError **error_r)
-{
-	struct sockaddr_in addr;
-
-	return get_sockaddr_by_host(host, destport, &addr, error_r) &&
-		get_tcp_connect(sd, addr, error_r);
-}
-
 static void
 rtsp_client_flush_received(struct rtspcl_data *rtspcld)
 {
@@ -337,14 +331,20 @@ rtspcl_connect(struct rtspcl_data *rtspcld, const char *host, short destport,
 	if (fd < 0)
 		return false;
 
-	if (!get_tcp_connect_by_host(fd, host, destport, error_r))
+	struct sockaddr_in dest_addr;
+	if (!get_sockaddr_by_host(host, destport, &dest_addr, error_r) ||
+	    !get_tcp_connect(fd, dest_addr, error_r)) {
+		close_socket(fd);
 		return false;
+	}
 
+	/* the local address is already known while the connection
+	   is still in progress */
 	getsockname(fd, (struct sockaddr*)&name, &namelen);
 	memcpy(&rtspcld->local_addr, &name.sin_addr,sizeof(struct in_addr));
 	sprintf(rtspcld->url, "rtsp://%s/%s", inet_ntoa(name.sin_addr), sid);
-	getpeername(fd, (struct sockaddr*)&name, &namelen);
-	memcpy(&rtspcld->host_addr, &name.sin_addr, sizeof(struct in_addr));
+	memcpy(&rtspcld->host_addr, &dest_addr.sin_addr,
+	       sizeof(struct in_addr));
 
 	rtspcld->tcp_socket = tcp_socket_new(fd, &rtsp_client_socket_handler,
 					     rtspcld);
@@ -457,24 +457,13 @@ read_line(struct rtspcl_data *rtspcld, char *line, int maxlen,
 	}
 }
 
-/*
- * send RTSP request, and get response if it's needed
- * if this gets a success, *kd is allocated or reallocated (if *kd is not NULL)
- */
 bool
-exec_request(struct rtspcl_data *rtspcld, const char *cmd,
-	     const char *content_type, const char *content,
-	     int get_response,
-	     const struct key_data *hds, struct key_data **kd,
-	     GError **error_r)
+rtspcl_send_request(struct rtspcl_data *rtspcld, const char *cmd,
+		    const char *content_type, const char *content,
+		    const struct key_data *hds, GError **error_r)
 {
-	char line[1024];
 	char req[1024];
 	char reql[128];
-	const char delimiters[] = " ";
-	char *token, *dp;
-	int dsize = 0;
-	int timeout = 5000; // msec unit
 
 	if (!rtspcld || !rtspcld->tcp_socket) {
 		g_set_error_literal(error_r, rtsp_client_quark(), 0,
@@ -523,7 +512,18 @@ exec_request(struct rtspcl_data *rtspcld, const char *cmd,
 		return false;
 	}
 
-	if (!get_response) return true;
+	return true;
+}
+
+bool
+rtspcl_read_response(struct rtspcl_data *rtspcld, struct key_data **kd,
+		     GError **error_r)
+{
+	char line[1024];
+	const char delimiters[] = " ";
+	char *token, *dp;
+	int dsize = 0;
+	int timeout = 5000; // msec unit
 
 	if (read_line(rtspcld, line, sizeof(line), timeout) <= 0) {
 		g_set_error_literal(error_r, rtsp_client_quark(), 0,
@@ -596,6 +596,34 @@ exec_request(struct rtspcl_data *rtspcld, const char *cmd,
 	return true;
 }
 
+/*
+ * send RTSP request, and get response if it's needed
+ * if this gets a success, *kd is allocated or reallocated (if *kd is not NULL)
+ */
+bool
+exec_request(struct rtspcl_data *rtspcld, const char *cmd,
+	     const char *content_type, const char *content,
+	     int get_response,
+	     const struct key_data *hds, struct key_data **kd,
+	     GError **error_r)
+{
+	if (!rtspcl_send_request(rtspcld, cmd, content_type, content, hds,
+				 error_r))
+		return false;
+
+	if (!get_response) return true;
+
+	return rtspcl_read_response(rtspcld, kd, error_r);
+}
+
+bool
+rtspcl_send_set_parameter(struct rtspcl_data *rtspcld, const char *parameter,
+			  GError **error_r)
+{
+	return rtspcl_send_request(rtspcld, "SET_PARAMETER", "text/parameters",
+				   parameter, NULL, error_r);
+}
+
 bool
 rtspcl_set_parameter(struct rtspcl_data *rtspcld, const char *parameter,
 		     GError **error_r)
@@ -610,6 +638,14 @@ rtspcl_set_useragent(struct rtspcl_data *rtspcld, const char *name)
 	rtspcld->useragent = name;
 }
 
+bool
+rtspcl_send_announce_sdp(struct rtspcl_data *rtspcld, const char *sdp,
+			 GError **error_r)
+{
+	return rtspcl_send_request(rtspcld, "ANNOUNCE", "application/sdp", sdp,
+				   NULL, error_r);
+}
+
 bool
 rtspcl_announce_sdp(struct rtspcl_data *rtspcld, const char *sdp,
 		    GError **error_r)
@@ -619,15 +655,11 @@ rtspcl_announce_sdp(struct rtspcl_data *rtspcld, const char *sdp,
 }
 
 bool
-rtspcl_setup(struct rtspcl_data *rtspcld, struct key_data **kd,
-	     int control_port, int ntp_port,
-	     GError **error_r)
+rtspcl_send_setup(struct rtspcl_data *rtspcld,
+		  int control_port, int ntp_port,
+		  GError **error_r)
 {
-	struct key_data *rkd = NULL, hds;
-	const char delimiters[] = ";";
-	char *buf = NULL;
-	char *token, *pc;
-	int rval = false;
+	struct key_data hds;
 
 	static char transport_key[] = "Transport";
 
@@ -639,8 +671,21 @@ rtspcl_setup(struct rtspcl_data *rtspcld, struct key_data **kd,
 	hds.key = transport_key;
 	hds.data = transport_value;
 	hds.next = NULL;
-	if (!exec_request(rtspcld, "SETUP", NULL, NULL, 1,
-			  &hds, &rkd, error_r))
+	return rtspcl_send_request(rtspcld, "SETUP", NULL, NULL,
+				   &hds, error_r);
+}
+
+bool
+rtspcl_read_setup_response(struct rtspcl_data *rtspcld, struct key_data **kd,
+			   GError **error_r)
+{
+	struct key_data *rkd = NULL;
+	const char delimiters[] = ";";
+	char *buf = NULL;
+	char *token, *pc;
+	int rval = false;
+
+	if (!rtspcl_read_response(rtspcld, &rkd, error_r))
 		return false;
 
 	if (!(rtspcld->session = g_strdup(kd_lookup(rkd, "Session")))) {
@@ -695,9 +740,18 @@ rtspcl_setup(struct rtspcl_data *rtspcld, struct key_data **kd,
 }
 
 bool
-rtspcl_record(struct rtspcl_data *rtspcld,
-	      int seq_num, int rtptime,
-	      GError **error_r)
+rtspcl_setup(struct rtspcl_data *rtspcld, struct key_data **kd,
+	     int control_port, int ntp_port,
+	     GError **error_r)
+{
+	return rtspcl_send_setup(rtspcld, control_port, ntp_port, error_r) &&
+		rtspcl_read_setup_response(rtspcld, kd, error_r);
+}
+
+bool
+rtspcl_send_record(struct rtspcl_data *rtspcld,
+		   int seq_num, int rtptime,
+		   GError **error_r)
 {
 	if (!rtspcld->session) {
 		g_set_error_literal(error_r, rtsp_client_quark(), 0,
@@ -721,8 +775,17 @@ rtspcl_record(struct rtspcl_data *rtspcld,
 	range.data = range_value;
 	range.next = &rtp;
 
-	return exec_request(rtspcld, "RECORD", NULL, NULL, 1, &range,
-			    NULL, error_r);
+	return rtspcl_send_request(rtspcld, "RECORD", NULL, NULL, &range,
+				   error_r);
+}
+
+bool
+rtspcl_record(struct rtspcl_data *rtspcld,
+	      int seq_num, int rtptime,
+	      GError **error_r)
+{
+	return rtspcl_send_record(rtspcld, seq_num, rtptime, error_r) &&
+		rtspcl_read_response(rtspcld, NULL, error_r);
 }
 
 char *
@@ -80,6 +80,12 @@ G_GNUC_MALLOC
 struct rtspcl_data *
 rtspcl_open(void);
 
+/**
+ * Start connecting to the RTSP server.  This does not block: requests
+ * may be sent right away, they are transmitted as soon as the
+ * connection is established.  A connection failure is reported by
+ * the first rtspcl_read_response() call.
+ */
 bool
 rtspcl_connect(struct rtspcl_data *rtspcld, const char *host, short destport,
 	       const char *sid, GError **error_r);
@@ -90,6 +96,29 @@ rtspcl_close(struct rtspcl_data *rtspcld);
 void
 rtspcl_add_exthds(struct rtspcl_data *rtspcld, const char *key, char *data);
 
+/**
+ * Send a request without waiting for the response.  Several requests
+ * may be sent in a row ("pipelining"); their responses must then be
+ * read in the same order with rtspcl_read_response().
+ */
+bool
+rtspcl_send_request(struct rtspcl_data *rtspcld, const char *cmd,
+		    const char *content_type, const char *content,
+		    const struct key_data *hds, GError **error_r);
+
+/**
+ * Wait for the response to the oldest request which has not been
+ * answered yet.  On success, the response headers are appended to
+ * *kd (unless kd is NULL).
+ */
+bool
+rtspcl_read_response(struct rtspcl_data *rtspcld, struct key_data **kd,
+		     GError **error_r);
+
+/**
+ * Send a request and, if get_response is non-zero, wait for its
+ * response.
+ */
 bool
 exec_request(struct rtspcl_data *rtspcld, const char *cmd,
 	     const char *content_type, const char *content,
@@ -97,6 +126,10 @@ exec_request(struct rtspcl_data *rtspcld, const char *cmd,
 	     const struct key_data *hds, struct key_data **kd,
 	     GError **error_r);
 
+bool
+rtspcl_send_set_parameter(struct rtspcl_data *rtspcld, const char *parameter,
+			  GError **error_r);
+
 bool
 rtspcl_set_parameter(struct rtspcl_data *rtspcld, const char *parameter,
 		     GError **error_r);
@@ -104,15 +137,41 @@ rtspcl_set_parameter(struct rtspcl_data *rtspcld, const char *parameter,
 void
 rtspcl_set_useragent(struct rtspcl_data *rtspcld, const char *name);
 
+bool
+rtspcl_send_announce_sdp(struct rtspcl_data *rtspcld, const char *sdp,
+			 GError **error_r);
+
 bool
 rtspcl_announce_sdp(struct rtspcl_data *rtspcld, const char *sdp,
 		    GError **error_r);
 
+bool
+rtspcl_send_setup(struct rtspcl_data *rtspcld,
+		  int control_port, int ntp_port,
+		  GError **error_r);
+
+/**
+ * Read the response to a SETUP request, and parse the session and
+ * the receiver's ports from it.
+ */
+bool
+rtspcl_read_setup_response(struct rtspcl_data *rtspcld, struct key_data **kd,
+			   GError **error_r);
+
 bool
 rtspcl_setup(struct rtspcl_data *rtspcld, struct key_data **kd,
 	     int control_port, int ntp_port,
 	     GError **error_r);
 
+/**
+ * Send a RECORD request.  Requires a session, i.e. the response to
+ * SETUP must have been read.
+ */
+bool
+rtspcl_send_record(struct rtspcl_data *rtspcld,
+		   int seq_num, int rtptime,
+		   GError **error_r);
+
 bool
 rtspcl_record(struct rtspcl_data *rtspcld,
 	      int seq_num, int rtptime,
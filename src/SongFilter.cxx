@@ -21,11 +21,14 @@
 #include "SongFilter.hxx"
 #include "song.h"
 #include "tag.h"
+#include "TagPool.hxx"
+#include "Directory.hxx"
 
 #include <glib.h>
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define LOCATE_TAG_FILE_KEY     "file"
 #define LOCATE_TAG_FILE_KEY_OLD "filename"
@@ -57,6 +60,14 @@ SongFilter::Item::~Item()
 	g_free(value);
 }
 
+bool
+SongFilter::Item::IsExactTag() const
+{
+	/* an empty value also matches songs which don't have this
+	   tag at all */
+	return tag < TAG_NUM_OF_ITEM_TYPES && !fold_case && *value != 0;
+}
+
 bool
 SongFilter::Item::StringMatch(const char *s) const
 {
@@ -76,8 +87,14 @@ SongFilter::Item::StringMatch(const char *s) const
 bool
 SongFilter::Item::Match(const tag_item &item) const
 {
-	return (tag == LOCATE_TAG_ANY_TYPE || (unsigned)item.type == tag) &&
-		StringMatch(item.value);
+	if (tag != LOCATE_TAG_ANY_TYPE && (unsigned)item.type != tag)
+		return false;
+
+	if (fold_case)
+		/* the pool has folded the value already */
+		return strstr(tag_pool_get_folded(&item), value) != nullptr;
+
+	return strcmp(item.value, value) == 0;
 }
 
 bool
@@ -106,13 +123,85 @@ SongFilter::Item::Match(const struct tag &_tag) const
 	return false;
 }
 
+/**
+ * Appends a string to the buffer, optionally converting ASCII
+ * letters to lower case.
+ *
+ * @return false if the buffer is full, or if case folding was
+ * requested and the string contains non-ASCII characters
+ */
+static bool
+append_folded(char *&p, const char *end, const char *s, bool fold_case)
+{
+	for (; *s != 0; ++s) {
+		if (p == end)
+			return false;
+
+		char ch = *s;
+		if (fold_case) {
+			if ((unsigned char)ch >= 0x80)
+				return false;
+
+			ch = g_ascii_tolower(ch);
+		}
+
+		*p++ = ch;
+	}
+
+	return true;
+}
+
+/**
+ * Copies the URI of the song (see song_get_uri()) into the buffer,
+ * which avoids a heap allocation per song.
+ *
+ * @return the length of the URI, or 0 if the buffer is too small or
+ * the URI cannot be folded here
+ */
+static size_t
+copy_song_uri(const song &song, char *buffer, size_t size, bool fold_case)
+{
+	char *p = buffer;
+	const char *const end = buffer + size;
+
+	if (song_in_database(&song) && !song.parent->IsRoot() &&
+	    (!append_folded(p, end, song.parent->GetPath(), fold_case) ||
+	     !append_folded(p, end, "/", false)))
+		return 0;
+
+	if (!append_folded(p, end, song.uri, fold_case))
+		return 0;
+
+	return p - buffer;
+}
+
 bool
-SongFilter::Item::Match(const song &song) const
+SongFilter::Item::UriMatch(const song &song) const
 {
-	if (tag == LOCATE_TAG_FILE_TYPE || tag == LOCATE_TAG_ANY_TYPE) {
+	char buffer[1024];
+	const size_t length = copy_song_uri(song, buffer, sizeof(buffer),
+					    fold_case);
+	if (length == 0) {
+		/* too long or not ASCII: fall back to the generic
+		   (allocating) code */
 		char *uri = song_get_uri(&song);
 		const bool result = StringMatch(uri);
 		g_free(uri);
+		return result;
+	}
+
+	const size_t value_length = strlen(value);
+	return fold_case
+		? memmem(buffer, length, value, value_length) != nullptr
+		: length == value_length &&
+		memcmp(buffer, value, length) == 0;
+}
+
+bool
+SongFilter::Item::Match(const song &song) const
+{
+	if (tag == LOCATE_TAG_FILE_TYPE || tag == LOCATE_TAG_ANY_TYPE) {
+		const bool result = UriMatch(song);
 
 		if (result || tag == LOCATE_TAG_FILE_TYPE)
 			return result;
@@ -61,9 +61,28 @@ class SongFilter {
 			return tag;
 		}
 
+		const char *GetValue() const {
+			return value;
+		}
+
+		/**
+		 * Does this item match only songs which have a tag
+		 * item of this type with exactly this value?
+		 */
+		gcc_pure
+		bool IsExactTag() const;
+
 		gcc_pure gcc_nonnull(2)
 		bool StringMatch(const char *s) const;
 
+		/**
+		 * Matches the song's URI, like StringMatch() on the
+		 * return value of song_get_uri(), but usually without
+		 * allocating memory.
+		 */
+		gcc_pure
+		bool UriMatch(const song &song) const;
+
 		gcc_pure
 		bool Match(const tag_item &tag_item) const;
 
@@ -95,6 +114,19 @@ public:
 
 	gcc_pure
 	bool Match(const song &song) const;
+
+	/**
+	 * Invokes the function for each item which matches only songs
+	 * having a tag item of this type with exactly this value (see
+	 * Item::IsExactTag()).  Such items can be looked up in a
+	 * #TagIndex.
+	 */
+	template<typename F>
+	void ForEachExactTag(F f) const {
+		for (const auto &i : items)
+			if (i.IsExactTag())
+				f(i.GetTag(), i.GetValue());
+	}
 };
 
 /**
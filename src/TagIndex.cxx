@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+#include "TagIndex.hxx"
+#include "Directory.hxx"
+#include "SongFilter.hxx"
+#include "DatabaseLock.hxx"
+#include "DatabasePlugin.hxx"
+#include "song.h"
+
+#include <algorithm>
+
+#include <assert.h>
+
+TagIndex db_tag_index;
+
+void
+TagIndex::Clear()
+{
+	/* swap with an empty map to free the memory */
+	decltype(map)().swap(map);
+	for (auto &i : values)
+		i.clear();
+
+	ClearStats();
+	enabled = false;
+}
+
+void
+TagIndex::ClearStats()
+{
+	std::fill(missing, missing + TAG_NUM_OF_ITEM_TYPES, 0u);
+	song_count = 0;
+	total_duration = 0;
+}
+
+void
+TagIndex::CountSong(const song &song, bool add)
+{
+	if (add)
+		++song_count;
+	else {
+		assert(song_count > 0);
+		--song_count;
+	}
+
+	const struct tag *tag = song.tag;
+	if (tag == nullptr)
+		return;
+
+	if (tag->time > 0) {
+		if (add)
+			total_duration += tag->time;
+		else
+			total_duration -= tag->time;
+	}
+
+	bool present[TAG_NUM_OF_ITEM_TYPES];
+	std::fill(present, present + TAG_NUM_OF_ITEM_TYPES, false);
+	for (unsigned i = 0; i < tag->num_items; ++i)
+		present[tag->items[i]->type] = true;
+
+	for (unsigned i = 0; i < TAG_NUM_OF_ITEM_TYPES; ++i) {
+		if (present[i])
+			continue;
+
+		if (add)
+			++missing[i];
+		else {
+			assert(missing[i] > 0);
+			--missing[i];
+		}
+	}
+}
+
+void
+TagIndex::Collect(const Directory *directory)
+{
+	struct song *song;
+	directory_for_each_song(song, directory) {
+		CountSong(*song, true);
+
+		if (song->tag == nullptr)
+			continue;
+
+		for (unsigned i = 0; i < song->tag->num_items; ++i) {
+			const struct tag_item &item = *song->tag->items[i];
+			map[MakeKey(item.type, item.value)].push_back(song);
+		}
+	}
+
+	const Directory *child;
+	directory_for_each_child(child, directory)
+		Collect(child);
+}
+
+void
+TagIndex::Build(const Directory &root)
+{
+	assert(holding_db_lock());
+
+	Clear();
+	Collect(&root);
+
+	/* sorting once is much cheaper than inserting each song at
+	   its position; this also removes duplicate tag items */
+	for (auto &i : map) {
+		SongList &songs = i.second;
+		std::sort(songs.begin(), songs.end());
+		songs.erase(std::unique(songs.begin(), songs.end()),
+			    songs.end());
+		songs.shrink_to_fit();
+
+		const std::string &key = i.first;
+		values[(unsigned char)key[0]].insert(key.c_str() + 1);
+	}
+
+	enabled = true;
+}
+
+void
+TagIndex::Add(song &song)
+{
+	if (!enabled)
+		return;
+
+	assert(holding_db_lock());
+
+	CountSong(song, true);
+
+	if (song.tag == nullptr)
+		return;
+
+	for (unsigned i = 0; i < song.tag->num_items; ++i) {
+		const struct tag_item &item = *song.tag->items[i];
+		auto k = map.emplace(MakeKey(item.type, item.value),
+				     SongList());
+		if (k.second)
+			/* a new value */
+			values[item.type].insert(k.first->first.c_str() + 1);
+
+		SongList &songs = k.first->second;
+
+		auto j = std::lower_bound(songs.begin(), songs.end(), &song);
+		if (j == songs.end() || *j != &song)
+			songs.insert(j, &song);
+	}
+}
+
+void
+TagIndex::Remove(const song &song)
+{
+	if (!enabled)
+		return;
+
+	assert(holding_db_lock());
+
+	CountSong(song, false);
+
+	if (song.tag == nullptr)
+		return;
+
+	for (unsigned i = 0; i < song.tag->num_items; ++i) {
+		const struct tag_item &item = *song.tag->items[i];
+		auto k = map.find(MakeKey(item.type, item.value));
+		if (k == map.end())
+			/* a duplicate item which has already been
+			   removed */
+			continue;
+
+		SongList &songs = k->second;
+		auto j = std::lower_bound(songs.begin(), songs.end(),
+					  const_cast<struct song *>(&song));
+		if (j == songs.end() || *j != &song)
+			continue;
+
+		songs.erase(j);
+		if (songs.empty()) {
+			values[item.type].erase(k->first.c_str() + 1);
+			map.erase(k);
+		}
+	}
+}
+
+const TagIndex::SongList *
+TagIndex::Find(enum tag_type type, const char *value) const
+{
+	assert(enabled);
+
+	auto i = map.find(MakeKey(type, value));
+	return i != map.end()
+		? &i->second
+		: nullptr;
+}
+
+bool
+TagIndex::Lookup(const SongFilter &filter, const SongList *&songs_r) const
+{
+	bool found = false;
+	const SongList *best = nullptr;
+
+	filter.ForEachExactTag([&](unsigned tag, const char *value){
+			const SongList *songs = Find(tag_type(tag), value);
+			if (!found ||
+			    (best != nullptr &&
+			     (songs == nullptr || songs->size() < best->size())))
+				best = songs;
+			found = true;
+		});
+
+	songs_r = best;
+	return found;
+}
+
+bool
+TagIndex::VisitUniqueTags(enum tag_type type, VisitString visit_string,
+			  GError **error_r) const
+{
+	assert(enabled);
+	assert(type < TAG_NUM_OF_ITEM_TYPES);
+
+	const auto &set = values[type];
+
+	/* the empty string sorts first; report it only once */
+	if (missing[type] > 0 && (set.empty() || **set.begin() != 0) &&
+	    !visit_string("", error_r))
+		return false;
+
+	for (auto value : set)
+		if (!visit_string(value, error_r))
+			return false;
+
+	return true;
+}
+
+void
+TagIndex::GetStats(DatabaseStats &stats) const
+{
+	assert(enabled);
+
+	stats.song_count = song_count;
+	stats.total_duration = total_duration;
+	stats.artist_count = values[TAG_ARTIST].size();
+	stats.album_count = values[TAG_ALBUM].size();
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MPD_TAG_INDEX_HXX
+#define MPD_TAG_INDEX_HXX
+
+#include "DatabaseVisitor.hxx"
+#include "tag.h"
+#include "gcc.h"
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+
+struct song;
+struct Directory;
+struct DatabaseStats;
+class SongFilter;
+
+/**
+ * An inverted index of the song database: it maps each tag value to
+ * the songs which have it, so a search for an exact tag value does
+ * not need to walk the whole directory tree.
+ *
+ * The index is maintained by Directory::AddSong(),
+ * Directory::RemoveSong() and the #Directory destructor, and it is
+ * protected by the global #db_mutex.  Code which modifies the tag of
+ * a song which is in the database must remove it from the index
+ * before, and add it again afterwards.
+ *
+ * Besides, it keeps the sorted list of distinct values of each tag
+ * type and the global #DatabaseStats up to date, so "list" and
+ * "stats" on the whole database don't need to walk the tree either.
+ */
+class TagIndex {
+public:
+	/**
+	 * The songs with one tag value, sorted by their address.
+	 */
+	typedef std::vector<song *> SongList;
+
+private:
+	struct StringLess {
+		gcc_pure
+		bool operator()(const char *a, const char *b) const {
+			return strcmp(a, b) < 0;
+		}
+	};
+
+	/**
+	 * Maps the key returned by MakeKey() to the songs.
+	 */
+	std::unordered_map<std::string, SongList> map;
+
+	/**
+	 * The distinct values of each tag type, sorted.  The strings
+	 * are owned by the keys of #map.
+	 */
+	std::set<const char *, StringLess> values[TAG_NUM_OF_ITEM_TYPES];
+
+	/**
+	 * The number of songs of each tag type which have a tag, but
+	 * no item of this type.  They make VisitUniqueTags() report
+	 * an empty value.
+	 */
+	unsigned missing[TAG_NUM_OF_ITEM_TYPES];
+
+	unsigned song_count;
+
+	/**
+	 * The sum of all song durations [seconds].
+	 */
+	unsigned long total_duration;
+
+	/**
+	 * Is the index up to date?  While this is false, Add() and
+	 * Remove() do nothing, and the index must not be used.
+	 */
+	bool enabled;
+
+public:
+	TagIndex():enabled(false) {
+		ClearStats();
+	}
+
+	TagIndex(const TagIndex &other) = delete;
+	TagIndex &operator=(const TagIndex &other) = delete;
+
+	bool IsEnabled() const {
+		return enabled;
+	}
+
+	/**
+	 * Discards the index and disables it until Build() is
+	 * called.  This is a shortcut for freeing or loading a whole
+	 * database.
+	 */
+	void Clear();
+
+	/**
+	 * Indexes all songs in the directory tree, and enables the
+	 * index.
+	 */
+	void Build(const Directory &root);
+
+	/**
+	 * Adds all tag items of the song to the index.
+	 */
+	void Add(song &song);
+
+	/**
+	 * Removes all tag items of the song from the index.  The song
+	 * must have the same tag as when it was added.
+	 */
+	void Remove(const song &song);
+
+	/**
+	 * Returns all songs which have a tag item with exactly this
+	 * value, or nullptr if there are none.
+	 */
+	gcc_pure
+	const SongList *Find(enum tag_type type, const char *value) const;
+
+	/**
+	 * Determines a superset of the songs matched by the filter,
+	 * by looking up the most selective item which requires an
+	 * exact tag value.
+	 *
+	 * @param songs_r the songs are returned here (nullptr if no
+	 * song can match)
+	 * @return false if the filter has no such item, i.e. the
+	 * index cannot be used
+	 */
+	bool Lookup(const SongFilter &filter,
+		    const SongList *&songs_r) const;
+
+	/**
+	 * Invokes the function for each distinct value of the tag
+	 * type, in sorted order; an empty string stands for songs
+	 * which don't have this tag type.  This is equivalent to
+	 * VisitUniqueTags() on the whole database.
+	 */
+	bool VisitUniqueTags(enum tag_type type, VisitString visit_string,
+			     GError **error_r) const;
+
+	/**
+	 * Returns the statistics of all indexed songs.  This is
+	 * equivalent to GetStats() on the whole database.
+	 */
+	void GetStats(DatabaseStats &stats) const;
+
+private:
+	gcc_pure
+	static std::string MakeKey(enum tag_type type, const char *value) {
+		std::string key(1, char(type));
+		key.append(value);
+		return key;
+	}
+
+	void ClearStats();
+
+	/**
+	 * Adds the song to (or subtracts it from) the statistics.
+	 */
+	void CountSong(const song &song, bool add);
+
+	void Collect(const Directory *directory);
+};
+
+/**
+ * The index of the songs below the root directory of the
+ * #SimpleDatabase.  Protected by #db_mutex.
+ */
+extern TagIndex db_tag_index;
+
+#endif
@@ -23,6 +23,7 @@
 #include <glib.h>
 
 #include <assert.h>
+#include <string.h>
 
 Mutex tag_pool_lock;
 
@@ -30,6 +31,15 @@ Mutex tag_pool_lock;
 
 struct slot {
 	struct slot *next;
+
+	/**
+	 * The case-folded value (see g_utf8_casefold()), stored in the
+	 * same allocation after #item, or nullptr if it is equal to
+	 * the value.  It is used by case-insensitive searches, which
+	 * would otherwise fold each value again for each song.
+	 */
+	const char *folded;
+
 	unsigned char ref;
 	struct tag_item item;
 } mpd_packed;
@@ -68,19 +78,70 @@ tag_item_to_slot(struct tag_item *item)
 	return (struct slot*)(((char*)item) - offsetof(struct slot, item));
 }
 
+/**
+ * Folds the case of a value, like g_utf8_casefold(), but with a
+ * cheaper path for plain ASCII.
+ *
+ * @return a newly allocated string, or nullptr if the folded value
+ * is equal to the value
+ */
+static char *
+casefold_n(const char *value, size_t length)
+{
+	bool upper = false;
+	for (size_t i = 0; i < length; ++i) {
+		if ((unsigned char)value[i] >= 0x80) {
+			char *folded = g_utf8_casefold(value, length);
+			if (strlen(folded) == length &&
+			    memcmp(folded, value, length) == 0) {
+				g_free(folded);
+				return nullptr;
+			}
+
+			return folded;
+		}
+
+		if (g_ascii_isupper(value[i]))
+			upper = true;
+	}
+
+	if (!upper)
+		return nullptr;
+
+	char *folded = g_strndup(value, length);
+	for (size_t i = 0; i < length; ++i)
+		folded[i] = g_ascii_tolower(folded[i]);
+	return folded;
+}
+
 static struct slot *slot_alloc(struct slot *next,
 			       enum tag_type type,
 			       const char *value, int length)
 {
 	struct slot *slot;
 
+	char *folded = casefold_n(value, length);
+	const size_t folded_size = folded != nullptr
+		? strlen(folded) + 1
+		: 0;
+
 	slot = (struct slot *)
-		g_malloc(sizeof(*slot) - sizeof(slot->item.value) + length + 1);
+		g_malloc(sizeof(*slot) - sizeof(slot->item.value) + length + 1
+			 + folded_size);
 	slot->next = next;
 	slot->ref = 1;
 	slot->item.type = type;
 	memcpy(slot->item.value, value, length);
 	slot->item.value[length] = 0;
+
+	if (folded != nullptr) {
+		char *p = slot->item.value + length + 1;
+		memcpy(p, folded, folded_size);
+		slot->folded = p;
+		g_free(folded);
+	} else
+		slot->folded = nullptr;
+
 	return slot;
 }
 
@@ -106,6 +167,15 @@ tag_pool_get_item(enum tag_type type, const char *value, size_t length)
 	return &slot->item;
 }
 
+const char *
+tag_pool_get_folded(const struct tag_item *item)
+{
+	const struct slot *slot =
+		tag_item_to_slot(const_cast<struct tag_item *>(item));
+
+	return slot->folded != nullptr ? slot->folded : item->value;
+}
+
 struct tag_item *tag_pool_dup_item(struct tag_item *item)
 {
 	struct slot *slot = tag_item_to_slot(item);
@@ -22,6 +22,7 @@
 
 #include "tag.h"
 #include "thread/Mutex.hxx"
+#include "gcc.h"
 
 extern Mutex tag_pool_lock;
 
@@ -30,6 +31,15 @@ struct tag_item;
 struct tag_item *
 tag_pool_get_item(enum tag_type type, const char *value, size_t length);
 
+/**
+ * Returns the case-folded value of a pooled item (see
+ * g_utf8_casefold()).  The string is owned by the pool and lives as
+ * long as the item.  No lock is needed, because it is immutable.
+ */
+gcc_pure
+const char *
+tag_pool_get_folded(const struct tag_item *item);
+
 struct tag_item *tag_pool_dup_item(struct tag_item *item);
 
 void tag_pool_put_item(struct tag_item *item);
@@ -29,12 +29,15 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 
 #ifdef WIN32
 #include <ws2tcpip.h>
 #include <winsock.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #endif
 
@@ -48,6 +51,20 @@ struct udp_server {
 	const struct udp_server_handler *handler;
 	void *handler_ctx;
 
+	/**
+	 * Held while the handler runs.  udp_server_free() obtains it
+	 * to wait for a handler which is running in the main thread.
+	 */
+	GMutex *mutex;
+
+	/**
+	 * Set by udp_server_free().  The main loop may still dispatch
+	 * the source once after it has been destroyed; the handler
+	 * is not invoked then, because its context may be gone.
+	 * Protected by #mutex.
+	 */
+	bool closed;
+
 	int fd;
 	GIOChannel *channel;
 	GSource *source;
@@ -55,6 +72,45 @@ struct udp_server {
 	char buffer[8192];
 };
 
+/**
+ * Determine the current time, as a fallback if there is no kernel
+ * time stamp.
+ */
+static void
+udp_current_time(struct timespec *ts)
+{
+#ifdef WIN32
+	GTimeVal now;
+	g_get_current_time(&now);
+	ts->tv_sec = now.tv_sec;
+	ts->tv_nsec = now.tv_usec * 1000;
+#else
+	clock_gettime(CLOCK_REALTIME, ts);
+#endif
+}
+
+#ifdef SO_TIMESTAMPNS
+
+/**
+ * Extract the SO_TIMESTAMPNS time stamp from the control messages.
+ */
+static bool
+udp_get_timestamp(struct msghdr *msg, struct timespec *ts)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#endif
+
 static gboolean
 udp_in_event(G_GNUC_UNUSED GIOChannel *source,
 	     G_GNUC_UNUSED GIOCondition condition,
@@ -62,10 +118,45 @@ udp_in_event(G_GNUC_UNUSED GIOChannel *source,
 {
 	struct udp_server *udp = (struct udp_server*)data;
 
+	g_mutex_lock(udp->mutex);
+	if (udp->closed) {
+		g_mutex_unlock(udp->mutex);
+		return false;
+	}
+
 	struct sockaddr_storage address_storage;
 	struct sockaddr *address = (struct sockaddr *)&address_storage;
 	socklen_t address_length = sizeof(address_storage);
 
+	struct timespec timestamp;
+
+#ifdef SO_TIMESTAMPNS
+	struct iovec iov;
+	iov.iov_base = udp->buffer;
+	iov.iov_len = sizeof(udp->buffer);
+
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = address;
+	msg.msg_namelen = address_length;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t nbytes = recvmsg(udp->fd, &msg, MSG_DONTWAIT);
+	if (nbytes <= 0) {
+		g_mutex_unlock(udp->mutex);
+		return true;
+	}
+
+	address_length = msg.msg_namelen;
+
+	if (!udp_get_timestamp(&msg, &timestamp))
+		udp_current_time(&timestamp);
+#else
 	ssize_t nbytes = recvfrom(udp->fd, udp->buffer, sizeof(udp->buffer),
 #ifdef WIN32
 				  0,
@@ -73,14 +164,36 @@ udp_in_event(G_GNUC_UNUSED GIOChannel *source,
 				  MSG_DONTWAIT,
 #endif
 				  address, &address_length);
-	if (nbytes <= 0)
+	if (nbytes <= 0) {
+		g_mutex_unlock(udp->mutex);
 		return true;
+	}
+
+	udp_current_time(&timestamp);
+#endif
 
 	udp->handler->datagram(udp->fd, udp->buffer, nbytes,
-			       address, address_length, udp->handler_ctx);
+			       address, address_length, &timestamp,
+			       udp->handler_ctx);
+	g_mutex_unlock(udp->mutex);
 	return true;
 }
 
+/**
+ * Frees the #udp_server object after the main loop has released the
+ * source, i.e. when udp_in_event() cannot run anymore.
+ */
+static void
+udp_server_destroy(gpointer data)
+{
+	struct udp_server *udp = (struct udp_server *)data;
+
+	g_io_channel_unref(udp->channel);
+	close(udp->fd);
+	g_mutex_free(udp->mutex);
+	g_free(udp);
+}
+
 struct udp_server *
 udp_server_new(unsigned port,
 	       const struct udp_server_handler *handler, void *ctx,
@@ -110,9 +223,18 @@ udp_server_new(unsigned port,
 		return NULL;
 	}
 
+#ifdef SO_TIMESTAMPNS
+	/* let the kernel stamp each datagram on arrival; failure is
+	   not fatal, the handler then gets the current time */
+	const int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#endif
+
 	struct udp_server *udp = g_new(struct udp_server, 1);
 	udp->handler = handler;
 	udp->handler_ctx = ctx;
+	udp->mutex = g_mutex_new();
+	udp->closed = false;
 
 	udp->fd = fd;
 	udp->channel = g_io_channel_new_socket(fd);
@@ -123,7 +245,7 @@ udp_server_new(unsigned port,
 
 	udp->source = g_io_create_watch(udp->channel, G_IO_IN);
 	g_source_set_callback(udp->source, (GSourceFunc)udp_in_event, udp,
-			      NULL);
+			      udp_server_destroy);
 	g_source_attach(udp->source, main_loop->GetContext());
 
 	return udp;
@@ -132,9 +254,34 @@ udp_server_new(unsigned port,
 void
 udp_server_free(struct udp_server *udp)
 {
-	g_source_destroy(udp->source);
-	g_source_unref(udp->source);
-	g_io_channel_unref(udp->channel);
-	close(udp->fd);
-	g_free(udp);
+	/* wait for the handler if it is running right now, and
+	   don't let it run again */
+	g_mutex_lock(udp->mutex);
+	udp->closed = true;
+	g_mutex_unlock(udp->mutex);
+
+	/* the object itself is freed by udp_server_destroy() as
+	   soon as the main loop doesn't use it anymore */
+	GSource *source = udp->source;
+	g_source_destroy(source);
+	g_source_unref(source);
+}
+
+int
+udp_server_get_fd(const struct udp_server *udp)
+{
+	return udp->fd;
+}
+
+unsigned
+udp_server_get_port(const struct udp_server *udp)
+{
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof(address);
+
+	if (getsockname(udp->fd, (struct sockaddr *)&address,
+			&address_length) < 0)
+		return 0;
+
+	return ntohs(address.sin_port);
 }
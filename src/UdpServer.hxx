@@ -25,14 +25,21 @@
 #include <stddef.h>
 
 struct sockaddr;
+struct timespec;
 
 struct udp_server_handler {
 	/**
 	 * A datagram was received.
+	 *
+	 * @param timestamp the (CLOCK_REALTIME) time when the
+	 * datagram was received; this is the kernel's time stamp if
+	 * the platform supports SO_TIMESTAMPNS, and thus does not
+	 * include the latency of the event loop
 	 */
 	void (*datagram)(int fd, const void *data, size_t length,
 			 const struct sockaddr *source_address,
-			 size_t source_address_length, void *ctx);
+			 size_t source_address_length,
+			 const struct timespec *timestamp, void *ctx);
 };
 
 static inline GQuark
@@ -46,7 +53,31 @@ udp_server_new(unsigned port,
 	       const struct udp_server_handler *handler, void *ctx,
 	       GError **error_r);
 
+/**
+ * Stops the server.  This may be called from any thread: it waits
+ * until a handler which is running in the main thread has returned,
+ * and the handler is not invoked again, so its context may be freed
+ * right after this function returns.  It must not be called from
+ * within the handler.
+ */
 void
 udp_server_free(struct udp_server *udp);
 
+/**
+ * Returns the socket, which may be used to send datagrams from the
+ * server's port.
+ */
+G_GNUC_PURE
+int
+udp_server_get_fd(const struct udp_server *udp);
+
+/**
+ * Returns the local port number the server is bound to.  This is
+ * useful if 0 was passed to udp_server_new(), which lets the kernel
+ * pick a free port.
+ */
+G_GNUC_PURE
+unsigned
+udp_server_get_port(const struct udp_server *udp);
+
 #endif
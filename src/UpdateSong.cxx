@@ -25,6 +25,7 @@
 #include "UpdateContainer.hxx"
 #include "DatabaseLock.hxx"
 #include "Directory.hxx"
+#include "TagIndex.hxx"
 #include "song.h"
 #include "decoder_plugin.h"
 #include "DecoderList.hxx"
@@ -85,14 +86,28 @@ update_song_file2(Directory *directory,
 	} else if (st->st_mtime != song->mtime || walk_discard) {
 		g_message("updating %s/%s",
 			  directory->GetPath(), name);
-		if (!song_file_update(song)) {
+
+		/* the tag index refers to the old tag items */
+		db_lock();
+		db_tag_index.Remove(*song);
+		db_unlock();
+
+		const bool success = song_file_update(song);
+
+		db_lock();
+		/* add it again even if it is going to be deleted,
+		   because Directory::RemoveSong() will remove it from
+		   the index */
+		db_tag_index.Add(*song);
+
+		if (!success) {
 			g_debug("deleting unrecognized file %s/%s",
 				directory->GetPath(), name);
-			db_lock();
 			delete_song(directory, song);
-			db_unlock();
 		}
 
+		db_unlock();
+
 		modified = true;
 	}
 }
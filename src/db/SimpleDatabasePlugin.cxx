@@ -23,13 +23,17 @@
 #include "DatabaseHelpers.hxx"
 #include "Directory.hxx"
 #include "SongFilter.hxx"
+#include "song.h"
 #include "DatabaseSave.hxx"
 #include "DatabaseLock.hxx"
+#include "TagIndex.hxx"
 #include "db_error.h"
 #include "TextFile.hxx"
 #include "conf.h"
 #include "fs/FileSystem.hxx"
 
+#include <unordered_map>
+
 #include <sys/types.h>
 #include <errno.h>
 
@@ -166,9 +170,17 @@ SimpleDatabase::Load(GError **error_r)
 		return false;
 	}
 
+	/* indexing the songs one by one while loading would be
+	   slow; build the index when the whole tree is there */
+	db_tag_index.Clear();
+
 	if (!db_load_internal(file, root, error_r))
 		return false;
 
+	db_lock();
+	db_tag_index.Build(*root);
+	db_unlock();
+
 	struct stat st;
 	if (StatFile(path, st))
 		mtime = st.st_mtime;
@@ -197,6 +209,10 @@ SimpleDatabase::Open(GError **error_r)
 			return false;
 
 		root = Directory::NewRoot();
+
+		db_lock();
+		db_tag_index.Build(*root);
+		db_unlock();
 	}
 
 	return true;
@@ -208,6 +224,7 @@ SimpleDatabase::Close()
 	assert(root != NULL);
 	assert(borrowed_song_count == 0);
 
+	db_tag_index.Clear();
 	root->Free();
 }
 
@@ -252,6 +269,85 @@ SimpleDatabase::LookupDirectory(const char *uri) const
 	return root->LookupDirectory(uri);
 }
 
+/**
+ * The state of a search which has been narrowed down with the
+ * #TagIndex.
+ */
+struct IndexedVisit {
+	const SongFilter &filter;
+	const VisitSong &visit_song;
+
+	/**
+	 * Maps the directories which contain songs found in the
+	 * #TagIndex to the number of these songs, and all
+	 * directories between them and the selected directory to
+	 * zero.  Directories which are not in this map are skipped.
+	 */
+	std::unordered_map<const Directory *, unsigned> directories;
+
+	IndexedVisit(const SongFilter &_filter, const VisitSong &_visit_song)
+		:filter(_filter), visit_song(_visit_song) {}
+
+	void Add(const Directory &base, bool recursive,
+		 const TagIndex::SongList &list);
+
+	bool Walk(const Directory *directory, GError **error_r) const;
+};
+
+void
+IndexedVisit::Add(const Directory &base, bool recursive,
+		  const TagIndex::SongList &list)
+{
+	for (const song *song : list) {
+		const Directory *parent = song->parent;
+
+		if (!recursive) {
+			if (parent == &base)
+				++directories[parent];
+			continue;
+		}
+
+		/* is it below the base directory? */
+		const Directory *d = parent;
+		while (d != &base && d != nullptr && directories.count(d) == 0)
+			d = d->parent;
+
+		if (d == nullptr)
+			continue;
+
+		++directories[parent];
+
+		for (d = parent; d != &base; d = d->parent)
+			if (!directories.emplace(d->parent, 0).second)
+				break;
+	}
+}
+
+/**
+ * Visits the matching songs in the same order as Directory::Walk(),
+ * but only in the directories which contain songs found in the
+ * #TagIndex.  Most of the tree is skipped, and the filter is only
+ * applied to the songs of these directories.
+ */
+bool
+IndexedVisit::Walk(const Directory *directory, GError **error_r) const
+{
+	if (directories.find(directory)->second > 0) {
+		struct song *song;
+		directory_for_each_song(song, directory)
+			if (filter.Match(*song) &&
+			    !visit_song(*song, error_r))
+				return false;
+	}
+
+	const Directory *child;
+	directory_for_each_child(child, directory)
+		if (directories.count(child) > 0 && !Walk(child, error_r))
+			return false;
+
+	return true;
+}
+
 bool
 SimpleDatabase::Visit(const DatabaseSelection &selection,
 		      VisitDirectory visit_directory,
@@ -275,6 +371,22 @@ SimpleDatabase::Visit(const DatabaseSelection &selection,
 		return false;
 	}
 
+	const TagIndex::SongList *list;
+	if (visit_song && !visit_directory && !visit_playlist &&
+	    selection.filter != nullptr && db_tag_index.IsEnabled() &&
+	    db_tag_index.Lookup(*selection.filter, list)) {
+		/* the filter requires an exact tag value: visit only
+		   the songs which have it, instead of walking the
+		   whole tree */
+		if (list == nullptr)
+			return true;
+
+		IndexedVisit v(*selection.filter, visit_song);
+		v.Add(*directory, selection.recursive, *list);
+		return v.directories.empty() ||
+			v.Walk(directory, error_r);
+	}
+
 	if (selection.recursive && visit_directory &&
 	    !visit_directory(*directory, error_r))
 		return false;
@@ -290,6 +402,15 @@ SimpleDatabase::VisitUniqueTags(const DatabaseSelection &selection,
 				VisitString visit_string,
 				GError **error_r) const
 {
+	if (selection.IsEverything()) {
+		/* the index has the sorted list already */
+		ScopeDatabaseLock protect;
+		if (db_tag_index.IsEnabled())
+			return db_tag_index.VisitUniqueTags(tag_type,
+							    visit_string,
+							    error_r);
+	}
+
 	return ::VisitUniqueTags(*this, selection, tag_type, visit_string,
 				 error_r);
 }
@@ -298,6 +419,14 @@ bool
 SimpleDatabase::GetStats(const DatabaseSelection &selection,
 			 DatabaseStats &stats, GError **error_r) const
 {
+	if (selection.IsEverything()) {
+		ScopeDatabaseLock protect;
+		if (db_tag_index.IsEnabled()) {
+			db_tag_index.GetStats(stats);
+			return true;
+		}
+	}
+
 	return ::GetStats(*this, selection, stats, error_r);
 }
 
@@ -53,6 +53,10 @@ public:
 		children.emplace_back(name, filter);
 	}
 
+	unsigned GetSize() const {
+		return children.size();
+	}
+
 	virtual const audio_format *Open(audio_format &af, GError **error_r);
 	virtual void Close();
 	virtual const void *FilterPCM(const void *src, size_t src_size,
@@ -182,3 +186,11 @@ filter_chain_append(Filter &_chain, const char *name, Filter *filter)
 
 	chain.Append(name, filter);
 }
+
+unsigned
+filter_chain_size(const Filter &_chain)
+{
+	const ChainFilter &chain = (const ChainFilter &)_chain;
+
+	return chain.GetSize();
+}
@@ -27,6 +27,8 @@
 #ifndef MPD_FILTER_CHAIN_HXX
 #define MPD_FILTER_CHAIN_HXX
 
+#include "gcc.h"
+
 class Filter;
 
 /**
@@ -45,4 +47,13 @@ filter_chain_new(void);
 void
 filter_chain_append(Filter &chain, const char *name, Filter *filter);
 
+/**
+ * Returns the number of filters in the filter chain.
+ *
+ * @param chain the filter chain created with filter_chain_new()
+ */
+gcc_pure
+unsigned
+filter_chain_size(const Filter &chain);
+
 #endif
@@ -24,6 +24,8 @@
 #include "FilterRegistry.hxx"
 #include "conf.h"
 #include "pcm/PcmConvert.hxx"
+#include "pcm/PcmKernelTable.hxx"
+#include "pcm/pcm_buffer.h"
 #include "util/Manual.hxx"
 #include "audio_format.h"
 #include "poison.h"
@@ -47,6 +49,25 @@ class ConvertFilter final : public Filter {
 
 	Manual<PcmConvert> state;
 
+	/**
+	 * If only the sample format differs, this kernel performs the
+	 * whole conversion, bypassing #state.  It is looked up once
+	 * by Set().
+	 */
+	pcm_format_kernel format_kernel;
+
+	/**
+	 * If only the number of channels differs, and the output is
+	 * stereo, this kernel performs the whole conversion.
+	 */
+	pcm_downmix_kernel downmix_kernel;
+
+	/**
+	 * The destination buffer of #format_kernel and
+	 * #downmix_kernel.
+	 */
+	struct pcm_buffer buffer;
+
 public:
 	void Set(const audio_format &_out_audio_format) {
 		assert(audio_format_valid(&in_audio_format));
@@ -54,6 +75,29 @@ public:
 		assert(audio_format_valid(&_out_audio_format));
 
 		out_audio_format = _out_audio_format;
+
+		format_kernel = nullptr;
+		downmix_kernel = nullptr;
+
+		if (in_audio_format.sample_rate !=
+		    out_audio_format.sample_rate)
+			return;
+
+		const struct pcm_kernel_table &table = pcm_kernel_table_get();
+		const sample_format in_format =
+			sample_format(in_audio_format.format);
+		const sample_format out_format =
+			sample_format(out_audio_format.format);
+
+		if (in_audio_format.channels == out_audio_format.channels)
+			format_kernel = pcm_kernel_table_format(table,
+								in_format,
+								out_format);
+		else if (in_format == out_format &&
+			 in_audio_format.channels > 2 &&
+			 out_audio_format.channels == 2)
+			downmix_kernel = pcm_kernel_table_downmix(table,
+								  in_format);
 	}
 
 	virtual const audio_format *Open(audio_format &af, GError **error_r);
@@ -77,12 +121,17 @@ ConvertFilter::Open(audio_format &audio_format, gcc_unused GError **error_r)
 	in_audio_format = out_audio_format = audio_format;
 	state.Construct();
 
+	format_kernel = nullptr;
+	downmix_kernel = nullptr;
+	pcm_buffer_init(&buffer);
+
 	return &in_audio_format;
 }
 
 void
 ConvertFilter::Close()
 {
+	pcm_buffer_deinit(&buffer);
 	state.Destruct();
 
 	poison_undefined(&in_audio_format, sizeof(in_audio_format));
@@ -99,6 +148,30 @@ ConvertFilter::FilterPCM(const void *src, size_t src_size,
 		return src;
 	}
 
+	if (format_kernel != nullptr) {
+		const size_t n = src_size /
+			sample_format_size(sample_format(in_audio_format.format));
+		const size_t dest_size = n *
+			sample_format_size(sample_format(out_audio_format.format));
+
+		void *dest = pcm_buffer_get(&buffer, dest_size);
+		format_kernel(dest, src, n);
+		*dest_size_r = dest_size;
+		return dest;
+	}
+
+	if (downmix_kernel != nullptr) {
+		const size_t n = src_size /
+			audio_format_frame_size(&in_audio_format);
+		const size_t dest_size = n *
+			audio_format_frame_size(&out_audio_format);
+
+		void *dest = pcm_buffer_get(&buffer, dest_size);
+		downmix_kernel(dest, src, n, in_audio_format.channels);
+		*dest_size_r = dest_size;
+		return dest;
+	}
+
 	return state->Convert(&in_audio_format,
 			      src, src_size,
 			      &out_audio_format, dest_size_r,
@@ -20,7 +20,7 @@
 #include <glib.h>
 #include <unistd.h>
 #include <sys/time.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
@@ -33,25 +33,41 @@
 #include "fd_util.h"
 #include "NtpServer.hxx"
 #include "RtspClient.hxx"
+#include "UdpServer.hxx"
+#include "AlacEncoder.hxx"
+#include "RaopTimeline.hxx"
+#include "clock.h"
+#include "util/SpscQueue.hxx"
 #include "glib_compat.h"
 
+#include <atomic>
+
+#include <time.h>
+
 #ifndef WIN32
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "raop"
 
 struct play_state {
-	bool playing;
 	unsigned short seq_num;
-	unsigned int rtptime;
 	unsigned int sync_src;
-	unsigned int start_rtptime;
-	struct timeval start_time;
-	struct timeval last_send;
+
+	/**
+	 * Maps the RTP time stamps to the wall clock (sync packets)
+	 * and to the monotonic clock (packet deadlines).
+	 */
+	RaopTimeline timeline;
 };
 
 /*********************************************************************/
@@ -70,10 +86,22 @@ enum pause_state {
 /*********************************************************************/
 
 struct encrypt_data {
-	AES_KEY ctx;
+	/**
+	 * The AES-128-CBC context, initialized with #key.  EVP picks
+	 * the fastest implementation, e.g. AES-NI.
+	 */
+	EVP_CIPHER_CTX *ctx;
+
 	unsigned char iv[16]; // initialization vector for aes-cbc
-	unsigned char nv[16]; // next vector for aes-cbc
 	unsigned char key[16]; // key for aes-cbc
+
+	/**
+	 * #key encrypted with the receivers' RSA public key and #iv,
+	 * both base64 encoded without padding, as announced in the
+	 * SDP.  The key is shared by all outputs of the session, so
+	 * this is computed only once.
+	 */
+	char *rsa_key, *base64_iv;
 };
 
 /*********************************************************************/
@@ -87,13 +115,55 @@ struct RaopOutput {
 	struct sockaddr_in ctrl_addr;
 	struct sockaddr_in data_addr;
 
+	/**
+	 * The "sync_group" setting.  Outputs in the same group share
+	 * one #raop_session_data, and only the master encodes audio
+	 * for all of them.  NULL means this output has a session of
+	 * its own.
+	 */
+	const char *sync_group;
+
+	/**
+	 * The session this output is attached to while it is open.
+	 */
+	struct raop_session_data *session;
+
 	bool is_master;
 	RaopOutput *next;
 
 	unsigned volume;
 
+	/**
+	 * One of the ALAC_COMPRESSION_* constants, configured with
+	 * "alac_compression".
+	 */
+	unsigned alac_compression;
+
 	GMutex *control_mutex;
 
+	/**
+	 * True while the responses to the RTSP handshake started by
+	 * raop_output_open() have not been read yet.  Protected by
+	 * #control_mutex.
+	 */
+	bool handshake_pending;
+
+	/**
+	 * True when the handshake is complete and the receiver accepts
+	 * audio.  Protected by the session's list_mutex.
+	 */
+	bool ready;
+
+	/**
+	 * The number of audio packets which could not be sent to
+	 * this receiver since it was opened.
+	 */
+	unsigned send_errors;
+
+	/**
+	 * Has the first audio packet (with the marker bit) been sent
+	 * to this receiver?  Protected by the session's list_mutex.
+	 */
 	bool started;
 	bool paused;
 };
@@ -102,20 +172,87 @@ struct RaopOutput {
 
 struct control_data {
 	unsigned short port;
+
+	/**
+	 * Receives resend requests from the receivers.  Its socket
+	 * (#fd) is also used to send sync packets.
+	 */
+	struct udp_server *udp;
 	int fd;
 };
 
 /*********************************************************************/
 
-#define NUMSAMPLES 352
+#define NUMSAMPLES ALAC_FRAME_LENGTH
 #define RAOP_BUFFER_SIZE NUMSAMPLES * 4
 #define RAOP_HEADER_SIZE 12
-#define ALAC_MAX_HEADER_SIZE 8
-#define RAOP_MAX_PACKET_SIZE RAOP_BUFFER_SIZE + RAOP_HEADER_SIZE + ALAC_MAX_HEADER_SIZE
+#define RAOP_MAX_PACKET_SIZE RAOP_HEADER_SIZE + ALAC_MAX_FRAME_SIZE
+
+/**
+ * The number of sent packets which are kept for retransmission
+ * (about 4 seconds).  Must be a divisor of 65536, so the sequence
+ * number wraps around cleanly.
+ */
+#define RAOP_RETRANSMIT_PACKETS 512
+
+/**
+ * An encrypted audio packet, kept for answering resend requests.
+ */
+struct retransmit_packet {
+	unsigned short seq_num;
+
+	/**
+	 * The size of #data in bytes; 0 if this slot is unused.
+	 */
+	unsigned short size;
+
+	unsigned char data[RAOP_MAX_PACKET_SIZE];
+};
+
+/**
+ * The number of packets which may be waiting for the sender thread
+ * (about 250 ms).
+ */
+#define RAOP_SEND_QUEUE_SIZE 32
+
+/**
+ * An encrypted audio packet waiting for the sender thread.
+ */
+struct raop_send_packet {
+	/**
+	 * When to send this packet, in monotonic_clock_us() units.
+	 */
+	uint64_t deadline;
+
+	/**
+	 * The #raop_session_data::flush_generation this packet was
+	 * queued in.  The sender drops it if a flush has happened
+	 * since.
+	 */
+	unsigned generation;
+
+	unsigned short size;
+
+	unsigned char data[RAOP_MAX_PACKET_SIZE];
+};
 
 // session
 struct raop_session_data {
+	struct raop_session_data *next;
+
+	/**
+	 * The sync group this session was created for, or NULL if it
+	 * belongs to one output only.
+	 */
+	char *sync_group;
+
+	/**
+	 * The outputs attached to this session; the first one is the
+	 * master.  Protected by #list_mutex.
+	 */
 	RaopOutput *raop_list;
+	GMutex *list_mutex;
+
 	struct ntp_server ntp;
 	struct control_data ctrl;
 	struct encrypt_data encrypt;
@@ -123,22 +260,75 @@ struct raop_session_data {
 
 	int data_fd;
 
-	unsigned char buffer[RAOP_BUFFER_SIZE];
+	int16_t buffer[RAOP_BUFFER_SIZE / 2];
 	size_t bufferSize;
 
-	unsigned char data[RAOP_MAX_PACKET_SIZE];
-	int wblk_wsize;
-	int wblk_remsize;
-
 	GMutex *data_mutex;
+
+	/**
+	 * Packets prepared by raop_output_play(), waiting to be sent
+	 * by #sender_thread when their deadline is reached.
+	 */
+	SpscQueue<struct raop_send_packet, RAOP_SEND_QUEUE_SIZE> send_queue;
+
+	GThread *sender_thread;
+
+	/**
+	 * Used only to sleep when #send_queue is empty (sender) or
+	 * full (raop_output_play()); see raop_send_queue_wake().
+	 */
+	GMutex *sender_mutex;
+	GCond *sender_cond;
+
+	std::atomic_bool sender_waiting, producer_waiting;
+	std::atomic_bool sender_quit;
+
+	/**
+	 * Incremented by raop_output_cancel() to discard all queued
+	 * packets.
+	 */
+	std::atomic_uint flush_generation;
+
+	/**
+	 * Set by the sender thread when no receiver could be reached;
+	 * reported by the next raop_output_play() call.
+	 * #send_errno is the errno value which goes with it.
+	 */
+	std::atomic_bool send_failed;
+	int send_errno;
+
+	/**
+	 * How much later than its deadline (in microseconds) the
+	 * sender thread has sent the most recent packet.  Consumed by
+	 * the next sync point in raop_output_play().
+	 */
+	std::atomic_int send_lag;
+
+	/**
+	 * The most recently sent packets, indexed by their sequence
+	 * number modulo #RAOP_RETRANSMIT_PACKETS.  Protected by
+	 * #retransmit_mutex, which is never held for long, so
+	 * resend requests do not wait for raop_output_play().
+	 */
+	struct retransmit_packet *retransmit;
+	GMutex *retransmit_mutex;
 };
 
 /*********************************************************************/
 
-static GStaticMutex raop_session_mutex = G_STATIC_MUTEX_INIT;	// need a static mutex to guard construction of raop_session
-static struct raop_session_data *raop_session = NULL;
+/**
+ * Protects #raop_sessions.
+ */
+static GStaticMutex raop_session_mutex = G_STATIC_MUTEX_INIT;
+
+/**
+ * A linked list of all open sessions, searched by raop_output_open()
+ * for the output's sync group.
+ */
+static struct raop_session_data *raop_sessions = NULL;
 
 static int open_udp_socket(char *hostname, unsigned short *port, GError **error_r);
+static gpointer raop_sender_task(gpointer data);
 
 /**
  * The quark used for GError.domain.
@@ -155,54 +345,325 @@ raop_session_free(struct raop_session_data *session)
 	assert(session != NULL);
 	assert(session->raop_list == NULL);
 
+	if (session->sender_thread != NULL) {
+		g_mutex_lock(session->sender_mutex);
+		session->sender_quit = true;
+		g_cond_broadcast(session->sender_cond);
+		g_mutex_unlock(session->sender_mutex);
+
+		g_thread_join(session->sender_thread);
+	}
+
 	ntp_server_close(&session->ntp);
 
 	if (session->data_mutex != NULL)
 		g_mutex_free(session->data_mutex);
 
-	if (raop_session->data_fd >= 0)
-		close_socket(raop_session->data_fd);
+	g_mutex_free(session->list_mutex);
+	g_free(session->sync_group);
+
+	if (session->data_fd >= 0)
+		close_socket(session->data_fd);
+
+	if (session->ctrl.udp != NULL)
+		udp_server_free(session->ctrl.udp);
+
+	g_mutex_free(session->retransmit_mutex);
+	g_free(session->retransmit);
+
+	g_cond_free(session->sender_cond);
+	g_mutex_free(session->sender_mutex);
+
+	if (session->encrypt.ctx != NULL)
+		EVP_CIPHER_CTX_free(session->encrypt.ctx);
+	g_free(session->encrypt.rsa_key);
+	g_free(session->encrypt.base64_iv);
+
+	delete session;
+}
+
+/**
+ * Remember a packet which is being sent, for retransmission.  Called
+ * by the sender thread, so only packets which have really been
+ * queued and not been flushed can be resent.
+ */
+static void
+raop_retransmit_store(struct raop_session_data *session,
+		      const struct raop_send_packet *p)
+{
+	const unsigned char *const data = p->data;
+	const size_t size = p->size;
+	const unsigned short seq_num = (data[2] << 8) | data[3];
+
+	assert(size <= RAOP_MAX_PACKET_SIZE);
+
+	struct retransmit_packet *packet =
+		&session->retransmit[seq_num % RAOP_RETRANSMIT_PACKETS];
+
+	g_mutex_lock(session->retransmit_mutex);
+	packet->seq_num = seq_num;
+	packet->size = size;
+	memcpy(packet->data, data, size);
+	g_mutex_unlock(session->retransmit_mutex);
+}
+
+/**
+ * A datagram on the control port.  The only thing receivers send
+ * there are resend requests (payload type 0x55) for lost packets.
+ * Each packet which is still in the retransmit buffer is sent back
+ * with payload type 0x56, wrapped in a 4 byte header.
+ */
+static void
+raop_control_datagram(int fd, const void *_data, size_t length,
+		      const struct sockaddr *source_address,
+		      size_t source_address_length,
+		      G_GNUC_UNUSED const struct timespec *timestamp,
+		      void *ctx)
+{
+	struct raop_session_data *session = (struct raop_session_data *)ctx;
+	const unsigned char *data = (const unsigned char *)_data;
+
+	if (length < 8 || (data[1] & 0x7f) != 0x55)
+		return;
+
+	const unsigned short first = (data[4] << 8) | data[5];
+	unsigned count = (data[6] << 8) | data[7];
+	if (count > RAOP_RETRANSMIT_PACKETS)
+		count = RAOP_RETRANSMIT_PACKETS;
+
+	unsigned char buffer[4 + RAOP_MAX_PACKET_SIZE];
+	buffer[0] = 0x80;
+	buffer[1] = 0xd6;
+
+	for (unsigned i = 0; i < count; ++i) {
+		const unsigned short seq_num = first + i;
+		const struct retransmit_packet *packet =
+			&session->retransmit[seq_num % RAOP_RETRANSMIT_PACKETS];
+
+		g_mutex_lock(session->retransmit_mutex);
+		size_t size = packet->seq_num == seq_num ? packet->size : 0;
+		memcpy(buffer + 4, packet->data, size);
+		g_mutex_unlock(session->retransmit_mutex);
+
+		if (size == 0)
+			/* not sent yet, or already overwritten */
+			continue;
+
+		buffer[2] = seq_num >> 8;
+		buffer[3] = seq_num & 0xff;
+
+		sendto(fd, (const void *)buffer, 4 + size, 0,
+		       source_address, source_address_length);
+	}
+}
+
+static const struct udp_server_handler raop_control_handler = {
+	raop_control_datagram,
+};
+
+/*
+ * remove one character from a string
+ * return the number of deleted characters
+ */
+static int
+remove_char_from_string(char *str, char c)
+{
+	char *src, *dst;
+
+	/* skip all characters that don't need to be copied */
+	src = strchr(str, c);
+	if (!src)
+		return 0;
+
+	for (dst = src; *src; src++)
+		if (*src != c)
+			*(dst++) = *src;
+
+	*dst = '\0';
+
+	return src - dst;
+}
+
+/**
+ * Protects #raop_rsa and #raop_rsa_users.
+ */
+static GStaticMutex raop_rsa_mutex = G_STATIC_MUTEX_INIT;
+
+/**
+ * The receivers' public key, parsed on first use and freed by
+ * raop_output_finish() when the last output is gone.
+ */
+static RSA *raop_rsa;
+
+/**
+ * The number of outputs which have been initialized and not yet
+ * finished.
+ */
+static unsigned raop_rsa_users;
+
+static void
+raop_set_openssl_error(GError **error_r, const char *function)
+{
+	g_set_error(error_r, raop_output_quark(), 0,
+		    "%s error code=%ld", function, ERR_get_error());
+}
+
+static RSA *
+raop_rsa_parse(GError **error_r)
+{
+	static const char n[] =
+		"59dE8qLieItsH1WgjrcFRKj6eUWqi+bGLOX1HL3U3GhC/j0Qg90u3sG/1CUtwC"
+		"5vOYvfDmFI6oSFXi5ELabWJmT2dKHzBJKa3k9ok+8t9ucRqMd6DZHJ2YCCLlDR"
+		"KSKv6kDqnw4UwPdpOMXziC/AMj3Z/lUVX1G7WSHCAWKf1zNS1eLvqr+boEjXuB"
+		"OitnZ/bDzPHrTOZz0Dew0uowxf/+sG+NCK3eQJVxqcaJ/vEHKIVd2M+5qL71yJ"
+		"Q+87X6oV3eaYvt3zWZYD6z5vYTcrtij2VZ9Zmni/UAaHqn9JdsBWLUEpVviYnh"
+		"imNVvYFZeCXg/IdTQ+x4IRdiXNv5hEew==";
+	static const char e[] = "AQAB";
+
+	gsize usize;
+	unsigned char *modulus = g_base64_decode(n, &usize);
+	BIGNUM *bn_n = BN_bin2bn(modulus, usize, NULL);
+	g_free(modulus);
+
+	unsigned char *exponent = g_base64_decode(e, &usize);
+	BIGNUM *bn_e = BN_bin2bn(exponent, usize, NULL);
+	g_free(exponent);
+
+	if (bn_n == NULL || bn_e == NULL) {
+		raop_set_openssl_error(error_r, "BN_bin2bn");
+		BN_free(bn_n);
+		BN_free(bn_e);
+		return NULL;
+	}
 
-	if (raop_session->ctrl.fd >= 0)
-		close_socket(raop_session->ctrl.fd);
+	RSA *rsa = RSA_new();
+	if (rsa == NULL) {
+		raop_set_openssl_error(error_r, "RSA_new");
+		BN_free(bn_n);
+		BN_free(bn_e);
+		return NULL;
+	}
 
-	g_free(session);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (!RSA_set0_key(rsa, bn_n, bn_e, NULL)) {
+		raop_set_openssl_error(error_r, "RSA_set0_key");
+		RSA_free(rsa);
+		BN_free(bn_n);
+		BN_free(bn_e);
+		return NULL;
+	}
+#else
+	rsa->n = bn_n;
+	rsa->e = bn_e;
+#endif
+	return rsa;
+}
+
+/**
+ * Encrypt the AES key with the receivers' public key.
+ *
+ * @return the size of the cipher text in #res, or -1 on error
+ */
+static int
+rsa_encrypt(const unsigned char *text, int len, unsigned char *res,
+	    GError **error_r)
+{
+	g_static_mutex_lock(&raop_rsa_mutex);
+
+	if (raop_rsa == NULL)
+		raop_rsa = raop_rsa_parse(error_r);
+
+	int size = -1;
+	if (raop_rsa != NULL) {
+		size = RSA_public_encrypt(len, text, res, raop_rsa,
+					  RSA_PKCS1_OAEP_PADDING);
+		if (size < 0)
+			raop_set_openssl_error(error_r,
+					       "RSA_public_encrypt");
+	}
+
+	g_static_mutex_unlock(&raop_rsa_mutex);
+	return size;
 }
 
 static struct raop_session_data *
-raop_session_new(GError **error_r)
+raop_session_new(const char *sync_group, GError **error_r)
 {
-	struct raop_session_data *session = g_new(struct raop_session_data, 1);
+	struct raop_session_data *session = new raop_session_data();
+	session->next = NULL;
+	session->sync_group = g_strdup(sync_group);
 	session->raop_list = NULL;
+	session->list_mutex = g_mutex_new();
 
 	session->data_mutex = g_mutex_new();
 
+	/* each session has its own control and timing ports; the
+	   receivers learn them in the SETUP request */
 	ntp_server_init(&session->ntp);
-	session->ctrl.port = 6001;
+	session->ntp.port = 0;
+	session->ctrl.port = 0;
+	session->ctrl.udp = NULL;
 	session->ctrl.fd = -1;
-	session->play_state.playing = false;
 	session->play_state.seq_num = (short) g_random_int();
-	session->play_state.rtptime = g_random_int();
+	session->play_state.timeline.Reset(g_random_int());
 	session->play_state.sync_src = g_random_int();
-	session->play_state.last_send.tv_sec = 0;
-	session->play_state.last_send.tv_usec = 0;
 	session->data_fd = -1;
 
+	session->sender_thread = NULL;
+	session->sender_mutex = g_mutex_new();
+	session->sender_cond = g_cond_new();
+	session->sender_waiting = false;
+	session->producer_waiting = false;
+	session->sender_quit = false;
+	session->flush_generation = 0;
+	session->send_failed = false;
+	session->send_errno = 0;
+	session->send_lag = 0;
+
+	session->retransmit = g_new0(struct retransmit_packet,
+				     RAOP_RETRANSMIT_PACKETS);
+	session->retransmit_mutex = g_mutex_new();
+
+	session->encrypt.ctx = NULL;
+	session->encrypt.rsa_key = NULL;
+	session->encrypt.base64_iv = NULL;
+
 	if (!RAND_bytes(session->encrypt.iv, sizeof(session->encrypt.iv)) ||
 	    !RAND_bytes(session->encrypt.key, sizeof(session->encrypt.key))) {
+		raop_set_openssl_error(error_r, "RAND_bytes");
 		raop_session_free(session);
-		g_set_error(error_r, raop_output_quark(), 0,
-			    "RAND_bytes error code=%ld", ERR_get_error());
 		return NULL;
 	}
-	memcpy(session->encrypt.nv, session->encrypt.iv, sizeof(session->encrypt.nv));
-	for (unsigned i = 0; i < 16; i++) {
-		printf("0x%x ", session->encrypt.key[i]);
+
+	unsigned char rsakey[512];
+	int rsakey_size = rsa_encrypt(session->encrypt.key, 16, rsakey,
+				      error_r);
+	if (rsakey_size < 0) {
+		raop_session_free(session);
+		return NULL;
+	}
+
+	session->encrypt.rsa_key = g_base64_encode(rsakey, rsakey_size);
+	remove_char_from_string(session->encrypt.rsa_key, '=');
+	session->encrypt.base64_iv = g_base64_encode(session->encrypt.iv, 16);
+	remove_char_from_string(session->encrypt.base64_iv, '=');
+
+	session->encrypt.ctx = EVP_CIPHER_CTX_new();
+	if (session->encrypt.ctx == NULL) {
+		raop_set_openssl_error(error_r, "EVP_CIPHER_CTX_new");
+		raop_session_free(session);
+		return NULL;
 	}
-	printf("\n");
-	AES_set_encrypt_key(session->encrypt.key, 128, &session->encrypt.ctx);
 
-	memset(session->buffer, 0, RAOP_BUFFER_SIZE);
+	if (!EVP_EncryptInit_ex(session->encrypt.ctx, EVP_aes_128_cbc(), NULL,
+				session->encrypt.key, session->encrypt.iv) ||
+	    !EVP_CIPHER_CTX_set_padding(session->encrypt.ctx, 0)) {
+		raop_set_openssl_error(error_r, "EVP_EncryptInit_ex");
+		raop_session_free(session);
+		return NULL;
+	}
+
+	memset(session->buffer, 0, sizeof(session->buffer));
 	session->bufferSize = 0;
 
 	unsigned short myport = 0;
@@ -213,19 +674,36 @@ raop_session_new(GError **error_r)
 		return NULL;
 	}
 
-	session->ctrl.fd = open_udp_socket(NULL, &session->ctrl.port, error_r);
-	if (session->ctrl.fd < 0)
+	session->ctrl.udp = udp_server_new(session->ctrl.port,
+					   &raop_control_handler, session,
+					   error_r);
+	if (session->ctrl.udp == NULL)
 	{
 		raop_session_free(session);
 		return NULL;
 	}
 
+	session->ctrl.fd = udp_server_get_fd(session->ctrl.udp);
+	session->ctrl.port = udp_server_get_port(session->ctrl.udp);
+
 	if (!ntp_server_open(&session->ntp, error_r))
 	{
 		raop_session_free(session);
 		return NULL;
 	}
 
+#if GLIB_CHECK_VERSION(2,32,0)
+	session->sender_thread = g_thread_new("raop", raop_sender_task,
+					      session);
+#else
+	session->sender_thread = g_thread_create(raop_sender_task, session,
+						 true, error_r);
+	if (session->sender_thread == NULL) {
+		raop_session_free(session);
+		return NULL;
+	}
+#endif
+
 	return session;
 }
 
@@ -240,37 +718,18 @@ new_raop_data(const struct config_param *param, GError **error_r)
 
 	ret->control_mutex = g_mutex_new();
 
+	ret->session = NULL;
 	ret->next = NULL;
 	ret->is_master = 0;
+	ret->send_errors = 0;
+	ret->handshake_pending = false;
+	ret->ready = false;
 	ret->started = 0;
 	ret->paused = 0;
 
 	return ret;
 }
 
-/*
- * remove one character from a string
- * return the number of deleted characters
- */
-static int
-remove_char_from_string(char *str, char c)
-{
-	char *src, *dst;
-
-	/* skip all characters that don't need to be copied */
-	src = strchr(str, c);
-	if (!src)
-		return 0;
-
-	for (dst = src; *src; src++)
-		if (*src != c)
-			*(dst++) = *src;
-
-	*dst = '\0';
-
-	return src - dst;
-}
-
 /* bind an opened socket to specified hostname and port.
  * if hostname=NULL, use INADDR_ANY.
  * if *port=0, use dynamically assigned port
@@ -396,36 +855,29 @@ fill_int(unsigned char *buffer, uint32_t value)
 	memcpy(buffer, &be, sizeof(be));
 }
 
-/*
- * Store time in the NTP format in the buffer
+/**
+ * Returns the wall clock time in microseconds; this is the clock
+ * the receivers synchronize with our timing server.
  */
-static void
-fill_time_buffer_with_time(unsigned char *buffer, struct timeval *tout)
+static uint64_t
+raop_realtime_us(void)
 {
-	unsigned long secs_to_baseline = 964697997;
-	double fraction;
-	unsigned long long_fraction;
-	unsigned long secs;
-
-	fraction = ((double) tout->tv_usec) / 1000000.0;
-	long_fraction = (unsigned long) (fraction * 256.0 * 256.0 * 256.0 * 256.0);
-	secs = secs_to_baseline + tout->tv_sec;
-	fill_int(buffer, secs);
-	fill_int(buffer + 4, long_fraction);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
+/*
+ * Store a wall clock time (in microseconds) in the NTP format in the
+ * buffer
+ */
 static void
-get_time_for_rtp(struct play_state *state, struct timeval *tout)
+fill_time_buffer_with_time(unsigned char *buffer, uint64_t time)
 {
-	unsigned long rtp_diff = state->rtptime - state->start_rtptime;
-	unsigned long add_secs = rtp_diff / 44100;
-	unsigned long add_usecs = (((rtp_diff % 44100) * 10000) / 441) % 1000000;
-	tout->tv_sec = state->start_time.tv_sec + add_secs;
-	tout->tv_usec = state->start_time.tv_usec + add_usecs;
-	if (tout->tv_usec >= 1000000) {
-		tout->tv_sec++;
-		tout->tv_usec = tout->tv_usec % 1000000;
-	}
+	struct timespec ts;
+	ts.tv_sec = time / 1000000;
+	ts.tv_nsec = (time % 1000000) * 1000;
+	ntp_fill_time(buffer, &ts);
 }
 
 /*
@@ -433,13 +885,13 @@ get_time_for_rtp(struct play_state *state, struct timeval *tout)
  */
 static bool
 send_control_command(struct control_data *ctrl, RaopOutput *rd,
-		     struct play_state *state,
+		     const RaopTimeline *timeline,
 		     GError **error_r)
 {
 	unsigned char buf[20];
 	int diff;
 	int num_bytes;
-	struct timeval ctrl_time;
+	const uint32_t rtptime = timeline->GetRtpTime();
 
 	diff = 88200;
 	if (rd->started) {
@@ -447,16 +899,14 @@ send_control_command(struct control_data *ctrl, RaopOutput *rd,
 		diff += NUMSAMPLES;
 	} else {
 		buf[0] = 0x90;
-		state->playing = true;
-		state->start_rtptime = state->rtptime;
 	}
 	buf[1] = 0xd4;
 	buf[2] = 0x00;
 	buf[3] = 0x07;
-	fill_int(buf + 4, state->rtptime - diff);
-	get_time_for_rtp(state, &ctrl_time);
-	fill_time_buffer_with_time(buf + 8, &ctrl_time);
-	fill_int(buf + 16, state->rtptime);
+	fill_int(buf + 4, rtptime - diff);
+	fill_time_buffer_with_time(buf + 8,
+				   timeline->GetRealtime(timeline->GetPosition()));
+	fill_int(buf + 16, rtptime);
 
 	num_bytes = sendto(ctrl->fd, (const void *)buf, sizeof(buf), 0,
 			   (struct sockaddr *)&rd->ctrl_addr,
@@ -471,147 +921,39 @@ send_control_command(struct control_data *ctrl, RaopOutput *rd,
 	return true;
 }
 
-static int rsa_encrypt(const unsigned char *text, int len, unsigned char *res)
-{
-	RSA *rsa;
-	gsize usize;
-	unsigned char *modulus;
-	unsigned char *exponent;
-	int size;
-
-	char n[] =
-		"59dE8qLieItsH1WgjrcFRKj6eUWqi+bGLOX1HL3U3GhC/j0Qg90u3sG/1CUtwC"
-		"5vOYvfDmFI6oSFXi5ELabWJmT2dKHzBJKa3k9ok+8t9ucRqMd6DZHJ2YCCLlDR"
-		"KSKv6kDqnw4UwPdpOMXziC/AMj3Z/lUVX1G7WSHCAWKf1zNS1eLvqr+boEjXuB"
-		"OitnZ/bDzPHrTOZz0Dew0uowxf/+sG+NCK3eQJVxqcaJ/vEHKIVd2M+5qL71yJ"
-		"Q+87X6oV3eaYvt3zWZYD6z5vYTcrtij2VZ9Zmni/UAaHqn9JdsBWLUEpVviYnh"
-		"imNVvYFZeCXg/IdTQ+x4IRdiXNv5hEew==";
-	char e[] = "AQAB";
-
-	rsa = RSA_new();
-
-	modulus = g_base64_decode(n, &usize);
-	rsa->n = BN_bin2bn(modulus, usize, NULL);
-	exponent = g_base64_decode(e, &usize);
-	rsa->e = BN_bin2bn(exponent, usize, NULL);
-	g_free(modulus);
-	g_free(exponent);
-	size = RSA_public_encrypt(len, text, res, rsa, RSA_PKCS1_OAEP_PADDING);
-
-	RSA_free(rsa);
-	return size;
-}
-
-static int
-raop_encrypt(struct encrypt_data *encryp, unsigned char *data, int size)
+static bool
+raop_encrypt(struct encrypt_data *encryp, unsigned char *data, int size,
+	     GError **error_r)
 {
 	// any bytes that fall beyond the last 16 byte page should be sent
 	// in the clear
 	int alt_size = size - (size % 16);
+	int out_size;
 
-	memcpy(encryp->nv, encryp->iv, 16);
-
-	AES_cbc_encrypt(data, data, alt_size, &encryp->ctx, encryp->nv, 1);
-
-	return size;
-}
-
-/* write bits filed data, *bpos=0 for msb, *bpos=7 for lsb
-   d=data, blen=length of bits field
-*/
-static inline void
-bits_write(unsigned char **p, unsigned char d, int blen, int *bpos)
-{
-	int lb, rb, bd;
-	lb =7 - *bpos;
-	rb = lb - blen + 1;
-	if (rb >= 0) {
-		bd = d << rb;
-		if (*bpos)
-			**p |= bd;
-		else
-			**p = bd;
-		*bpos += blen;
-	} else {
-		bd = d >> -rb;
-		**p |= bd;
-		*p += 1;
-		**p = d << (8 + rb);
-		*bpos = -rb;
-	}
-}
-
-static bool
-wrap_pcm(unsigned char *buffer, int bsize, int *size, unsigned char *inData, int inSize)
-{
-	unsigned char one[4];
-	int count = 0;
-	int bpos = 0;
-	unsigned char *bp = buffer;
-	int i, nodata = 0;
-	bits_write(&bp, 1, 3, &bpos); // channel=1, stereo
-	bits_write(&bp, 0, 4, &bpos); // unknown
-	bits_write(&bp, 0, 8, &bpos); // unknown
-	bits_write(&bp, 0, 4, &bpos); // unknown
-	if (bsize != 4096 && false)
-		bits_write(&bp, 1, 1, &bpos); // hassize
-	else
-		bits_write(&bp, 0, 1, &bpos); // hassize
-	bits_write(&bp, 0, 2, &bpos); // unused
-	bits_write(&bp, 1, 1, &bpos); // is-not-compressed
-	if (bsize != 4096 && false) {
-		// size of data, integer, big endian
-		bits_write(&bp, (bsize >> 24) & 0xff, 8, &bpos);
-		bits_write(&bp, (bsize >> 16) & 0xff, 8, &bpos);
-		bits_write(&bp, (bsize >> 8) & 0xff, 8, &bpos);
-		bits_write(&bp, bsize&0xff, 8, &bpos);
+	/* each packet is encrypted with the same IV; re-initializing
+	   keeps the key schedule */
+	if (!EVP_EncryptInit_ex(encryp->ctx, NULL, NULL, NULL, encryp->iv) ||
+	    !EVP_EncryptUpdate(encryp->ctx, data, &out_size, data, alt_size)) {
+		raop_set_openssl_error(error_r, "EVP_EncryptUpdate");
+		return false;
 	}
-	while (1) {
-		if (inSize <= count * 4) nodata = 1;
-		if (nodata) break;
-		one[0] = inData[count * 4];
-		one[1] = inData[count * 4 + 1];
-		one[2] = inData[count * 4 + 2];
-		one[3] = inData[count * 4 + 3];
-
-#if BYTE_ORDER == BIG_ENDIAN
-		bits_write(&bp, one[0], 8, &bpos);
-		bits_write(&bp, one[1], 8, &bpos);
-		bits_write(&bp, one[2], 8, &bpos);
-		bits_write(&bp, one[3], 8, &bpos);
-#else
-		bits_write(&bp, one[1], 8, &bpos);
-		bits_write(&bp, one[0], 8, &bpos);
-		bits_write(&bp, one[3], 8, &bpos);
-		bits_write(&bp, one[2], 8, &bpos);
-#endif
 
-		if (++count == bsize) break;
-	}
-	if (!count) return false; // when no data at all, it should stop playing
-	/* when readable size is less than bsize, fill 0 at the bottom */
-	for(i = 0; i < (bsize - count) * 4; i++) {
-		bits_write(&bp, 0, 8, &bpos);
-	}
-	*size = (int)(bp - buffer);
-	if (bpos) *size += 1;
 	return true;
 }
 
 static bool
 raopcl_connect(RaopOutput *rd, GError **error_r)
 {
+	struct raop_session_data *const session = rd->session;
 	unsigned char buf[4 + 8 + 16];
 	char sid[16];
 	char sci[24];
 	char act_r[17];
-	char *sac=NULL, *key = NULL, *iv = NULL;
+	char *sac=NULL;
 	char sdp[1024];
 	int rval = false;
-	unsigned char rsakey[512];
 	struct timeval current_time;
 	unsigned int sessionNum;
-	int i;
 
 
 	gettimeofday(&current_time,NULL);
@@ -630,11 +972,6 @@ raopcl_connect(RaopOutput *rd, GError **error_r)
 	if (!rtspcl_connect(rd->rtspcl, rd->addr, rd->rtsp_port, sid, error_r))
 		goto erexit;
 
-	i = rsa_encrypt(raop_session->encrypt.key, 16, rsakey);
-	key = g_base64_encode(rsakey, i);
-	remove_char_from_string(key, '=');
-	iv = g_base64_encode(raop_session->encrypt.iv, 16);
-	remove_char_from_string(iv, '=');
 	sprintf(sdp,
 		"v=0\r\n"
 		"o=iTunes %s 0 IN IP4 %s\r\n"
@@ -643,100 +980,435 @@ raopcl_connect(RaopOutput *rd, GError **error_r)
 		"t=0 0\r\n"
 		"m=audio 0 RTP/AVP 96\r\n"
 		"a=rtpmap:96 AppleLossless\r\n"
-		"a=fmtp:96 %d  0 16 40 10 14 2 255 0 0 44100\r\n"
+		"a=fmtp:96 %u 0 16 %u %u %u 2 255 0 0 44100\r\n"
 		"a=rsaaeskey:%s\r\n"
 		"a=aesiv:%s\r\n",
-		sid, rtspcl_local_ip(rd->rtspcl), rd->addr, NUMSAMPLES, key, iv);
+		sid, rtspcl_local_ip(rd->rtspcl), rd->addr, NUMSAMPLES,
+		ALAC_RICE_HISTORY_MULT, ALAC_RICE_INITIAL_HISTORY,
+		ALAC_RICE_LIMIT, session->encrypt.rsa_key,
+		session->encrypt.base64_iv);
 	remove_char_from_string(sac, '=');
 	// rtspcl_add_exthds(rd->rtspcl, "Apple-Challenge", sac);
-	if (!rtspcl_announce_sdp(rd->rtspcl, sdp, error_r))
+	if (!rtspcl_send_announce_sdp(rd->rtspcl, sdp, error_r))
 		goto erexit;
 	//	if (!rtspcl_mark_del_exthds(rd->rtspcl, "Apple-Challenge")) goto erexit;
-	if (!rtspcl_setup(rd->rtspcl, NULL,
-			  raop_session->ctrl.port, raop_session->ntp.port,
-			  error_r))
+	if (!rtspcl_send_setup(rd->rtspcl,
+			       session->ctrl.port, session->ntp.port,
+			       error_r))
 		goto erexit;
 
+	rd->handshake_pending = true;
+	rval = true;
+
+ erexit:
+	g_free(sac);
+	return rval;
+}
+
+#define RAOP_VOLUME_MIN -30
+#define RAOP_VOLUME_MAX 0
+
+/**
+ * Format the SET_PARAMETER body for a MPD volume (0..100).
+ */
+static void
+raop_volume_parameter(char *buffer, unsigned volume)
+{
+	int raop_volume;
+
+	if (volume == 0) {
+		raop_volume = -144;
+	} else {
+		raop_volume = RAOP_VOLUME_MIN +
+			(RAOP_VOLUME_MAX - RAOP_VOLUME_MIN) * volume / 100;
+	}
+
+	sprintf(buffer, "volume: %d.000000\r\n", raop_volume);
+}
+
+/**
+ * Second half of the RTSP handshake: read the responses to ANNOUNCE
+ * and SETUP, then send RECORD and the initial volume in one go and
+ * wait for their responses.  Caller must lock the control_mutex.
+ */
+static bool
+raopcl_complete(RaopOutput *rd, GError **error_r)
+{
+	struct raop_session_data *const session = rd->session;
+
+	assert(rd->handshake_pending);
+
+	rd->handshake_pending = false;
+
+	if (!rtspcl_read_response(rd->rtspcl, NULL, error_r) ||
+	    !rtspcl_read_setup_response(rd->rtspcl, NULL, error_r))
+		return false;
+
 	if (!get_sockaddr_by_host(rd->addr, rd->rtspcl->control_port,
 				  &rd->ctrl_addr, error_r))
-		goto erexit;
+		return false;
 
 	if (!get_sockaddr_by_host(rd->addr, rd->rtspcl->server_port,
 				  &rd->data_addr, error_r))
-		goto erexit;
+		return false;
 
-	if (!rtspcl_record(rd->rtspcl,
-			   raop_session->play_state.seq_num,
-			   raop_session->play_state.rtptime,
-			   error_r))
-		goto erexit;
+	char vol_str[128];
+	raop_volume_parameter(vol_str, rd->volume);
+
+	if (!rtspcl_send_record(rd->rtspcl,
+				session->play_state.seq_num,
+				session->play_state.timeline.GetRtpTime(),
+				error_r) ||
+	    !rtspcl_send_set_parameter(rd->rtspcl, vol_str, error_r) ||
+	    !rtspcl_read_response(rd->rtspcl, NULL, error_r) ||
+	    !rtspcl_read_response(rd->rtspcl, NULL, error_r))
+		return false;
 
-	rval = true;
+	g_mutex_lock(session->list_mutex);
+	rd->ready = true;
+	g_mutex_unlock(session->list_mutex);
 
- erexit:
-	g_free(sac);
-	g_free(key);
-	g_free(iv);
-	return rval;
+	return true;
 }
 
-static int
-difference (struct timeval *t1, struct timeval *t2)
+/**
+ * Make sure the handshake is complete.  It is finished lazily by the
+ * output thread, so raop_output_open() does not wait for the
+ * receiver and all outputs negotiate concurrently.
+ */
+static bool
+raop_output_complete(RaopOutput *rd, GError **error_r)
+{
+	bool success = true;
+
+	g_mutex_lock(rd->control_mutex);
+	if (rd->handshake_pending)
+		success = raopcl_complete(rd, error_r);
+	g_mutex_unlock(rd->control_mutex);
+
+	return success;
+}
+
+/**
+ * Account for the result of sending one audio packet to a receiver.
+ *
+ * @return true if the packet was sent
+ */
+static bool
+raop_account_send(RaopOutput *rd, ssize_t nbytes, int error)
 {
-	int ret = 150000000;
-	if (t1->tv_sec - t2->tv_sec < 150) {
-		ret = (t1->tv_sec - t2->tv_sec) * 1000000;
-		ret += t1->tv_usec - t2->tv_usec;
+	if (nbytes > 0)
+		return true;
+
+	rd->base.pipeline_stats.send_errors.Increment();
+
+	if (rd->send_errors++ == 0)
+		g_warning("failed to send audio to %s: %s", rd->addr,
+			  nbytes < 0
+			  ? g_strerror(error)
+			  : "disconnected on the other end");
+
+	return false;
+}
+
+#ifdef HAVE_SENDMMSG
+
+/**
+ * The maximum number of receivers passed to one sendmmsg() call.
+ */
+#define RAOP_SEND_BATCH 32
+
+/**
+ * Send a packet to a batch of receivers with one system call.
+ *
+ * @param last_error_r the errno value of a failed sendmmsg() call
+ * is stored here
+ * @return the number of receivers which have received the packet
+ */
+static unsigned
+send_audio_batch(int fd, RaopOutput *const*receivers, const bool *first,
+		 unsigned n, unsigned char *header, unsigned char *first_header,
+		 unsigned char *payload, size_t payload_size,
+		 int *last_error_r)
+{
+	struct iovec iov[RAOP_SEND_BATCH][2];
+	struct mmsghdr msgs[RAOP_SEND_BATCH];
+
+	assert(n <= RAOP_SEND_BATCH);
+
+	for (unsigned i = 0; i < n; ++i) {
+		iov[i][0].iov_base = first[i] ? first_header : header;
+		iov[i][0].iov_len = RAOP_HEADER_SIZE;
+		iov[i][1].iov_base = payload;
+		iov[i][1].iov_len = payload_size;
+
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &receivers[i]->data_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(receivers[i]->data_addr);
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
 	}
-	return ret;
+
+	unsigned n_sent = 0;
+	for (unsigned i = 0; i < n;) {
+		int result = sendmmsg(fd, msgs + i, n - i, 0);
+		if (result <= 0) {
+			/* the first message failed; skip it and
+			   continue with the next one */
+			const int error = result < 0 ? errno : 0;
+			if (error != 0)
+				*last_error_r = error;
+			raop_account_send(receivers[i], result, error);
+			++i;
+			continue;
+		}
+
+		for (int j = 0; j < result; ++j, ++i)
+			if (raop_account_send(receivers[i], msgs[i].msg_len, 0))
+				++n_sent;
+	}
+
+	return n_sent;
 }
 
+#endif
+
 /*
  * With airtunes version 2, we don't get responses back when we send audio
  * data.  The only requests we get from the airtunes device are timing
  * requests.
+ *
+ * A failing receiver does not affect the others; it only increments
+ * its #send_errors counter.  This fails only if no receiver at all
+ * could be reached.
+ *
+ * Runs in the sender thread.
  */
 static bool
-send_audio_data(int fd, GError **error_r)
+send_audio_data(struct raop_session_data *session,
+		struct raop_send_packet *p, int *error_r)
 {
-	int i = 0;
-	struct timeval current_time, rtp_time;
-	RaopOutput *rd = raop_session->raop_list;
-
-	get_time_for_rtp(&raop_session->play_state, &rtp_time);
-	gettimeofday(&current_time, NULL);
-	int diff = difference(&rtp_time, &current_time);
-	if (diff > 0)
-		g_usleep(diff);
-
-	gettimeofday(&raop_session->play_state.last_send, NULL);
-	while (rd) {
+	unsigned char *const packet = p->data;
+	const size_t size = p->size;
+
+	unsigned n_receivers = 0, n_sent = 0;
+	int last_error = 0;
+
+	g_mutex_lock(session->list_mutex);
+
+#ifdef HAVE_SENDMMSG
+	/* the first packet sent to a receiver has the marker bit
+	   set */
+	unsigned char first_header[RAOP_HEADER_SIZE];
+	memcpy(first_header, packet, RAOP_HEADER_SIZE);
+	first_header[1] = 0xe0;
+	packet[1] = 0x60;
+
+	RaopOutput *batch[RAOP_SEND_BATCH];
+	bool first[RAOP_SEND_BATCH];
+	unsigned n_batch = 0;
+
+	for (RaopOutput *rd = session->raop_list; rd != NULL;
+	     rd = rd->next) {
+		if (!rd->ready)
+			continue;
+
+		first[n_batch] = !rd->started;
+		rd->started = true;
+		batch[n_batch++] = rd;
+		++n_receivers;
+
+		if (n_batch == RAOP_SEND_BATCH) {
+			n_sent += send_audio_batch(session->data_fd,
+						   batch, first, n_batch,
+						   packet, first_header,
+						   packet + RAOP_HEADER_SIZE,
+						   size - RAOP_HEADER_SIZE,
+						   &last_error);
+			n_batch = 0;
+		}
+	}
+
+	if (n_batch > 0)
+		n_sent += send_audio_batch(session->data_fd,
+					   batch, first, n_batch,
+					   packet, first_header,
+					   packet + RAOP_HEADER_SIZE,
+					   size - RAOP_HEADER_SIZE,
+					   &last_error);
+
+#else
+	for (RaopOutput *rd = session->raop_list; rd != NULL;
+	     rd = rd->next) {
+		if (!rd->ready)
+			continue;
+
 		if (rd->started) {
-			raop_session->data[1] = 0x60;
+			packet[1] = 0x60;
 		} else {
 			rd->started = true;
-			raop_session->data[1] = 0xe0;
+			packet[1] = 0xe0;
 		}
-		i = sendto(fd, (const void *)(raop_session->data + raop_session->wblk_wsize),
-			   raop_session->wblk_remsize, 0, (struct sockaddr *) &rd->data_addr,
-			   sizeof(rd->data_addr));
-		if (i < 0) {
-			g_set_error(error_r, raop_output_quark(), errno,
-				    "write error: %s",
-				    g_strerror(errno));
-			return false;
+
+		++n_receivers;
+
+		ssize_t nbytes = sendto(session->data_fd,
+					(const void *)packet, size, 0,
+					(struct sockaddr *) &rd->data_addr,
+					sizeof(rd->data_addr));
+		const int error = nbytes < 0 ? errno : 0;
+		if (error != 0)
+			last_error = error;
+
+		if (raop_account_send(rd, nbytes, error))
+			++n_sent;
+	}
+#endif
+
+	g_mutex_unlock(session->list_mutex);
+
+	if (n_receivers > 0 && n_sent == 0) {
+		*error_r = last_error;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Wake up the other side of #raop_session_data::send_queue if it is
+ * sleeping.
+ *
+ * @param waiting the "waiting" flag of the other side
+ */
+static void
+raop_send_queue_wake(struct raop_session_data *session,
+		     const std::atomic_bool &waiting)
+{
+	if (waiting) {
+		g_mutex_lock(session->sender_mutex);
+		g_cond_broadcast(session->sender_cond);
+		g_mutex_unlock(session->sender_mutex);
+	}
+}
+
+/**
+ * Obtain a free slot in the send queue, waiting for the sender
+ * thread if it is full.  This is what paces raop_output_play().
+ */
+static struct raop_send_packet *
+raop_send_queue_prepare(struct raop_session_data *session)
+{
+	struct raop_send_packet *packet = session->send_queue.Prepare();
+	if (packet != NULL)
+		return packet;
+
+	g_mutex_lock(session->sender_mutex);
+	session->producer_waiting = true;
+	while ((packet = session->send_queue.Prepare()) == NULL)
+		g_cond_wait(session->sender_cond, session->sender_mutex);
+	session->producer_waiting = false;
+	g_mutex_unlock(session->sender_mutex);
+
+	return packet;
+}
+
+/**
+ * Sleep until the specified monotonic_clock_us() value.
+ */
+static void
+raop_sleep_until(uint64_t deadline)
+{
+#ifdef HAVE_CLOCK_NANOSLEEP
+	/* an absolute deadline does not accumulate the error of
+	   previous wakeups */
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000;
+	ts.tv_nsec = (deadline % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       &ts, NULL) == EINTR) {}
+#else
+	uint64_t now = monotonic_clock_us();
+	if (deadline > now)
+		g_usleep(deadline - now);
+#endif
+}
+
+/**
+ * Attempt to give the sender thread real-time priority.  This
+ * usually requires CAP_SYS_NICE or RLIMIT_RTPRIO; failure is not
+ * fatal.
+ */
+static void
+raop_sender_set_realtime(void)
+{
+#ifdef __linux__
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+
+	int result = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+					   &param);
+	if (result != 0)
+		g_debug("failed to set real-time priority: %s",
+			g_strerror(result));
+#endif
+}
+
+/**
+ * The sender thread: sends each queued packet to all receivers when
+ * its deadline is reached.
+ */
+static gpointer
+raop_sender_task(gpointer data)
+{
+	struct raop_session_data *session =
+		(struct raop_session_data *)data;
+
+	raop_sender_set_realtime();
+
+	while (!session->sender_quit) {
+		struct raop_send_packet *packet = session->send_queue.Front();
+		if (packet == NULL) {
+			g_mutex_lock(session->sender_mutex);
+			session->sender_waiting = true;
+			while (session->send_queue.IsEmpty() &&
+			       !session->sender_quit)
+				g_cond_wait(session->sender_cond,
+					    session->sender_mutex);
+			session->sender_waiting = false;
+			g_mutex_unlock(session->sender_mutex);
+			continue;
 		}
-		if (i == 0) {
-			g_set_error_literal(error_r, raop_output_quark(), 0,
-					    "disconnected on the other end");
-			return false;
+
+		if (packet->generation == session->flush_generation) {
+			raop_sleep_until(packet->deadline);
+
+			const uint64_t now = monotonic_clock_us();
+			if (now > packet->deadline)
+				session->send_lag = now - packet->deadline;
+
+			/* check again, raop_output_cancel() may have
+			   been called while we were sleeping */
+			if (packet->generation == session->flush_generation) {
+				/* store it before send_audio_data()
+				   sets the marker bit */
+				raop_retransmit_store(session, packet);
+
+				int error;
+				if (!send_audio_data(session, packet, &error)) {
+					session->send_errno = error;
+					session->send_failed = true;
+				}
+			}
 		}
-		rd = rd->next;
+
+		session->send_queue.Pop();
+		raop_send_queue_wake(session, session->producer_waiting);
 	}
-	raop_session->wblk_wsize += i;
-	raop_session->wblk_remsize -= i;
 
-	return true;
+	return NULL;
 }
 
 static struct audio_output *
@@ -749,6 +1421,16 @@ raop_output_init(const struct config_param *param, GError **error_r)
 		return NULL;
 	}
 
+	unsigned alac_compression =
+		config_get_block_unsigned(param, "alac_compression",
+					  ALAC_COMPRESSION_FAST);
+	if (alac_compression > ALAC_COMPRESSION_BEST) {
+		g_set_error(error_r, raop_output_quark(), 0,
+			    "invalid \"alac_compression\" %u, must be 0..%u",
+			    alac_compression, ALAC_COMPRESSION_BEST);
+		return NULL;
+	}
+
 	RaopOutput *rd;
 
 	rd = new_raop_data(param, error_r);
@@ -758,36 +1440,34 @@ raop_output_init(const struct config_param *param, GError **error_r)
 	rd->addr = host;
 	rd->rtsp_port = config_get_block_unsigned(param, "port", 5000);
 	rd->volume = config_get_block_unsigned(param, "volume", 75);
-	return &rd->base;
-}
+	rd->alac_compression = alac_compression;
+	rd->sync_group = config_get_block_string(param, "sync_group", NULL);
 
-static bool
-raop_set_volume_local(RaopOutput *rd, int volume, GError **error_r)
-{
-	char vol_str[128];
-	sprintf(vol_str, "volume: %d.000000\r\n", volume);
-	return rtspcl_set_parameter(rd->rtspcl, vol_str, error_r);
-}
+	g_static_mutex_lock(&raop_rsa_mutex);
+	++raop_rsa_users;
+	g_static_mutex_unlock(&raop_rsa_mutex);
 
+	return &rd->base;
+}
 
 static void
 raop_output_finish(struct audio_output *ao)
 {
 	RaopOutput *rd = (RaopOutput *)ao;
 
+	g_static_mutex_lock(&raop_rsa_mutex);
+	assert(raop_rsa_users > 0);
+	if (--raop_rsa_users == 0 && raop_rsa != NULL) {
+		RSA_free(raop_rsa);
+		raop_rsa = NULL;
+	}
+	g_static_mutex_unlock(&raop_rsa_mutex);
+
 	g_mutex_free(rd->control_mutex);
 	ao_base_finish(&rd->base);
 	g_free(rd);
-
-	if (raop_session->raop_list == NULL) {
-		raop_session_free(raop_session);
-		raop_session = NULL;
-	}
 }
 
-#define RAOP_VOLUME_MIN -30
-#define RAOP_VOLUME_MAX 0
-
 int
 raop_output_get_volume(RaopOutput *raop)
 {
@@ -795,21 +1475,21 @@ raop_output_get_volume(RaopOutput *raop)
 }
 
 bool
-raop_set_volume(RaopOutput *rd, unsigned volume, GError **error_r)
+raop_output_set_volume(RaopOutput *rd, unsigned volume, GError **error_r)
 {
-	int raop_volume;
-	bool rval;
+	bool rval = true;
 
-	//set parameter volume
-	if (volume == 0) {
-		raop_volume = -144;
+	g_mutex_lock(rd->control_mutex);
+	if (rd->handshake_pending) {
+		/* raopcl_complete() will send it */
+		rd->volume = volume;
 	} else {
-		raop_volume = RAOP_VOLUME_MIN +
-			(RAOP_VOLUME_MAX - RAOP_VOLUME_MIN) * volume / 100;
+		char vol_str[128];
+		raop_volume_parameter(vol_str, volume);
+
+		rval = rtspcl_set_parameter(rd->rtspcl, vol_str, error_r);
+		if (rval) rd->volume = volume;
 	}
-	g_mutex_lock(rd->control_mutex);
-	rval = raop_set_volume_local(rd, raop_volume, error_r);
-	if (rval) rd->volume = volume;
 	g_mutex_unlock(rd->control_mutex);
 
 	return rval;
@@ -821,18 +1501,37 @@ raop_output_cancel(struct audio_output *ao)
 	//flush
 	struct key_data kd;
 	RaopOutput *rd = (RaopOutput *)ao;
+	struct raop_session_data *const session = rd->session;
 	int flush_diff = 1;
 
-	rd->started = 0;
+	g_mutex_lock(session->list_mutex);
+	rd->started = false;
+	g_mutex_unlock(session->list_mutex);
+
+	if (rd->is_master) {
+		/* discard the packets which have not been sent yet,
+		   and start a new timeline with the next packet */
+		g_mutex_lock(session->data_mutex);
+		++session->flush_generation;
+		session->play_state.timeline.Stop();
+		g_mutex_unlock(session->data_mutex);
+	}
+
 	if (rd->paused) {
 		return;
 	}
 
 	g_mutex_lock(rd->control_mutex);
+	if (rd->handshake_pending) {
+		/* nothing has been recorded yet */
+		g_mutex_unlock(rd->control_mutex);
+		return;
+	}
+
 	static char rtp_key[] = "RTP-Info";
 	kd.key = rtp_key;
 	char buf[128];
-	sprintf(buf, "seq=%d; rtptime=%d", raop_session->play_state.seq_num + flush_diff, raop_session->play_state.rtptime + NUMSAMPLES * flush_diff);
+	sprintf(buf, "seq=%d; rtptime=%d", session->play_state.seq_num + flush_diff, session->play_state.timeline.GetRtpTime() + NUMSAMPLES * flush_diff);
 	kd.data = buf;
 	kd.next = NULL;
 	exec_request(rd->rtspcl, "FLUSH", NULL, NULL, 1,
@@ -844,20 +1543,118 @@ static bool
 raop_output_pause(struct audio_output *ao)
 {
 	RaopOutput *rd = (RaopOutput *)ao;
+	struct raop_session_data *const session = rd->session;
 
 	rd->paused = true;
+
+	if (rd->is_master) {
+		/* the timeline would fall behind the clock while
+		   paused, so start a new one when playback resumes */
+		g_mutex_lock(session->data_mutex);
+		session->play_state.timeline.Stop();
+		g_mutex_unlock(session->data_mutex);
+	}
+
 	return true;
 }
 
 /**
- * Remove the output from the session's list.  Caller must not lock the raop_session_mutex.
+ * Find the open session of a sync group.  Caller must lock the
+ * raop_session_mutex.
+ *
+ * @return the session, or NULL if there is none (or if the sync
+ * group is NULL)
+ */
+static struct raop_session_data *
+raop_session_find(const char *sync_group)
+{
+	if (sync_group == NULL)
+		return NULL;
+
+	for (struct raop_session_data *session = raop_sessions;
+	     session != NULL; session = session->next)
+		if (session->sync_group != NULL &&
+		    strcmp(session->sync_group, sync_group) == 0)
+			return session;
+
+	return NULL;
+}
+
+/**
+ * Attach the output to its session, creating the session if this is
+ * the first output of its sync group (or if it has none).
+ */
+static bool
+raop_output_add(RaopOutput *rd, GError **error_r)
+{
+	assert(rd->session == NULL);
+
+	g_static_mutex_lock(&raop_session_mutex);
+	struct raop_session_data *session = raop_session_find(rd->sync_group);
+	g_static_mutex_unlock(&raop_session_mutex);
+
+	/* creating a session takes a while (RSA, sockets, a thread),
+	   so this is done without holding the raop_session_mutex */
+	struct raop_session_data *new_session = NULL;
+	if (session == NULL) {
+		new_session = raop_session_new(rd->sync_group, error_r);
+		if (new_session == NULL)
+			return false;
+	}
+
+	g_static_mutex_lock(&raop_session_mutex);
+
+	/* look again: the session may have been closed meanwhile, or
+	   another output of the sync group may have created one */
+	session = raop_session_find(rd->sync_group);
+	if (session == NULL) {
+		if (new_session == NULL) {
+			/* the session we found has been closed; try
+			   again */
+			g_static_mutex_unlock(&raop_session_mutex);
+			return raop_output_add(rd, error_r);
+		}
+
+		session = new_session;
+		new_session = NULL;
+
+		session->next = raop_sessions;
+		raop_sessions = session;
+	}
+
+	// first raop is set as master, add to list
+	g_mutex_lock(session->list_mutex);
+	rd->is_master = session->raop_list == NULL;
+	rd->next = session->raop_list;
+	session->raop_list = rd;
+	g_mutex_unlock(session->list_mutex);
+
+	rd->session = session;
+
+	g_static_mutex_unlock(&raop_session_mutex);
+
+	if (new_session != NULL)
+		/* another output was faster */
+		raop_session_free(new_session);
+
+	return true;
+}
+
+/**
+ * Remove the output from the session's list, and free the session
+ * if it was the last one.  Caller must not lock the
+ * raop_session_mutex.
  */
 static void
 raop_output_remove(RaopOutput *rd)
 {
+	struct raop_session_data *session = rd->session;
+	assert(session != NULL);
+
 	g_static_mutex_lock(&raop_session_mutex);
+	g_mutex_lock(session->list_mutex);
 
-	RaopOutput *iter = raop_session->raop_list;
+	RaopOutput *iter = session->raop_list;
 	RaopOutput *prev = NULL;
 
 	while (iter) {
@@ -865,25 +1662,37 @@ raop_output_remove(RaopOutput *rd)
 			if (prev != NULL) {
 				prev->next = rd->next;
 			} else {
-				raop_session->raop_list = rd->next;
+				session->raop_list = rd->next;
 			}
-			if (rd->is_master && raop_session->raop_list != NULL) {
-				raop_session->raop_list->is_master = true;
+			if (rd->is_master && session->raop_list != NULL) {
+				session->raop_list->is_master = true;
 			}
 			rd->next = NULL;
 			rd->is_master = false;
+			rd->ready = false;
+			rd->started = false;
 			break;
 		}
 		prev = iter;
 		iter = iter->next;
 	}
 
-	if (raop_session->raop_list == NULL) {
-		ntp_server_close(&raop_session->ntp);
-		close(raop_session->ctrl.fd);
-		raop_session->ctrl.fd = -1;
+	const bool empty = session->raop_list == NULL;
+	g_mutex_unlock(session->list_mutex);
+
+	if (empty) {
+		struct raop_session_data **p = &raop_sessions;
+		while (*p != session)
+			p = &(*p)->next;
+		*p = session->next;
 	}
+
 	g_static_mutex_unlock(&raop_session_mutex);
+
+	rd->session = NULL;
+
+	if (empty)
+		raop_session_free(session);
 }
 
 static void
@@ -895,13 +1704,20 @@ raop_output_close(struct audio_output *ao)
 	raop_output_remove(rd);
 
 	g_mutex_lock(rd->control_mutex);
-	exec_request(rd->rtspcl, "TEARDOWN", NULL, NULL, 0,
-		     NULL, NULL, NULL);
+	if (rd->handshake_pending)
+		/* the receiver has not recorded yet, just drop the
+		   connection */
+		rd->handshake_pending = false;
+	else
+		exec_request(rd->rtspcl, "TEARDOWN", NULL, NULL, 0,
+			     NULL, NULL, NULL);
 	rtspcl_close(rd->rtspcl);
 	rd->rtspcl = NULL;
  	g_mutex_unlock(rd->control_mutex);
 
-	rd->started = 0;
+	if (rd->send_errors > 0)
+		g_message("%u audio packets could not be sent to %s",
+			  rd->send_errors, rd->addr);
 }
 
 
@@ -911,32 +1727,23 @@ raop_output_open(struct audio_output *ao, struct audio_format *audio_format, GEr
 	//setup, etc.
 	RaopOutput *rd = (RaopOutput *)ao;
 
-	// add this raop to the global raop_session, guarded using the raop_session_mutex
-	{
-		g_static_mutex_lock(&raop_session_mutex);
+	rd->send_errors = 0;
 
-		// create the raop session on demand
-		if (raop_session == NULL && (raop_session = raop_session_new(error_r)) == NULL)
-		{
-			g_static_mutex_unlock(&raop_session_mutex);
- 			return false;
- 		}
-
-		// first raop is set as master, add to list
-		rd->is_master = raop_session->raop_list == NULL;
-		rd->next = raop_session->raop_list;
-		raop_session->raop_list = rd;
-
-		g_static_mutex_unlock(&raop_session_mutex);
-	}
+	if (!raop_output_add(rd, error_r))
+		return false;
 
+	/* this is what the SDP announces to the receiver */
 	audio_format->format = SAMPLE_FORMAT_S16;
+	audio_format->channels = 2;
+	audio_format->sample_rate = 44100;
+	/* this only sends the first requests; the responses are
+	   read by raop_output_complete() */
 	if (!raopcl_connect(rd, error_r)) {
-		raop_output_remove(rd);
-		return false;
-	}
+		if (rd->rtspcl != NULL) {
+			rtspcl_close(rd->rtspcl);
+			rd->rtspcl = NULL;
+		}
 
-	if (!raop_set_volume(rd, rd->volume, error_r)) {
 		raop_output_remove(rd);
 		return false;
 	}
@@ -950,22 +1757,43 @@ raop_output_play(struct audio_output *ao, const void *chunk, size_t size,
 {
 	//raopcl_send_sample
 	RaopOutput *rd = (RaopOutput *)ao;
+	struct raop_session_data *const session = rd->session;
 	size_t rval = 0, orig_size = size;
 
+	if (!raop_output_complete(rd, error_r))
+		return 0;
+
 	rd->paused = false;
 	if (!rd->is_master) {
 		// only process data for the master raop
 		return size;
 	}
 
-	g_mutex_lock(raop_session->data_mutex);
-
-	if (raop_session->play_state.rtptime <= NUMSAMPLES) {
-		// looped over, need new reference point to calculate correct times
-		raop_session->play_state.playing = false;
+	g_mutex_lock(session->data_mutex);
+
+	if (session->send_failed.exchange(false)) {
+		/* the sender thread has failed to send the previous
+		   packet to any receiver */
+		const int error = session->send_errno;
+		g_set_error(error_r, raop_output_quark(), error,
+			    "write error: %s",
+			    error != 0
+			    ? g_strerror(error)
+			    : "disconnected on the other end");
+		goto erexit;
 	}
 
-	while (raop_session->bufferSize + size >= RAOP_BUFFER_SIZE) {
+	while (session->bufferSize + size >= RAOP_BUFFER_SIZE) {
+		/* this blocks while the sender thread is busy with
+		   the packets queued before; don't hold data_mutex
+		   meanwhile, or raop_output_cancel() and
+		   raop_output_pause() would have to wait, too.  This
+		   is the only producer, so the slot remains ours. */
+		g_mutex_unlock(session->data_mutex);
+		struct raop_send_packet *packet =
+			raop_send_queue_prepare(session);
+		g_mutex_lock(session->data_mutex);
+
 		// ntp header
 		unsigned char header[] = {
 			0x80, 0x60, 0x00, 0x00,
@@ -976,63 +1804,83 @@ raop_output_play(struct audio_output *ao, const void *chunk, size_t size,
 		};
 
 
-		int count = 0;
-		int copyBytes = RAOP_BUFFER_SIZE - raop_session->bufferSize;
+		size_t count;
+		int copyBytes = RAOP_BUFFER_SIZE - session->bufferSize;
 
-		if (!raop_session->play_state.playing ||
-		    raop_session->play_state.seq_num % (44100 / NUMSAMPLES + 1) == 0) {
+		RaopTimeline &timeline = session->play_state.timeline;
+		if (!timeline.IsStarted() ||
+		    session->play_state.seq_num % (44100 / NUMSAMPLES + 1) == 0) {
 			RaopOutput *iter;
-			g_static_mutex_lock(&raop_session_mutex);
-			if (!raop_session->play_state.playing) {
-				gettimeofday(&raop_session->play_state.start_time,NULL);
-			}
-			iter = raop_session->raop_list;
+			const int send_lag = session->send_lag.exchange(0);
+			g_mutex_lock(session->list_mutex);
+			if (!timeline.IsStarted())
+				timeline.Start(monotonic_clock_us(),
+					       raop_realtime_us());
+			else
+				timeline.Synchronize(monotonic_clock_us(),
+						     raop_realtime_us(),
+						     send_lag);
+
+			iter = session->raop_list;
 			while (iter) {
-				if (!send_control_command(&raop_session->ctrl, iter,
-							  &raop_session->play_state,
-							  error_r))
+				if (iter->ready &&
+				    !send_control_command(&session->ctrl, iter,
+							  &timeline,
+							  error_r)) {
+					g_mutex_unlock(session->list_mutex);
 					goto erexit;
+				}
 
 				iter = iter->next;
 			}
-			g_static_mutex_unlock(&raop_session_mutex);
+			g_mutex_unlock(session->list_mutex);
 		}
 
-		fill_int(header + 8, raop_session->play_state.sync_src);
+		fill_int(header + 8, session->play_state.sync_src);
 
-		memcpy(raop_session->buffer + raop_session->bufferSize, chunk, copyBytes);
-		raop_session->bufferSize += copyBytes;
+		memcpy((unsigned char *)session->buffer + session->bufferSize,
+		       chunk, copyBytes);
+		session->bufferSize += copyBytes;
 		chunk = ((const char *)chunk) + copyBytes;
 		size -= copyBytes;
 
-		if (!wrap_pcm(raop_session->data + RAOP_HEADER_SIZE, NUMSAMPLES, &count, raop_session->buffer, RAOP_BUFFER_SIZE)) {
-			g_warning("unable to encode %d bytes properly\n", RAOP_BUFFER_SIZE);
-		}
-
-		memcpy(raop_session->data, header, RAOP_HEADER_SIZE);
-		raop_session->data[2] = raop_session->play_state.seq_num >> 8;
-		raop_session->data[3] = raop_session->play_state.seq_num & 0xff;
-		raop_session->play_state.seq_num ++;
+		count = alac_encode(packet->data + RAOP_HEADER_SIZE,
+				    session->buffer, NUMSAMPLES,
+				    rd->alac_compression);
 
-		fill_int(raop_session->data + 4, raop_session->play_state.rtptime);
-		raop_session->play_state.rtptime += NUMSAMPLES;
+		memcpy(packet->data, header, RAOP_HEADER_SIZE);
+		packet->data[2] = session->play_state.seq_num >> 8;
+		packet->data[3] = session->play_state.seq_num & 0xff;
+		session->play_state.seq_num ++;
 
-		raop_encrypt(&raop_session->encrypt, raop_session->data + RAOP_HEADER_SIZE, count);
-		raop_session->wblk_remsize = count + RAOP_HEADER_SIZE;
-		raop_session->wblk_wsize = 0;
+		fill_int(packet->data + 4, timeline.GetRtpTime());
+		packet->deadline = timeline.GetDeadline();
+		timeline.Advance(NUMSAMPLES);
 
-		if (!send_audio_data(raop_session->data_fd, error_r))
+		if (!raop_encrypt(&session->encrypt,
+				  packet->data + RAOP_HEADER_SIZE, count,
+				  error_r))
 			goto erexit;
 
-		raop_session->bufferSize = 0;
+		packet->size = count + RAOP_HEADER_SIZE;
+		packet->generation = session->flush_generation;
+
+		packet->data[1] = 0x60;
+
+		session->send_queue.Commit();
+		raop_send_queue_wake(session,
+				     session->sender_waiting);
+
+		session->bufferSize = 0;
 	}
 	if (size > 0) {
-		memcpy(raop_session->buffer + raop_session->bufferSize, chunk, size);
-		raop_session->bufferSize += size;
+		memcpy((unsigned char *)session->buffer + session->bufferSize,
+		       chunk, size);
+		session->bufferSize += size;
 	}
 	rval = orig_size;
  erexit:
-	g_mutex_unlock(raop_session->data_mutex);
+	g_mutex_unlock(session->data_mutex);
 	return rval;
 }
 
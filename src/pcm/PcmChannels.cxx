@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "PcmChannels.hxx"
+#include "PcmKernelTable.hxx"
 #include "pcm_buffer.h"
 #include "PcmUtils.hxx"
 
@@ -49,30 +50,6 @@ pcm_convert_channels_16_2_to_1(int16_t *restrict dest,
 	}
 }
 
-static void
-pcm_convert_channels_16_n_to_2(int16_t *restrict dest,
-			       unsigned src_channels,
-			       const int16_t *restrict src,
-			       const int16_t *restrict src_end)
-{
-	unsigned c;
-
-	assert(src_channels > 0);
-
-	while (src < src_end) {
-		int32_t sum = 0;
-		int16_t value;
-
-		for (c = 0; c < src_channels; ++c)
-			sum += *src++;
-		value = sum / (int)src_channels;
-
-		/* XXX this is actually only mono ... */
-		*dest++ = value;
-		*dest++ = value;
-	}
-}
-
 const int16_t *
 pcm_convert_channels_16(struct pcm_buffer *buffer,
 			unsigned dest_channels,
@@ -92,8 +69,9 @@ pcm_convert_channels_16(struct pcm_buffer *buffer,
 	else if (src_channels == 2 && dest_channels == 1)
 		pcm_convert_channels_16_2_to_1(dest, src, src_end);
 	else if (dest_channels == 2)
-		pcm_convert_channels_16_n_to_2(dest, src_channels, src,
-					       src_end);
+		pcm_kernel_table_get().downmix_16(dest, src,
+						  src_size / sizeof(*src) / src_channels,
+						  src_channels);
 	else
 		return NULL;
 
@@ -112,30 +90,6 @@ pcm_convert_channels_24_2_to_1(int32_t *restrict dest,
 	}
 }
 
-static void
-pcm_convert_channels_24_n_to_2(int32_t *restrict dest,
-			       unsigned src_channels,
-			       const int32_t *restrict src,
-			       const int32_t *restrict src_end)
-{
-	unsigned c;
-
-	assert(src_channels > 0);
-
-	while (src < src_end) {
-		int32_t sum = 0;
-		int32_t value;
-
-		for (c = 0; c < src_channels; ++c)
-			sum += *src++;
-		value = sum / (int)src_channels;
-
-		/* XXX this is actually only mono ... */
-		*dest++ = value;
-		*dest++ = value;
-	}
-}
-
 const int32_t *
 pcm_convert_channels_24(struct pcm_buffer *buffer,
 			unsigned dest_channels,
@@ -156,8 +110,9 @@ pcm_convert_channels_24(struct pcm_buffer *buffer,
 	else if (src_channels == 2 && dest_channels == 1)
 		pcm_convert_channels_24_2_to_1(dest, src, src_end);
 	else if (dest_channels == 2)
-		pcm_convert_channels_24_n_to_2(dest, src_channels, src,
-					       src_end);
+		pcm_kernel_table_get().downmix_24(dest, src,
+						  src_size / sizeof(*src) / src_channels,
+						  src_channels);
 	else
 		return NULL;
 
@@ -176,29 +131,6 @@ pcm_convert_channels_32_2_to_1(int32_t *restrict dest,
 	}
 }
 
-static void
-pcm_convert_channels_32_n_to_2(int32_t *dest,
-			       unsigned src_channels, const int32_t *src,
-			       const int32_t *src_end)
-{
-	unsigned c;
-
-	assert(src_channels > 0);
-
-	while (src < src_end) {
-		int64_t sum = 0;
-		int32_t value;
-
-		for (c = 0; c < src_channels; ++c)
-			sum += *src++;
-		value = sum / (int64_t)src_channels;
-
-		/* XXX this is actually only mono ... */
-		*dest++ = value;
-		*dest++ = value;
-	}
-}
-
 const int32_t *
 pcm_convert_channels_32(struct pcm_buffer *buffer,
 			unsigned dest_channels,
@@ -219,8 +151,9 @@ pcm_convert_channels_32(struct pcm_buffer *buffer,
 	else if (src_channels == 2 && dest_channels == 1)
 		pcm_convert_channels_32_2_to_1(dest, src, src_end);
 	else if (dest_channels == 2)
-		pcm_convert_channels_32_n_to_2(dest, src_channels, src,
-					       src_end);
+		pcm_kernel_table_get().downmix_32(dest, src,
+						  src_size / sizeof(*src) / src_channels,
+						  src_channels);
 	else
 		return NULL;
 
@@ -239,29 +172,6 @@ pcm_convert_channels_float_2_to_1(float *restrict dest,
 	}
 }
 
-static void
-pcm_convert_channels_float_n_to_2(float *dest,
-				  unsigned src_channels, const float *src,
-				  const float *src_end)
-{
-	unsigned c;
-
-	assert(src_channels > 0);
-
-	while (src < src_end) {
-		double sum = 0;
-		float value;
-
-		for (c = 0; c < src_channels; ++c)
-			sum += *src++;
-		value = sum / (double)src_channels;
-
-		/* XXX this is actually only mono ... */
-		*dest++ = value;
-		*dest++ = value;
-	}
-}
-
 const float *
 pcm_convert_channels_float(struct pcm_buffer *buffer,
 			   unsigned dest_channels,
@@ -281,8 +191,9 @@ pcm_convert_channels_float(struct pcm_buffer *buffer,
 	else if (src_channels == 2 && dest_channels == 1)
 		pcm_convert_channels_float_2_to_1(dest, src, src_end);
 	else if (dest_channels == 2)
-		pcm_convert_channels_float_n_to_2(dest, src_channels, src,
-						  src_end);
+		pcm_kernel_table_get().downmix_float(dest, src,
+						     src_size / sizeof(*src) / src_channels,
+						     src_channels);
 	else
 		return NULL;
 
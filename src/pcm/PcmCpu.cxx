@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "PcmCpu.hxx"
+
+static unsigned
+pcm_cpu_detect(void)
+{
+	unsigned features = 0;
+
+#ifdef PCM_HAVE_X86_SIMD
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2"))
+		features |= PCM_CPU_SSE2;
+
+	/* this checks the operating system's support for the AVX
+	   registers, too */
+	if (__builtin_cpu_supports("avx2"))
+		features |= PCM_CPU_AVX2;
+#endif
+
+#ifdef PCM_HAVE_NEON
+	features |= PCM_CPU_NEON;
+#endif
+
+	return features;
+}
+
+unsigned
+pcm_cpu_features(void)
+{
+	static const unsigned features = pcm_cpu_detect();
+	return features;
+}
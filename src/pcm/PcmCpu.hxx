@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_PCM_CPU_HXX
+#define MPD_PCM_CPU_HXX
+
+#include "gcc.h"
+
+/*
+ * Which SIMD code can be compiled?  The x86 kernels use the "target"
+ * function attribute, so they don't need special compiler flags, and
+ * are selected at run time.  NEON is selected at compile time.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(GCC_CHECK_VERSION(4,9) || defined(__clang__))
+#define PCM_HAVE_X86_SIMD
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PCM_HAVE_NEON
+#endif
+
+/**
+ * Flags returned by pcm_cpu_features().
+ */
+enum {
+	PCM_CPU_SSE2 = 0x1,
+	PCM_CPU_AVX2 = 0x2,
+	PCM_CPU_NEON = 0x4,
+};
+
+/**
+ * Determines which SIMD instruction sets the PCM library may use on
+ * this CPU.  Only instruction sets for which code has been compiled
+ * are reported.
+ */
+gcc_const
+unsigned
+pcm_cpu_features(void);
+
+/**
+ * Chooses the kernel table for the most preferred instruction set
+ * which this CPU supports, and falls back to the generic one.
+ *
+ * @param generic the portable implementation
+ * @param simd returns the table for one PCM_CPU_* flag, or nullptr if
+ * there is none
+ */
+template<typename T>
+const T &
+pcm_cpu_select(const T &generic, const T *(*simd)(unsigned feature))
+{
+	const unsigned features = pcm_cpu_features();
+
+	/* the preferred ones first */
+	static constexpr unsigned candidates[] = {
+		PCM_CPU_AVX2, PCM_CPU_SSE2, PCM_CPU_NEON,
+	};
+
+	for (unsigned feature : candidates) {
+		if ((features & feature) == 0)
+			continue;
+
+		const T *kernels = simd(feature);
+		if (kernels != nullptr)
+			return *kernels;
+	}
+
+	return generic;
+}
+
+/**
+ * Like pcm_cpu_select(), but the choice is made on the first call
+ * and cached.
+ */
+template<typename T, const T &generic, const T *(*simd)(unsigned feature)>
+const T &
+pcm_cpu_select_kernels(void)
+{
+	static const T &kernels = pcm_cpu_select(generic, simd);
+	return kernels;
+}
+
+#endif
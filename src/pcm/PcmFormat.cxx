@@ -20,19 +20,28 @@
 #include "config.h"
 #include "PcmFormat.hxx"
 #include "PcmDither.hxx"
+#include "PcmKernelTable.hxx"
 #include "pcm_buffer.h"
 #include "pcm_pack.h"
 #include "PcmUtils.hxx"
 
-#include <type_traits>
-
-template<typename S>
-struct DefaultSampleBits {
-	typedef decltype(*S()) T;
-	typedef typename std::remove_reference<T>::type U;
+/**
+ * Allocates a buffer, and converts the samples with a kernel from
+ * the #pcm_kernel_table.
+ */
+template<typename D, typename S>
+static D *
+AllocateWithKernel(pcm_buffer &buffer, pcm_format_kernel kernel,
+		   const S *src, size_t src_size, size_t *dest_size_r)
+{
+	assert(src_size % sizeof(*src) == 0);
 
-	static constexpr auto value = sizeof(U) * 8;
-};
+	const size_t num_samples = src_size / sizeof(*src);
+	*dest_size_r = num_samples * sizeof(D);
+	D *dest = (D *)pcm_buffer_get(&buffer, *dest_size_r);
+	kernel(dest, src, num_samples);
+	return dest;
+}
 
 static void
 pcm_convert_8_to_16(int16_t *out, const int8_t *in, const int8_t *in_end)
@@ -56,43 +65,6 @@ pcm_convert_32_to_16(PcmDither &dither,
 	dither.Dither32To16(out, in, in_end);
 }
 
-template<typename S, unsigned bits=DefaultSampleBits<S>::value>
-static void
-ConvertFromFloat(S dest, const float *src, const float *end)
-{
-	typedef decltype(*S()) T;
-	typedef typename std::remove_reference<T>::type U;
-
-	const float factor = 1 << (bits - 1);
-
-	while (src != end) {
-		int sample(*src++ * factor);
-		*dest++ = PcmClamp<U, int, bits>(sample);
-	}
-}
-
-template<typename S, unsigned bits=DefaultSampleBits<S>::value>
-static void
-ConvertFromFloat(S dest, const float *src, size_t size)
-{
-	ConvertFromFloat<S, bits>(dest, src, pcm_end_pointer(src, size));
-}
-
-template<typename S, unsigned bits=sizeof(S)*8>
-static S *
-AllocateFromFloat(pcm_buffer &buffer, const float *src, size_t src_size,
-		  size_t *dest_size_r)
-{
-	constexpr size_t src_sample_size = sizeof(*src);
-	assert(src_size % src_sample_size == 0);
-
-	const size_t num_samples = src_size / src_sample_size;
-	*dest_size_r = num_samples * sizeof(S);
-	S *dest = (S *)pcm_buffer_get(&buffer, *dest_size_r);
-	ConvertFromFloat<S *, bits>(dest, src, src_size);
-	return dest;
-}
-
 static int16_t *
 pcm_allocate_8_to_16(struct pcm_buffer *buffer,
 		     const int8_t *src, size_t src_size, size_t *dest_size_r)
@@ -137,7 +109,9 @@ pcm_allocate_float_to_16(struct pcm_buffer *buffer,
 			 const float *src, size_t src_size,
 			 size_t *dest_size_r)
 {
-	return AllocateFromFloat<int16_t>(*buffer, src, src_size, dest_size_r);
+	return AllocateWithKernel<int16_t>(*buffer,
+					   pcm_kernel_table_get().convert_float_to_16,
+					   src, src_size, dest_size_r);
 }
 
 const int16_t *
@@ -187,22 +161,6 @@ pcm_convert_8_to_24(int32_t *out, const int8_t *in, const int8_t *in_end)
 		*out++ = *in++ << 16;
 }
 
-static void
-pcm_convert_16_to_24(int32_t *out, const int16_t *in, const int16_t *in_end)
-{
-	while (in < in_end)
-		*out++ = *in++ << 8;
-}
-
-static void
-pcm_convert_32_to_24(int32_t *restrict out,
-		     const int32_t *restrict in,
-		     const int32_t *restrict in_end)
-{
-	while (in < in_end)
-		*out++ = *in++ >> 8;
-}
-
 static int32_t *
 pcm_allocate_8_to_24(struct pcm_buffer *buffer,
 		     const int8_t *src, size_t src_size, size_t *dest_size_r)
@@ -218,22 +176,18 @@ static int32_t *
 pcm_allocate_16_to_24(struct pcm_buffer *buffer,
 		      const int16_t *src, size_t src_size, size_t *dest_size_r)
 {
-	int32_t *dest;
-	*dest_size_r = src_size * 2;
-	assert(*dest_size_r == src_size / sizeof(*src) * sizeof(*dest));
-	dest = (int32_t *)pcm_buffer_get(buffer, *dest_size_r);
-	pcm_convert_16_to_24(dest, src, pcm_end_pointer(src, src_size));
-	return dest;
+	return AllocateWithKernel<int32_t>(*buffer,
+					   pcm_kernel_table_get().convert_16_to_24,
+					   src, src_size, dest_size_r);
 }
 
 static int32_t *
 pcm_allocate_32_to_24(struct pcm_buffer *buffer,
 		      const int32_t *src, size_t src_size, size_t *dest_size_r)
 {
-	*dest_size_r = src_size;
-	int32_t *dest = (int32_t *)pcm_buffer_get(buffer, *dest_size_r);
-	pcm_convert_32_to_24(dest, src, pcm_end_pointer(src, src_size));
-	return dest;
+	return AllocateWithKernel<int32_t>(*buffer,
+					   pcm_kernel_table_get().convert_32_to_24,
+					   src, src_size, dest_size_r);
 }
 
 static int32_t *
@@ -241,8 +195,9 @@ pcm_allocate_float_to_24(struct pcm_buffer *buffer,
 			 const float *src, size_t src_size,
 			 size_t *dest_size_r)
 {
-	return AllocateFromFloat<int32_t, 24>(*buffer, src, src_size,
-					      dest_size_r);
+	return AllocateWithKernel<int32_t>(*buffer,
+					   pcm_kernel_table_get().convert_float_to_24,
+					   src, src_size, dest_size_r);
 }
 
 const int32_t *
@@ -292,22 +247,6 @@ pcm_convert_8_to_32(int32_t *out, const int8_t *in, const int8_t *in_end)
 		*out++ = *in++ << 24;
 }
 
-static void
-pcm_convert_16_to_32(int32_t *out, const int16_t *in, const int16_t *in_end)
-{
-	while (in < in_end)
-		*out++ = *in++ << 16;
-}
-
-static void
-pcm_convert_24_to_32(int32_t *restrict out,
-		     const int32_t *restrict in,
-		     const int32_t *restrict in_end)
-{
-	while (in < in_end)
-		*out++ = *in++ << 8;
-}
-
 static int32_t *
 pcm_allocate_8_to_32(struct pcm_buffer *buffer,
 		     const int8_t *src, size_t src_size, size_t *dest_size_r)
@@ -323,12 +262,9 @@ static int32_t *
 pcm_allocate_16_to_32(struct pcm_buffer *buffer,
 		      const int16_t *src, size_t src_size, size_t *dest_size_r)
 {
-	int32_t *dest;
-	*dest_size_r = src_size * 2;
-	assert(*dest_size_r == src_size / sizeof(*src) * sizeof(*dest));
-	dest = (int32_t *)pcm_buffer_get(buffer, *dest_size_r);
-	pcm_convert_16_to_32(dest, src, pcm_end_pointer(src, src_size));
-	return dest;
+	return AllocateWithKernel<int32_t>(*buffer,
+					   pcm_kernel_table_get().convert_16_to_32,
+					   src, src_size, dest_size_r);
 }
 
 static int32_t *
@@ -336,10 +272,9 @@ pcm_allocate_24p32_to_32(struct pcm_buffer *buffer,
 			 const int32_t *src, size_t src_size,
 			 size_t *dest_size_r)
 {
-	*dest_size_r = src_size;
-	int32_t *dest = (int32_t *)pcm_buffer_get(buffer, *dest_size_r);
-	pcm_convert_24_to_32(dest, src, pcm_end_pointer(src, src_size));
-	return dest;
+	return AllocateWithKernel<int32_t>(*buffer,
+					   pcm_kernel_table_get().convert_24_to_32,
+					   src, src_size, dest_size_r);
 }
 
 static int32_t *
@@ -352,7 +287,8 @@ pcm_allocate_float_to_32(struct pcm_buffer *buffer,
 						 dest_size_r);
 
 	/* convert to 32 bit in-place */
-	pcm_convert_24_to_32(dest, dest, pcm_end_pointer(dest, *dest_size_r));
+	pcm_kernel_table_get().convert_24_to_32(dest, dest,
+						*dest_size_r / sizeof(*dest));
 	return dest;
 }
 
@@ -396,44 +332,14 @@ pcm_convert_to_32(struct pcm_buffer *buffer,
 	return NULL;
 }
 
-template<typename S, unsigned bits=DefaultSampleBits<S>::value>
-static void
-ConvertToFloat(float *dest, S src, S end)
-{
-	constexpr float factor = 0.5 / (1 << (bits - 2));
-	while (src != end)
-		*dest++ = float(*src++) * factor;
-
-}
-
-template<typename S, unsigned bits=DefaultSampleBits<S>::value>
-static void
-ConvertToFloat(float *dest, S src, size_t size)
-{
-	ConvertToFloat<S, bits>(dest, src, pcm_end_pointer(src, size));
-}
-
-template<typename S, unsigned bits=DefaultSampleBits<S>::value>
-static float *
-AllocateToFloat(pcm_buffer &buffer, S src, size_t src_size,
-		size_t *dest_size_r)
-{
-	constexpr size_t src_sample_size = sizeof(*S());
-	assert(src_size % src_sample_size == 0);
-
-	const size_t num_samples = src_size / src_sample_size;
-	*dest_size_r = num_samples * sizeof(float);
-	float *dest = (float *)pcm_buffer_get(&buffer, *dest_size_r);
-	ConvertToFloat<S, bits>(dest, src, src_size);
-	return dest;
-}
-
 static float *
 pcm_allocate_8_to_float(struct pcm_buffer *buffer,
 			const int8_t *src, size_t src_size,
 			size_t *dest_size_r)
 {
-	return AllocateToFloat(*buffer, src, src_size, dest_size_r);
+	return AllocateWithKernel<float>(*buffer,
+					 pcm_kernel_table_get().convert_8_to_float,
+					 src, src_size, dest_size_r);
 }
 
 static float *
@@ -441,7 +347,9 @@ pcm_allocate_16_to_float(struct pcm_buffer *buffer,
 			 const int16_t *src, size_t src_size,
 			 size_t *dest_size_r)
 {
-	return AllocateToFloat(*buffer, src, src_size, dest_size_r);
+	return AllocateWithKernel<float>(*buffer,
+					 pcm_kernel_table_get().convert_16_to_float,
+					 src, src_size, dest_size_r);
 }
 
 static float *
@@ -449,8 +357,9 @@ pcm_allocate_24p32_to_float(struct pcm_buffer *buffer,
 			    const int32_t *src, size_t src_size,
 			    size_t *dest_size_r)
 {
-	return AllocateToFloat<decltype(src), 24>
-		(*buffer, src, src_size, dest_size_r);
+	return AllocateWithKernel<float>(*buffer,
+					 pcm_kernel_table_get().convert_24_to_float,
+					 src, src_size, dest_size_r);
 }
 
 static float *
@@ -458,7 +367,9 @@ pcm_allocate_32_to_float(struct pcm_buffer *buffer,
 			 const int32_t *src, size_t src_size,
 			 size_t *dest_size_r)
 {
-	return AllocateToFloat(*buffer, src, src_size, dest_size_r);
+	return AllocateWithKernel<float>(*buffer,
+					 pcm_kernel_table_get().convert_32_to_float,
+					 src, src_size, dest_size_r);
 }
 
 const float *
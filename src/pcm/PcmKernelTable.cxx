@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "PcmKernelTable.hxx"
+#include "PcmCpu.hxx"
+#include "PcmUtils.hxx"
+
+#include <assert.h>
+#include <stdint.h>
+
+template<typename S, unsigned shift>
+static void
+ConvertShiftLeft(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const S *src = (const S *)_src;
+
+	for (size_t i = 0; i != n; ++i)
+		dest[i] = src[i] << shift;
+}
+
+template<unsigned shift>
+static void
+ConvertShiftRight(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	for (size_t i = 0; i != n; ++i)
+		dest[i] = src[i] >> shift;
+}
+
+template<typename S, unsigned bits=sizeof(S)*8>
+static void
+ConvertToFloat(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const S *src = (const S *)_src;
+
+	constexpr float factor = 0.5 / (1 << (bits - 2));
+	for (size_t i = 0; i != n; ++i)
+		dest[i] = float(src[i]) * factor;
+}
+
+template<typename D, unsigned bits=sizeof(D)*8>
+static void
+ConvertFromFloat(void *_dest, const void *_src, size_t n)
+{
+	D *dest = (D *)_dest;
+	const float *src = (const float *)_src;
+
+	const float factor = 1 << (bits - 1);
+
+	for (size_t i = 0; i != n; ++i) {
+		int sample(src[i] * factor);
+		dest[i] = PcmClamp<D, int, bits>(sample);
+	}
+}
+
+/**
+ * @param T the sample type
+ * @param U the type used for the sum of all channels
+ */
+template<typename T, typename U>
+static void
+Downmix(void *_dest, const void *_src, size_t n, unsigned src_channels)
+{
+	T *dest = (T *)_dest;
+	const T *src = (const T *)_src;
+
+	assert(src_channels > 0);
+
+	for (size_t i = 0; i != n; ++i) {
+		U sum = 0;
+		for (unsigned c = 0; c < src_channels; ++c)
+			sum += *src++;
+
+		const T value = sum / U(src_channels);
+
+		/* XXX this is actually only mono ... */
+		*dest++ = value;
+		*dest++ = value;
+	}
+}
+
+const struct pcm_kernel_table pcm_kernel_table_generic = {
+	"generic",
+	ConvertShiftLeft<int16_t, 8>,
+	ConvertShiftLeft<int16_t, 16>,
+	ConvertShiftLeft<int32_t, 8>,
+	ConvertShiftRight<8>,
+	ConvertToFloat<int8_t>,
+	ConvertToFloat<int16_t>,
+	ConvertToFloat<int32_t, 24>,
+	ConvertToFloat<int32_t>,
+	ConvertFromFloat<int16_t>,
+	ConvertFromFloat<int32_t, 24>,
+	Downmix<int16_t, int32_t>,
+	Downmix<int32_t, int32_t>,
+	Downmix<int32_t, int64_t>,
+	Downmix<float, double>,
+};
+
+const struct pcm_kernel_table &
+pcm_kernel_table_get(void)
+{
+	return pcm_cpu_select_kernels<struct pcm_kernel_table,
+				      pcm_kernel_table_generic,
+				      pcm_kernel_table_simd>();
+}
+
+pcm_format_kernel
+pcm_kernel_table_format(const struct pcm_kernel_table &table,
+			enum sample_format src_format,
+			enum sample_format dest_format)
+{
+	switch (dest_format) {
+	case SAMPLE_FORMAT_S16:
+		if (src_format == SAMPLE_FORMAT_FLOAT)
+			return table.convert_float_to_16;
+		break;
+
+	case SAMPLE_FORMAT_S24_P32:
+		if (src_format == SAMPLE_FORMAT_S16)
+			return table.convert_16_to_24;
+		else if (src_format == SAMPLE_FORMAT_S32)
+			return table.convert_32_to_24;
+		else if (src_format == SAMPLE_FORMAT_FLOAT)
+			return table.convert_float_to_24;
+		break;
+
+	case SAMPLE_FORMAT_S32:
+		if (src_format == SAMPLE_FORMAT_S16)
+			return table.convert_16_to_32;
+		else if (src_format == SAMPLE_FORMAT_S24_P32)
+			return table.convert_24_to_32;
+		break;
+
+	case SAMPLE_FORMAT_FLOAT:
+		switch (src_format) {
+		case SAMPLE_FORMAT_S8:
+			return table.convert_8_to_float;
+
+		case SAMPLE_FORMAT_S16:
+			return table.convert_16_to_float;
+
+		case SAMPLE_FORMAT_S24_P32:
+			return table.convert_24_to_float;
+
+		case SAMPLE_FORMAT_S32:
+			return table.convert_32_to_float;
+
+		default:
+			break;
+		}
+
+		break;
+
+	default:
+		break;
+	}
+
+	return nullptr;
+}
+
+pcm_downmix_kernel
+pcm_kernel_table_downmix(const struct pcm_kernel_table &table,
+			 enum sample_format format)
+{
+	switch (format) {
+	case SAMPLE_FORMAT_S16:
+		return table.downmix_16;
+
+	case SAMPLE_FORMAT_S24_P32:
+		return table.downmix_24;
+
+	case SAMPLE_FORMAT_S32:
+		return table.downmix_32;
+
+	case SAMPLE_FORMAT_FLOAT:
+		return table.downmix_float;
+
+	default:
+		return nullptr;
+	}
+}
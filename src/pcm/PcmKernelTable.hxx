@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_PCM_KERNEL_TABLE_HXX
+#define MPD_PCM_KERNEL_TABLE_HXX
+
+#include "audio_format.h"
+#include "gcc.h"
+
+#include <stddef.h>
+
+/**
+ * Converts #n samples from one sample format to another.  #dest may
+ * be equal to #src if both formats have the same sample size.
+ */
+typedef void (*pcm_format_kernel)(void *dest, const void *src, size_t n);
+
+/**
+ * Mixes all channels of #n frames, and writes the result to both
+ * channels of a stereo buffer.
+ */
+typedef void (*pcm_downmix_kernel)(void *dest, const void *src, size_t n,
+				   unsigned src_channels);
+
+/**
+ * The inner loops of the most frequently used sample format and
+ * channel conversions, for one instruction set.  All kernels give
+ * exactly the same results as the generic implementation.
+ */
+struct pcm_kernel_table {
+	const char *name;
+
+	pcm_format_kernel convert_16_to_24;
+	pcm_format_kernel convert_16_to_32;
+	pcm_format_kernel convert_24_to_32;
+	pcm_format_kernel convert_32_to_24;
+
+	pcm_format_kernel convert_8_to_float;
+	pcm_format_kernel convert_16_to_float;
+	pcm_format_kernel convert_24_to_float;
+	pcm_format_kernel convert_32_to_float;
+
+	pcm_format_kernel convert_float_to_16;
+	pcm_format_kernel convert_float_to_24;
+
+	pcm_downmix_kernel downmix_16;
+	pcm_downmix_kernel downmix_24;
+	pcm_downmix_kernel downmix_32;
+	pcm_downmix_kernel downmix_float;
+};
+
+/**
+ * The portable implementation.
+ */
+extern const struct pcm_kernel_table pcm_kernel_table_generic;
+
+/**
+ * Returns the SIMD kernels for the specified instruction set
+ * (#PCM_CPU_SSE2, #PCM_CPU_AVX2 or #PCM_CPU_NEON), or nullptr if they
+ * have not been compiled.
+ */
+const struct pcm_kernel_table *
+pcm_kernel_table_simd(unsigned feature);
+
+/**
+ * Returns the fastest kernels supported by this CPU.
+ */
+const struct pcm_kernel_table &
+pcm_kernel_table_get(void);
+
+/**
+ * Looks up the kernel which converts samples between the two
+ * formats.
+ *
+ * @return the kernel, or nullptr if the table has none for this pair
+ * (e.g. conversions which need dithering)
+ */
+gcc_pure
+pcm_format_kernel
+pcm_kernel_table_format(const struct pcm_kernel_table &table,
+			enum sample_format src_format,
+			enum sample_format dest_format);
+
+/**
+ * Looks up the kernel which mixes a number of channels down to
+ * stereo.
+ *
+ * @return the kernel, or nullptr if the table has none for this
+ * format
+ */
+gcc_pure
+pcm_downmix_kernel
+pcm_kernel_table_downmix(const struct pcm_kernel_table &table,
+			 enum sample_format format);
+
+#endif
@@ -0,0 +1,886 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * SIMD implementations of the #pcm_kernel_table.  Each kernel
+ * processes as many samples as fit into its vector registers, and
+ * leaves the rest to the generic implementation.
+ */
+
+#include "config.h"
+#include "PcmKernelTable.hxx"
+#include "PcmSimd.hxx"
+
+#ifdef PCM_HAVE_X86_SIMD
+
+/*
+ * SSE2
+ *
+ */
+
+/**
+ * Converts 16 bit samples to 32 bit integers, shifted left by the
+ * specified number of bits.
+ */
+template<unsigned shift>
+SSE2_FUNC
+static void
+sse2_convert_16_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+
+		/* interleaving with zero shifts left by 16 */
+		__m128i lo = _mm_unpacklo_epi16(zero, x);
+		__m128i hi = _mm_unpackhi_epi16(zero, x);
+		if (shift < 16) {
+			lo = _mm_srai_epi32(lo, 16 - shift);
+			hi = _mm_srai_epi32(hi, 16 - shift);
+		}
+
+		_mm_storeu_si128((__m128i *)(dest + i), lo);
+		_mm_storeu_si128((__m128i *)(dest + i + 4), hi);
+	}
+
+	if (shift == 8)
+		pcm_kernel_table_generic.convert_16_to_24(dest + i, src + i,
+							  n - i);
+	else
+		pcm_kernel_table_generic.convert_16_to_32(dest + i, src + i,
+							  n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_24_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_slli_epi32(x, 8));
+	}
+
+	pcm_kernel_table_generic.convert_24_to_32(dest + i, src + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_32_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_srai_epi32(x, 8));
+	}
+
+	pcm_kernel_table_generic.convert_32_to_24(dest + i, src + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_8_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int8_t *src = (const int8_t *)_src;
+
+	const __m128 factor = _mm_set1_ps(0.5 / (1 << 6));
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadl_epi64((const __m128i *)(src + i));
+
+		/* move each sample to the top byte, then sign extension */
+		const __m128i x16 = _mm_unpacklo_epi8(x, x);
+		const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 24);
+		const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x16, x16), 24);
+
+		_mm_storeu_ps(dest + i,
+			      _mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+		_mm_storeu_ps(dest + i + 4,
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+	}
+
+	pcm_kernel_table_generic.convert_8_to_float(dest + i, src + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_16_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	const __m128 factor = _mm_set1_ps(0.5 / (1 << 14));
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+
+		/* sign extension */
+		const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+		_mm_storeu_ps(dest + i,
+			      _mm_mul_ps(_mm_cvtepi32_ps(lo), factor));
+		_mm_storeu_ps(dest + i + 4,
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), factor));
+	}
+
+	pcm_kernel_table_generic.convert_16_to_float(dest + i, src + i,
+						     n - i);
+}
+
+template<unsigned bits>
+SSE2_FUNC
+static void
+sse2_convert_32_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	const __m128 factor = _mm_set1_ps(0.5 / (1 << (bits - 2)));
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_ps(dest + i,
+			      _mm_mul_ps(_mm_cvtepi32_ps(x), factor));
+	}
+
+	if (bits == 24)
+		pcm_kernel_table_generic.convert_24_to_float(dest + i, src + i,
+							     n - i);
+	else
+		pcm_kernel_table_generic.convert_32_to_float(dest + i, src + i,
+							     n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_float_to_16(void *_dest, const void *_src, size_t n)
+{
+	int16_t *dest = (int16_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const __m128 factor = _mm_set1_ps(1 << 15);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i lo =
+			_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i),
+						    factor));
+		const __m128i hi =
+			_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4),
+						    factor));
+
+		/* _mm_packs_epi32() clamps to 16 bit */
+		_mm_storeu_si128((__m128i *)(dest + i),
+				 _mm_packs_epi32(lo, hi));
+	}
+
+	pcm_kernel_table_generic.convert_float_to_16(dest + i, src + i,
+						     n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_convert_float_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const __m128 factor = _mm_set1_ps(1 << 23);
+	const __m128i min = _mm_set1_epi32(-0x800000);
+	const __m128i max = _mm_set1_epi32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x =
+			_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i),
+						    factor));
+		x = sse2_select(_mm_cmpgt_epi32(x, max), max, x);
+		x = sse2_select(_mm_cmplt_epi32(x, min), min, x);
+		_mm_storeu_si128((__m128i *)(dest + i), x);
+	}
+
+	pcm_kernel_table_generic.convert_float_to_24(dest + i, src + i,
+						     n - i);
+}
+
+/**
+ * Writes two frames to a stereo buffer, one value per frame.
+ */
+SSE2_FUNC
+static inline void
+sse2_store_stereo(int16_t *dest, __m128d value)
+{
+	const __m128i x = _mm_cvttpd_epi32(value);
+	const __m128i stereo = _mm_unpacklo_epi32(x, x);
+	_mm_storel_epi64((__m128i *)dest, _mm_packs_epi32(stereo, stereo));
+}
+
+SSE2_FUNC
+static inline void
+sse2_store_stereo(int32_t *dest, __m128d value)
+{
+	const __m128i x = _mm_cvttpd_epi32(value);
+	_mm_storeu_si128((__m128i *)dest, _mm_unpacklo_epi32(x, x));
+}
+
+SSE2_FUNC
+static inline void
+sse2_store_stereo(float *dest, __m128d value)
+{
+	const __m128 x = _mm_cvtpd_ps(value);
+	_mm_storeu_ps(dest, _mm_unpacklo_ps(x, x));
+}
+
+/**
+ * Mixes two frames at a time.  The sum and the quotient are
+ * calculated in double precision; for integer samples, this is exact
+ * enough to truncate to the same result as the integer division of
+ * the generic code.
+ */
+template<typename T, enum sample_format format>
+SSE2_FUNC
+static void
+sse2_downmix(void *_dest, const void *_src, size_t n, unsigned src_channels)
+{
+	T *dest = (T *)_dest;
+	const T *src = (const T *)_src;
+
+	const __m128d divisor = _mm_set1_pd(src_channels);
+
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		const T *frame0 = src + i * src_channels;
+		const T *frame1 = frame0 + src_channels;
+
+		__m128d sum = _mm_setzero_pd();
+		for (unsigned c = 0; c < src_channels; ++c)
+			sum = _mm_add_pd(sum, _mm_set_pd(frame1[c],
+							 frame0[c]));
+
+		sse2_store_stereo(dest + i * 2, _mm_div_pd(sum, divisor));
+	}
+
+	pcm_kernel_table_downmix(pcm_kernel_table_generic, format)
+		(dest + i * 2, src + i * src_channels, n - i, src_channels);
+}
+
+/**
+ * A faster variant of sse2_downmix() for 16 and 24 bit samples,
+ * whose sum fits into 32 bit integers: four frames at a time, and
+ * only the sum is converted to double precision.
+ */
+template<typename T, enum sample_format format>
+SSE2_FUNC
+static void
+sse2_downmix_int(void *_dest, const void *_src, size_t n,
+		 unsigned src_channels)
+{
+	T *dest = (T *)_dest;
+	const T *src = (const T *)_src;
+
+	const __m128d divisor = _mm_set1_pd(src_channels);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const T *frame0 = src + i * src_channels;
+		const T *frame1 = frame0 + src_channels;
+		const T *frame2 = frame1 + src_channels;
+		const T *frame3 = frame2 + src_channels;
+
+		__m128i sum = _mm_setzero_si128();
+		for (unsigned c = 0; c < src_channels; ++c)
+			sum = _mm_add_epi32(sum, _mm_set_epi32(frame3[c],
+							       frame2[c],
+							       frame1[c],
+							       frame0[c]));
+
+		const __m128d lo = _mm_cvtepi32_pd(sum);
+		const __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(sum, 8));
+		sse2_store_stereo(dest + i * 2, _mm_div_pd(lo, divisor));
+		sse2_store_stereo(dest + i * 2 + 4, _mm_div_pd(hi, divisor));
+	}
+
+	pcm_kernel_table_downmix(pcm_kernel_table_generic, format)
+		(dest + i * 2, src + i * src_channels, n - i, src_channels);
+}
+
+static constexpr struct pcm_kernel_table pcm_kernel_table_sse2 = {
+	"sse2",
+	sse2_convert_16_to_32<8>,
+	sse2_convert_16_to_32<16>,
+	sse2_convert_24_to_32,
+	sse2_convert_32_to_24,
+	sse2_convert_8_to_float,
+	sse2_convert_16_to_float,
+	sse2_convert_32_to_float<24>,
+	sse2_convert_32_to_float<32>,
+	sse2_convert_float_to_16,
+	sse2_convert_float_to_24,
+	sse2_downmix_int<int16_t, SAMPLE_FORMAT_S16>,
+	sse2_downmix_int<int32_t, SAMPLE_FORMAT_S24_P32>,
+	sse2_downmix<int32_t, SAMPLE_FORMAT_S32>,
+	sse2_downmix<float, SAMPLE_FORMAT_FLOAT>,
+};
+
+/*
+ * AVX2
+ *
+ */
+
+template<unsigned shift>
+AVX2_FUNC
+static void
+avx2_convert_16_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_slli_epi32(x, shift));
+	}
+
+	if (shift == 8)
+		pcm_kernel_table_generic.convert_16_to_24(dest + i, src + i,
+							  n - i);
+	else
+		pcm_kernel_table_generic.convert_16_to_32(dest + i, src + i,
+							  n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_24_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_slli_epi32(x, 8));
+	}
+
+	pcm_kernel_table_generic.convert_24_to_32(dest + i, src + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_32_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_srai_epi32(x, 8));
+	}
+
+	pcm_kernel_table_generic.convert_32_to_24(dest + i, src + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_8_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int8_t *src = (const int8_t *)_src;
+
+	const __m256 factor = _mm256_set1_ps(0.5 / (1 << 6));
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dest + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), factor));
+	}
+
+	pcm_kernel_table_generic.convert_8_to_float(dest + i, src + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_16_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	const __m256 factor = _mm256_set1_ps(0.5 / (1 << 14));
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dest + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), factor));
+	}
+
+	pcm_kernel_table_generic.convert_16_to_float(dest + i, src + i,
+						     n - i);
+}
+
+template<unsigned bits>
+AVX2_FUNC
+static void
+avx2_convert_32_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	const __m256 factor = _mm256_set1_ps(0.5 / (1 << (bits - 2)));
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x =
+			_mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_ps(dest + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), factor));
+	}
+
+	if (bits == 24)
+		pcm_kernel_table_generic.convert_24_to_float(dest + i, src + i,
+							     n - i);
+	else
+		pcm_kernel_table_generic.convert_32_to_float(dest + i, src + i,
+							     n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_float_to_16(void *_dest, const void *_src, size_t n)
+{
+	int16_t *dest = (int16_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const __m256 factor = _mm256_set1_ps(1 << 15);
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i lo =
+			_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i),
+							  factor));
+		const __m256i hi =
+			_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8),
+							  factor));
+
+		/* _mm256_packs_epi32() works on each 128 bit half;
+		   restore the order of the 64 bit quarters */
+		const __m256i packed = _mm256_packs_epi32(lo, hi);
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_permute4x64_epi64(packed,
+							     _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	pcm_kernel_table_generic.convert_float_to_16(dest + i, src + i,
+						     n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_convert_float_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const __m256 factor = _mm256_set1_ps(1 << 23);
+	const __m256i min = _mm256_set1_epi32(-0x800000);
+	const __m256i max = _mm256_set1_epi32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i x =
+			_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i),
+							  factor));
+		x = _mm256_max_epi32(_mm256_min_epi32(x, max), min);
+		_mm256_storeu_si256((__m256i *)(dest + i), x);
+	}
+
+	pcm_kernel_table_generic.convert_float_to_24(dest + i, src + i,
+						     n - i);
+}
+
+/**
+ * Writes four frames to a stereo buffer, one value per frame.
+ */
+AVX2_FUNC
+static inline void
+avx2_store_stereo(int16_t *dest, __m256d value)
+{
+	const __m128i x = _mm256_cvttpd_epi32(value);
+	_mm_storeu_si128((__m128i *)dest,
+			 _mm_packs_epi32(_mm_unpacklo_epi32(x, x),
+					 _mm_unpackhi_epi32(x, x)));
+}
+
+AVX2_FUNC
+static inline void
+avx2_store_stereo(int32_t *dest, __m256d value)
+{
+	const __m128i x = _mm256_cvttpd_epi32(value);
+	_mm_storeu_si128((__m128i *)dest, _mm_unpacklo_epi32(x, x));
+	_mm_storeu_si128((__m128i *)(dest + 4), _mm_unpackhi_epi32(x, x));
+}
+
+AVX2_FUNC
+static inline void
+avx2_store_stereo(float *dest, __m256d value)
+{
+	const __m128 x = _mm256_cvtpd_ps(value);
+	_mm_storeu_ps(dest, _mm_unpacklo_ps(x, x));
+	_mm_storeu_ps(dest + 4, _mm_unpackhi_ps(x, x));
+}
+
+/**
+ * Mixes four frames at a time; see sse2_downmix().
+ */
+template<typename T, enum sample_format format>
+AVX2_FUNC
+static void
+avx2_downmix(void *_dest, const void *_src, size_t n, unsigned src_channels)
+{
+	T *dest = (T *)_dest;
+	const T *src = (const T *)_src;
+
+	const __m256d divisor = _mm256_set1_pd(src_channels);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const T *frame0 = src + i * src_channels;
+		const T *frame1 = frame0 + src_channels;
+		const T *frame2 = frame1 + src_channels;
+		const T *frame3 = frame2 + src_channels;
+
+		__m256d sum = _mm256_setzero_pd();
+		for (unsigned c = 0; c < src_channels; ++c)
+			sum = _mm256_add_pd(sum, _mm256_set_pd(frame3[c],
+							       frame2[c],
+							       frame1[c],
+							       frame0[c]));
+
+		avx2_store_stereo(dest + i * 2, _mm256_div_pd(sum, divisor));
+	}
+
+	pcm_kernel_table_downmix(pcm_kernel_table_generic, format)
+		(dest + i * 2, src + i * src_channels, n - i, src_channels);
+}
+
+/**
+ * A faster variant of avx2_downmix() for 16 and 24 bit samples; see
+ * sse2_downmix_int().
+ */
+template<typename T, enum sample_format format>
+AVX2_FUNC
+static void
+avx2_downmix_int(void *_dest, const void *_src, size_t n,
+		 unsigned src_channels)
+{
+	T *dest = (T *)_dest;
+	const T *src = (const T *)_src;
+
+	const __m256d divisor = _mm256_set1_pd(src_channels);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const T *frame = src + i * src_channels;
+		const size_t stride = src_channels;
+
+		__m256i sum = _mm256_setzero_si256();
+		for (unsigned c = 0; c < src_channels; ++c)
+			sum = _mm256_add_epi32(sum,
+					       _mm256_set_epi32(frame[7 * stride + c],
+								frame[6 * stride + c],
+								frame[5 * stride + c],
+								frame[4 * stride + c],
+								frame[3 * stride + c],
+								frame[2 * stride + c],
+								frame[stride + c],
+								frame[c]));
+
+		const __m256d lo =
+			_mm256_cvtepi32_pd(_mm256_castsi256_si128(sum));
+		const __m256d hi =
+			_mm256_cvtepi32_pd(_mm256_extracti128_si256(sum, 1));
+		avx2_store_stereo(dest + i * 2, _mm256_div_pd(lo, divisor));
+		avx2_store_stereo(dest + i * 2 + 8,
+				  _mm256_div_pd(hi, divisor));
+	}
+
+	pcm_kernel_table_downmix(pcm_kernel_table_generic, format)
+		(dest + i * 2, src + i * src_channels, n - i, src_channels);
+}
+
+static constexpr struct pcm_kernel_table pcm_kernel_table_avx2 = {
+	"avx2",
+	avx2_convert_16_to_32<8>,
+	avx2_convert_16_to_32<16>,
+	avx2_convert_24_to_32,
+	avx2_convert_32_to_24,
+	avx2_convert_8_to_float,
+	avx2_convert_16_to_float,
+	avx2_convert_32_to_float<24>,
+	avx2_convert_32_to_float<32>,
+	avx2_convert_float_to_16,
+	avx2_convert_float_to_24,
+	avx2_downmix_int<int16_t, SAMPLE_FORMAT_S16>,
+	avx2_downmix_int<int32_t, SAMPLE_FORMAT_S24_P32>,
+	avx2_downmix<int32_t, SAMPLE_FORMAT_S32>,
+	avx2_downmix<float, SAMPLE_FORMAT_FLOAT>,
+};
+
+#endif /* PCM_HAVE_X86_SIMD */
+
+#ifdef PCM_HAVE_NEON
+
+template<unsigned shift>
+static void
+neon_convert_16_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int16x8_t x = vld1q_s16(src + i);
+		vst1q_s32(dest + i, vshll_n_s16(vget_low_s16(x), shift));
+		vst1q_s32(dest + i + 4, vshll_n_s16(vget_high_s16(x), shift));
+	}
+
+	if (shift == 8)
+		pcm_kernel_table_generic.convert_16_to_24(dest + i, src + i,
+							  n - i);
+	else
+		pcm_kernel_table_generic.convert_16_to_32(dest + i, src + i,
+							  n - i);
+}
+
+static void
+neon_convert_24_to_32(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_s32(dest + i, vshlq_n_s32(vld1q_s32(src + i), 8));
+
+	pcm_kernel_table_generic.convert_24_to_32(dest + i, src + i, n - i);
+}
+
+static void
+neon_convert_32_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_s32(dest + i, vshrq_n_s32(vld1q_s32(src + i), 8));
+
+	pcm_kernel_table_generic.convert_32_to_24(dest + i, src + i, n - i);
+}
+
+static void
+neon_convert_8_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int8_t *src = (const int8_t *)_src;
+
+	const float factor = 0.5 / (1 << 6);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int16x8_t x = vmovl_s8(vld1_s8(src + i));
+		const int32x4_t lo = vmovl_s16(vget_low_s16(x));
+		const int32x4_t hi = vmovl_s16(vget_high_s16(x));
+		vst1q_f32(dest + i, vmulq_n_f32(vcvtq_f32_s32(lo), factor));
+		vst1q_f32(dest + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), factor));
+	}
+
+	pcm_kernel_table_generic.convert_8_to_float(dest + i, src + i, n - i);
+}
+
+static void
+neon_convert_16_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int16_t *src = (const int16_t *)_src;
+
+	const float factor = 0.5 / (1 << 14);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int16x8_t x = vld1q_s16(src + i);
+		const int32x4_t lo = vmovl_s16(vget_low_s16(x));
+		const int32x4_t hi = vmovl_s16(vget_high_s16(x));
+		vst1q_f32(dest + i, vmulq_n_f32(vcvtq_f32_s32(lo), factor));
+		vst1q_f32(dest + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), factor));
+	}
+
+	pcm_kernel_table_generic.convert_16_to_float(dest + i, src + i,
+						     n - i);
+}
+
+template<unsigned bits>
+static void
+neon_convert_32_to_float(void *_dest, const void *_src, size_t n)
+{
+	float *dest = (float *)_dest;
+	const int32_t *src = (const int32_t *)_src;
+
+	const float factor = 0.5 / (1 << (bits - 2));
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dest + i,
+			  vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)),
+				      factor));
+
+	if (bits == 24)
+		pcm_kernel_table_generic.convert_24_to_float(dest + i, src + i,
+							     n - i);
+	else
+		pcm_kernel_table_generic.convert_32_to_float(dest + i, src + i,
+							     n - i);
+}
+
+static void
+neon_convert_float_to_16(void *_dest, const void *_src, size_t n)
+{
+	int16_t *dest = (int16_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const float factor = 1 << 15;
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		/* vcvtq_s32_f32() truncates and saturates like the
+		   scalar conversion on ARM; vqmovn_s32() clamps to 16
+		   bit */
+		const int32x4_t lo =
+			vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), factor));
+		const int32x4_t hi =
+			vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4),
+						  factor));
+		vst1q_s16(dest + i, vcombine_s16(vqmovn_s32(lo),
+						 vqmovn_s32(hi)));
+	}
+
+	pcm_kernel_table_generic.convert_float_to_16(dest + i, src + i,
+						     n - i);
+}
+
+static void
+neon_convert_float_to_24(void *_dest, const void *_src, size_t n)
+{
+	int32_t *dest = (int32_t *)_dest;
+	const float *src = (const float *)_src;
+
+	const float factor = 1 << 23;
+	const int32x4_t min = vdupq_n_s32(-0x800000);
+	const int32x4_t max = vdupq_n_s32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const int32x4_t x =
+			vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), factor));
+		vst1q_s32(dest + i, vmaxq_s32(vminq_s32(x, max), min));
+	}
+
+	pcm_kernel_table_generic.convert_float_to_24(dest + i, src + i,
+						     n - i);
+}
+
+/**
+ * 32 bit ARM has no double precision vectors; this calls the generic
+ * downmix kernel.
+ */
+template<enum sample_format format>
+static void
+neon_downmix(void *dest, const void *src, size_t n, unsigned src_channels)
+{
+	pcm_kernel_table_downmix(pcm_kernel_table_generic, format)
+		(dest, src, n, src_channels);
+}
+
+static constexpr struct pcm_kernel_table pcm_kernel_table_neon = {
+	"neon",
+	neon_convert_16_to_32<8>,
+	neon_convert_16_to_32<16>,
+	neon_convert_24_to_32,
+	neon_convert_32_to_24,
+	neon_convert_8_to_float,
+	neon_convert_16_to_float,
+	neon_convert_32_to_float<24>,
+	neon_convert_32_to_float<32>,
+	neon_convert_float_to_16,
+	neon_convert_float_to_24,
+	neon_downmix<SAMPLE_FORMAT_S16>,
+	neon_downmix<SAMPLE_FORMAT_S24_P32>,
+	neon_downmix<SAMPLE_FORMAT_S32>,
+	neon_downmix<SAMPLE_FORMAT_FLOAT>,
+};
+
+#endif /* PCM_HAVE_NEON */
+
+const struct pcm_kernel_table *
+pcm_kernel_table_simd(unsigned feature)
+{
+	switch (feature) {
+#ifdef PCM_HAVE_X86_SIMD
+	case PCM_CPU_SSE2:
+		return &pcm_kernel_table_sse2;
+
+	case PCM_CPU_AVX2:
+		return &pcm_kernel_table_avx2;
+#endif
+
+#ifdef PCM_HAVE_NEON
+	case PCM_CPU_NEON:
+		return &pcm_kernel_table_neon;
+#endif
+
+	default:
+		return nullptr;
+	}
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2003-2011 The Music Player Daemon Project
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
  * http://www.musicpd.org
  *
  * This program is free software; you can redistribute it and/or modify
@@ -19,10 +19,13 @@
 
 #include "config.h"
 #include "PcmMix.hxx"
+#include "PcmMixKernels.hxx"
+#include "PcmCpu.hxx"
 #include "PcmVolume.hxx"
 #include "PcmUtils.hxx"
 #include "audio_format.h"
 
+#include <assert.h>
 #include <math.h>
 
 template<typename T, typename U, unsigned bits>
@@ -40,42 +43,82 @@ PcmAddVolume(T _a, T _b, int volume1, int volume2)
 
 template<typename T, typename U, unsigned bits>
 static void
-PcmAddVolume(T *a, const T *b, unsigned n, int volume1, int volume2)
+PcmAddVolume(T *dest, const T *a, const T *b, size_t n,
+	     int volume1, int volume2)
 {
 	for (size_t i = 0; i != n; ++i)
-		a[i] = PcmAddVolume<T, U, bits>(a[i], b[i], volume1, volume2);
+		dest[i] = PcmAddVolume<T, U, bits>(a[i], b[i],
+						   volume1, volume2);
 }
 
-template<typename T, typename U, unsigned bits>
 static void
-PcmAddVolumeVoid(void *a, const void *b, size_t size, int volume1, int volume2)
+pcm_add_vol_float(float *dest, const float *buffer1, const float *buffer2,
+		  size_t num_samples, float volume1, float volume2)
 {
-	constexpr size_t sample_size = sizeof(T);
-	assert(size % sample_size == 0);
+	while (num_samples > 0) {
+		float sample1 = *buffer1++;
+		float sample2 = *buffer2++;
+
+		*dest++ = (sample1 * volume1 + sample2 * volume2);
+		--num_samples;
+	}
+}
 
-	PcmAddVolume<T, U, bits>((T *)a, (const T *)b, size / sample_size,
-				 volume1, volume2);
+template<typename T, typename U, unsigned bits>
+static T
+PcmAdd(T _a, T _b)
+{
+	U a(_a), b(_b);
+	return PcmClamp<T, U, bits>(a + b);
 }
 
+template<typename T, typename U, unsigned bits>
 static void
-pcm_add_vol_float(float *buffer1, const float *buffer2,
-		  unsigned num_samples, float volume1, float volume2)
+PcmAdd(T *dest, const T *a, const T *b, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+		dest[i] = PcmAdd<T, U, bits>(a[i], b[i]);
+}
+
+static void
+pcm_add_float(float *dest, const float *buffer1, const float *buffer2,
+	      size_t num_samples)
 {
 	while (num_samples > 0) {
-		float sample1 = *buffer1;
+		float sample1 = *buffer1++;
 		float sample2 = *buffer2++;
-
-		sample1 = (sample1 * volume1 + sample2 * volume2);
-		*buffer1++ = sample1;
+		*dest++ = sample1 + sample2;
 		--num_samples;
 	}
 }
 
+const PcmMixKernels pcm_mix_kernels_generic = {
+	"generic",
+	PcmAdd<int16_t, int32_t, 16>,
+	PcmAdd<int32_t, int64_t, 24>,
+	PcmAdd<int32_t, int64_t, 32>,
+	pcm_add_float,
+	PcmAddVolume<int16_t, int32_t, 16>,
+	PcmAddVolume<int32_t, int64_t, 24>,
+	PcmAddVolume<int32_t, int64_t, 32>,
+	pcm_add_vol_float,
+};
+
+const PcmMixKernels &
+pcm_mix_kernels(void)
+{
+	return pcm_cpu_select_kernels<PcmMixKernels,
+				      pcm_mix_kernels_generic,
+				      pcm_mix_kernels_simd>();
+}
+
 static bool
-pcm_add_vol(void *buffer1, const void *buffer2, size_t size,
-	    int vol1, int vol2,
+pcm_add_vol(void *dest, const void *buffer1, const void *buffer2,
+	    size_t size, int vol1, int vol2,
 	    enum sample_format format)
 {
+	const PcmMixKernels &kernels = pcm_mix_kernels();
+
 	switch (format) {
 	case SAMPLE_FORMAT_UNDEFINED:
 	case SAMPLE_FORMAT_DSD:
@@ -83,30 +126,40 @@ pcm_add_vol(void *buffer1, const void *buffer2, size_t size,
 		return false;
 
 	case SAMPLE_FORMAT_S8:
-		PcmAddVolumeVoid<int8_t, int32_t, 8>(buffer1, buffer2, size,
-						     vol1, vol2);
+		PcmAddVolume<int8_t, int32_t, 8>((int8_t *)dest,
+						 (const int8_t *)buffer1,
+						 (const int8_t *)buffer2,
+						 size, vol1, vol2);
 		return true;
 
 	case SAMPLE_FORMAT_S16:
-		PcmAddVolumeVoid<int16_t, int32_t, 16>(buffer1, buffer2, size,
-						       vol1, vol2);
+		assert(size % sizeof(int16_t) == 0);
+		kernels.add_vol_16((int16_t *)dest, (const int16_t *)buffer1,
+				   (const int16_t *)buffer2,
+				   size / sizeof(int16_t), vol1, vol2);
 		return true;
 
 	case SAMPLE_FORMAT_S24_P32:
-		PcmAddVolumeVoid<int32_t, int64_t, 24>(buffer1, buffer2, size,
-						       vol1, vol2);
+		assert(size % sizeof(int32_t) == 0);
+		kernels.add_vol_24((int32_t *)dest, (const int32_t *)buffer1,
+				   (const int32_t *)buffer2,
+				   size / sizeof(int32_t), vol1, vol2);
 		return true;
 
 	case SAMPLE_FORMAT_S32:
-		PcmAddVolumeVoid<int32_t, int64_t, 32>(buffer1, buffer2, size,
-						       vol1, vol2);
+		assert(size % sizeof(int32_t) == 0);
+		kernels.add_vol_32((int32_t *)dest, (const int32_t *)buffer1,
+				   (const int32_t *)buffer2,
+				   size / sizeof(int32_t), vol1, vol2);
 		return true;
 
 	case SAMPLE_FORMAT_FLOAT:
-		pcm_add_vol_float((float *)buffer1, (const float *)buffer2,
-				  size / 4,
-				  pcm_volume_to_float(vol1),
-				  pcm_volume_to_float(vol2));
+		assert(size % sizeof(float) == 0);
+		kernels.add_vol_float((float *)dest, (const float *)buffer1,
+				      (const float *)buffer2,
+				      size / sizeof(float),
+				      pcm_volume_to_float(vol1),
+				      pcm_volume_to_float(vol2));
 		return true;
 	}
 
@@ -115,47 +168,12 @@ pcm_add_vol(void *buffer1, const void *buffer2, size_t size,
 	return false;
 }
 
-template<typename T, typename U, unsigned bits>
-static T
-PcmAdd(T _a, T _b)
-{
-	U a(_a), b(_b);
-	return PcmClamp<T, U, bits>(a + b);
-}
-
-template<typename T, typename U, unsigned bits>
-static void
-PcmAdd(T *a, const T *b, unsigned n)
-{
-	for (size_t i = 0; i != n; ++i)
-		a[i] = PcmAdd<T, U, bits>(a[i], b[i]);
-}
-
-template<typename T, typename U, unsigned bits>
-static void
-PcmAddVoid(void *a, const void *b, size_t size)
-{
-	constexpr size_t sample_size = sizeof(T);
-	assert(size % sample_size == 0);
-
-	PcmAdd<T, U, bits>((T *)a, (const T *)b, size / sample_size);
-}
-
-static void
-pcm_add_float(float *buffer1, const float *buffer2, unsigned num_samples)
-{
-	while (num_samples > 0) {
-		float sample1 = *buffer1;
-		float sample2 = *buffer2++;
-		*buffer1++ = sample1 + sample2;
-		--num_samples;
-	}
-}
-
 static bool
-pcm_add(void *buffer1, const void *buffer2, size_t size,
+pcm_add(void *dest, const void *buffer1, const void *buffer2, size_t size,
 	enum sample_format format)
 {
+	const PcmMixKernels &kernels = pcm_mix_kernels();
+
 	switch (format) {
 	case SAMPLE_FORMAT_UNDEFINED:
 	case SAMPLE_FORMAT_DSD:
@@ -163,24 +181,37 @@ pcm_add(void *buffer1, const void *buffer2, size_t size,
 		return false;
 
 	case SAMPLE_FORMAT_S8:
-		PcmAddVoid<int8_t, int32_t, 8>(buffer1, buffer2, size);
+		PcmAdd<int8_t, int32_t, 8>((int8_t *)dest,
+					   (const int8_t *)buffer1,
+					   (const int8_t *)buffer2, size);
 		return true;
 
 	case SAMPLE_FORMAT_S16:
-		PcmAddVoid<int16_t, int32_t, 16>(buffer1, buffer2, size);
+		assert(size % sizeof(int16_t) == 0);
+		kernels.add_16((int16_t *)dest, (const int16_t *)buffer1,
+			       (const int16_t *)buffer2,
+			       size / sizeof(int16_t));
 		return true;
 
 	case SAMPLE_FORMAT_S24_P32:
-		PcmAddVoid<int32_t, int64_t, 24>(buffer1, buffer2, size);
+		assert(size % sizeof(int32_t) == 0);
+		kernels.add_24((int32_t *)dest, (const int32_t *)buffer1,
+			       (const int32_t *)buffer2,
+			       size / sizeof(int32_t));
 		return true;
 
 	case SAMPLE_FORMAT_S32:
-		PcmAddVoid<int32_t, int64_t, 32>(buffer1, buffer2, size);
+		assert(size % sizeof(int32_t) == 0);
+		kernels.add_32((int32_t *)dest, (const int32_t *)buffer1,
+			       (const int32_t *)buffer2,
+			       size / sizeof(int32_t));
 		return true;
 
 	case SAMPLE_FORMAT_FLOAT:
-		pcm_add_float((float *)buffer1, (const float *)buffer2,
-			      size / 4);
+		assert(size % sizeof(float) == 0);
+		kernels.add_float((float *)dest, (const float *)buffer1,
+				  (const float *)buffer2,
+				  size / sizeof(float));
 		return true;
 	}
 
@@ -190,8 +221,8 @@ pcm_add(void *buffer1, const void *buffer2, size_t size,
 }
 
 bool
-pcm_mix(void *buffer1, const void *buffer2, size_t size,
-	enum sample_format format, float portion1)
+pcm_mix_to(void *dest, const void *buffer1, const void *buffer2,
+	   size_t size, enum sample_format format, float portion1)
 {
 	int vol1;
 	float s;
@@ -199,7 +230,7 @@ pcm_mix(void *buffer1, const void *buffer2, size_t size,
 	/* portion1 is between 0.0 and 1.0 for crossfading, MixRamp uses NaN
 	 * to signal mixing rather than fading */
 	if (isnan(portion1))
-		return pcm_add(buffer1, buffer2, size, format);
+		return pcm_add(dest, buffer1, buffer2, size, format);
 
 	s = sin(M_PI_2 * portion1);
 	s *= s;
@@ -207,5 +238,13 @@ pcm_mix(void *buffer1, const void *buffer2, size_t size,
 	vol1 = s * PCM_VOLUME_1 + 0.5;
 	vol1 = vol1 > PCM_VOLUME_1 ? PCM_VOLUME_1 : (vol1 < 0 ? 0 : vol1);
 
-	return pcm_add_vol(buffer1, buffer2, size, vol1, PCM_VOLUME_1 - vol1, format);
+	return pcm_add_vol(dest, buffer1, buffer2, size,
+			   vol1, PCM_VOLUME_1 - vol1, format);
+}
+
+bool
+pcm_mix(void *buffer1, const void *buffer2, size_t size,
+	enum sample_format format, float portion1)
+{
+	return pcm_mix_to(buffer1, buffer1, buffer2, size, format, portion1);
 }
@@ -46,4 +46,16 @@ bool
 pcm_mix(void *buffer1, const void *buffer2, size_t size,
 	enum sample_format format, float portion1);
 
+/**
+ * Like pcm_mix(), but writes the result to a separate buffer, so the
+ * caller doesn't need to copy #buffer1 first.
+ *
+ * @param dest the destination buffer; it may be equal to #buffer1,
+ * but must not overlap otherwise
+ */
+gcc_warn_unused_result
+bool
+pcm_mix_to(void *dest, const void *buffer1, const void *buffer2,
+	   size_t size, enum sample_format format, float portion1);
+
 #endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Internal interface between PcmMix.cxx and the SIMD implementations
+ * of its inner loops.
+ */
+
+#ifndef MPD_PCM_MIX_KERNELS_HXX
+#define MPD_PCM_MIX_KERNELS_HXX
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The inner loops of pcm_mix_to() for one instruction set.  All of
+ * them process #n samples; #dest may be equal to #a.
+ *
+ * The "add" kernels return exactly the same results as the generic
+ * C++ code.  The integer "add_vol" kernels use the same formula, but
+ * their dither values come from a different random sequence.
+ * add_vol_float() may differ in the last bit, if the compiler has
+ * contracted the generic code to fused multiply-add instructions.
+ */
+struct PcmMixKernels {
+	const char *name;
+
+	void (*add_16)(int16_t *dest, const int16_t *a, const int16_t *b,
+		       size_t n);
+	void (*add_24)(int32_t *dest, const int32_t *a, const int32_t *b,
+		       size_t n);
+	void (*add_32)(int32_t *dest, const int32_t *a, const int32_t *b,
+		       size_t n);
+	void (*add_float)(float *dest, const float *a, const float *b,
+			  size_t n);
+
+	void (*add_vol_16)(int16_t *dest, const int16_t *a, const int16_t *b,
+			   size_t n, int vol1, int vol2);
+	void (*add_vol_24)(int32_t *dest, const int32_t *a, const int32_t *b,
+			   size_t n, int vol1, int vol2);
+	void (*add_vol_32)(int32_t *dest, const int32_t *a, const int32_t *b,
+			   size_t n, int vol1, int vol2);
+	void (*add_vol_float)(float *dest, const float *a, const float *b,
+			      size_t n, float vol1, float vol2);
+};
+
+/**
+ * The portable implementation.
+ */
+extern const PcmMixKernels pcm_mix_kernels_generic;
+
+/**
+ * Returns the SIMD kernels for the specified instruction set
+ * (#PCM_CPU_SSE2, #PCM_CPU_AVX2 or #PCM_CPU_NEON), or nullptr if they
+ * have not been compiled.
+ */
+const PcmMixKernels *
+pcm_mix_kernels_simd(unsigned feature);
+
+/**
+ * Returns the fastest kernels supported by this CPU.
+ */
+const PcmMixKernels &
+pcm_mix_kernels(void);
+
+#endif
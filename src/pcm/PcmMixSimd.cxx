@@ -0,0 +1,597 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * SIMD implementations of the pcm_mix() inner loops.  Each kernel
+ * processes as many samples as fit into its vector registers, and
+ * leaves the rest to the generic implementation.
+ *
+ * The integer "add_vol" kernels compute exactly the formula of
+ * PcmAddVolume(): 16 bit samples with 32 bit integers, 24 and 32 bit
+ * samples with double precision floating point, which represents
+ * all intermediate values exactly.
+ */
+
+#include "config.h"
+#include "PcmMixKernels.hxx"
+#include "PcmSimd.hxx"
+
+#if defined(PCM_HAVE_X86_SIMD) || defined(PCM_HAVE_NEON)
+
+/**
+ * The state of the dither PRNG of the SIMD kernels.
+ */
+static uint32_t pcm_mix_dither_state;
+
+#endif
+
+#ifdef PCM_HAVE_X86_SIMD
+
+/*
+ * SSE2
+ *
+ */
+
+SSE2_FUNC
+static void
+sse2_add_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_adds_epi16(x, y));
+	}
+
+	pcm_mix_kernels_generic.add_16(dest + i, a + i, b + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_add_24(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	const __m128i min = _mm_set1_epi32(-0x800000);
+	const __m128i max = _mm_set1_epi32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+
+		/* 24 bit samples cannot overflow here */
+		__m128i s = _mm_add_epi32(x, y);
+		s = sse2_select(_mm_cmpgt_epi32(s, max), max, s);
+		s = sse2_select(_mm_cmplt_epi32(s, min), min, s);
+		_mm_storeu_si128((__m128i *)(dest + i), s);
+	}
+
+	pcm_mix_kernels_generic.add_24(dest + i, a + i, b + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_add_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	const __m128i max = _mm_set1_epi32(0x7fffffff);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		const __m128i s = _mm_add_epi32(x, y);
+
+		/* the sum has overflowed if its sign differs from
+		   the signs of both operands; then saturate in the
+		   direction of the operands */
+		const __m128i overflow =
+			_mm_srai_epi32(_mm_and_si128(_mm_xor_si128(x, s),
+						     _mm_xor_si128(y, s)),
+				       31);
+		const __m128i saturated =
+			_mm_xor_si128(_mm_srai_epi32(x, 31), max);
+		_mm_storeu_si128((__m128i *)(dest + i),
+				 sse2_select(overflow, saturated, s));
+	}
+
+	pcm_mix_kernels_generic.add_32(dest + i, a + i, b + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_add_float(float *dest, const float *a, const float *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(a + i),
+						   _mm_loadu_ps(b + i)));
+
+	pcm_mix_kernels_generic.add_float(dest + i, a + i, b + i, n - i);
+}
+
+SSE2_FUNC
+static void
+sse2_add_vol_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n,
+		int vol1, int vol2)
+{
+	/* pairs of (vol1, vol2) for _mm_madd_epi16() */
+	const __m128i v = _mm_set1_epi32(vol1 | (vol2 << 16));
+	__m128i state = sse2_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, y), v);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, y), v);
+		lo = _mm_add_epi32(lo, sse2_dither_next(state));
+		hi = _mm_add_epi32(hi, sse2_dither_next(state));
+
+		/* _mm_packs_epi32() clamps to 16 bit */
+		_mm_storeu_si128((__m128i *)(dest + i),
+				 _mm_packs_epi32(sse2_div_volume(lo),
+						 sse2_div_volume(hi)));
+	}
+
+	pcm_mix_dither_state = sse2_dither_end(state);
+
+	pcm_mix_kernels_generic.add_vol_16(dest + i, a + i, b + i, n - i,
+					   vol1, vol2);
+}
+
+/**
+ * Mixes two pairs of samples in double precision, and returns the
+ * clamped results.
+ */
+template<unsigned bits>
+SSE2_FUNC
+static inline __m128i
+sse2_add_vol_pd(__m128i x, __m128i y, __m128i d, __m128d v1, __m128d v2)
+{
+	const __m128d t = _mm_add_pd(sse2_volume_pd(x, v1, d),
+				     sse2_volume_pd(y, v2, _mm_setzero_si128()));
+	return sse2_clamp_pd<bits>(t);
+}
+
+template<unsigned bits>
+SSE2_FUNC
+static void
+sse2_add_vol_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n,
+		int vol1, int vol2)
+{
+	const __m128d v1 = _mm_set1_pd(vol1), v2 = _mm_set1_pd(vol2);
+	__m128i state = sse2_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		const __m128i d = sse2_dither_next(state);
+
+		const __m128i lo = sse2_add_vol_pd<bits>(x, y, d, v1, v2);
+		const __m128i hi =
+			sse2_add_vol_pd<bits>(_mm_srli_si128(x, 8),
+					      _mm_srli_si128(y, 8),
+					      _mm_srli_si128(d, 8),
+					      v1, v2);
+		_mm_storeu_si128((__m128i *)(dest + i),
+				 _mm_unpacklo_epi64(lo, hi));
+	}
+
+	pcm_mix_dither_state = sse2_dither_end(state);
+
+	if (bits == 24)
+		pcm_mix_kernels_generic.add_vol_24(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+	else
+		pcm_mix_kernels_generic.add_vol_32(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+}
+
+SSE2_FUNC
+static void
+sse2_add_vol_float(float *dest, const float *a, const float *b, size_t n,
+		   float vol1, float vol2)
+{
+	const __m128 v1 = _mm_set1_ps(vol1), v2 = _mm_set1_ps(vol2);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128 x = _mm_mul_ps(_mm_loadu_ps(a + i), v1);
+		const __m128 y = _mm_mul_ps(_mm_loadu_ps(b + i), v2);
+		_mm_storeu_ps(dest + i, _mm_add_ps(x, y));
+	}
+
+	pcm_mix_kernels_generic.add_vol_float(dest + i, a + i, b + i, n - i,
+					      vol1, vol2);
+}
+
+static constexpr PcmMixKernels pcm_mix_kernels_sse2 = {
+	"sse2",
+	sse2_add_16,
+	sse2_add_24,
+	sse2_add_32,
+	sse2_add_float,
+	sse2_add_vol_16,
+	sse2_add_vol_32<24>,
+	sse2_add_vol_32<32>,
+	sse2_add_vol_float,
+};
+
+/*
+ * AVX2
+ *
+ */
+
+AVX2_FUNC
+static void
+avx2_add_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_adds_epi16(x, y));
+	}
+
+	pcm_mix_kernels_generic.add_16(dest + i, a + i, b + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_add_24(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	const __m256i min = _mm256_set1_epi32(-0x800000);
+	const __m256i max = _mm256_set1_epi32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		const __m256i s = _mm256_add_epi32(x, y);
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_min_epi32(_mm256_max_epi32(s, min),
+						     max));
+	}
+
+	pcm_mix_kernels_generic.add_24(dest + i, a + i, b + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_add_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	const __m256i max = _mm256_set1_epi32(0x7fffffff);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		const __m256i s = _mm256_add_epi32(x, y);
+
+		/* see sse2_add_32() */
+		const __m256i overflow =
+			_mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(x, s),
+							   _mm256_xor_si256(y, s)),
+					  31);
+		const __m256i saturated =
+			_mm256_xor_si256(_mm256_srai_epi32(x, 31), max);
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_blendv_epi8(s, saturated, overflow));
+	}
+
+	pcm_mix_kernels_generic.add_32(dest + i, a + i, b + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_add_float(float *dest, const float *a, const float *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dest + i,
+				 _mm256_add_ps(_mm256_loadu_ps(a + i),
+					       _mm256_loadu_ps(b + i)));
+
+	pcm_mix_kernels_generic.add_float(dest + i, a + i, b + i, n - i);
+}
+
+AVX2_FUNC
+static void
+avx2_add_vol_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n,
+		int vol1, int vol2)
+{
+	const __m256i v = _mm256_set1_epi32(vol1 | (vol2 << 16));
+	__m256i state = avx2_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		/* the unpack and pack instructions work on each 128
+		   bit lane separately: "lo" contains the samples 0-3
+		   and 8-11, "hi" contains 4-7 and 12-15 */
+		__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(x, y), v);
+		__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(x, y), v);
+		lo = _mm256_add_epi32(lo, avx2_dither_next(state));
+		hi = _mm256_add_epi32(hi, avx2_dither_next(state));
+
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    _mm256_packs_epi32(avx2_div_volume(lo),
+						       avx2_div_volume(hi)));
+	}
+
+	pcm_mix_dither_state = avx2_dither_end(state);
+
+	pcm_mix_kernels_generic.add_vol_16(dest + i, a + i, b + i, n - i,
+					   vol1, vol2);
+}
+
+/**
+ * Mixes four samples in double precision; see sse2_add_vol_pd().
+ */
+template<unsigned bits>
+AVX2_FUNC
+static inline __m128i
+avx2_add_vol_pd(__m128i x, __m128i y, __m128i d, __m256d v1, __m256d v2)
+{
+	const __m256d t = _mm256_add_pd(avx2_volume_pd(x, v1, d),
+					avx2_volume_pd(y, v2,
+						       _mm_setzero_si128()));
+	return avx2_clamp_pd<bits>(t);
+}
+
+template<unsigned bits>
+AVX2_FUNC
+static void
+avx2_add_vol_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n,
+		int vol1, int vol2)
+{
+	const __m256d v1 = _mm256_set1_pd(vol1), v2 = _mm256_set1_pd(vol2);
+	__m256i state = avx2_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i d = avx2_dither_next(state);
+
+		const __m128i lo =
+			avx2_add_vol_pd<bits>(_mm_loadu_si128((const __m128i *)(a + i)),
+					      _mm_loadu_si128((const __m128i *)(b + i)),
+					      _mm256_castsi256_si128(d),
+					      v1, v2);
+		const __m128i hi =
+			avx2_add_vol_pd<bits>(_mm_loadu_si128((const __m128i *)(a + i + 4)),
+					      _mm_loadu_si128((const __m128i *)(b + i + 4)),
+					      _mm256_extracti128_si256(d, 1),
+					      v1, v2);
+		_mm256_storeu_si256((__m256i *)(dest + i),
+				    avx2_combine(lo, hi));
+	}
+
+	pcm_mix_dither_state = avx2_dither_end(state);
+
+	if (bits == 24)
+		pcm_mix_kernels_generic.add_vol_24(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+	else
+		pcm_mix_kernels_generic.add_vol_32(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+}
+
+AVX2_FUNC
+static void
+avx2_add_vol_float(float *dest, const float *a, const float *b, size_t n,
+		   float vol1, float vol2)
+{
+	const __m256 v1 = _mm256_set1_ps(vol1), v2 = _mm256_set1_ps(vol2);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		/* no FMA: the result must be equal to the generic
+		   code's */
+		const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(a + i), v1);
+		const __m256 y = _mm256_mul_ps(_mm256_loadu_ps(b + i), v2);
+		_mm256_storeu_ps(dest + i, _mm256_add_ps(x, y));
+	}
+
+	pcm_mix_kernels_generic.add_vol_float(dest + i, a + i, b + i, n - i,
+					      vol1, vol2);
+}
+
+static constexpr PcmMixKernels pcm_mix_kernels_avx2 = {
+	"avx2",
+	avx2_add_16,
+	avx2_add_24,
+	avx2_add_32,
+	avx2_add_float,
+	avx2_add_vol_16,
+	avx2_add_vol_32<24>,
+	avx2_add_vol_32<32>,
+	avx2_add_vol_float,
+};
+
+#endif /* PCM_HAVE_X86_SIMD */
+
+#ifdef PCM_HAVE_NEON
+
+static void
+neon_add_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		vst1q_s16(dest + i, vqaddq_s16(vld1q_s16(a + i),
+					       vld1q_s16(b + i)));
+
+	pcm_mix_kernels_generic.add_16(dest + i, a + i, b + i, n - i);
+}
+
+static void
+neon_add_24(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	const int32x4_t min = vdupq_n_s32(-0x800000);
+	const int32x4_t max = vdupq_n_s32(0x7fffff);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const int32x4_t s = vaddq_s32(vld1q_s32(a + i),
+					      vld1q_s32(b + i));
+		vst1q_s32(dest + i, vminq_s32(vmaxq_s32(s, min), max));
+	}
+
+	pcm_mix_kernels_generic.add_24(dest + i, a + i, b + i, n - i);
+}
+
+static void
+neon_add_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_s32(dest + i, vqaddq_s32(vld1q_s32(a + i),
+					       vld1q_s32(b + i)));
+
+	pcm_mix_kernels_generic.add_32(dest + i, a + i, b + i, n - i);
+}
+
+static void
+neon_add_float(float *dest, const float *a, const float *b, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dest + i, vaddq_f32(vld1q_f32(a + i),
+					      vld1q_f32(b + i)));
+
+	pcm_mix_kernels_generic.add_float(dest + i, a + i, b + i, n - i);
+}
+
+static void
+neon_add_vol_16(int16_t *dest, const int16_t *a, const int16_t *b, size_t n,
+		int vol1, int vol2)
+{
+	uint32x4_t state = neon_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int16x8_t x = vld1q_s16(a + i);
+		const int16x8_t y = vld1q_s16(b + i);
+
+		int32x4_t lo = vmull_n_s16(vget_low_s16(x), vol1);
+		int32x4_t hi = vmull_n_s16(vget_high_s16(x), vol1);
+		lo = vmlal_n_s16(lo, vget_low_s16(y), vol2);
+		hi = vmlal_n_s16(hi, vget_high_s16(y), vol2);
+		lo = vaddq_s32(lo, neon_dither_next(state));
+		hi = vaddq_s32(hi, neon_dither_next(state));
+
+		/* vqmovn_s32() clamps to 16 bit */
+		vst1q_s16(dest + i,
+			  vcombine_s16(vqmovn_s32(neon_div_volume(lo)),
+				       vqmovn_s32(neon_div_volume(hi))));
+	}
+
+	pcm_mix_dither_state = neon_dither_end(state);
+
+	pcm_mix_kernels_generic.add_vol_16(dest + i, a + i, b + i, n - i,
+					   vol1, vol2);
+}
+
+template<unsigned bits>
+static void
+neon_add_vol_32(int32_t *dest, const int32_t *a, const int32_t *b, size_t n,
+		int vol1, int vol2)
+{
+	uint32x4_t state = neon_dither_begin(pcm_mix_dither_state);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const int32x4_t x = vld1q_s32(a + i);
+		const int32x4_t y = vld1q_s32(b + i);
+		const int32x4_t d = neon_dither_next(state);
+
+		int64x2_t lo = vmull_n_s32(vget_low_s32(x), vol1);
+		int64x2_t hi = vmull_n_s32(vget_high_s32(x), vol1);
+		lo = vmlal_n_s32(lo, vget_low_s32(y), vol2);
+		hi = vmlal_n_s32(hi, vget_high_s32(y), vol2);
+		lo = vaddq_s64(lo, vmovl_s32(vget_low_s32(d)));
+		hi = vaddq_s64(hi, vmovl_s32(vget_high_s32(d)));
+
+		vst1q_s32(dest + i, vcombine_s32(neon_narrow_volume<bits>(lo),
+						 neon_narrow_volume<bits>(hi)));
+	}
+
+	pcm_mix_dither_state = neon_dither_end(state);
+
+	if (bits == 24)
+		pcm_mix_kernels_generic.add_vol_24(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+	else
+		pcm_mix_kernels_generic.add_vol_32(dest + i, a + i, b + i,
+						   n - i, vol1, vol2);
+}
+
+static void
+neon_add_vol_float(float *dest, const float *a, const float *b, size_t n,
+		   float vol1, float vol2)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const float32x4_t x = vmulq_n_f32(vld1q_f32(a + i), vol1);
+		const float32x4_t y = vmulq_n_f32(vld1q_f32(b + i), vol2);
+		vst1q_f32(dest + i, vaddq_f32(x, y));
+	}
+
+	pcm_mix_kernels_generic.add_vol_float(dest + i, a + i, b + i, n - i,
+					      vol1, vol2);
+}
+
+static constexpr PcmMixKernels pcm_mix_kernels_neon = {
+	"neon",
+	neon_add_16,
+	neon_add_24,
+	neon_add_32,
+	neon_add_float,
+	neon_add_vol_16,
+	neon_add_vol_32<24>,
+	neon_add_vol_32<32>,
+	neon_add_vol_float,
+};
+
+#endif /* PCM_HAVE_NEON */
+
+const PcmMixKernels *
+pcm_mix_kernels_simd(unsigned feature)
+{
+	switch (feature) {
+#ifdef PCM_HAVE_X86_SIMD
+	case PCM_CPU_SSE2:
+		return &pcm_mix_kernels_sse2;
+
+	case PCM_CPU_AVX2:
+		return &pcm_mix_kernels_avx2;
+#endif
+
+#ifdef PCM_HAVE_NEON
+	case PCM_CPU_NEON:
+		return &pcm_mix_kernels_neon;
+#endif
+
+	default:
+		return nullptr;
+	}
+}
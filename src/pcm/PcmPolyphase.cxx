@@ -0,0 +1,783 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "PcmPolyphase.hxx"
+#include "PcmPolyphaseKernels.hxx"
+#include "PcmCpu.hxx"
+#include "PcmUtils.hxx"
+#include "thread/Mutex.hxx"
+#include "thread/Cond.hxx"
+
+extern "C" {
+#include "pcm_resample_internal.h"
+}
+
+#include <glib.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "pcm"
+
+/**
+ * The number of filter taps per phase for upsampling.  For
+ * downsampling, the filter is stretched by the ratio.
+ */
+static constexpr unsigned POLYPHASE_TAPS = 64;
+
+/**
+ * The cutoff frequency (-6 dB), relative to the lower one of the two
+ * Nyquist frequencies.
+ */
+static constexpr double POLYPHASE_CUTOFF = 0.91;
+
+/**
+ * The parameter of the Kaiser window, which attenuates the stop band
+ * by about 90 dB.
+ */
+static constexpr double POLYPHASE_KAISER_BETA = 9;
+
+/**
+ * Sample rate ratios which need more coefficients than this (e.g.
+ * 44100 to 44099 Hz) are not supported.
+ */
+static constexpr size_t POLYPHASE_MAX_COEFFICIENTS = 1 << 20;
+
+/**
+ * The channels are filtered by multiple threads only if this many
+ * multiplications are needed; below that, waking up the threads
+ * costs more than it gains.
+ */
+static constexpr size_t POLYPHASE_PARALLEL_MIN_WORK = 1 << 18;
+
+struct PolyphaseFilter {
+	PolyphaseFilter *next;
+
+	/**
+	 * The input is upsampled by #l and decimated by #m.
+	 */
+	unsigned l, m;
+
+	/**
+	 * By how many input samples and phases the filter moves for
+	 * each output sample: #m divided by #l.
+	 */
+	unsigned step, step_phase;
+
+	/**
+	 * The number of coefficients per phase, a multiple of
+	 * #PCM_POLYPHASE_TAP_ALIGN.
+	 */
+	unsigned taps;
+
+	/**
+	 * #l rows of #taps coefficients; the sum of each row is 1.
+	 */
+	float *coefficients;
+
+	/**
+	 * The same in 1.15 fixed point.
+	 */
+	int16_t *coefficients_16;
+
+	PolyphaseFilter(unsigned _l, unsigned _m, unsigned _taps);
+};
+
+gcc_const
+static unsigned
+gcd(unsigned a, unsigned b)
+{
+	while (b != 0) {
+		const unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+gcc_const
+static unsigned
+polyphase_taps(unsigned l, unsigned m)
+{
+	unsigned taps = POLYPHASE_TAPS;
+	if (m > l)
+		taps = (uint64_t(taps) * m + l - 1) / l;
+
+	return (taps + PCM_POLYPHASE_TAP_ALIGN - 1)
+		/ PCM_POLYPHASE_TAP_ALIGN * PCM_POLYPHASE_TAP_ALIGN;
+}
+
+/**
+ * The modified Bessel function of the first kind, order zero.
+ */
+gcc_const
+static double
+bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	for (unsigned k = 1; term > sum * 1e-12; ++k) {
+		const double t = x / (2 * k);
+		term *= t * t;
+		sum += term;
+	}
+
+	return sum;
+}
+
+gcc_const
+static double
+sinc(double x)
+{
+	if (x == 0)
+		return 1;
+
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+PolyphaseFilter::PolyphaseFilter(unsigned _l, unsigned _m, unsigned _taps)
+	:next(nullptr), l(_l), m(_m), step(_m / _l), step_phase(_m % _l),
+	 taps(_taps),
+	 coefficients(new float[l * taps]),
+	 coefficients_16(new int16_t[l * taps])
+{
+	const double cutoff = POLYPHASE_CUTOFF * std::min(1., double(l) / m);
+	const double half = taps / 2;
+	const double i0_beta = bessel_i0(POLYPHASE_KAISER_BETA);
+
+	double *row = new double[taps];
+
+	for (unsigned phase = 0; phase < l; ++phase) {
+		double sum = 0;
+		for (unsigned i = 0; i < taps; ++i) {
+			/* the distance of this tap from the output
+			   sample, in input samples */
+			const double d = i - (half - 1) - double(phase) / l;
+			const double u = d / half;
+			const double window = u * u < 1
+				? bessel_i0(POLYPHASE_KAISER_BETA *
+					    sqrt(1 - u * u)) / i0_beta
+				: 0;
+
+			row[i] = cutoff * sinc(cutoff * d) * window;
+			sum += row[i];
+		}
+
+		float *c = coefficients + phase * taps;
+		int16_t *c16 = coefficients_16 + phase * taps;
+		for (unsigned i = 0; i < taps; ++i) {
+			/* normalize to unity gain at 0 Hz */
+			const double h = row[i] / sum;
+			c[i] = h;
+
+			/* -32768 is excluded, so _mm_madd_epi16() cannot
+			   overflow */
+			c16[i] = std::max(PcmClamp<int16_t, long, 16>(lrint(h * 32768)),
+					  int16_t(-32767));
+		}
+
+	}
+
+	delete[] row;
+}
+
+/**
+ * All filters which have been calculated so far.  They are never
+ * freed; there are only a few different sample rate ratios.
+ */
+static PolyphaseFilter *polyphase_filters;
+static Mutex polyphase_filters_mutex;
+
+/**
+ * Returns the (shared) filter for the specified sample rates, and
+ * calculates it if needed.
+ *
+ * @return the filter, or nullptr if the ratio is not supported
+ */
+static const PolyphaseFilter *
+polyphase_filter_get(unsigned src_rate, unsigned dest_rate)
+{
+	const unsigned g = gcd(src_rate, dest_rate);
+	const unsigned l = dest_rate / g, m = src_rate / g;
+	const unsigned taps = polyphase_taps(l, m);
+	if (size_t(l) * taps > POLYPHASE_MAX_COEFFICIENTS)
+		return nullptr;
+
+	const ScopeLock protect(polyphase_filters_mutex);
+
+	for (PolyphaseFilter *f = polyphase_filters; f != nullptr; f = f->next)
+		if (f->l == l && f->m == m)
+			return f;
+
+	PolyphaseFilter *f = new PolyphaseFilter(l, m, taps);
+	f->next = polyphase_filters;
+	polyphase_filters = f;
+
+	g_debug("polyphase filter %u:%u, %u phases, %u taps",
+		src_rate, dest_rate, l, taps);
+	return f;
+}
+
+/*
+ * The generic kernels
+ *
+ */
+
+static int64_t
+polyphase_dot_16(const int16_t *x, const int16_t *h, unsigned n)
+{
+	int64_t sum = 0;
+	for (unsigned i = 0; i < n; ++i)
+		sum += int32_t(x[i]) * h[i];
+	return sum;
+}
+
+static float
+polyphase_dot_float(const float *x, const float *h, unsigned n)
+{
+	float sum = 0;
+	for (unsigned i = 0; i < n; ++i)
+		sum += x[i] * h[i];
+	return sum;
+}
+
+const PcmPolyphaseKernels pcm_polyphase_kernels_generic = {
+	"generic",
+	polyphase_dot_16,
+	polyphase_dot_float,
+};
+
+const PcmPolyphaseKernels &
+pcm_polyphase_kernels(void)
+{
+	return pcm_cpu_select_kernels<PcmPolyphaseKernels,
+				      pcm_polyphase_kernels_generic,
+				      pcm_polyphase_kernels_simd>();
+}
+
+/*
+ * Sample format traits
+ *
+ */
+
+struct Polyphase16Traits {
+	typedef int16_t sample_type;
+	typedef int16_t history_type;
+
+	static int16_t Load(int16_t x) {
+		return x;
+	}
+
+	static int16_t Filter(const PcmPolyphaseKernels &kernels,
+			      const int16_t *x, const PolyphaseFilter &f,
+			      unsigned phase) {
+		const int64_t sum =
+			kernels.dot_16(x, f.coefficients_16 + phase * f.taps,
+				       f.taps);
+		return PcmClamp<int16_t, int64_t, 16>((sum + (1 << 14)) >> 15);
+	}
+};
+
+template<unsigned bits>
+struct PolyphaseInt32Traits {
+	typedef int32_t sample_type;
+	typedef float history_type;
+
+	static float Load(int32_t x) {
+		return x;
+	}
+
+	static int32_t Filter(const PcmPolyphaseKernels &kernels,
+			      const float *x, const PolyphaseFilter &f,
+			      unsigned phase) {
+		const float sum =
+			kernels.dot_float(x, f.coefficients + phase * f.taps,
+					  f.taps);
+		return PcmClamp<int32_t, int64_t, bits>(llrintf(sum));
+	}
+};
+
+struct PolyphaseFloatTraits {
+	typedef float sample_type;
+	typedef float history_type;
+
+	static float Load(float x) {
+		return x;
+	}
+
+	static float Filter(const PcmPolyphaseKernels &kernels,
+			    const float *x, const PolyphaseFilter &f,
+			    unsigned phase) {
+		return kernels.dot_float(x, f.coefficients + phase * f.taps,
+					 f.taps);
+	}
+};
+
+/**
+ * Filters one channel, and writes #n samples to the interleaved
+ * destination buffer.
+ */
+template<typename Traits>
+static void
+polyphase_run_channel(const PcmPolyphase &p, unsigned channel,
+		      void *_dest, size_t n)
+{
+	typedef typename Traits::sample_type T;
+	typedef typename Traits::history_type H;
+
+	const PolyphaseFilter &f = *p.filter;
+	const PcmPolyphaseKernels &kernels = pcm_polyphase_kernels();
+
+	const H *x = p.GetHistory<H>(channel);
+	T *dest = (T *)_dest + channel;
+	unsigned phase = p.phase;
+
+	for (size_t i = 0; i < n; ++i) {
+		*dest = Traits::Filter(kernels, x, f, phase);
+		dest += p.channels;
+
+		x += f.step;
+		phase += f.step_phase;
+		if (phase >= f.l) {
+			phase -= f.l;
+			++x;
+		}
+	}
+}
+
+typedef void (*polyphase_run_function)(const PcmPolyphase &p,
+				       unsigned channel,
+				       void *dest, size_t n);
+
+/*
+ * Parallel filtering
+ *
+ */
+
+/**
+ * Filters a subset of the channels: every #channel_step-th channel,
+ * beginning with #first_channel.
+ */
+struct PolyphaseJob {
+	polyphase_run_function run;
+	const PcmPolyphase *p;
+	void *dest;
+	size_t n;
+
+	unsigned first_channel, channel_step;
+
+	/**
+	 * The number of jobs which have not been finished by a
+	 * worker thread yet.  Protected by #polyphase_pool_mutex.
+	 */
+	unsigned *pending;
+
+	void Run() const {
+		for (unsigned c = first_channel; c < p->channels;
+		     c += channel_step)
+			run(*p, c, dest, n);
+	}
+};
+
+/**
+ * The worker threads shared by all resamplers, or nullptr if
+ * parallel filtering is disabled.
+ */
+static GThreadPool *polyphase_pool;
+
+/**
+ * The maximum number of threads filtering one buffer, including the
+ * caller.
+ */
+static unsigned polyphase_threads = 1;
+
+static Mutex polyphase_pool_mutex;
+static Cond polyphase_pool_cond;
+
+static void
+polyphase_worker(gpointer data, gcc_unused gpointer user_data)
+{
+	const PolyphaseJob &job = *(const PolyphaseJob *)data;
+	unsigned *const pending = job.pending;
+
+	job.Run();
+
+	/* the job belongs to the caller's stack frame; don't touch
+	   it after this */
+	const ScopeLock protect(polyphase_pool_mutex);
+	--*pending;
+	polyphase_pool_cond.broadcast();
+}
+
+bool
+pcm_resample_polyphase_global_init(unsigned threads, GError **error_r)
+{
+	if (threads <= 1)
+		return true;
+
+	/* more threads than channels would be idle */
+	threads = std::min(threads, MAX_CHANNELS);
+
+	polyphase_pool = g_thread_pool_new(polyphase_worker, nullptr,
+					   threads - 1, true, error_r);
+	if (polyphase_pool == nullptr)
+		return false;
+
+	polyphase_threads = threads;
+	return true;
+}
+
+/**
+ * Filters all channels, distributing them among the worker threads
+ * if the buffer is large enough.
+ */
+static void
+polyphase_run(const PcmPolyphase &p, polyphase_run_function run,
+	      void *dest, size_t n)
+{
+	unsigned n_jobs = 1;
+	if (polyphase_pool != nullptr &&
+	    n * p.filter->taps * p.channels >= POLYPHASE_PARALLEL_MIN_WORK)
+		n_jobs = std::min(p.channels, polyphase_threads);
+
+	unsigned pending = n_jobs - 1;
+
+	PolyphaseJob jobs[MAX_CHANNELS];
+	for (unsigned i = 0; i < n_jobs; ++i) {
+		jobs[i].run = run;
+		jobs[i].p = &p;
+		jobs[i].dest = dest;
+		jobs[i].n = n;
+		jobs[i].first_channel = i;
+		jobs[i].channel_step = n_jobs;
+		jobs[i].pending = &pending;
+	}
+
+	for (unsigned i = 1; i < n_jobs; ++i)
+		g_thread_pool_push(polyphase_pool, &jobs[i], nullptr);
+
+	/* the first job is done by this thread */
+	jobs[0].Run();
+
+	if (n_jobs > 1) {
+		const ScopeLock protect(polyphase_pool_mutex);
+		while (pending > 0)
+			polyphase_pool_cond.wait(polyphase_pool_mutex);
+	}
+}
+
+/*
+ * PcmPolyphase
+ *
+ */
+
+PcmPolyphase::PcmPolyphase()
+	:filter(nullptr), format(SAMPLE_FORMAT_UNDEFINED),
+	 channels(0), src_rate(0), dest_rate(0),
+	 history(nullptr), capacity(0), fill(0), phase(0)
+{
+	pcm_buffer_init(&buffer);
+}
+
+PcmPolyphase::~PcmPolyphase()
+{
+	Close();
+	pcm_buffer_deinit(&buffer);
+}
+
+void
+PcmPolyphase::Close()
+{
+	g_free(history);
+	history = nullptr;
+	capacity = 0;
+	fill = 0;
+	filter = nullptr;
+}
+
+bool
+PcmPolyphase::Open(enum sample_format _format, unsigned _channels,
+		   unsigned _src_rate, unsigned _dest_rate)
+{
+	assert(_channels > 0 && _channels <= MAX_CHANNELS);
+	assert(_src_rate > 0 && _dest_rate > 0);
+
+	if (filter != nullptr && _format == format &&
+	    _channels == channels && _src_rate == src_rate &&
+	    _dest_rate == dest_rate)
+		return true;
+
+	Close();
+
+	format = _format;
+	channels = _channels;
+	src_rate = _src_rate;
+	dest_rate = _dest_rate;
+
+	filter = polyphase_filter_get(src_rate, dest_rate);
+	if (filter == nullptr)
+		return false;
+
+	Reset();
+	return true;
+}
+
+void
+PcmPolyphase::Reset()
+{
+	if (filter == nullptr)
+		return;
+
+	/* start with silence, so the first output sample is centered
+	   on the first input sample */
+	fill = 0;
+	const size_t n = filter->taps / 2 - 1;
+	Reserve(n);
+
+	const size_t sample_size = GetSampleSize();
+	for (unsigned c = 0; c < channels; ++c)
+		memset((char *)history + c * capacity * sample_size, 0,
+		       n * sample_size);
+
+	fill = n;
+	phase = 0;
+}
+
+void
+PcmPolyphase::Reserve(size_t n)
+{
+	if (fill + n <= capacity)
+		return;
+
+	/* leave some room for larger buffers */
+	const size_t new_capacity = (fill + n) * 3 / 2;
+	const size_t sample_size = GetSampleSize();
+
+	char *new_history =
+		(char *)g_malloc(channels * new_capacity * sample_size);
+	for (unsigned c = 0; c < channels && fill > 0; ++c)
+		memcpy(new_history + c * new_capacity * sample_size,
+		       (const char *)history + c * capacity * sample_size,
+		       fill * sample_size);
+
+	g_free(history);
+	history = new_history;
+	capacity = new_capacity;
+}
+
+template<typename Traits>
+void
+PcmPolyphase::Feed(const typename Traits::sample_type *src, size_t n)
+{
+	typedef typename Traits::history_type H;
+
+	Reserve(n);
+
+	for (unsigned c = 0; c < channels; ++c) {
+		H *dest = GetHistory<H>(c) + fill;
+		const typename Traits::sample_type *s = src + c;
+
+		for (size_t i = 0; i < n; ++i, s += channels)
+			dest[i] = Traits::Load(*s);
+	}
+
+	fill += n;
+}
+
+size_t
+PcmPolyphase::CountOutput(size_t *consumed_r, unsigned *phase_r) const
+{
+	const PolyphaseFilter &f = *filter;
+
+	size_t position = 0, n = 0;
+	unsigned p = phase;
+	while (position + f.taps <= fill) {
+		++n;
+
+		position += f.step;
+		p += f.step_phase;
+		if (p >= f.l) {
+			p -= f.l;
+			++position;
+		}
+	}
+
+	*consumed_r = position;
+	*phase_r = p;
+	return n;
+}
+
+void
+PcmPolyphase::Consume(size_t n)
+{
+	assert(n <= fill);
+
+	const size_t sample_size = GetSampleSize();
+	for (unsigned c = 0; c < channels; ++c) {
+		char *h = (char *)history + c * capacity * sample_size;
+		memmove(h, h + n * sample_size, (fill - n) * sample_size);
+	}
+
+	fill -= n;
+}
+
+template<typename Traits>
+typename Traits::sample_type *
+PcmPolyphase::Resample(const typename Traits::sample_type *src,
+		       size_t src_size, size_t *dest_size_r)
+{
+	typedef typename Traits::sample_type T;
+
+	assert(filter != nullptr);
+	assert(src_size % (sizeof(*src) * channels) == 0);
+
+	Feed<Traits>(src, src_size / sizeof(*src) / channels);
+
+	size_t consumed;
+	unsigned next_phase;
+	const size_t n = CountOutput(&consumed, &next_phase);
+
+	const size_t dest_size = n * channels * sizeof(T);
+	T *dest = (T *)pcm_buffer_get(&buffer, dest_size);
+
+	polyphase_run(*this, polyphase_run_channel<Traits>, dest, n);
+
+	Consume(consumed);
+	phase = next_phase;
+
+	*dest_size_r = dest_size;
+	return dest;
+}
+
+const int16_t *
+PcmPolyphase::Resample16(const int16_t *src, size_t src_size,
+			 size_t *dest_size_r)
+{
+	assert(format == SAMPLE_FORMAT_S16);
+
+	return Resample<Polyphase16Traits>(src, src_size, dest_size_r);
+}
+
+const int32_t *
+PcmPolyphase::Resample32(unsigned bits, const int32_t *src, size_t src_size,
+			 size_t *dest_size_r)
+{
+	assert(format != SAMPLE_FORMAT_S16);
+
+	return bits == 24
+		? Resample<PolyphaseInt32Traits<24>>(src, src_size,
+						     dest_size_r)
+		: Resample<PolyphaseInt32Traits<32>>(src, src_size,
+						     dest_size_r);
+}
+
+const float *
+PcmPolyphase::ResampleFloat(const float *src, size_t src_size,
+			    size_t *dest_size_r)
+{
+	assert(format == SAMPLE_FORMAT_FLOAT);
+
+	return Resample<PolyphaseFloatTraits>(src, src_size, dest_size_r);
+}
+
+/*
+ * The pcm_resample backend
+ *
+ */
+
+void
+pcm_resample_polyphase_init(struct pcm_resample_state *state)
+{
+	/* for the fallback resampler, see below */
+	pcm_buffer_init(&state->buffer);
+
+	state->polyphase = new PcmPolyphase();
+}
+
+void
+pcm_resample_polyphase_deinit(struct pcm_resample_state *state)
+{
+	delete state->polyphase;
+	state->polyphase = nullptr;
+
+	pcm_buffer_deinit(&state->buffer);
+}
+
+void
+pcm_resample_polyphase_reset(struct pcm_resample_state *state)
+{
+	state->polyphase->Reset();
+}
+
+const float *
+pcm_resample_polyphase_float(struct pcm_resample_state *state,
+			     unsigned channels,
+			     unsigned src_rate,
+			     const float *src_buffer, size_t src_size,
+			     unsigned dest_rate, size_t *dest_size_r)
+{
+	PcmPolyphase &p = *state->polyphase;
+	if (!p.Open(SAMPLE_FORMAT_FLOAT, channels, src_rate, dest_rate))
+		/* this ratio is not supported */
+		return (const float *)
+			pcm_resample_fallback_32(state, channels, src_rate,
+						 (const int32_t *)src_buffer,
+						 src_size,
+						 dest_rate, dest_size_r);
+
+	return p.ResampleFloat(src_buffer, src_size, dest_size_r);
+}
+
+const int16_t *
+pcm_resample_polyphase_16(struct pcm_resample_state *state,
+			  unsigned channels,
+			  unsigned src_rate,
+			  const int16_t *src_buffer, size_t src_size,
+			  unsigned dest_rate, size_t *dest_size_r)
+{
+	PcmPolyphase &p = *state->polyphase;
+	if (!p.Open(SAMPLE_FORMAT_S16, channels, src_rate, dest_rate))
+		return pcm_resample_fallback_16(state, channels, src_rate,
+						src_buffer, src_size,
+						dest_rate, dest_size_r);
+
+	return p.Resample16(src_buffer, src_size, dest_size_r);
+}
+
+const int32_t *
+pcm_resample_polyphase_32(struct pcm_resample_state *state,
+			  unsigned bits, unsigned channels,
+			  unsigned src_rate,
+			  const int32_t *src_buffer, size_t src_size,
+			  unsigned dest_rate, size_t *dest_size_r)
+{
+	PcmPolyphase &p = *state->polyphase;
+	if (!p.Open(bits == 24 ? SAMPLE_FORMAT_S24_P32 : SAMPLE_FORMAT_S32,
+		    channels, src_rate, dest_rate))
+		return pcm_resample_fallback_32(state, channels, src_rate,
+						src_buffer, src_size,
+						dest_rate, dest_size_r);
+
+	return p.Resample32(bits, src_buffer, src_size, dest_size_r);
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_PCM_POLYPHASE_HXX
+#define MPD_PCM_POLYPHASE_HXX
+
+#include "pcm_buffer.h"
+#include "audio_format.h"
+#include "gcc.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct PolyphaseFilter;
+
+/**
+ * A polyphase windowed-sinc resampler.  The ratio between the two
+ * sample rates is reduced to a fraction L/M; the input is
+ * (virtually) upsampled by L, low-pass filtered and decimated by M.
+ * The coefficients of each of the L phases are calculated once per
+ * ratio and shared by all resamplers.
+ *
+ * 16 bit samples are filtered with 16 bit fixed point coefficients
+ * and 32 bit sums; all other formats are filtered in single
+ * precision floating point.  The channels are stored in separate
+ * (planar) buffers, so each channel can be filtered by another
+ * thread; see pcm_resample_polyphase_global_init().
+ */
+struct PcmPolyphase {
+	/**
+	 * The filter for the current sample rates, or nullptr if
+	 * Open() has not been called or has failed.
+	 */
+	const PolyphaseFilter *filter;
+
+	/**
+	 * The sample format of the input, which determines the type
+	 * of #history: int16_t for #SAMPLE_FORMAT_S16, float for all
+	 * others.
+	 */
+	enum sample_format format;
+
+	unsigned channels;
+	unsigned src_rate, dest_rate;
+
+	/**
+	 * The input samples which are still needed by the filter,
+	 * one array of #capacity samples per channel.
+	 */
+	void *history;
+
+	/**
+	 * The number of samples allocated per channel in #history.
+	 */
+	size_t capacity;
+
+	/**
+	 * The number of valid samples per channel in #history.
+	 */
+	size_t fill;
+
+	/**
+	 * The phase (0..L-1) of the next output sample, which begins
+	 * at the first sample in #history.
+	 */
+	unsigned phase;
+
+	struct pcm_buffer buffer;
+
+	PcmPolyphase();
+	~PcmPolyphase();
+
+	PcmPolyphase(const PcmPolyphase &other) = delete;
+	PcmPolyphase &operator=(const PcmPolyphase &other) = delete;
+
+	/**
+	 * Prepares the resampler for the specified parameters.  This
+	 * is a no-op if they have not changed since the last call.
+	 *
+	 * @return false if this sample rate ratio is not supported
+	 * (the filter would be too large)
+	 */
+	bool Open(enum sample_format format, unsigned channels,
+		  unsigned src_rate, unsigned dest_rate);
+
+	/**
+	 * Discards the buffered input, e.g. after seeking.
+	 */
+	void Reset();
+
+	const int16_t *Resample16(const int16_t *src, size_t src_size,
+				  size_t *dest_size_r);
+
+	/**
+	 * @param bits the number of significant bits (24 or 32); the
+	 * output is clamped to this range
+	 */
+	const int32_t *Resample32(unsigned bits,
+				  const int32_t *src, size_t src_size,
+				  size_t *dest_size_r);
+
+	const float *ResampleFloat(const float *src, size_t src_size,
+				   size_t *dest_size_r);
+
+	template<typename H>
+	H *GetHistory(unsigned channel) const {
+		return (H *)history + channel * capacity;
+	}
+
+private:
+	void Close();
+
+	gcc_pure
+	size_t GetSampleSize() const {
+		return format == SAMPLE_FORMAT_S16 ? sizeof(int16_t) : sizeof(float);
+	}
+
+	void Reserve(size_t n);
+
+	template<typename Traits>
+	void Feed(const typename Traits::sample_type *src, size_t n);
+
+	size_t CountOutput(size_t *consumed_r, unsigned *phase_r) const;
+
+	void Consume(size_t n);
+
+	template<typename Traits>
+	typename Traits::sample_type *
+	Resample(const typename Traits::sample_type *src, size_t src_size,
+		 size_t *dest_size_r);
+};
+
+#endif
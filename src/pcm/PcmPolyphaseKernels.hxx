@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Internal interface between PcmPolyphase.cxx and the SIMD
+ * implementations of its inner loops.
+ */
+
+#ifndef MPD_PCM_POLYPHASE_KERNELS_HXX
+#define MPD_PCM_POLYPHASE_KERNELS_HXX
+
+#include <stdint.h>
+
+/**
+ * The number of filter taps must be a multiple of this value; the
+ * kernels don't handle a tail.
+ */
+static constexpr unsigned PCM_POLYPHASE_TAP_ALIGN = 16;
+
+/**
+ * The inner loops of the polyphase resampler for one instruction
+ * set: the dot product of #n input samples and #n filter
+ * coefficients.  #n is a multiple of #PCM_POLYPHASE_TAP_ALIGN.
+ *
+ * The 16 bit kernel returns exactly the same results as the generic
+ * C++ code.  Its sum is 64 bit wide: the sum of the absolute values
+ * of a filter row is more than 2, so full scale input which matches
+ * the signs of the coefficients exceeds 32 bit.  The floating point kernels add the products in a
+ * different order, which may change the last bits.
+ */
+struct PcmPolyphaseKernels {
+	const char *name;
+
+	int64_t (*dot_16)(const int16_t *x, const int16_t *h, unsigned n);
+	float (*dot_float)(const float *x, const float *h, unsigned n);
+};
+
+/**
+ * The portable implementation.
+ */
+extern const PcmPolyphaseKernels pcm_polyphase_kernels_generic;
+
+/**
+ * Returns the SIMD kernels for the specified instruction set
+ * (#PCM_CPU_SSE2, #PCM_CPU_AVX2 or #PCM_CPU_NEON), or nullptr if they
+ * have not been compiled.
+ */
+const PcmPolyphaseKernels *
+pcm_polyphase_kernels_simd(unsigned feature);
+
+/**
+ * Returns the fastest kernels supported by this CPU.
+ */
+const PcmPolyphaseKernels &
+pcm_polyphase_kernels(void);
+
+#endif
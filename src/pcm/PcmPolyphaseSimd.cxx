@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * SIMD implementations of the polyphase resampler's dot product.
+ */
+
+#include "config.h"
+#include "PcmPolyphaseKernels.hxx"
+#include "PcmSimd.hxx"
+
+#ifdef PCM_HAVE_X86_SIMD
+
+/*
+ * SSE2
+ *
+ */
+
+/**
+ * Returns the sum of the two 64 bit integers.
+ */
+SSE2_FUNC
+static int64_t
+sse2_hsum_epi64(__m128i v)
+{
+	v = _mm_add_epi64(v, _mm_unpackhi_epi64(v, v));
+
+	int64_t result;
+	_mm_storel_epi64((__m128i *)&result, v);
+	return result;
+}
+
+SSE2_FUNC
+static int64_t
+sse2_dot_16(const int16_t *x, const int16_t *h, unsigned n)
+{
+	/* the coefficients are limited to +/-32767, so each pair
+	   sum of _mm_madd_epi16() fits in 32 bit; but the sum of
+	   all of them doesn't, so each one is sign-extended and
+	   added to a 64 bit accumulator (SSE2 has no
+	   _mm_cvtepi32_epi64()) */
+	__m128i sum_lo = _mm_setzero_si128(), sum_hi = _mm_setzero_si128();
+	for (unsigned i = 0; i < n; i += 8) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(h + i));
+		const __m128i p = _mm_madd_epi16(a, b);
+		const __m128i sign = _mm_srai_epi32(p, 31);
+		sum_lo = _mm_add_epi64(sum_lo, _mm_unpacklo_epi32(p, sign));
+		sum_hi = _mm_add_epi64(sum_hi, _mm_unpackhi_epi32(p, sign));
+	}
+
+	return sse2_hsum_epi64(_mm_add_epi64(sum_lo, sum_hi));
+}
+
+SSE2_FUNC
+static float
+sse2_dot_float(const float *x, const float *h, unsigned n)
+{
+	/* two accumulators to hide the latency of the addition */
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+	for (unsigned i = 0; i < n; i += 8) {
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(x + i),
+						   _mm_loadu_ps(h + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(x + i + 4),
+						   _mm_loadu_ps(h + i + 4)));
+	}
+
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(sum);
+}
+
+static constexpr PcmPolyphaseKernels pcm_polyphase_kernels_sse2 = {
+	"sse2",
+	sse2_dot_16,
+	sse2_dot_float,
+};
+
+/*
+ * AVX2
+ *
+ */
+
+AVX2_FUNC
+static int64_t
+avx2_dot_16(const int16_t *x, const int16_t *h, unsigned n)
+{
+	/* see sse2_dot_16() */
+	__m256i sum_lo = _mm256_setzero_si256();
+	__m256i sum_hi = _mm256_setzero_si256();
+	for (unsigned i = 0; i < n; i += 16) {
+		const __m256i a =
+			_mm256_loadu_si256((const __m256i *)(x + i));
+		const __m256i b =
+			_mm256_loadu_si256((const __m256i *)(h + i));
+		const __m256i p = _mm256_madd_epi16(a, b);
+		sum_lo = _mm256_add_epi64(sum_lo,
+					  _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+		sum_hi = _mm256_add_epi64(sum_hi,
+					  _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+	}
+
+	const __m256i sum = _mm256_add_epi64(sum_lo, sum_hi);
+	return sse2_hsum_epi64(_mm_add_epi64(_mm256_castsi256_si128(sum),
+					     _mm256_extracti128_si256(sum, 1)));
+}
+
+AVX2_FUNC
+static float
+avx2_dot_float(const float *x, const float *h, unsigned n)
+{
+	__m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+	for (unsigned i = 0; i < n; i += 16) {
+		sum0 = _mm256_add_ps(sum0,
+				     _mm256_mul_ps(_mm256_loadu_ps(x + i),
+						   _mm256_loadu_ps(h + i)));
+		sum1 = _mm256_add_ps(sum1,
+				     _mm256_mul_ps(_mm256_loadu_ps(x + i + 8),
+						   _mm256_loadu_ps(h + i + 8)));
+	}
+
+	const __m256 sum = _mm256_add_ps(sum0, sum1);
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(sum),
+			      _mm256_extractf128_ps(sum, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(s);
+}
+
+static constexpr PcmPolyphaseKernels pcm_polyphase_kernels_avx2 = {
+	"avx2",
+	avx2_dot_16,
+	avx2_dot_float,
+};
+
+#endif /* PCM_HAVE_X86_SIMD */
+
+#ifdef PCM_HAVE_NEON
+
+static int64_t
+neon_dot_16(const int16_t *x, const int16_t *h, unsigned n)
+{
+	/* each product fits in 32 bit, but their sum doesn't; the
+	   products are added pairwise to 64 bit accumulators */
+	int64x2_t sum = vdupq_n_s64(0);
+	for (unsigned i = 0; i < n; i += 8) {
+		const int16x8_t a = vld1q_s16(x + i);
+		const int16x8_t b = vld1q_s16(h + i);
+		sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(a),
+						 vget_low_s16(b)));
+		sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(a),
+						 vget_high_s16(b)));
+	}
+
+	return vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+}
+
+static float
+neon_dot_float(const float *x, const float *h, unsigned n)
+{
+	float32x4_t sum0 = vdupq_n_f32(0), sum1 = vdupq_n_f32(0);
+	for (unsigned i = 0; i < n; i += 8) {
+		sum0 = vmlaq_f32(sum0, vld1q_f32(x + i), vld1q_f32(h + i));
+		sum1 = vmlaq_f32(sum1, vld1q_f32(x + i + 4),
+				 vld1q_f32(h + i + 4));
+	}
+
+	const float32x4_t sum = vaddq_f32(sum0, sum1);
+	const float32x2_t s = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+static constexpr PcmPolyphaseKernels pcm_polyphase_kernels_neon = {
+	"neon",
+	neon_dot_16,
+	neon_dot_float,
+};
+
+#endif /* PCM_HAVE_NEON */
+
+const PcmPolyphaseKernels *
+pcm_polyphase_kernels_simd(unsigned feature)
+{
+	switch (feature) {
+#ifdef PCM_HAVE_X86_SIMD
+	case PCM_CPU_SSE2:
+		return &pcm_polyphase_kernels_sse2;
+
+	case PCM_CPU_AVX2:
+		return &pcm_polyphase_kernels_avx2;
+#endif
+
+#ifdef PCM_HAVE_NEON
+	case PCM_CPU_NEON:
+		return &pcm_polyphase_kernels_neon;
+#endif
+
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Inline helpers for the SIMD implementations of the PCM library.
+ */
+
+#ifndef MPD_PCM_SIMD_HXX
+#define MPD_PCM_SIMD_HXX
+
+#include "PcmCpu.hxx"
+#include "PcmPrng.hxx"
+#include "PcmVolume.hxx"
+
+#include <stdint.h>
+
+#ifdef PCM_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef PCM_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * The dither values are generated by several instances of
+ * pcm_prng() in parallel, one per vector lane.  Lane i starts with
+ * the i-th state, and each lane skips as many states as there are
+ * lanes, so together they produce the same sequence as the scalar
+ * generator.  Between two calls, the state is kept in a uint32_t:
+ * the next state of the first lane.
+ */
+
+/**
+ * Multiplier of pcm_prng() applied n times.
+ */
+static constexpr uint32_t
+pcm_prng_a(unsigned n)
+{
+	return n == 0 ? 1 : pcm_prng_a(n - 1) * uint32_t(0x0019660d);
+}
+
+/**
+ * Increment of pcm_prng() applied n times.
+ */
+static constexpr uint32_t
+pcm_prng_c(unsigned n)
+{
+	return n == 0
+		? 0
+		: pcm_prng_c(n - 1) * uint32_t(0x0019660d) + uint32_t(0x3c6ef35f);
+}
+
+/**
+ * Calculates the initial state of each lane.
+ */
+static inline void
+pcm_simd_dither_lanes(uint32_t state, uint32_t *lanes, unsigned n)
+{
+	for (unsigned i = 0; i < n; ++i) {
+		lanes[i] = state;
+		state = pcm_prng(state);
+	}
+}
+
+#ifdef PCM_HAVE_X86_SIMD
+
+#define SSE2_FUNC __attribute__((target("sse2")))
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+/*
+ * SSE2
+ *
+ */
+
+/**
+ * Divides by #PCM_VOLUME_1, rounding towards zero like the C
+ * division operator.
+ */
+SSE2_FUNC
+static inline __m128i
+sse2_div_volume(__m128i x)
+{
+	const __m128i bias = _mm_and_si128(_mm_srai_epi32(x, 31),
+					   _mm_set1_epi32(PCM_VOLUME_1 - 1));
+	return _mm_srai_epi32(_mm_add_epi32(x, bias), 10);
+}
+
+SSE2_FUNC
+static inline __m128i
+sse2_mullo_epi32(__m128i a, __m128i b)
+{
+	/* SSE2 has only the 32x32=64 bit multiplication of the even
+	   lanes */
+	const __m128i even = _mm_mul_epu32(a, b);
+	const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32),
+					  _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/**
+ * Returns "a" where the mask is set, and "b" elsewhere.
+ */
+SSE2_FUNC
+static inline __m128i
+sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a),
+			    _mm_andnot_si128(mask, b));
+}
+
+SSE2_FUNC
+static inline __m128i
+sse2_dither_begin(uint32_t state)
+{
+	uint32_t lanes[4];
+	pcm_simd_dither_lanes(state, lanes, 4);
+	return _mm_loadu_si128((const __m128i *)lanes);
+}
+
+SSE2_FUNC
+static inline uint32_t
+sse2_dither_end(__m128i state)
+{
+	return _mm_cvtsi128_si32(state);
+}
+
+/**
+ * Returns four dither values like pcm_volume_dither(), plus the
+ * rounding offset #PCM_VOLUME_1/2.
+ */
+SSE2_FUNC
+static inline __m128i
+sse2_dither_next(__m128i &state)
+{
+	const __m128i r = state;
+	state = _mm_add_epi32(sse2_mullo_epi32(state,
+					       _mm_set1_epi32(pcm_prng_a(4))),
+			      _mm_set1_epi32(pcm_prng_c(4)));
+
+	const __m128i mask = _mm_set1_epi32(511);
+	const __m128i d = _mm_sub_epi32(_mm_and_si128(r, mask),
+					_mm_and_si128(_mm_srli_epi32(r, 9),
+						      mask));
+	return _mm_add_epi32(d, _mm_set1_epi32(PCM_VOLUME_1 / 2));
+}
+
+/**
+ * Converts two 32 bit integers to double, multiplies them with the
+ * volume, adds the dither values and divides by #PCM_VOLUME_1.  All
+ * of this is exact, because the results fit into the mantissa.
+ */
+SSE2_FUNC
+static inline __m128d
+sse2_volume_pd(__m128i x, __m128d volume, __m128i d)
+{
+	const __m128d t = _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(x), volume),
+				     _mm_cvtepi32_pd(d));
+	return _mm_mul_pd(t, _mm_set1_pd(1.0 / PCM_VOLUME_1));
+}
+
+/**
+ * Clamps to the specified number of bits and truncates to 32 bit
+ * integers.  Clamping before truncating gives the same result as the
+ * other way round.
+ */
+template<unsigned bits>
+SSE2_FUNC
+static inline __m128i
+sse2_clamp_pd(__m128d t)
+{
+	const __m128d min = _mm_set1_pd(-double(int64_t(1) << (bits - 1)));
+	const __m128d max = _mm_set1_pd(double((int64_t(1) << (bits - 1)) - 1));
+
+	return _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(t, min), max));
+}
+
+/*
+ * AVX2
+ *
+ */
+
+AVX2_FUNC
+static inline __m256i
+avx2_div_volume(__m256i x)
+{
+	const __m256i bias =
+		_mm256_and_si256(_mm256_srai_epi32(x, 31),
+				 _mm256_set1_epi32(PCM_VOLUME_1 - 1));
+	return _mm256_srai_epi32(_mm256_add_epi32(x, bias), 10);
+}
+
+AVX2_FUNC
+static inline __m256i
+avx2_dither_begin(uint32_t state)
+{
+	uint32_t lanes[8];
+	pcm_simd_dither_lanes(state, lanes, 8);
+	return _mm256_loadu_si256((const __m256i *)lanes);
+}
+
+AVX2_FUNC
+static inline uint32_t
+avx2_dither_end(__m256i state)
+{
+	return _mm_cvtsi128_si32(_mm256_castsi256_si128(state));
+}
+
+/**
+ * Returns eight dither values; see sse2_dither_next().
+ */
+AVX2_FUNC
+static inline __m256i
+avx2_dither_next(__m256i &state)
+{
+	const __m256i r = state;
+	state = _mm256_add_epi32(_mm256_mullo_epi32(state,
+						    _mm256_set1_epi32(pcm_prng_a(8))),
+				 _mm256_set1_epi32(pcm_prng_c(8)));
+
+	const __m256i mask = _mm256_set1_epi32(511);
+	const __m256i d =
+		_mm256_sub_epi32(_mm256_and_si256(r, mask),
+				 _mm256_and_si256(_mm256_srli_epi32(r, 9),
+						  mask));
+	return _mm256_add_epi32(d, _mm256_set1_epi32(PCM_VOLUME_1 / 2));
+}
+
+/**
+ * Four samples; see sse2_volume_pd().
+ */
+AVX2_FUNC
+static inline __m256d
+avx2_volume_pd(__m128i x, __m256d volume, __m128i d)
+{
+	const __m256d t =
+		_mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(x), volume),
+			      _mm256_cvtepi32_pd(d));
+	return _mm256_mul_pd(t, _mm256_set1_pd(1.0 / PCM_VOLUME_1));
+}
+
+/**
+ * Four samples; see sse2_clamp_pd().
+ */
+template<unsigned bits>
+AVX2_FUNC
+static inline __m128i
+avx2_clamp_pd(__m256d t)
+{
+	const __m256d min = _mm256_set1_pd(-double(int64_t(1) << (bits - 1)));
+	const __m256d max = _mm256_set1_pd(double((int64_t(1) << (bits - 1)) - 1));
+
+	return _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(t, min), max));
+}
+
+/**
+ * Combines two 128 bit vectors.
+ */
+AVX2_FUNC
+static inline __m256i
+avx2_combine(__m128i lo, __m128i hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+#endif /* PCM_HAVE_X86_SIMD */
+
+#ifdef PCM_HAVE_NEON
+
+static inline uint32x4_t
+neon_dither_begin(uint32_t state)
+{
+	uint32_t lanes[4];
+	pcm_simd_dither_lanes(state, lanes, 4);
+	return vld1q_u32(lanes);
+}
+
+static inline uint32_t
+neon_dither_end(uint32x4_t state)
+{
+	return vgetq_lane_u32(state, 0);
+}
+
+/**
+ * Returns four dither values like pcm_volume_dither(), plus the
+ * rounding offset #PCM_VOLUME_1/2.
+ */
+static inline int32x4_t
+neon_dither_next(uint32x4_t &state)
+{
+	const uint32x4_t r = state;
+	state = vmlaq_u32(vdupq_n_u32(pcm_prng_c(4)),
+			  state, vdupq_n_u32(pcm_prng_a(4)));
+
+	const uint32x4_t mask = vdupq_n_u32(511);
+	const int32x4_t d =
+		vsubq_s32(vreinterpretq_s32_u32(vandq_u32(r, mask)),
+			  vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(r, 9),
+							  mask)));
+	return vaddq_s32(d, vdupq_n_s32(PCM_VOLUME_1 / 2));
+}
+
+/**
+ * Divides by #PCM_VOLUME_1, rounding towards zero like the C
+ * division operator.
+ */
+static inline int32x4_t
+neon_div_volume(int32x4_t x)
+{
+	const int32x4_t bias = vandq_s32(vshrq_n_s32(x, 31),
+					 vdupq_n_s32(PCM_VOLUME_1 - 1));
+	return vshrq_n_s32(vaddq_s32(x, bias), 10);
+}
+
+static inline int64x2_t
+neon_div_volume(int64x2_t x)
+{
+	const int64x2_t bias = vandq_s64(vshrq_n_s64(x, 63),
+					 vdupq_n_s64(PCM_VOLUME_1 - 1));
+	return vshrq_n_s64(vaddq_s64(x, bias), 10);
+}
+
+/**
+ * Divides two 64 bit sums by #PCM_VOLUME_1 and clamps them to the
+ * specified number of bits.
+ */
+template<unsigned bits>
+static inline int32x2_t
+neon_narrow_volume(int64x2_t x)
+{
+	/* vqmovn_s64() clamps to 32 bit */
+	int32x2_t r = vqmovn_s64(neon_div_volume(x));
+	if (bits < 32)
+		r = vmin_s32(vmax_s32(r, vdup_n_s32(-(1 << (bits - 1)))),
+			     vdup_n_s32((1 << (bits - 1)) - 1));
+	return r;
+}
+
+#endif /* PCM_HAVE_NEON */
+
+#endif
@@ -19,11 +19,14 @@
 
 #include "config.h"
 #include "PcmVolume.hxx"
+#include "PcmVolumeKernels.hxx"
+#include "PcmCpu.hxx"
 #include "PcmUtils.hxx"
 #include "audio_format.h"
 
 #include <glib.h>
 
+#include <assert.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -45,8 +48,10 @@ pcm_volume_change_8(int8_t *buffer, const int8_t *end, int volume)
 }
 
 static void
-pcm_volume_change_16(int16_t *buffer, const int16_t *end, int volume)
+pcm_volume_change_16(int16_t *buffer, size_t n, int volume)
 {
+	const int16_t *end = buffer + n;
+
 	while (buffer < end) {
 		int32_t sample = *buffer;
 
@@ -90,8 +95,10 @@ pcm_volume_sample_24(int32_t sample, int32_t volume, G_GNUC_UNUSED int32_t dithe
 #endif
 
 static void
-pcm_volume_change_24(int32_t *buffer, const int32_t *end, int volume)
+pcm_volume_change_24(int32_t *buffer, size_t n, int volume)
 {
+	const int32_t *end = buffer + n;
+
 	while (buffer < end) {
 #ifdef __i386__
 		/* assembly version for i386 */
@@ -112,8 +119,10 @@ pcm_volume_change_24(int32_t *buffer, const int32_t *end, int volume)
 }
 
 static void
-pcm_volume_change_32(int32_t *buffer, const int32_t *end, int volume)
+pcm_volume_change_32(int32_t *buffer, size_t n, int volume)
 {
+	const int32_t *end = buffer + n;
+
 	while (buffer < end) {
 #ifdef __i386__
 		/* assembly version for i386 */
@@ -133,8 +142,10 @@ pcm_volume_change_32(int32_t *buffer, const int32_t *end, int volume)
 }
 
 static void
-pcm_volume_change_float(float *buffer, const float *end, float volume)
+pcm_volume_change_float(float *buffer, size_t n, float volume)
 {
+	const float *end = buffer + n;
+
 	while (buffer < end) {
 		float sample = *buffer;
 		sample *= volume;
@@ -142,6 +153,22 @@ pcm_volume_change_float(float *buffer, const float *end, float volume)
 	}
 }
 
+const PcmVolumeKernels pcm_volume_kernels_generic = {
+	"generic",
+	pcm_volume_change_16,
+	pcm_volume_change_24,
+	pcm_volume_change_32,
+	pcm_volume_change_float,
+};
+
+const PcmVolumeKernels &
+pcm_volume_kernels(void)
+{
+	return pcm_cpu_select_kernels<PcmVolumeKernels,
+				      pcm_volume_kernels_generic,
+				      pcm_volume_kernels_simd>();
+}
+
 bool
 pcm_volume(void *buffer, size_t length,
 	   enum sample_format format,
@@ -155,7 +182,8 @@ pcm_volume(void *buffer, size_t length,
 		return true;
 	}
 
-	const void *end = pcm_end_pointer(buffer, length);
+	const PcmVolumeKernels &kernels = pcm_volume_kernels();
+
 	switch (format) {
 	case SAMPLE_FORMAT_UNDEFINED:
 	case SAMPLE_FORMAT_DSD:
@@ -163,28 +191,34 @@ pcm_volume(void *buffer, size_t length,
 		return false;
 
 	case SAMPLE_FORMAT_S8:
-		pcm_volume_change_8((int8_t *)buffer, (const int8_t *)end,
+		pcm_volume_change_8((int8_t *)buffer,
+				    (const int8_t *)pcm_end_pointer(buffer,
+								    length),
 				    volume);
 		return true;
 
 	case SAMPLE_FORMAT_S16:
-		pcm_volume_change_16((int16_t *)buffer, (const int16_t *)end,
-				     volume);
+		assert(length % sizeof(int16_t) == 0);
+		kernels.change_16((int16_t *)buffer, length / sizeof(int16_t),
+				  volume);
 		return true;
 
 	case SAMPLE_FORMAT_S24_P32:
-		pcm_volume_change_24((int32_t *)buffer, (const int32_t *)end,
-				     volume);
+		assert(length % sizeof(int32_t) == 0);
+		kernels.change_24((int32_t *)buffer, length / sizeof(int32_t),
+				  volume);
 		return true;
 
 	case SAMPLE_FORMAT_S32:
-		pcm_volume_change_32((int32_t *)buffer, (const int32_t *)end,
-				     volume);
+		assert(length % sizeof(int32_t) == 0);
+		kernels.change_32((int32_t *)buffer, length / sizeof(int32_t),
+				  volume);
 		return true;
 
 	case SAMPLE_FORMAT_FLOAT:
-		pcm_volume_change_float((float *)buffer, (const float *)end,
-					pcm_volume_to_float(volume));
+		assert(length % sizeof(float) == 0);
+		kernels.change_float((float *)buffer, length / sizeof(float),
+				     pcm_volume_to_float(volume));
 		return true;
 	}
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Internal interface between PcmVolume.cxx and the SIMD
+ * implementations of its inner loops.
+ */
+
+#ifndef MPD_PCM_VOLUME_KERNELS_HXX
+#define MPD_PCM_VOLUME_KERNELS_HXX
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The inner loops of pcm_volume() for one instruction set.  All of
+ * them modify #n samples in place.
+ *
+ * The floating point kernel returns exactly the same results as the
+ * generic C++ code.  The integer kernels use the same formula, but
+ * their dither values come from a different random sequence.
+ */
+struct PcmVolumeKernels {
+	const char *name;
+
+	void (*change_16)(int16_t *buffer, size_t n, int volume);
+	void (*change_24)(int32_t *buffer, size_t n, int volume);
+	void (*change_32)(int32_t *buffer, size_t n, int volume);
+	void (*change_float)(float *buffer, size_t n, float volume);
+};
+
+/**
+ * The portable implementation.
+ */
+extern const PcmVolumeKernels pcm_volume_kernels_generic;
+
+/**
+ * Returns the SIMD kernels for the specified instruction set
+ * (#PCM_CPU_SSE2, #PCM_CPU_AVX2 or #PCM_CPU_NEON), or nullptr if they
+ * have not been compiled.
+ */
+const PcmVolumeKernels *
+pcm_volume_kernels_simd(unsigned feature);
+
+/**
+ * Returns the fastest kernels supported by this CPU.
+ */
+const PcmVolumeKernels &
+pcm_volume_kernels(void);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * SIMD implementations of the pcm_volume() inner loops.  Each kernel
+ * processes as many samples as fit into its vector registers, and
+ * leaves the rest to the generic implementation.
+ *
+ * The integer kernels compute the same formula as the generic code:
+ * 16 bit samples with 32 bit integers, 24 and 32 bit samples with
+ * double precision floating point, which represents all intermediate
+ * values exactly.
+ */
+
+#include "config.h"
+#include "PcmVolumeKernels.hxx"
+#include "PcmSimd.hxx"
+
+#if defined(PCM_HAVE_X86_SIMD) || defined(PCM_HAVE_NEON)
+
+/**
+ * The state of the dither PRNG of the SIMD kernels.
+ */
+static uint32_t pcm_volume_dither_state;
+
+#endif
+
+#ifdef PCM_HAVE_X86_SIMD
+
+/*
+ * SSE2
+ *
+ */
+
+SSE2_FUNC
+static void
+sse2_change_16(int16_t *buffer, size_t n, int volume)
+{
+	if (volume > INT16_MAX) {
+		/* doesn't fit into _mm_madd_epi16(); this may happen
+		   with replay gain */
+		pcm_volume_kernels_generic.change_16(buffer, n, volume);
+		return;
+	}
+
+	/* pairs of (volume, 1) for _mm_madd_epi16(), which
+	   multiplies the samples and adds the dither values in one
+	   step */
+	const __m128i v = _mm_set1_epi32(volume | (1 << 16));
+	__m128i state = sse2_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(buffer + i));
+
+		/* the dither values including the rounding offset
+		   are between 1 and 1023, which fits into 16 bit */
+		const __m128i d0 = sse2_dither_next(state);
+		const __m128i d1 = sse2_dither_next(state);
+		const __m128i d = _mm_packs_epi32(d0, d1);
+
+		const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, d), v);
+		const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, d), v);
+
+		/* _mm_packs_epi32() clamps to 16 bit */
+		_mm_storeu_si128((__m128i *)(buffer + i),
+				 _mm_packs_epi32(sse2_div_volume(lo),
+						 sse2_div_volume(hi)));
+	}
+
+	pcm_volume_dither_state = sse2_dither_end(state);
+
+	pcm_volume_kernels_generic.change_16(buffer + i, n - i, volume);
+}
+
+template<unsigned bits>
+SSE2_FUNC
+static void
+sse2_change_32(int32_t *buffer, size_t n, int volume)
+{
+	const __m128d v = _mm_set1_pd(volume);
+	__m128i state = sse2_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(buffer + i));
+		const __m128i d = sse2_dither_next(state);
+
+		const __m128i lo = sse2_clamp_pd<bits>(sse2_volume_pd(x, v, d));
+		const __m128i hi =
+			sse2_clamp_pd<bits>(sse2_volume_pd(_mm_srli_si128(x, 8),
+							   v,
+							   _mm_srli_si128(d, 8)));
+		_mm_storeu_si128((__m128i *)(buffer + i),
+				 _mm_unpacklo_epi64(lo, hi));
+	}
+
+	pcm_volume_dither_state = sse2_dither_end(state);
+
+	if (bits == 24)
+		pcm_volume_kernels_generic.change_24(buffer + i, n - i,
+						     volume);
+	else
+		pcm_volume_kernels_generic.change_32(buffer + i, n - i,
+						     volume);
+}
+
+SSE2_FUNC
+static void
+sse2_change_float(float *buffer, size_t n, float volume)
+{
+	const __m128 v = _mm_set1_ps(volume);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(buffer + i,
+			      _mm_mul_ps(_mm_loadu_ps(buffer + i), v));
+
+	pcm_volume_kernels_generic.change_float(buffer + i, n - i, volume);
+}
+
+static constexpr PcmVolumeKernels pcm_volume_kernels_sse2 = {
+	"sse2",
+	sse2_change_16,
+	sse2_change_32<24>,
+	sse2_change_32<32>,
+	sse2_change_float,
+};
+
+/*
+ * AVX2
+ *
+ */
+
+AVX2_FUNC
+static void
+avx2_change_16(int16_t *buffer, size_t n, int volume)
+{
+	if (volume > INT16_MAX) {
+		pcm_volume_kernels_generic.change_16(buffer, n, volume);
+		return;
+	}
+
+	/* see sse2_change_16() */
+	const __m256i v = _mm256_set1_epi32(volume | (1 << 16));
+	__m256i state = avx2_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i x =
+			_mm256_loadu_si256((const __m256i *)(buffer + i));
+
+		const __m256i d0 = avx2_dither_next(state);
+		const __m256i d1 = avx2_dither_next(state);
+		const __m256i d = _mm256_packs_epi32(d0, d1);
+
+		/* the unpack and pack instructions work on each 128
+		   bit lane separately, and restore the order */
+		const __m256i lo =
+			_mm256_madd_epi16(_mm256_unpacklo_epi16(x, d), v);
+		const __m256i hi =
+			_mm256_madd_epi16(_mm256_unpackhi_epi16(x, d), v);
+
+		_mm256_storeu_si256((__m256i *)(buffer + i),
+				    _mm256_packs_epi32(avx2_div_volume(lo),
+						       avx2_div_volume(hi)));
+	}
+
+	pcm_volume_dither_state = avx2_dither_end(state);
+
+	pcm_volume_kernels_generic.change_16(buffer + i, n - i, volume);
+}
+
+template<unsigned bits>
+AVX2_FUNC
+static void
+avx2_change_32(int32_t *buffer, size_t n, int volume)
+{
+	const __m256d v = _mm256_set1_pd(volume);
+	__m256i state = avx2_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i d = avx2_dither_next(state);
+
+		const __m128i lo =
+			avx2_clamp_pd<bits>(avx2_volume_pd(_mm_loadu_si128((const __m128i *)(buffer + i)),
+							   v,
+							   _mm256_castsi256_si128(d)));
+		const __m128i hi =
+			avx2_clamp_pd<bits>(avx2_volume_pd(_mm_loadu_si128((const __m128i *)(buffer + i + 4)),
+							   v,
+							   _mm256_extracti128_si256(d, 1)));
+		_mm256_storeu_si256((__m256i *)(buffer + i),
+				    avx2_combine(lo, hi));
+	}
+
+	pcm_volume_dither_state = avx2_dither_end(state);
+
+	if (bits == 24)
+		pcm_volume_kernels_generic.change_24(buffer + i, n - i,
+						     volume);
+	else
+		pcm_volume_kernels_generic.change_32(buffer + i, n - i,
+						     volume);
+}
+
+AVX2_FUNC
+static void
+avx2_change_float(float *buffer, size_t n, float volume)
+{
+	const __m256 v = _mm256_set1_ps(volume);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(buffer + i,
+				 _mm256_mul_ps(_mm256_loadu_ps(buffer + i), v));
+
+	pcm_volume_kernels_generic.change_float(buffer + i, n - i, volume);
+}
+
+static constexpr PcmVolumeKernels pcm_volume_kernels_avx2 = {
+	"avx2",
+	avx2_change_16,
+	avx2_change_32<24>,
+	avx2_change_32<32>,
+	avx2_change_float,
+};
+
+#endif /* PCM_HAVE_X86_SIMD */
+
+#ifdef PCM_HAVE_NEON
+
+static void
+neon_change_16(int16_t *buffer, size_t n, int volume)
+{
+	uint32x4_t state = neon_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int16x8_t x = vld1q_s16(buffer + i);
+
+		const int32x4_t lo =
+			vmlaq_n_s32(neon_dither_next(state),
+				    vmovl_s16(vget_low_s16(x)), volume);
+		const int32x4_t hi =
+			vmlaq_n_s32(neon_dither_next(state),
+				    vmovl_s16(vget_high_s16(x)), volume);
+
+		/* vqmovn_s32() clamps to 16 bit */
+		vst1q_s16(buffer + i,
+			  vcombine_s16(vqmovn_s32(neon_div_volume(lo)),
+				       vqmovn_s32(neon_div_volume(hi))));
+	}
+
+	pcm_volume_dither_state = neon_dither_end(state);
+
+	pcm_volume_kernels_generic.change_16(buffer + i, n - i, volume);
+}
+
+template<unsigned bits>
+static void
+neon_change_32(int32_t *buffer, size_t n, int volume)
+{
+	uint32x4_t state = neon_dither_begin(pcm_volume_dither_state);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const int32x4_t x = vld1q_s32(buffer + i);
+		const int32x4_t d = neon_dither_next(state);
+
+		const int64x2_t lo =
+			vaddq_s64(vmull_n_s32(vget_low_s32(x), volume),
+				  vmovl_s32(vget_low_s32(d)));
+		const int64x2_t hi =
+			vaddq_s64(vmull_n_s32(vget_high_s32(x), volume),
+				  vmovl_s32(vget_high_s32(d)));
+
+		vst1q_s32(buffer + i,
+			  vcombine_s32(neon_narrow_volume<bits>(lo),
+				       neon_narrow_volume<bits>(hi)));
+	}
+
+	pcm_volume_dither_state = neon_dither_end(state);
+
+	if (bits == 24)
+		pcm_volume_kernels_generic.change_24(buffer + i, n - i,
+						     volume);
+	else
+		pcm_volume_kernels_generic.change_32(buffer + i, n - i,
+						     volume);
+}
+
+static void
+neon_change_float(float *buffer, size_t n, float volume)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(buffer + i, vmulq_n_f32(vld1q_f32(buffer + i),
+						  volume));
+
+	pcm_volume_kernels_generic.change_float(buffer + i, n - i, volume);
+}
+
+static constexpr PcmVolumeKernels pcm_volume_kernels_neon = {
+	"neon",
+	neon_change_16,
+	neon_change_32<24>,
+	neon_change_32<32>,
+	neon_change_float,
+};
+
+#endif /* PCM_HAVE_NEON */
+
+const PcmVolumeKernels *
+pcm_volume_kernels_simd(unsigned feature)
+{
+	switch (feature) {
+#ifdef PCM_HAVE_X86_SIMD
+	case PCM_CPU_SSE2:
+		return &pcm_volume_kernels_sse2;
+
+	case PCM_CPU_AVX2:
+		return &pcm_volume_kernels_avx2;
+#endif
+
+#ifdef PCM_HAVE_NEON
+	case PCM_CPU_NEON:
+		return &pcm_volume_kernels_neon;
+#endif
+
+	default:
+		return nullptr;
+	}
+}
@@ -19,71 +19,118 @@
 
 #include "config.h"
 #include "pcm_resample_internal.h"
-
-#ifdef HAVE_LIBSAMPLERATE
 #include "conf.h"
-#endif
+
+#include <glib.h>
 
 #include <string.h>
 
-#ifdef HAVE_LIBSAMPLERATE
-static bool lsr_enabled;
-#endif
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "pcm"
+
+enum pcm_resampler {
+	/**
+	 * The "internal" resampler, which picks the nearest sample.
+	 */
+	PCM_RESAMPLER_FALLBACK,
+
+	PCM_RESAMPLER_POLYPHASE,
 
 #ifdef HAVE_LIBSAMPLERATE
-static bool
-pcm_resample_lsr_enabled(void)
-{
-	return lsr_enabled;
-}
+	PCM_RESAMPLER_LSR,
 #endif
+};
+
+static enum pcm_resampler pcm_resampler;
 
 bool
 pcm_resample_global_init(GError **error_r)
 {
-#ifdef HAVE_LIBSAMPLERATE
 	const char *converter =
 		config_get_string(CONF_SAMPLERATE_CONVERTER, "");
 
-	lsr_enabled = strcmp(converter, "internal") != 0;
-	if (lsr_enabled)
-		return pcm_resample_lsr_global_init(converter, error_r);
-	else
+	if (strcmp(converter, "internal") == 0) {
+		pcm_resampler = PCM_RESAMPLER_FALLBACK;
 		return true;
+	}
+
+#ifdef HAVE_LIBSAMPLERATE
+	if (strcmp(converter, "polyphase") != 0) {
+		pcm_resampler = PCM_RESAMPLER_LSR;
+		return pcm_resample_lsr_global_init(converter, error_r);
+	}
 #else
-	(void)error_r;
-	return true;
+	/* without libsamplerate, the polyphase resampler is the
+	   default */
+	if (*converter != 0 && strcmp(converter, "polyphase") != 0)
+		g_warning("libsamplerate support is disabled, "
+			  "ignoring samplerate_converter '%s'", converter);
 #endif
+
+	pcm_resampler = PCM_RESAMPLER_POLYPHASE;
+
+	const unsigned threads =
+		config_get_unsigned(CONF_SAMPLERATE_THREADS, 1);
+	return pcm_resample_polyphase_global_init(threads, error_r);
 }
 
 void pcm_resample_init(struct pcm_resample_state *state)
 {
+	state->polyphase = NULL;
+
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		pcm_resample_fallback_init(state);
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		pcm_resample_polyphase_init(state);
+		break;
+
 #ifdef HAVE_LIBSAMPLERATE
-	if (pcm_resample_lsr_enabled())
+	case PCM_RESAMPLER_LSR:
 		pcm_resample_lsr_init(state);
-	else
+		break;
 #endif
-		pcm_resample_fallback_init(state);
+	}
 }
 
 void pcm_resample_deinit(struct pcm_resample_state *state)
 {
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		pcm_resample_fallback_deinit(state);
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		pcm_resample_polyphase_deinit(state);
+		break;
+
 #ifdef HAVE_LIBSAMPLERATE
-	if (pcm_resample_lsr_enabled())
+	case PCM_RESAMPLER_LSR:
 		pcm_resample_lsr_deinit(state);
-	else
+		break;
 #endif
-		pcm_resample_fallback_deinit(state);
+	}
 }
 
 void
 pcm_resample_reset(struct pcm_resample_state *state)
 {
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		pcm_resample_polyphase_reset(state);
+		break;
+
 #ifdef HAVE_LIBSAMPLERATE
-	pcm_resample_lsr_reset(state);
-#else
-	(void)state;
+	case PCM_RESAMPLER_LSR:
+		pcm_resample_lsr_reset(state);
+		break;
 #endif
+	}
 }
 
 const float *
@@ -94,15 +141,26 @@ pcm_resample_float(struct pcm_resample_state *state,
 		   unsigned dest_rate, size_t *dest_size_r,
 		   GError **error_r)
 {
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		return pcm_resample_polyphase_float(state, channels,
+						    src_rate,
+						    src_buffer, src_size,
+						    dest_rate, dest_size_r);
+
 #ifdef HAVE_LIBSAMPLERATE
-	if (pcm_resample_lsr_enabled())
+	case PCM_RESAMPLER_LSR:
 		return pcm_resample_lsr_float(state, channels,
 					      src_rate, src_buffer, src_size,
 					      dest_rate, dest_size_r,
 					      error_r);
-#else
-	(void)error_r;
 #endif
+	}
+
+	(void)error_r;
 
 	/* sizeof(float)==sizeof(int32_t); the fallback resampler does
 	   not do any math on the sample values, so this hack is
@@ -121,39 +179,93 @@ pcm_resample_16(struct pcm_resample_state *state,
 		unsigned dest_rate, size_t *dest_size_r,
 		GError **error_r)
 {
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		return pcm_resample_polyphase_16(state, channels,
+						 src_rate,
+						 src_buffer, src_size,
+						 dest_rate, dest_size_r);
+
 #ifdef HAVE_LIBSAMPLERATE
-	if (pcm_resample_lsr_enabled())
+	case PCM_RESAMPLER_LSR:
 		return pcm_resample_lsr_16(state, channels,
 					   src_rate, src_buffer, src_size,
 					   dest_rate, dest_size_r,
 					   error_r);
-#else
-	(void)error_r;
 #endif
+	}
+
+	(void)error_r;
 
 	return pcm_resample_fallback_16(state, channels,
 					src_rate, src_buffer, src_size,
 					dest_rate, dest_size_r);
 }
 
-const int32_t *
-pcm_resample_32(struct pcm_resample_state *state,
-		unsigned channels,
-		unsigned src_rate, const int32_t *src_buffer, size_t src_size,
-		unsigned dest_rate, size_t *dest_size_r,
-		GError **error_r)
+/**
+ * @param bits the number of significant bits (24 or 32)
+ */
+static const int32_t *
+pcm_resample_32_bits(struct pcm_resample_state *state, unsigned bits,
+		     unsigned channels,
+		     unsigned src_rate,
+		     const int32_t *src_buffer, size_t src_size,
+		     unsigned dest_rate, size_t *dest_size_r,
+		     GError **error_r)
 {
+	switch (pcm_resampler) {
+	case PCM_RESAMPLER_FALLBACK:
+		break;
+
+	case PCM_RESAMPLER_POLYPHASE:
+		return pcm_resample_polyphase_32(state, bits, channels,
+						 src_rate,
+						 src_buffer, src_size,
+						 dest_rate, dest_size_r);
+
 #ifdef HAVE_LIBSAMPLERATE
-	if (pcm_resample_lsr_enabled())
+	case PCM_RESAMPLER_LSR:
+		/* libsamplerate converts to float and back, which
+		   doesn't care if the upper 8 bits are actually
+		   used */
 		return pcm_resample_lsr_32(state, channels,
 					   src_rate, src_buffer, src_size,
 					   dest_rate, dest_size_r,
 					   error_r);
-#else
-	(void)error_r;
 #endif
+	}
+
+	(void)bits;
+	(void)error_r;
 
 	return pcm_resample_fallback_32(state, channels,
 					src_rate, src_buffer, src_size,
 					dest_rate, dest_size_r);
 }
+
+const int32_t *
+pcm_resample_24(struct pcm_resample_state *state,
+		unsigned channels,
+		unsigned src_rate, const int32_t *src_buffer, size_t src_size,
+		unsigned dest_rate, size_t *dest_size_r,
+		GError **error_r)
+{
+	return pcm_resample_32_bits(state, 24, channels,
+				    src_rate, src_buffer, src_size,
+				    dest_rate, dest_size_r, error_r);
+}
+
+const int32_t *
+pcm_resample_32(struct pcm_resample_state *state,
+		unsigned channels,
+		unsigned src_rate, const int32_t *src_buffer, size_t src_size,
+		unsigned dest_rate, size_t *dest_size_r,
+		GError **error_r)
+{
+	return pcm_resample_32_bits(state, 32, channels,
+				    src_rate, src_buffer, src_size,
+				    dest_rate, dest_size_r, error_r);
+}
@@ -31,6 +31,8 @@
 #include <samplerate.h>
 #endif
 
+struct PcmPolyphase;
+
 /**
  * This object is statically allocated (within another struct), and
  * holds buffer allocations and the state for the resampler.
@@ -51,6 +53,12 @@ struct pcm_resample_state {
 	int error;
 #endif
 
+	/**
+	 * The polyphase resampler, allocated by pcm_resample_init()
+	 * if it has been selected.
+	 */
+	struct PcmPolyphase *polyphase;
+
 	struct pcm_buffer buffer;
 };
 
@@ -146,19 +154,12 @@ pcm_resample_32(struct pcm_resample_state *state,
  * @param dest_size_r returns the number of bytes of the destination buffer
  * @return the destination buffer
  */
-static inline const int32_t *
+const int32_t *
 pcm_resample_24(struct pcm_resample_state *state,
 		unsigned channels,
 		unsigned src_rate,
 		const int32_t *src_buffer, size_t src_size,
 		unsigned dest_rate, size_t *dest_size_r,
-		GError **error_r)
-{
-	/* reuse the 32 bit code - the resampler code doesn't care if
-	   the upper 8 bits are actually used */
-	return pcm_resample_32(state, channels,
-			       src_rate, src_buffer, src_size,
-			       dest_rate, dest_size_r, error_r);
-}
+		GError **error_r);
 
 #endif
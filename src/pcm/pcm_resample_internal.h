@@ -71,6 +71,49 @@ pcm_resample_lsr_32(struct pcm_resample_state *state,
 
 #endif
 
+/**
+ * Configures the threads which are shared by all polyphase
+ * resamplers.
+ *
+ * @param threads the maximum number of threads filtering one buffer,
+ * including the caller; 0 or 1 disables parallel filtering
+ */
+bool
+pcm_resample_polyphase_global_init(unsigned threads, GError **error_r);
+
+void
+pcm_resample_polyphase_init(struct pcm_resample_state *state);
+
+void
+pcm_resample_polyphase_deinit(struct pcm_resample_state *state);
+
+void
+pcm_resample_polyphase_reset(struct pcm_resample_state *state);
+
+const float *
+pcm_resample_polyphase_float(struct pcm_resample_state *state,
+			     unsigned channels,
+			     unsigned src_rate,
+			     const float *src_buffer, size_t src_size,
+			     unsigned dest_rate, size_t *dest_size_r);
+
+const int16_t *
+pcm_resample_polyphase_16(struct pcm_resample_state *state,
+			  unsigned channels,
+			  unsigned src_rate,
+			  const int16_t *src_buffer, size_t src_size,
+			  unsigned dest_rate, size_t *dest_size_r);
+
+/**
+ * @param bits the number of significant bits (24 or 32)
+ */
+const int32_t *
+pcm_resample_polyphase_32(struct pcm_resample_state *state,
+			  unsigned bits, unsigned channels,
+			  unsigned src_rate,
+			  const int32_t *src_buffer, size_t src_size,
+			  unsigned dest_rate, size_t *dest_size_r);
+
 void
 pcm_resample_fallback_init(struct pcm_resample_state *state);
 
@@ -23,22 +23,38 @@
 #include "HugeAllocator.hxx"
 #include "gcc.h"
 
+#include <atomic>
 #include <utility>
 #include <new>
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * This class pre-allocates a certain number of objects, and allows
  * callers to allocate and free these objects ("slices").
+ *
+ * Allocate() and Free() are lock-free, and may be called by any
+ * number of threads at the same time.  The free slices are kept in a
+ * Treiber stack; its head is a slice index combined with a counter
+ * which is incremented on every modification, so a thread which has
+ * been preempted during Allocate() cannot be fooled by a slice which
+ * has been allocated and freed again in the meantime (the "ABA"
+ * problem).
  */
 template<typename T>
 class SliceBuffer {
-	union Slice {
-		Slice *next;
-
+	struct Slice {
 		T value;
+
+		/**
+		 * The index of the next free slice plus one (0 is
+		 * the end of the list).  This is not overlapped with
+		 * the value, because a thread in Allocate() may still
+		 * read it after another thread has taken the slice.
+		 */
+		std::atomic<unsigned> next;
 	};
 
 	/**
@@ -51,29 +67,84 @@ class SliceBuffer {
 	 * avoid page faulting on the new allocation, so the kernel
 	 * does not need to reserve physical memory pages.
 	 */
-	unsigned n_initialized;
+	std::atomic<unsigned> n_initialized;
 
 	/**
 	 * The number of slices currently allocated.
 	 */
-	unsigned n_allocated;
+	std::atomic<unsigned> n_allocated;
 
 	Slice *const data;
 
 	/**
-	 * Pointer to the first free element in the chain.
+	 * The first free slice in the chain: the lower 32 bits are
+	 * the index plus one (0 means the chain is empty), the upper
+	 * 32 bits are the modification counter.
 	 */
-	Slice *available;
+	std::atomic<uint64_t> available;
 
 	size_t CalcAllocationSize() const {
 		return n_max * sizeof(Slice);
 	}
 
+	static constexpr uint64_t MakeHead(uint64_t old_head,
+					   unsigned index_plus_one) {
+		return ((old_head >> 32) + 1) << 32 | index_plus_one;
+	}
+
+	/**
+	 * Pops a slice from the "available" chain.
+	 */
+	Slice *Pop() {
+		uint64_t head = available.load();
+		while (true) {
+			const unsigned i = (unsigned)head;
+			if (i == 0)
+				return nullptr;
+
+			Slice *slice = &data[i - 1];
+			const unsigned next =
+				slice->next.load(std::memory_order_relaxed);
+
+			if (available.compare_exchange_weak(head,
+							    MakeHead(head,
+								     next)))
+				return slice;
+		}
+	}
+
+	/**
+	 * Pushes a slice to the "available" chain.
+	 */
+	void Push(Slice *slice) {
+		const unsigned i = slice - data + 1;
+
+		uint64_t head = available.load();
+		do {
+			slice->next.store((unsigned)head,
+					  std::memory_order_relaxed);
+		} while (!available.compare_exchange_weak(head,
+							  MakeHead(head, i)));
+	}
+
+	/**
+	 * Takes a slice which has never been used since the last
+	 * Discard().
+	 */
+	Slice *TakeNew() {
+		unsigned n = n_initialized.load();
+		while (n < n_max)
+			if (n_initialized.compare_exchange_weak(n, n + 1))
+				return &data[n];
+
+		return nullptr;
+	}
+
 public:
 	SliceBuffer(unsigned _count)
 		:n_max(_count), n_initialized(0), n_allocated(0),
 		 data((Slice *)HugeAllocate(CalcAllocationSize())),
-		 available(nullptr) {
+		 available(0) {
 		assert(n_max > 0);
 	}
 
@@ -107,35 +178,45 @@ public:
 		return n_allocated == n_max;
 	}
 
+	/**
+	 * Returns the position of an allocated object in this
+	 * container, a number smaller than GetCapacity().  This may
+	 * be used to associate more memory with each slice.
+	 */
+	gcc_pure
+	unsigned GetIndex(const T *value) const {
+		const Slice *slice = reinterpret_cast<const Slice *>(value);
+		assert(slice >= data && slice < data + n_max);
+
+		return slice - data;
+	}
+
 	template<typename... Args>
 	T *Allocate(Args&&... args) {
-		assert(n_initialized <= n_max);
-		assert(n_allocated <= n_initialized);
-
-		if (available == nullptr) {
-			if (n_initialized == n_max) {
-				/* out of (internal) memory, buffer is full */
-				assert(n_allocated == n_max);
+		Slice *slice = Pop();
+		if (slice == nullptr) {
+			slice = TakeNew();
+
+			/* all slices were initialized meanwhile; try
+			   the chain again */
+			if (slice == nullptr)
+				slice = Pop();
+
+			if (slice == nullptr)
+				/* out of (internal) memory, buffer is
+				   full */
 				return nullptr;
-			}
-
-			available = &data[n_initialized++];
-			available->next = nullptr;
 		}
 
-		/* allocate a slice */
-		T *value = &available->value;
-		available = available->next;
 		++n_allocated;
 
 		/* construct the object */
-		return ::new((void *)value) T(std::forward<Args>(args)...);
+		return ::new((void *)&slice->value)
+			T(std::forward<Args>(args)...);
 	}
 
 	void Free(T *value) {
-		assert(n_initialized <= n_max);
 		assert(n_allocated > 0);
-		assert(n_allocated <= n_initialized);
 
 		Slice *slice = reinterpret_cast<Slice *>(value);
 		assert(slice >= data && slice < data + n_max);
@@ -144,17 +225,22 @@ public:
 		value->~T();
 
 		/* insert the slice in the "available" linked list */
-		slice->next = available;
-		available = slice;
+		Push(slice);
 		--n_allocated;
+	}
 
-		/* give memory back to the kernel when the last slice
-		   was freed */
-		if (n_allocated == 0) {
-			HugeDiscard(data, CalcAllocationSize());
-			n_initialized = 0;
-			available = nullptr;
-		}
+	/**
+	 * Give memory back to the kernel.  This is only done if all
+	 * slices have been freed, and the caller must make sure that
+	 * no other thread uses this object meanwhile.
+	 */
+	void Discard() {
+		if (n_allocated > 0)
+			return;
+
+		HugeDiscard(data, CalcAllocationSize());
+		n_initialized = 0;
+		available = 0;
 	}
 };
 
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_SPSC_QUEUE_HXX
+#define MPD_SPSC_QUEUE_HXX
+
+#include <atomic>
+
+#include <assert.h>
+
+/**
+ * A fixed-size lock-free queue for exactly one producer thread and
+ * exactly one consumer thread.  Elements are constructed in place:
+ * the producer obtains a free slot with Prepare(), fills it and
+ * publishes it with Commit(); the consumer looks at the oldest
+ * element with Front() and releases it with Pop().
+ *
+ * The indices are accessed with sequentially consistent operations,
+ * so a thread which finds the queue full (or empty) and then checks
+ * a "waiting" flag of the other side cannot miss an update; this
+ * allows putting a condition variable next to the queue for
+ * sleeping.
+ *
+ * @param N the capacity; must be a power of two
+ */
+template<typename T, unsigned N>
+class SpscQueue {
+	static_assert(N > 0 && (N & (N - 1)) == 0,
+		      "capacity must be a power of two");
+
+	/**
+	 * The number of elements ever popped.  Written only by the
+	 * consumer.
+	 */
+	std::atomic_uint head;
+
+	/**
+	 * The number of elements ever committed.  Written only by
+	 * the producer.
+	 */
+	std::atomic_uint tail;
+
+	T data[N];
+
+public:
+	SpscQueue():head(0), tail(0) {}
+
+	SpscQueue(const SpscQueue &other) = delete;
+	SpscQueue &operator=(const SpscQueue &other) = delete;
+
+	static constexpr unsigned GetCapacity() {
+		return N;
+	}
+
+	bool IsEmpty() const {
+		return head == tail;
+	}
+
+	/**
+	 * Producer: returns a pointer to the next free slot, or
+	 * nullptr if the queue is full.
+	 */
+	T *Prepare() {
+		const unsigned t = tail.load(std::memory_order_relaxed);
+		if (t - head == N)
+			return nullptr;
+
+		return &data[t % N];
+	}
+
+	/**
+	 * Producer: publishes the slot returned by Prepare().
+	 */
+	void Commit() {
+		const unsigned t = tail.load(std::memory_order_relaxed);
+		assert(t - head < N);
+
+		tail = t + 1;
+	}
+
+	/**
+	 * Consumer: returns a pointer to the oldest element, or
+	 * nullptr if the queue is empty.
+	 */
+	T *Front() {
+		const unsigned h = head.load(std::memory_order_relaxed);
+		if (h == tail)
+			return nullptr;
+
+		return &data[h % N];
+	}
+
+	/**
+	 * Consumer: releases the element returned by Front().
+	 */
+	void Pop() {
+		const unsigned h = head.load(std::memory_order_relaxed);
+		assert(h != tail);
+
+		head = h + 1;
+	}
+};
+
+#endif
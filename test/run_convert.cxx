@@ -54,6 +54,13 @@ config_get_string(gcc_unused enum ConfigOption option,
 	return default_value;
 }
 
+unsigned
+config_get_unsigned(gcc_unused enum ConfigOption option,
+		    unsigned default_value)
+{
+	return default_value;
+}
+
 int main(int argc, char **argv)
 {
 	GError *error = NULL;
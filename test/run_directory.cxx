@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Measures the Directory lookups in a synthetic database: one flat
+ * directory with many songs, and one with many sub directories
+ * (which are a few levels deep).  Each URI is looked up once, in
+ * random order, the way the update thread and "add" do.  The
+ * database is also saved and loaded again with directory_load(),
+ * which looks up each entry before adding it, just like the update
+ * walk.
+ */
+
+#include "config.h"
+#include "Directory.hxx"
+#include "DirectorySave.hxx"
+#include "DatabaseLock.hxx"
+#include "TextFile.hxx"
+#include "song.h"
+#include "clock.h"
+#include "fs/Path.hxx"
+
+#include <glib.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static constexpr unsigned DEPTH = 4;
+
+/**
+ * Returns the URIs in a random (but reproducible) order.
+ */
+static char **
+shuffle(char **uris, unsigned n)
+{
+	GRand *rand = g_rand_new_with_seed(42);
+	for (unsigned i = n - 1; i > 0; --i) {
+		unsigned j = g_rand_int_range(rand, 0, i + 1);
+		char *tmp = uris[i];
+		uris[i] = uris[j];
+		uris[j] = tmp;
+	}
+
+	g_rand_free(rand);
+	return uris;
+}
+
+static void
+print_result(const char *name, unsigned n, uint64_t duration)
+{
+	g_print("%-16s %8u: %8.3f ms, %7.1f ns each\n", name, n,
+		duration / 1000.0, duration * 1000.0 / n);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 2) {
+		g_printerr("Usage: run_directory [ENTRIES]\n");
+		return EXIT_FAILURE;
+	}
+
+	const unsigned n = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+	if (n < 2) {
+		g_printerr("Invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	g_thread_init(NULL);
+#endif
+
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *flat = root->CreateChild("flat");
+	Directory *deep = root->CreateChild("deep");
+
+	char **song_uris = g_new(char *, n);
+	char **directory_uris = g_new(char *, n);
+
+	/* create the songs and directories */
+	uint64_t start = monotonic_clock_us();
+
+	for (unsigned i = 0; i < n; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "%08x - Track %u.flac",
+			 i * 2654435761u, i);
+		flat->AddSong(song_file_new(name, flat));
+		song_uris[i] = g_strconcat("flat/", name, NULL);
+
+		snprintf(name, sizeof(name), "Album %u", i);
+		Directory *d = deep->CreateChild(name);
+		for (unsigned j = 1; j < DEPTH; ++j)
+			d = d->CreateChild("CD 1");
+		directory_uris[i] = g_strdup(d->GetPath());
+	}
+
+	print_result("create", n, monotonic_clock_us() - start);
+
+	shuffle(song_uris, n);
+	shuffle(directory_uris, n);
+
+	/* look them all up; the results are stored, or the compiler
+	   could move these "pure" calls out of the measured range */
+	const void **results = g_new(const void *, 2 * n);
+
+	start = monotonic_clock_us();
+	for (unsigned i = 0; i < n; ++i)
+		results[i] = root->LookupSong(song_uris[i]);
+
+	print_result("LookupSong", n, monotonic_clock_us() - start);
+
+	start = monotonic_clock_us();
+	for (unsigned i = 0; i < n; ++i)
+		results[n + i] = root->LookupDirectory(directory_uris[i]);
+
+	print_result("LookupDirectory", n, monotonic_clock_us() - start);
+
+	for (unsigned i = 0; i < 2 * n; ++i) {
+		if (results[i] == NULL) {
+			g_printerr("Lookup failed\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	g_free(results);
+
+	/* save and load the whole tree */
+	char *db_path;
+	int fd = g_file_open_tmp("run_directory.XXXXXX", &db_path, NULL);
+	if (fd < 0) {
+		g_printerr("Failed to create a temporary file\n");
+		return EXIT_FAILURE;
+	}
+
+	FILE *fp = fdopen(fd, "w");
+	directory_save(fp, root);
+	fclose(fp);
+
+	Directory *loaded = Directory::NewRoot();
+	GError *error = NULL;
+
+	start = monotonic_clock_us();
+	bool success;
+	{
+		TextFile file(Path::FromFS(db_path));
+		success = !file.HasFailed() &&
+			directory_load(file, loaded, &error);
+	}
+
+	print_result("directory_load", n * (1 + DEPTH),
+		     monotonic_clock_us() - start);
+
+	unlink(db_path);
+	g_free(db_path);
+
+	if (!success) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("Failed to load the database\n");
+		return EXIT_FAILURE;
+	}
+
+	if (loaded->LookupSong(song_uris[0]) == NULL ||
+	    loaded->LookupDirectory(directory_uris[0]) == NULL) {
+		g_printerr("Lookup in the loaded database failed\n");
+		return EXIT_FAILURE;
+	}
+
+	loaded->Free();
+
+	/* remove the songs one by one */
+	start = monotonic_clock_us();
+	for (unsigned i = 0; i < n; ++i) {
+		const char *name = strchr(song_uris[i], '/') + 1;
+		struct song *song = flat->FindSong(name);
+		assert(song != NULL);
+		flat->RemoveSong(song);
+		song_free(song);
+	}
+
+	print_result("RemoveSong", n, monotonic_clock_us() - start);
+
+	/* delete the directories */
+	start = monotonic_clock_us();
+	for (unsigned i = 0; i < n; ++i) {
+		char *slash = strchr(directory_uris[i] + 5, '/');
+		*slash = 0;
+		Directory *directory = root->LookupDirectory(directory_uris[i]);
+		assert(directory != NULL);
+		directory->Delete();
+	}
+
+	print_result("Delete", n, monotonic_clock_us() - start);
+
+	root->Free();
+	db_unlock();
+
+	for (unsigned i = 0; i < n; ++i) {
+		g_free(song_uris[i]);
+		g_free(directory_uris[i]);
+	}
+
+	g_free(song_uris);
+	g_free(directory_uris);
+
+	return EXIT_SUCCESS;
+}
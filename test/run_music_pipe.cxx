@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Measures how many chunks per second pass through a "decoder"
+ * thread, the "player" (this thread) and a number of "null output"
+ * threads, using #music_buffer, #music_pipe and #music_pipe_reader
+ * the way MPD does.  The threads poll instead of sleeping, so the
+ * result shows the cost of the data structures, not of the wakeups.
+ */
+
+#include "config.h"
+#include "MusicPipe.hxx"
+#include "MusicBuffer.hxx"
+#include "MusicChunk.hxx"
+#include "audio_format.h"
+#include "tag.h"
+#include "clock.h"
+
+#include <glib.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr unsigned BUFFER_CHUNKS = 1024;
+
+void
+tag_free(gcc_unused struct tag *tag)
+{
+}
+
+static struct audio_format audio_format;
+static struct music_buffer *buffer;
+static unsigned num_chunks;
+static size_t chunk_size;
+
+static gpointer
+decoder_task(gpointer data)
+{
+	struct music_pipe *pipe = (struct music_pipe *)data;
+
+	for (unsigned i = 0; i < num_chunks; ++i) {
+		struct music_chunk *chunk;
+		while ((chunk = music_buffer_allocate(buffer)) == NULL)
+			g_thread_yield();
+
+		size_t max_length;
+		void *dest = chunk->Write(audio_format, 0, 0, &max_length);
+		memset(dest, 0, max_length);
+		chunk->Expand(audio_format, max_length);
+
+		music_pipe_push(pipe, chunk);
+	}
+
+	return NULL;
+}
+
+struct null_output {
+	const struct music_pipe *pipe;
+	struct music_pipe_reader reader;
+	GThread *thread;
+};
+
+static gpointer
+null_output_task(gpointer data)
+{
+	struct null_output *o = (struct null_output *)data;
+
+	for (unsigned i = 0; i < num_chunks; ++i) {
+		const struct music_chunk *chunk;
+		while ((chunk = music_pipe_reader_get(o->pipe,
+						      &o->reader)) == NULL)
+			g_thread_yield();
+
+		music_pipe_reader_consumed(o->pipe, &o->reader, chunk);
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns all chunks which have been consumed by all outputs, like
+ * audio_output_all_check().
+ */
+static void
+check(struct music_pipe *pipe, struct null_output *outputs,
+      unsigned num_outputs)
+{
+	unsigned n = music_pipe_size(pipe);
+	for (unsigned i = 0; i < num_outputs && n > 0; ++i) {
+		unsigned done = music_pipe_reader_done(pipe,
+						       &outputs[i].reader);
+		if (done < n)
+			n = done;
+	}
+
+	while (n-- > 0)
+		music_buffer_return(buffer, music_pipe_shift(pipe));
+
+	const struct music_chunk *tail = music_pipe_peek(pipe);
+	if (tail == NULL || tail->next != NULL)
+		return;
+
+	for (unsigned i = 0; i < num_outputs; ++i)
+		if (!music_pipe_reader_is_finished(&outputs[i].reader, tail))
+			return;
+
+	for (unsigned i = 0; i < num_outputs; ++i)
+		music_pipe_reader_release(&outputs[i].reader, tail);
+
+	music_buffer_return(buffer, music_pipe_shift(pipe));
+}
+
+static GThread *
+start_thread(GThreadFunc func, gpointer data)
+{
+#if GLIB_CHECK_VERSION(2,32,0)
+	return g_thread_new("bench", func, data);
+#else
+	return g_thread_create(func, data, true, NULL);
+#endif
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 4) {
+		g_printerr("Usage: run_music_pipe [OUTPUTS] [CHUNKS] [CHUNK_SIZE]\n");
+		return EXIT_FAILURE;
+	}
+
+	const unsigned num_outputs = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+	num_chunks = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	chunk_size = argc > 3
+		? strtoul(argv[3], NULL, 10)
+		: (unsigned long)DEFAULT_CHUNK_SIZE;
+	if (num_outputs == 0 || num_chunks == 0 || chunk_size < 4) {
+		g_printerr("Invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+	g_thread_init(NULL);
+#endif
+
+	audio_format_init(&audio_format, 44100, SAMPLE_FORMAT_S16, 2);
+	buffer = music_buffer_new(BUFFER_CHUNKS, chunk_size);
+
+	struct music_pipe *decoder_pipe = music_pipe_new();
+	struct music_pipe *output_pipe = music_pipe_new();
+
+	struct null_output *outputs = new struct null_output[num_outputs];
+	for (unsigned i = 0; i < num_outputs; ++i) {
+		outputs[i].pipe = output_pipe;
+		music_pipe_reader_rewind(&outputs[i].reader);
+		outputs[i].thread = start_thread(null_output_task, &outputs[i]);
+	}
+
+	const uint64_t start = monotonic_clock_us();
+
+	GThread *decoder = start_thread(decoder_task, decoder_pipe);
+
+	/* the player: move chunks from the decoder to the outputs */
+	for (unsigned i = 0; i < num_chunks; ++i) {
+		struct music_chunk *chunk;
+		while ((chunk = music_pipe_shift(decoder_pipe)) == NULL) {
+			check(output_pipe, outputs, num_outputs);
+			g_thread_yield();
+		}
+
+		music_pipe_push(output_pipe, chunk);
+		for (unsigned j = 0; j < num_outputs; ++j)
+			music_pipe_reader_hand_over(&outputs[j].reader, chunk);
+
+		check(output_pipe, outputs, num_outputs);
+	}
+
+	g_thread_join(decoder);
+	for (unsigned i = 0; i < num_outputs; ++i)
+		g_thread_join(outputs[i].thread);
+
+	const uint64_t duration = monotonic_clock_us() - start;
+
+	check(output_pipe, outputs, num_outputs);
+	assert(music_pipe_empty(output_pipe));
+
+	delete[] outputs;
+	music_pipe_free(output_pipe);
+	music_pipe_free(decoder_pipe);
+	music_buffer_free(buffer);
+
+	const double seconds = duration / 1e6;
+	g_print("%u chunks of %u bytes, %u outputs: %.3f s, %.0f chunks/s, %.1f MiB/s\n",
+		num_chunks, (unsigned)chunk_size, num_outputs, seconds,
+		num_chunks / seconds,
+		num_chunks * (double)chunk_size / (1024 * 1024) / seconds);
+
+	return EXIT_SUCCESS;
+}
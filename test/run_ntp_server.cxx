@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2003-2011 The Music Player Daemon Project
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
  * http://www.musicpd.org
  *
  * This program is free software; you can redistribute it and/or modify
@@ -17,55 +17,201 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/*
+ * Runs the RAOP timing server.  With "--histogram", the time between
+ * the kernel's receive time stamp and the reply is measured for each
+ * request, and a histogram is printed on exit.
+ */
+
 #include "config.h"
-#include "ntp_server.h"
-#include "signals.h"
-#include "io_thread.h"
+#include "NtpServer.hxx"
+#include "Main.hxx"
+#include "event/Loop.hxx"
+#include "event/SocketMonitor.hxx"
+#include "event/WakeFD.hxx"
 
 #include <glib.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <unistd.h>
-
-#ifdef WIN32
-#include <ws2tcpip.h>
-#include <winsock.h>
-#else
-#include <sys/socket.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <signal.h>
 #endif
 
-void
-on_quit(void)
+EventLoop *main_loop;
+
+#ifndef WIN32
+
+/**
+ * Breaks the main loop after a signal.  The signal handler only
+ * writes to a #WakeFD, which is async-signal-safe.
+ */
+class ExitMonitor final : public SocketMonitor {
+	WakeFD &wake_fd;
+
+public:
+	ExitMonitor(EventLoop &_loop, WakeFD &_wake_fd)
+		:SocketMonitor(_wake_fd.Get(), _loop), wake_fd(_wake_fd) {
+		ScheduleRead();
+	}
+
+	~ExitMonitor() {
+		/* the WakeFD closes the descriptor */
+		Steal();
+	}
+
+protected:
+	virtual bool OnSocketReady(G_GNUC_UNUSED unsigned flags) override {
+		wake_fd.Read();
+		main_loop->Break();
+		return true;
+	}
+};
+
+static WakeFD exit_wake_fd;
+
+static void
+exit_signal_handler(G_GNUC_UNUSED int signum)
 {
-	io_thread_quit();
+	exit_wake_fd.Write();
+}
+
+#endif
+
+/**
+ * The number of buckets in a #ntp_latency_histogram.
+ */
+#define NTP_LATENCY_BUCKETS 24
+
+/**
+ * Counts timing requests by the time between their arrival (the
+ * kernel's time stamp) and the reply.  Bucket i counts latencies
+ * below 2^i microseconds; the last bucket counts everything else.
+ */
+struct ntp_latency_histogram {
+	unsigned buckets[NTP_LATENCY_BUCKETS];
+};
+
+static void
+account_latency(const struct timespec *received,
+		const struct timespec *replied, void *ctx)
+{
+	struct ntp_latency_histogram *histogram =
+		(struct ntp_latency_histogram *)ctx;
+
+	int64_t ns = (int64_t)(replied->tv_sec - received->tv_sec) * 1000000000
+		+ (replied->tv_nsec - received->tv_nsec);
+	uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+
+	unsigned i = 0;
+	while (i < NTP_LATENCY_BUCKETS - 1 && us >= (UINT64_C(1) << i))
+		++i;
+
+	++histogram->buckets[i];
+}
+
+static void
+print_histogram(const struct ntp_latency_histogram *histogram)
+{
+	unsigned total = 0;
+	for (unsigned i = 0; i < NTP_LATENCY_BUCKETS; ++i)
+		total += histogram->buckets[i];
+
+	g_print("%u replies\n", total);
+	if (total == 0)
+		return;
+
+	for (unsigned i = 0; i < NTP_LATENCY_BUCKETS; ++i) {
+		const unsigned n = histogram->buckets[i];
+		if (n == 0)
+			continue;
+
+		if (i == NTP_LATENCY_BUCKETS - 1)
+			g_print("   >= %8u us: ", 1u << (i - 1));
+		else
+			g_print("    < %8u us: ", 1u << i);
+
+		g_print("%8u (%5.1f%%)\n", n, 100.0 * n / total);
+	}
 }
 
 int
-main(G_GNUC_UNUSED int argc, G_GNUC_UNUSED char **argv)
+main(int argc, char **argv)
 {
+	bool histogram_mode = false;
+	unsigned port = 6002;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--histogram") == 0)
+			histogram_mode = true;
+		else if (argv[i][0] != '-')
+			port = strtoul(argv[i], NULL, 10);
+		else {
+			g_printerr("Usage: run_ntp_server [--histogram] [PORT]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+#if !GLIB_CHECK_VERSION(2,32,0)
 	g_thread_init(NULL);
-	signals_init();
-	io_thread_init();
+#endif
+
+	main_loop = new EventLoop(EventLoop::Default());
+
+	struct ntp_latency_histogram histogram;
+	memset(&histogram, 0, sizeof(histogram));
 
 	struct ntp_server ntp;
 	ntp_server_init(&ntp);
+	ntp.port = port;
+	if (histogram_mode) {
+		ntp.reply_callback = account_latency;
+		ntp.reply_ctx = &histogram;
+	}
 
 	GError *error = NULL;
 	if (!ntp_server_open(&ntp, &error)) {
-		io_thread_deinit();
+		delete main_loop;
 		g_printerr("%s\n", error->message);
 		g_error_free(error);
 		return EXIT_FAILURE;
 	}
 
-	io_thread_run();
+	g_printerr("listening on port %u\n", ntp.port);
+
+#ifndef WIN32
+	if (!exit_wake_fd.Create()) {
+		ntp_server_close(&ntp);
+		delete main_loop;
+		g_printerr("failed to create the wakeup descriptor\n");
+		return EXIT_FAILURE;
+	}
+
+	ExitMonitor *exit_monitor = new ExitMonitor(*main_loop, exit_wake_fd);
+
+	struct sigaction sa;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = exit_signal_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+#endif
+
+	main_loop->Run();
+
+#ifndef WIN32
+	delete exit_monitor;
+	exit_wake_fd.Destroy();
+#endif
 
 	ntp_server_close(&ntp);
-	io_thread_deinit();
+	delete main_loop;
+
+	if (histogram_mode)
+		print_histogram(&histogram);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Encodes test signals with the ALAC encoder and decodes them again
+ * with an independent reference decoder, which follows the
+ * published Apple/FFmpeg decoder.
+ */
+
+#include "config.h"
+#include "AlacEncoder.hxx"
+
+#include <glib.h>
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+class BitReader {
+	const uint8_t *data;
+	size_t size_bits, position;
+
+public:
+	BitReader(const void *_data, size_t size)
+		:data((const uint8_t *)_data), size_bits(size * 8),
+		 position(0) {}
+
+	size_t GetRemaining() const {
+		return size_bits - position;
+	}
+
+	unsigned ReadBit() {
+		g_assert_cmpuint(position, <, size_bits);
+		unsigned bit = (data[position / 8] >> (7 - position % 8)) & 1;
+		++position;
+		return bit;
+	}
+
+	uint32_t Read(unsigned n) {
+		uint32_t value = 0;
+		while (n-- > 0)
+			value = (value << 1) | ReadBit();
+		return value;
+	}
+
+	uint32_t Peek(unsigned n) const {
+		uint32_t value = 0;
+		for (size_t p = position; p < position + n; ++p) {
+			unsigned bit = p < size_bits
+				? (data[p / 8] >> (7 - p % 8)) & 1
+				: 0;
+			value = (value << 1) | bit;
+		}
+		return value;
+	}
+
+	void Skip(unsigned n) {
+		position += n;
+		g_assert_cmpuint(position, <=, size_bits);
+	}
+
+	int32_t ReadSigned(unsigned n) {
+		return SignExtend(Read(n), n);
+	}
+
+	static int32_t SignExtend(uint32_t value, unsigned bits) {
+		const unsigned shift = 32 - bits;
+		return int32_t(value << shift) >> shift;
+	}
+};
+
+static int
+SignOnly(int v)
+{
+	return v ? (v > 0 ? 1 : -1) : 0;
+}
+
+static unsigned
+Log2(unsigned v)
+{
+	unsigned n = 0;
+	while (v >>= 1)
+		++n;
+	return n;
+}
+
+static unsigned
+DecodeScalar(BitReader &r, unsigned k, unsigned bps)
+{
+	unsigned x = 0;
+	while (x < 9 && r.ReadBit())
+		++x;
+
+	if (x > 8)
+		return r.Read(bps);
+
+	if (k != 1) {
+		unsigned extra = r.Peek(k);
+		x = (x << k) - x;
+		if (extra > 1) {
+			x += extra - 1;
+			r.Skip(k);
+		} else
+			r.Skip(k - 1);
+	}
+
+	return x;
+}
+
+static void
+RiceDecompress(BitReader &r, int32_t *out, unsigned n, unsigned bps,
+	       unsigned history_mult)
+{
+	unsigned history = ALAC_RICE_INITIAL_HISTORY;
+	unsigned sign_modifier = 0;
+
+	for (unsigned i = 0; i < n; ++i) {
+		unsigned k = Log2((history >> 9) + 3);
+		if (k > ALAC_RICE_LIMIT)
+			k = ALAC_RICE_LIMIT;
+
+		unsigned x = DecodeScalar(r, k, bps) + sign_modifier;
+		sign_modifier = 0;
+		out[i] = (x >> 1) ^ -(x & 1);
+
+		if (x > 0xffff)
+			history = 0xffff;
+		else
+			history += x * history_mult -
+				((history * history_mult) >> 9);
+
+		if (history < 128 && i + 1 < n) {
+			k = 7 - Log2(history) + ((history + 16) >> 6);
+			if (k > ALAC_RICE_LIMIT)
+				k = ALAC_RICE_LIMIT;
+
+			unsigned block_size = DecodeScalar(r, k, 16);
+			if (block_size > 0) {
+				g_assert_cmpuint(block_size, <, n - i);
+				memset(out + i + 1, 0,
+				       block_size * sizeof(*out));
+				i += block_size;
+			}
+
+			if (block_size <= 0xffff)
+				sign_modifier = 1;
+			history = 0;
+		}
+	}
+}
+
+static void
+LpcPrediction(const int32_t *error, int32_t *out, unsigned n, unsigned bps,
+	      int16_t *coefs, unsigned order, unsigned quant)
+{
+	out[0] = error[0];
+
+	if (order == 0) {
+		memcpy(out + 1, error + 1, (n - 1) * sizeof(*out));
+		return;
+	}
+
+	unsigned i;
+	for (i = 1; i <= order && i < n; ++i)
+		out[i] = BitReader::SignExtend(out[i - 1] + error[i], bps);
+
+	const int32_t *pred = out;
+	for (; i < n; ++i) {
+		int val = 0;
+		int error_val = error[i];
+		const int d = *pred++;
+
+		for (unsigned j = 0; j < order; ++j)
+			val += (pred[j] - d) * coefs[j];
+		val = (val + (1LL << (quant - 1))) >> quant;
+		val += d + error_val;
+		out[i] = BitReader::SignExtend(val, bps);
+
+		const int error_sign = SignOnly(error_val);
+		if (error_sign) {
+			for (unsigned j = 0;
+			     j < order && error_val * error_sign > 0; ++j) {
+				val = d - pred[j];
+				const int sign = SignOnly(val) * error_sign;
+				coefs[j] -= sign;
+				val *= sign;
+				error_val -= (val >> quant) * int(j + 1);
+			}
+		}
+	}
+}
+
+/**
+ * Decode one stereo frame of #n frames into interleaved 16 bit
+ * samples.
+ */
+static void
+AlacDecode(const void *data, size_t size, int16_t *dest, unsigned n)
+{
+	BitReader r(data, size);
+
+	g_assert_cmpuint(r.Read(3), ==, 1); /* ID_CPE */
+	r.Skip(4);
+	r.Skip(12);
+	g_assert_cmpuint(r.Read(1), ==, 0); /* has size */
+	g_assert_cmpuint(r.Read(2), ==, 0); /* extra bits */
+	const bool compressed = !r.Read(1);
+
+	int32_t samples[2][ALAC_FRAME_LENGTH];
+
+	if (compressed) {
+		const unsigned bps = 16 + 1;
+		const unsigned shift = r.Read(8);
+		const int weight = r.Read(8);
+
+		int16_t coefs[2][32];
+		unsigned order[2], quant[2], mult[2];
+
+		for (unsigned ch = 0; ch < 2; ++ch) {
+			g_assert_cmpuint(r.Read(4), ==, 0);
+			quant[ch] = r.Read(4);
+			mult[ch] = r.Read(3);
+			order[ch] = r.Read(5);
+
+			for (int i = order[ch] - 1; i >= 0; --i)
+				coefs[ch][i] = r.ReadSigned(16);
+		}
+
+		for (unsigned ch = 0; ch < 2; ++ch) {
+			int32_t error[ALAC_FRAME_LENGTH];
+			RiceDecompress(r, error, n, bps,
+				       mult[ch] * ALAC_RICE_HISTORY_MULT / 4);
+			LpcPrediction(error, samples[ch], n, bps,
+				      coefs[ch], order[ch], quant[ch]);
+		}
+
+		if (weight != 0) {
+			for (unsigned i = 0; i < n; ++i) {
+				int32_t a = samples[0][i], b = samples[1][i];
+				a -= (b * weight) >> shift;
+				b += a;
+				samples[0][i] = b;
+				samples[1][i] = a;
+			}
+		}
+
+		g_assert_cmpuint(r.Read(3), ==, 7); /* ID_END */
+	} else {
+		for (unsigned i = 0; i < n; ++i)
+			for (unsigned ch = 0; ch < 2; ++ch)
+				samples[ch][i] = r.ReadSigned(16);
+	}
+
+	g_assert_cmpuint(r.GetRemaining(), <, 8);
+
+	for (unsigned i = 0; i < n; ++i) {
+		dest[i * 2] = samples[0][i];
+		dest[i * 2 + 1] = samples[1][i];
+	}
+}
+
+/**
+ * Encode and decode the given frame, and verify that the result is
+ * lossless.
+ *
+ * @return the encoded size in bytes
+ */
+static size_t
+RoundTrip(const int16_t *src, unsigned compression)
+{
+	uint8_t encoded[ALAC_MAX_FRAME_SIZE + 16];
+	memset(encoded, 0xa5, sizeof(encoded));
+
+	size_t size = alac_encode(encoded, src, ALAC_FRAME_LENGTH,
+				  compression);
+	g_assert_cmpuint(size, >, 0);
+	g_assert_cmpuint(size, <=, ALAC_MAX_FRAME_SIZE);
+
+	/* no overrun */
+	for (size_t i = ALAC_MAX_FRAME_SIZE; i < sizeof(encoded); ++i)
+		g_assert_cmpuint(encoded[i], ==, 0xa5);
+
+	int16_t decoded[ALAC_FRAME_LENGTH * 2];
+	AlacDecode(encoded, size, decoded, ALAC_FRAME_LENGTH);
+	g_assert(memcmp(src, decoded, sizeof(decoded)) == 0);
+
+	return size;
+}
+
+template<typename G>
+static void
+TestSignal(G g, bool compressible)
+{
+	for (unsigned frame = 0; frame < 16; ++frame) {
+		int16_t src[ALAC_FRAME_LENGTH * 2];
+		for (unsigned i = 0; i < ALAC_FRAME_LENGTH; ++i)
+			g(frame * ALAC_FRAME_LENGTH + i, src[i * 2],
+			  src[i * 2 + 1]);
+
+		g_assert_cmpuint(RoundTrip(src, ALAC_COMPRESSION_NONE),
+				 ==, ALAC_MAX_FRAME_SIZE);
+
+		const size_t fast = RoundTrip(src, ALAC_COMPRESSION_FAST);
+		const size_t best = RoundTrip(src, ALAC_COMPRESSION_BEST);
+		g_assert_cmpuint(best, <=, fast);
+
+		if (compressible)
+			g_assert_cmpuint(best, <, ALAC_MAX_FRAME_SIZE / 2);
+	}
+}
+
+static void
+test_alac_silence()
+{
+	TestSignal([](unsigned, int16_t &l, int16_t &r){
+			l = r = 0;
+		}, true);
+}
+
+static void
+test_alac_sine()
+{
+	TestSignal([](unsigned i, int16_t &l, int16_t &r){
+			l = 20000 * sin(i * 0.031);
+			r = 12000 * sin(i * 0.047 + 1);
+		}, true);
+}
+
+static void
+test_alac_mono()
+{
+	TestSignal([](unsigned i, int16_t &l, int16_t &r){
+			l = r = 30000 * sin(i * 0.013) * sin(i * 0.0007);
+		}, true);
+}
+
+static void
+test_alac_full_scale()
+{
+	/* square waves exercise the 17 bit side channel and the
+	   residual escape code */
+	TestSignal([](unsigned i, int16_t &l, int16_t &r){
+			l = (i / 7) % 2 ? 32767 : -32768;
+			r = (i / 5) % 2 ? -32768 : 32767;
+		}, false);
+}
+
+static void
+test_alac_noise()
+{
+	TestSignal([](unsigned, int16_t &l, int16_t &r){
+			l = g_random_int();
+			r = g_random_int();
+		}, false);
+}
+
+static void
+test_alac_sparse()
+{
+	/* long runs of zero residuals separated by clicks */
+	TestSignal([](unsigned i, int16_t &l, int16_t &r){
+			l = i % 97 == 0 ? 1000 : 0;
+			r = i % 131 == 0 ? -3 : 0;
+		}, true);
+}
+
+/*
+ * The original RAOP "uncompressed ALAC" packer, which wrote the
+ * frame one bit field at a time.  Used as the reference for the
+ * byte-aligned implementation.
+ */
+
+static void
+ReferenceBitsWrite(unsigned char **p, unsigned char d, int blen, int *bpos)
+{
+	int lb, rb, bd;
+	lb = 7 - *bpos;
+	rb = lb - blen + 1;
+	if (rb >= 0) {
+		bd = d << rb;
+		if (*bpos)
+			**p |= bd;
+		else
+			**p = bd;
+		*bpos += blen;
+	} else {
+		bd = d >> -rb;
+		**p |= bd;
+		*p += 1;
+		**p = d << (8 + rb);
+		*bpos = -rb;
+	}
+}
+
+static size_t
+ReferenceVerbatim(unsigned char *buffer, const int16_t *src, unsigned n)
+{
+	int bpos = 0;
+	unsigned char *bp = buffer;
+	ReferenceBitsWrite(&bp, 1, 3, &bpos);
+	ReferenceBitsWrite(&bp, 0, 4, &bpos);
+	ReferenceBitsWrite(&bp, 0, 8, &bpos);
+	ReferenceBitsWrite(&bp, 0, 4, &bpos);
+	ReferenceBitsWrite(&bp, 0, 1, &bpos);
+	ReferenceBitsWrite(&bp, 0, 2, &bpos);
+	ReferenceBitsWrite(&bp, 1, 1, &bpos);
+
+	for (unsigned i = 0; i < n * 2; ++i) {
+		const uint16_t sample = src[i];
+		ReferenceBitsWrite(&bp, sample >> 8, 8, &bpos);
+		ReferenceBitsWrite(&bp, sample & 0xff, 8, &bpos);
+	}
+
+	size_t size = bp - buffer;
+	if (bpos)
+		++size;
+	return size;
+}
+
+static void
+test_alac_verbatim()
+{
+	for (unsigned n = 0; n <= ALAC_FRAME_LENGTH; ++n) {
+		int16_t src[ALAC_FRAME_LENGTH * 2];
+		for (auto &i : src)
+			i = g_random_int();
+
+		uint8_t expected[ALAC_MAX_FRAME_SIZE];
+		const size_t expected_size = ReferenceVerbatim(expected, src, n);
+
+		uint8_t result[ALAC_MAX_FRAME_SIZE];
+		const size_t size = alac_encode_verbatim(result, src, n);
+
+		g_assert_cmpuint(size, ==, expected_size);
+		g_assert(memcmp(result, expected, size) == 0);
+	}
+}
+
+static void
+test_alac_verbatim_benchmark()
+{
+	if (!g_test_perf())
+		return;
+
+	int16_t src[ALAC_FRAME_LENGTH * 2];
+	for (auto &i : src)
+		i = g_random_int();
+
+	uint8_t dest[ALAC_MAX_FRAME_SIZE];
+	constexpr unsigned n = 100000;
+
+	GTimer *timer = g_timer_new();
+	for (unsigned i = 0; i < n; ++i)
+		ReferenceVerbatim(dest, src, ALAC_FRAME_LENGTH);
+	const double reference = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (unsigned i = 0; i < n; ++i)
+		alac_encode_verbatim(dest, src, ALAC_FRAME_LENGTH);
+	const double optimized = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	g_test_minimized_result(optimized,
+				"verbatim: %.0f frames/s (reference %.0f frames/s)",
+				n / optimized, n / reference);
+}
+
+int
+main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/alac/silence", test_alac_silence);
+	g_test_add_func("/alac/sine", test_alac_sine);
+	g_test_add_func("/alac/mono", test_alac_mono);
+	g_test_add_func("/alac/full_scale", test_alac_full_scale);
+	g_test_add_func("/alac/noise", test_alac_noise);
+	g_test_add_func("/alac/sparse", test_alac_sparse);
+	g_test_add_func("/alac/verbatim", test_alac_verbatim);
+	g_test_add_func("/alac/verbatim/benchmark",
+			test_alac_verbatim_benchmark);
+
+	return g_test_run();
+}
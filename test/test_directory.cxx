@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+#include "Directory.hxx"
+#include "DatabaseLock.hxx"
+#include "song.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+static void
+test_directory_find_child()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *a = root->CreateChild("a");
+	Directory *b = root->CreateChild("b");
+	Directory *ab = a->CreateChild("b");
+
+	g_assert(root->FindChild("a") == a);
+	g_assert(root->FindChild("b") == b);
+	g_assert(root->FindChild("c") == nullptr);
+	g_assert(a->FindChild("b") == ab);
+	g_assert(strcmp(ab->GetPath(), "a/b") == 0);
+	g_assert(root->LookupDirectory("a/b") == ab);
+
+	b->Delete();
+	g_assert(root->FindChild("b") == nullptr);
+	g_assert(root->FindChild("a") == a);
+	g_assert(a->FindChild("b") == ab);
+
+	ab->Delete();
+	g_assert(a->FindChild("b") == nullptr);
+	g_assert(root->LookupDirectory("a/b") == nullptr);
+
+	db_unlock();
+	root->Free();
+}
+
+static void
+test_directory_find_song()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *a = root->CreateChild("a");
+
+	struct song *s1 = song_file_new("1.ogg", a);
+	a->AddSong(s1);
+	struct song *s2 = song_file_new("2.ogg", a);
+	a->AddSong(s2);
+
+	g_assert(a->FindSong("1.ogg") == s1);
+	g_assert(a->FindSong("2.ogg") == s2);
+	g_assert(a->FindSong("3.ogg") == nullptr);
+	g_assert(root->FindSong("1.ogg") == nullptr);
+
+	a->RemoveSong(s1);
+	song_free(s1);
+	g_assert(a->FindSong("1.ogg") == nullptr);
+	g_assert(a->FindSong("2.ogg") == s2);
+
+	db_unlock();
+	root->Free();
+}
+
+static void
+test_directory_duplicates()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+
+	/* several children with the same name: Delete() must remove
+	   exactly the given object from the index */
+	Directory *d1 = root->CreateChild("d");
+	Directory *d2 = root->CreateChild("d");
+	Directory *d3 = root->CreateChild("d");
+
+	Directory *found = root->FindChild("d");
+	g_assert(found == d1 || found == d2 || found == d3);
+
+	d2->Delete();
+	for (unsigned i = 0; i < 4; ++i) {
+		found = root->FindChild("d");
+		g_assert(found == d1 || found == d3);
+	}
+
+	found->Delete();
+	Directory *last = found == d1 ? d3 : d1;
+	g_assert(root->FindChild("d") == last);
+
+	last->Delete();
+	g_assert(root->FindChild("d") == nullptr);
+
+	/* the same for songs */
+	struct song *s1 = song_file_new("dup.ogg", root);
+	root->AddSong(s1);
+	struct song *s2 = song_file_new("dup.ogg", root);
+	root->AddSong(s2);
+	struct song *s3 = song_file_new("dup.ogg", root);
+	root->AddSong(s3);
+
+	struct song *song = root->FindSong("dup.ogg");
+	g_assert(song == s1 || song == s2 || song == s3);
+
+	root->RemoveSong(s2);
+	song_free(s2);
+	song = root->FindSong("dup.ogg");
+	g_assert(song == s1 || song == s3);
+
+	root->RemoveSong(song);
+	struct song *last_song = song == s1 ? s3 : s1;
+	song_free(song);
+	g_assert(root->FindSong("dup.ogg") == last_song);
+
+	root->RemoveSong(last_song);
+	song_free(last_song);
+	g_assert(root->FindSong("dup.ogg") == nullptr);
+
+	db_unlock();
+	root->Free();
+}
+
+int
+main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/directory/find_child", test_directory_find_child);
+	g_test_add_func("/directory/find_song", test_directory_find_song);
+	g_test_add_func("/directory/duplicates", test_directory_duplicates);
+
+	return g_test_run();
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A stress test for the #music_pipe_reader protocol: one producer
+ * (the player thread) feeds 64 "null outputs", each in its own
+ * thread, through a small #music_buffer, and returns chunks the way
+ * audio_output_all_check() does.
+ */
+
+#include "config.h"
+#include "MusicPipe.hxx"
+#include "MusicBuffer.hxx"
+#include "MusicChunk.hxx"
+#include "audio_format.h"
+#include "tag.h"
+#include "thread/Mutex.hxx"
+#include "thread/Cond.hxx"
+
+#include <glib.h>
+
+#include <string.h>
+
+static constexpr unsigned NUM_OUTPUTS = 64;
+static constexpr unsigned NUM_CHUNKS = 20000;
+static constexpr unsigned BUFFER_CHUNKS = 32;
+
+void
+tag_free(gcc_unused struct tag *tag)
+{
+}
+
+/**
+ * Protects only the sleeping; the pipe itself is not locked by the
+ * outputs.
+ */
+static Mutex mutex;
+
+/**
+ * Wakes up the outputs after a push.
+ */
+static Cond output_cond;
+
+/**
+ * Wakes up the producer after an output has consumed a chunk.
+ */
+static Cond producer_cond;
+
+static bool quit;
+
+struct null_output {
+	struct music_pipe *pipe;
+	struct music_pipe_reader reader;
+
+	/**
+	 * The number of the next chunk this output expects.
+	 */
+	unsigned next;
+
+	GThread *thread;
+};
+
+static struct null_output outputs[NUM_OUTPUTS];
+
+static gpointer
+null_output_task(gpointer data)
+{
+	struct null_output *o = (struct null_output *)data;
+
+	while (true) {
+		mutex.lock();
+		const struct music_chunk *chunk;
+		while ((chunk = music_pipe_reader_get(o->pipe, &o->reader)) == NULL &&
+		       !quit)
+			output_cond.wait(mutex);
+		mutex.unlock();
+
+		if (chunk == NULL)
+			break;
+
+		/* "play" the chunk: it must be the one we expect, and
+		   it must not have been freed yet */
+		unsigned number;
+		g_assert_cmpuint(chunk->length, ==, sizeof(number));
+		memcpy(&number, chunk->data, sizeof(number));
+		g_assert_cmpuint(number, ==, o->next);
+		++o->next;
+
+		music_pipe_reader_consumed(o->pipe, &o->reader, chunk);
+
+		mutex.lock();
+		producer_cond.signal();
+		mutex.unlock();
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns all chunks which have been consumed by all outputs; this is
+ * a copy of audio_output_all_check().
+ */
+static unsigned
+check(struct music_pipe *pipe, struct music_buffer *buffer)
+{
+	unsigned n = music_pipe_size(pipe);
+	for (unsigned i = 0; i < NUM_OUTPUTS && n > 0; ++i) {
+		unsigned done = music_pipe_reader_done(pipe,
+						       &outputs[i].reader);
+		if (done < n)
+			n = done;
+	}
+
+	while (n-- > 0)
+		music_buffer_return(buffer, music_pipe_shift(pipe));
+
+	const struct music_chunk *tail = music_pipe_peek(pipe);
+	if (tail == NULL || tail->next != NULL)
+		return music_pipe_size(pipe);
+
+	for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+		if (!music_pipe_reader_is_finished(&outputs[i].reader, tail))
+			return 1;
+
+	for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+		music_pipe_reader_release(&outputs[i].reader, tail);
+
+	music_buffer_return(buffer, music_pipe_shift(pipe));
+	return 0;
+}
+
+static struct music_chunk *
+allocate(struct music_pipe *pipe, struct music_buffer *buffer)
+{
+	struct music_chunk *chunk;
+
+	mutex.lock();
+	while ((chunk = music_buffer_allocate(buffer)) == NULL) {
+		check(pipe, buffer);
+		if ((chunk = music_buffer_allocate(buffer)) != NULL)
+			break;
+
+		producer_cond.wait(mutex);
+	}
+	mutex.unlock();
+
+	return chunk;
+}
+
+static void
+test_music_pipe_null_outputs(void)
+{
+	struct audio_format audio_format;
+	audio_format_init(&audio_format, 44100, SAMPLE_FORMAT_S16, 2);
+
+	struct music_buffer *buffer = music_buffer_new(BUFFER_CHUNKS, DEFAULT_CHUNK_SIZE);
+	struct music_pipe *pipe = music_pipe_new();
+	quit = false;
+
+	for (unsigned i = 0; i < NUM_OUTPUTS; ++i) {
+		struct null_output *o = &outputs[i];
+		o->pipe = pipe;
+		o->next = 0;
+		music_pipe_reader_rewind(&o->reader);
+
+#if GLIB_CHECK_VERSION(2,32,0)
+		o->thread = g_thread_new("output", null_output_task, o);
+#else
+		o->thread = g_thread_create(null_output_task, o, true, NULL);
+#endif
+	}
+
+	for (unsigned number = 0; number < NUM_CHUNKS; ++number) {
+		struct music_chunk *chunk = allocate(pipe, buffer);
+
+		size_t max_length;
+		void *dest = chunk->Write(audio_format, 0, 0, &max_length);
+		g_assert(dest != NULL);
+		memcpy(dest, &number, sizeof(number));
+		chunk->Expand(audio_format, sizeof(number));
+
+		music_pipe_push(pipe, chunk);
+
+		for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+			music_pipe_reader_hand_over(&outputs[i].reader, chunk);
+
+		mutex.lock();
+		output_cond.broadcast();
+		mutex.unlock();
+
+		/* sometimes let the outputs drain the pipe
+		   completely, to exercise the tail hand-over */
+		if (number % 1000 == 999) {
+			mutex.lock();
+			while (check(pipe, buffer) > 0)
+				producer_cond.wait(mutex);
+			mutex.unlock();
+		}
+	}
+
+	/* wait until all outputs have consumed everything */
+	mutex.lock();
+	while (check(pipe, buffer) > 0)
+		producer_cond.wait(mutex);
+
+	quit = true;
+	output_cond.broadcast();
+	mutex.unlock();
+
+	for (unsigned i = 0; i < NUM_OUTPUTS; ++i) {
+		g_thread_join(outputs[i].thread);
+		g_assert_cmpuint(outputs[i].next, ==, NUM_CHUNKS);
+	}
+
+	g_assert(music_pipe_empty(pipe));
+	music_pipe_free(pipe);
+
+	/* all chunks must have been returned (this is checked by
+	   the music_buffer destructor) */
+	music_buffer_free(buffer);
+}
+
+int
+main(int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION(2,32,0)
+	g_thread_init(NULL);
+#endif
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/music_pipe/null_outputs",
+			test_music_pipe_null_outputs);
+
+	return g_test_run();
+}
@@ -53,6 +53,12 @@ test_pcm_volume_32();
 void
 test_pcm_volume_float();
 
+void
+test_pcm_volume_simd();
+
+void
+test_pcm_volume_benchmark();
+
 void
 test_pcm_format_8_to_16();
 
@@ -65,6 +71,9 @@ test_pcm_format_16_to_32();
 void
 test_pcm_format_float();
 
+void
+test_pcm_format_simd();
+
 void
 test_pcm_mix_8();
 
@@ -77,4 +86,22 @@ test_pcm_mix_24();
 void
 test_pcm_mix_32();
 
+void
+test_pcm_mix_simd();
+
+void
+test_pcm_mix_benchmark();
+
+void
+test_pcm_resample_polyphase();
+
+void
+test_pcm_resample_simd();
+
+void
+test_pcm_resample_threads();
+
+void
+test_pcm_resample_benchmark();
+
 #endif
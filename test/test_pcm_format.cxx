@@ -20,14 +20,18 @@
 #include "config.h"
 #include "test_pcm_all.hxx"
 #include "test_pcm_util.hxx"
+#include "test_pcm_simd.hxx"
 #include "pcm/PcmFormat.hxx"
 #include "pcm/PcmDither.hxx"
 #include "pcm/PcmUtils.hxx"
+#include "pcm/PcmKernelTable.hxx"
 #include "pcm/pcm_buffer.h"
 #include "audio_format.h"
 
 #include <glib.h>
 
+#include <string.h>
+
 void
 test_pcm_format_8_to_16()
 {
@@ -128,3 +132,104 @@ test_pcm_format_float()
 	pcm_buffer_deinit(&buffer1);
 	pcm_buffer_deinit(&buffer2);
 }
+
+/**
+ * Generates floating point samples which exceed the valid range
+ * sometimes, to test the clamping.
+ */
+struct GlibRandomLoudFloat {
+	float operator()() const {
+		return g_random_double_range(-1.5, 1.5);
+	}
+};
+
+/**
+ * Compares one format kernel with the generic implementation; the
+ * results must be bit-identical.  The odd number of samples lets the
+ * SIMD kernels handle a tail.
+ */
+template<typename S, typename D, typename G=GlibRandomInt<S>>
+static void
+TestPcmFormatKernel(pcm_format_kernel simd, pcm_format_kernel generic,
+		    G g=G())
+{
+	constexpr unsigned N = 1027;
+	const auto src = TestDataBuffer<S, N>(g);
+
+	D expected[N], result[N];
+	generic(expected, src.begin(), N);
+	simd(result, src.begin(), N);
+	g_assert(memcmp(result, expected, sizeof(result)) == 0);
+}
+
+/**
+ * Compares one downmix kernel with the generic implementation.
+ */
+template<typename T, typename G=GlibRandomInt<T>>
+static void
+TestPcmDownmixKernel(pcm_downmix_kernel simd, pcm_downmix_kernel generic,
+		     G g=G())
+{
+	constexpr unsigned N = 1027;
+	const auto src = TestDataBuffer<T, N * 8>(g);
+
+	for (unsigned channels = 3; channels <= 8; ++channels) {
+		T expected[N * 2], result[N * 2];
+		generic(expected, src.begin(), N, channels);
+		simd(result, src.begin(), N, channels);
+		g_assert(memcmp(result, expected, sizeof(result)) == 0);
+	}
+}
+
+/**
+ * Compares each kernel of the table with the generic one.
+ */
+static void
+TestPcmFormatKernels(const struct pcm_kernel_table &k)
+{
+	const struct pcm_kernel_table &generic = pcm_kernel_table_generic;
+
+	TestPcmFormatKernel<int16_t, int32_t>(k.convert_16_to_24,
+					      generic.convert_16_to_24);
+	TestPcmFormatKernel<int16_t, int32_t>(k.convert_16_to_32,
+					      generic.convert_16_to_32);
+	TestPcmFormatKernel<int32_t, int32_t>(k.convert_24_to_32,
+					      generic.convert_24_to_32,
+					      GlibRandomInt24());
+	TestPcmFormatKernel<int32_t, int32_t>(k.convert_32_to_24,
+					      generic.convert_32_to_24);
+
+	TestPcmFormatKernel<int8_t, float>(k.convert_8_to_float,
+					   generic.convert_8_to_float);
+	TestPcmFormatKernel<int16_t, float>(k.convert_16_to_float,
+					    generic.convert_16_to_float);
+	TestPcmFormatKernel<int32_t, float>(k.convert_24_to_float,
+					    generic.convert_24_to_float,
+					    GlibRandomInt24());
+	TestPcmFormatKernel<int32_t, float>(k.convert_32_to_float,
+					    generic.convert_32_to_float);
+
+	TestPcmFormatKernel<float, int16_t>(k.convert_float_to_16,
+					    generic.convert_float_to_16,
+					    GlibRandomLoudFloat());
+	TestPcmFormatKernel<float, int32_t>(k.convert_float_to_24,
+					    generic.convert_float_to_24,
+					    GlibRandomLoudFloat());
+
+	TestPcmDownmixKernel<int16_t>(k.downmix_16,
+				      generic.downmix_16);
+	TestPcmDownmixKernel<int32_t>(k.downmix_24,
+				      generic.downmix_24,
+				      GlibRandomInt24());
+	TestPcmDownmixKernel<int32_t>(k.downmix_32,
+				      generic.downmix_32);
+	TestPcmDownmixKernel<float>(k.downmix_float,
+				    generic.downmix_float,
+				    GlibRandomFloat());
+}
+
+void
+test_pcm_format_simd()
+{
+	ForEachPcmSimdKernels(pcm_kernel_table_simd, TestPcmFormatKernels);
+}
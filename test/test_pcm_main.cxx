@@ -24,6 +24,11 @@
 int
 main(int argc, char **argv)
 {
+#if !GLIB_CHECK_VERSION(2,32,0)
+	/* for the resampler's thread pool */
+	g_thread_init(NULL);
+#endif
+
 	g_test_init (&argc, &argv, NULL);
 	g_test_add_func("/pcm/dither/24", test_pcm_dither_24);
 	g_test_add_func("/pcm/dither/32", test_pcm_dither_32);
@@ -37,16 +42,35 @@ main(int argc, char **argv)
 	g_test_add_func("/pcm/volume/24", test_pcm_volume_24);
 	g_test_add_func("/pcm/volume/32", test_pcm_volume_32);
 	g_test_add_func("/pcm/volume/float", test_pcm_volume_float);
+	g_test_add_func("/pcm/volume/simd", test_pcm_volume_simd);
+
+	if (g_test_perf())
+		g_test_add_func("/pcm/volume/benchmark",
+				test_pcm_volume_benchmark);
 
 	g_test_add_func("/pcm/format/8_to_16", test_pcm_format_8_to_16);
 	g_test_add_func("/pcm/format/16_to_24", test_pcm_format_16_to_24);
 	g_test_add_func("/pcm/format/16_to_32", test_pcm_format_16_to_32);
 	g_test_add_func("/pcm/format/float", test_pcm_format_float);
+	g_test_add_func("/pcm/format/simd", test_pcm_format_simd);
 
 	g_test_add_func("/pcm/mix/8", test_pcm_mix_8);
 	g_test_add_func("/pcm/mix/16", test_pcm_mix_16);
 	g_test_add_func("/pcm/mix/24", test_pcm_mix_24);
 	g_test_add_func("/pcm/mix/32", test_pcm_mix_32);
+	g_test_add_func("/pcm/mix/simd", test_pcm_mix_simd);
+
+	if (g_test_perf())
+		g_test_add_func("/pcm/mix/benchmark", test_pcm_mix_benchmark);
+
+	g_test_add_func("/pcm/resample/polyphase",
+			test_pcm_resample_polyphase);
+	g_test_add_func("/pcm/resample/simd", test_pcm_resample_simd);
+	g_test_add_func("/pcm/resample/threads", test_pcm_resample_threads);
+
+	if (g_test_perf())
+		g_test_add_func("/pcm/resample/benchmark",
+				test_pcm_resample_benchmark);
 
 	g_test_run();
 }
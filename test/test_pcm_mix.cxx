@@ -20,10 +20,18 @@
 #include "config.h"
 #include "test_pcm_all.hxx"
 #include "test_pcm_util.hxx"
+#include "test_pcm_simd.hxx"
 #include "pcm/PcmMix.hxx"
+#include "pcm/PcmMixKernels.hxx"
+#include "pcm/PcmVolume.hxx"
 
 #include <glib.h>
 
+#include <algorithm>
+
+#include <float.h>
+#include <math.h>
+
 template<typename T, sample_format format, typename G=GlibRandomInt<T>>
 void
 TestPcmMix(G g=G())
@@ -57,6 +65,14 @@ TestPcmMix(G g=G())
 		expected[i] = (int64_t(src1[i]) + int64_t(src2[i])) / 2;
 
 	AssertEqualWithTolerance(result, expected, 1);
+
+	/* the same with a separate destination buffer, which must be
+	   overwritten completely */
+	std::fill(result.begin(), result.end(), T(0));
+	success = pcm_mix_to(result.begin(), src1.begin(), src2.begin(),
+			     sizeof(result), format, 0.5);
+	g_assert(success);
+	AssertEqualWithTolerance(result, expected, 1);
 }
 
 void
@@ -82,3 +98,159 @@ test_pcm_mix_32()
 {
 	TestPcmMix<int32_t, SAMPLE_FORMAT_S32>();
 }
+
+/**
+ * Compares one kernel with the generic implementation.  The odd
+ * number of samples lets the SIMD kernels handle a tail.
+ */
+template<typename T, typename G, typename... V>
+static void
+TestPcmMixKernel(void (*simd)(T *, const T *, const T *, size_t, V...),
+		 void (*generic)(T *, const T *, const T *, size_t, V...),
+		 unsigned tolerance, G g, V... volume)
+{
+	constexpr unsigned N = 1027;
+	const auto src1 = TestDataBuffer<T, N>(g);
+	const auto src2 = TestDataBuffer<T, N>(g);
+
+	auto expected = src1, result = src1;
+	generic(expected.begin(), src1.begin(), src2.begin(), N, volume...);
+	simd(result.begin(), src1.begin(), src2.begin(), N, volume...);
+	AssertEqualWithTolerance(result, expected, tolerance);
+
+	/* in place */
+	result = src1;
+	simd(result.begin(), result.begin(), src2.begin(), N, volume...);
+	AssertEqualWithTolerance(result, expected, tolerance);
+}
+
+template<size_t N>
+static void
+AssertEqualFloat(const TestDataBuffer<float, N> &a,
+		 const TestDataBuffer<float, N> &b, float tolerance)
+{
+	for (unsigned i = 0; i < N; ++i)
+		g_assert_cmpfloat(fabs(a[i] - b[i]), <=, tolerance);
+}
+
+/**
+ * Compares one floating point kernel with the generic
+ * implementation.
+ *
+ * @param tolerance the maximum difference; 0 means the results must
+ * be exactly equal
+ */
+template<typename... V>
+static void
+TestPcmMixKernelFloat(void (*simd)(float *, const float *, const float *,
+				   size_t, V...),
+		      void (*generic)(float *, const float *, const float *,
+				      size_t, V...),
+		      float tolerance, V... volume)
+{
+	constexpr unsigned N = 1027;
+	const auto src1 = TestDataBuffer<float, N>(GlibRandomFloat());
+	const auto src2 = TestDataBuffer<float, N>(GlibRandomFloat());
+
+	auto expected = src1, result = src1;
+	generic(expected.begin(), src1.begin(), src2.begin(), N, volume...);
+	simd(result.begin(), src1.begin(), src2.begin(), N, volume...);
+	AssertEqualFloat(result, expected, tolerance);
+
+	/* in place, which is what pcm_mix() does */
+	result = src1;
+	simd(result.begin(), result.begin(), src2.begin(), N, volume...);
+	AssertEqualFloat(result, expected, tolerance);
+}
+
+/**
+ * Compares each kernel of the table with the generic one.
+ */
+static void
+TestPcmMixKernels(const PcmMixKernels &k)
+{
+	const PcmMixKernels &generic = pcm_mix_kernels_generic;
+
+	TestPcmMixKernel(k.add_16, generic.add_16, 0, GlibRandomInt<int16_t>());
+	TestPcmMixKernel(k.add_24, generic.add_24, 0, GlibRandomInt24());
+	TestPcmMixKernel(k.add_32, generic.add_32, 0, GlibRandomInt<int32_t>());
+	TestPcmMixKernelFloat(k.add_float, generic.add_float, 0.f);
+
+	/* the dithered kernels differ in the random sequence only */
+	static const int volumes[] = {
+		0, 1, 300, PCM_VOLUME_1 / 2, PCM_VOLUME_1,
+	};
+
+	for (int vol1 : volumes) {
+		const int vol2 = PCM_VOLUME_1 - vol1;
+
+		TestPcmMixKernel(k.add_vol_16, generic.add_vol_16, 1,
+				 GlibRandomInt<int16_t>(), vol1, vol2);
+		TestPcmMixKernel(k.add_vol_24, generic.add_vol_24, 1,
+				 GlibRandomInt24(), vol1, vol2);
+		TestPcmMixKernel(k.add_vol_32, generic.add_vol_32, 1,
+				 GlibRandomInt<int32_t>(), vol1, vol2);
+
+		/* the compiler may contract the generic code to fused
+		   multiply-add instructions, which round only once;
+		   the results are at most 1.0, so this is one unit in
+		   the last place */
+		TestPcmMixKernelFloat(k.add_vol_float, generic.add_vol_float,
+				      FLT_EPSILON,
+				      vol1 / float(PCM_VOLUME_1),
+				      vol2 / float(PCM_VOLUME_1));
+	}
+}
+
+void
+test_pcm_mix_simd()
+{
+	ForEachPcmSimdKernels(pcm_mix_kernels_simd, TestPcmMixKernels);
+}
+
+template<typename T, typename... V>
+static double
+BenchmarkPcmMixKernel(void (*kernel)(T *, const T *, const T *, size_t,
+				     V...),
+		      V... volume)
+{
+	/* one second of 48 kHz stereo, mixed for one minute */
+	constexpr unsigned N = 2 * 48000, ROUNDS = 60;
+	static T a[N], b[N];
+
+	const double elapsed = BenchmarkRounds(ROUNDS, [&]() {
+			kernel(a, a, b, N, volume...);
+		});
+
+	return ROUNDS * sizeof(a) / (1024. * 1024.) / elapsed;
+}
+
+static void
+ReportPcmMixBenchmark(const PcmMixKernels &k, const char *function,
+		      double mib_per_second)
+{
+	ReportPcmBenchmark(k.name, function, mib_per_second, "MiB/s");
+}
+
+static void
+BenchmarkPcmMixKernels(const PcmMixKernels &k)
+{
+	const int vol1 = PCM_VOLUME_1 / 3, vol2 = PCM_VOLUME_1 - vol1;
+
+	ReportPcmMixBenchmark(k, "add_vol_16",
+			      BenchmarkPcmMixKernel(k.add_vol_16, vol1, vol2));
+	ReportPcmMixBenchmark(k, "add_vol_24",
+			      BenchmarkPcmMixKernel(k.add_vol_24, vol1, vol2));
+	ReportPcmMixBenchmark(k, "add_vol_32",
+			      BenchmarkPcmMixKernel(k.add_vol_32, vol1, vol2));
+	ReportPcmMixBenchmark(k, "add_vol_float",
+			      BenchmarkPcmMixKernel(k.add_vol_float,
+						    0.3f, 0.7f));
+}
+
+void
+test_pcm_mix_benchmark()
+{
+	BenchmarkPcmMixKernels(pcm_mix_kernels_generic);
+	ForEachPcmSimdKernels(pcm_mix_kernels_simd, BenchmarkPcmMixKernels);
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+#include "test_pcm_all.hxx"
+#include "test_pcm_util.hxx"
+#include "test_pcm_simd.hxx"
+#include "pcm/PcmPolyphase.hxx"
+#include "pcm/PcmPolyphaseKernels.hxx"
+
+extern "C" {
+#include "pcm/pcm_resample_internal.h"
+}
+
+#include <glib.h>
+
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Generates one second of a stereo sine wave (the right channel is
+ * inverted).
+ */
+template<typename T>
+static std::vector<T>
+GenerateSine(unsigned rate, double amplitude)
+{
+	std::vector<T> v(rate * 2);
+	for (unsigned i = 0; i < rate; ++i) {
+		const double x = amplitude * sin(2 * M_PI * 997 * i / rate);
+		v[i * 2] = T(x);
+		v[i * 2 + 1] = T(-x);
+	}
+
+	return v;
+}
+
+/**
+ * Resamples the sine wave in chunks of different sizes, compares the
+ * result with the same wave generated at the destination rate, and
+ * with the result of a single call.
+ */
+template<typename T, typename F>
+static void
+TestPolyphaseSine(enum sample_format format, unsigned src_rate,
+		  unsigned dest_rate, double amplitude,
+		  double tolerance, F resample)
+{
+	const auto src = GenerateSine<T>(src_rate, amplitude);
+	const auto expected = GenerateSine<double>(dest_rate, amplitude);
+
+	PcmPolyphase p;
+	bool success = p.Open(format, 2, src_rate, dest_rate);
+	g_assert(success);
+
+	std::vector<T> result;
+	static constexpr size_t chunks[] = { 1, 1000, 333, 4096, 7 };
+	for (size_t i = 0, n = 0; i < src.size(); i += n * 2) {
+		n = std::min(chunks[i % G_N_ELEMENTS(chunks)],
+			     (src.size() - i) / 2);
+
+		size_t dest_size;
+		const T *dest = resample(p, &src[i], n * 2 * sizeof(T),
+					 &dest_size);
+		result.insert(result.end(), dest, dest + dest_size / sizeof(T));
+	}
+
+	/* the filter needs 32 samples of lookahead */
+	g_assert_cmpint(result.size(), >=, expected.size() - 2 * 64);
+	g_assert_cmpint(result.size(), <=, expected.size());
+
+	/* skip the transient at the beginning; the tolerance is
+	   dominated by the quantized coefficients of the 16 bit
+	   path */
+	for (size_t i = 2 * 64; i < result.size(); ++i)
+		g_assert_cmpfloat(fabs(result[i] - expected[i]), <=,
+				  tolerance);
+
+	/* the chunk size doesn't matter */
+	p.Reset();
+	size_t dest_size;
+	const T *dest = resample(p, src.data(), src.size() * sizeof(T),
+				 &dest_size);
+	g_assert_cmpint(dest_size, ==, result.size() * sizeof(T));
+	g_assert(memcmp(dest, result.data(), dest_size) == 0);
+}
+
+static const int16_t *
+Resample16(PcmPolyphase &p, const int16_t *src, size_t src_size,
+	   size_t *dest_size_r)
+{
+	return p.Resample16(src, src_size, dest_size_r);
+}
+
+static const int32_t *
+Resample24(PcmPolyphase &p, const int32_t *src, size_t src_size,
+	   size_t *dest_size_r)
+{
+	return p.Resample32(24, src, src_size, dest_size_r);
+}
+
+static const float *
+ResampleFloat(PcmPolyphase &p, const float *src, size_t src_size,
+	      size_t *dest_size_r)
+{
+	return p.ResampleFloat(src, src_size, dest_size_r);
+}
+
+/**
+ * Feeds the 16 bit resampler full scale input whose signs match the
+ * coefficients of one output sample, which makes this sample as
+ * large as it can get: the sum of the absolute coefficient values
+ * is more than 2.  The signs are determined from the impulse
+ * responses of the floating point resampler.
+ */
+static void
+TestPolyphaseFullScale16(unsigned src_rate, unsigned dest_rate)
+{
+	constexpr unsigned N = 512, J = 200;
+
+	PcmPolyphase pf;
+	bool success = pf.Open(SAMPLE_FORMAT_FLOAT, 1, src_rate, dest_rate);
+	g_assert(success);
+
+	std::vector<int16_t> positive(N), negative(N);
+	for (unsigned n = 0; n < N; ++n) {
+		std::vector<float> impulse(N);
+		impulse[n] = 1;
+
+		pf.Reset();
+		size_t dest_size;
+		const float *dest = pf.ResampleFloat(impulse.data(),
+						     N * sizeof(float),
+						     &dest_size);
+		g_assert_cmpint(dest_size / sizeof(*dest), >, J);
+
+		positive[n] = dest[J] >= 0 ? 32767 : -32768;
+		negative[n] = dest[J] >= 0 ? -32768 : 32767;
+	}
+
+	PcmPolyphase p;
+	success = p.Open(SAMPLE_FORMAT_S16, 1, src_rate, dest_rate);
+	g_assert(success);
+
+	size_t dest_size;
+	const int16_t *dest = p.Resample16(positive.data(),
+					   N * sizeof(int16_t), &dest_size);
+	g_assert_cmpint(dest_size / sizeof(*dest), >, J);
+	g_assert_cmpint(dest[J], ==, 32767);
+
+	p.Reset();
+	dest = p.Resample16(negative.data(), N * sizeof(int16_t), &dest_size);
+	g_assert_cmpint(dest_size / sizeof(*dest), >, J);
+	g_assert_cmpint(dest[J], ==, -32768);
+}
+
+void
+test_pcm_resample_polyphase()
+{
+	TestPolyphaseSine<int16_t>(SAMPLE_FORMAT_S16, 44100, 48000,
+				   16384, 6, Resample16);
+	TestPolyphaseSine<int32_t>(SAMPLE_FORMAT_S24_P32, 44100, 48000,
+				   1 << 22, 64, Resample24);
+	TestPolyphaseSine<float>(SAMPLE_FORMAT_FLOAT, 44100, 48000,
+				 0.5, 2e-5, ResampleFloat);
+
+	/* downsampling lowers the cutoff frequency of the filter */
+	TestPolyphaseSine<int16_t>(SAMPLE_FORMAT_S16, 96000, 44100,
+				   16384, 6, Resample16);
+	TestPolyphaseSine<int32_t>(SAMPLE_FORMAT_S24_P32, 96000, 44100,
+				   1 << 22, 64, Resample24);
+	TestPolyphaseSine<float>(SAMPLE_FORMAT_FLOAT, 96000, 44100,
+				 0.5, 2e-5, ResampleFloat);
+
+	/* the output is clamped to 24 bit */
+	PcmPolyphase p;
+	bool success = p.Open(SAMPLE_FORMAT_S24_P32, 1, 48000, 44100);
+	g_assert(success);
+
+	std::vector<int32_t> square(4096);
+	for (size_t i = 0; i < square.size(); ++i)
+		square[i] = (i / 16) % 2 ? 0x7fffff : -0x800000;
+
+	size_t dest_size;
+	const int32_t *dest = p.Resample32(24, square.data(),
+					   square.size() * sizeof(int32_t),
+					   &dest_size);
+	g_assert_cmpint(dest_size, >, 0);
+	for (size_t i = 0; i < dest_size / sizeof(*dest); ++i) {
+		g_assert_cmpint(dest[i], >=, -0x800000);
+		g_assert_cmpint(dest[i], <=, 0x7fffff);
+	}
+
+	/* the 16 bit sum must not overflow */
+	TestPolyphaseFullScale16(44100, 48000);
+	TestPolyphaseFullScale16(96000, 44100);
+
+	/* a ratio which needs too many coefficients */
+	success = p.Open(SAMPLE_FORMAT_S16, 2, 44100, 44099);
+	g_assert(!success);
+}
+
+/**
+ * Resamples one second of a test signal with one call, and returns
+ * a copy of the result.
+ */
+template<typename T, typename F>
+static std::vector<T>
+ResampleOnce(enum sample_format format, unsigned channels,
+	     unsigned src_rate, unsigned dest_rate, F resample)
+{
+	/* the stereo sine, reinterpreted for the given number of
+	   channels */
+	const auto src = GenerateSine<T>(src_rate * channels / 2,
+					 format == SAMPLE_FORMAT_FLOAT
+					 ? 0.5 : 16384);
+
+	PcmPolyphase p;
+	bool success = p.Open(format, channels, src_rate, dest_rate);
+	g_assert(success);
+
+	size_t dest_size;
+	const T *dest = resample(p, src.data(), src.size() * sizeof(T),
+				 &dest_size);
+	return std::vector<T>(dest, dest + dest_size / sizeof(T));
+}
+
+void
+test_pcm_resample_threads()
+{
+	/* more channels than threads, so some threads get more than
+	   one */
+	static constexpr unsigned CHANNELS = 6, THREADS = 4;
+
+	/* the references are calculated before the worker threads
+	   are started; this is the only test which starts them */
+	const auto up16 = ResampleOnce<int16_t>(SAMPLE_FORMAT_S16, CHANNELS,
+						44100, 48000, Resample16);
+	const auto down16 = ResampleOnce<int16_t>(SAMPLE_FORMAT_S16, CHANNELS,
+						  96000, 44100, Resample16);
+	const auto up_float = ResampleOnce<float>(SAMPLE_FORMAT_FLOAT,
+						  CHANNELS, 44100, 48000,
+						  ResampleFloat);
+	const auto down_float = ResampleOnce<float>(SAMPLE_FORMAT_FLOAT,
+						    CHANNELS, 96000, 44100,
+						    ResampleFloat);
+
+	GError *error = NULL;
+	bool success = pcm_resample_polyphase_global_init(THREADS, &error);
+	g_assert(success);
+
+	/* each channel is filtered exactly like before, only by
+	   another thread */
+	g_assert(ResampleOnce<int16_t>(SAMPLE_FORMAT_S16, CHANNELS,
+				       44100, 48000, Resample16) == up16);
+	g_assert(ResampleOnce<int16_t>(SAMPLE_FORMAT_S16, CHANNELS,
+				       96000, 44100, Resample16) == down16);
+	g_assert(ResampleOnce<float>(SAMPLE_FORMAT_FLOAT, CHANNELS,
+				     44100, 48000, ResampleFloat) == up_float);
+	g_assert(ResampleOnce<float>(SAMPLE_FORMAT_FLOAT, CHANNELS,
+				     96000, 44100, ResampleFloat) == down_float);
+}
+
+void
+test_pcm_resample_simd()
+{
+	constexpr unsigned N = 288;
+	const auto x16 = TestDataBuffer<int16_t, N>();
+	const auto xf = TestDataBuffer<float, N>(GlibRandomFloat());
+
+	/* the coefficients are limited to +/-32767 */
+	auto h16 = TestDataBuffer<int16_t, N>();
+	for (auto &i : h16)
+		i = std::max(i, int16_t(-32767));
+
+	/* full scale, with the signs of the coefficients: the sum
+	   needs more than 32 bit */
+	int16_t x_max[N];
+	int64_t sum_max[N + 1];
+	sum_max[0] = 0;
+	for (unsigned i = 0; i < N; ++i) {
+		x_max[i] = h16[i] >= 0 ? 32767 : -32768;
+		sum_max[i + 1] = sum_max[i] + int32_t(x_max[i]) * h16[i];
+	}
+
+	const auto hf = TestDataBuffer<float, N>(GlibRandomFloat());
+
+	const PcmPolyphaseKernels &generic = pcm_polyphase_kernels_generic;
+	g_assert_cmpint(sum_max[N], >, INT32_MAX);
+	g_assert_cmpint(generic.dot_16(x_max, h16.begin(), N), ==, sum_max[N]);
+
+	ForEachPcmSimdKernels(pcm_polyphase_kernels_simd,
+			      [&](const PcmPolyphaseKernels &k) {
+			for (unsigned n = PCM_POLYPHASE_TAP_ALIGN; n <= N;
+			     n += PCM_POLYPHASE_TAP_ALIGN) {
+				g_assert_cmpint(k.dot_16(x16.begin(), h16.begin(), n),
+						==,
+						generic.dot_16(x16.begin(), h16.begin(), n));
+				g_assert_cmpint(k.dot_16(x_max, h16.begin(), n),
+						==, sum_max[n]);
+
+				g_assert_cmpfloat(fabs(k.dot_float(xf.begin(), hf.begin(), n) -
+						       generic.dot_float(xf.begin(), hf.begin(), n)),
+						  <=, 1e-4);
+			}
+		});
+}
+
+template<typename T, typename F>
+static double
+BenchmarkPolyphase(enum sample_format format, unsigned src_rate,
+		   unsigned dest_rate, F resample)
+{
+	/* one second of stereo, resampled ten times */
+	constexpr unsigned ROUNDS = 10;
+	const auto src = GenerateSine<T>(src_rate, 1000);
+
+	PcmPolyphase p;
+	bool success = p.Open(format, 2, src_rate, dest_rate);
+	g_assert(success);
+
+	size_t dest_size;
+	const double elapsed = BenchmarkRounds(ROUNDS, [&]() {
+			resample(p, src.data(), src.size() * sizeof(T),
+				 &dest_size);
+		});
+
+	return ROUNDS * 2 * dest_rate / elapsed;
+}
+
+static void
+ReportPolyphaseBenchmark(const char *name, unsigned src_rate,
+			 unsigned dest_rate, double samples_per_second)
+{
+	char rates[32];
+	snprintf(rates, sizeof(rates), "%u:%u", src_rate, dest_rate);
+	ReportPcmBenchmark(name, rates, samples_per_second / 1e6,
+			   "Msamples/s");
+}
+
+void
+test_pcm_resample_benchmark()
+{
+	static constexpr unsigned rates[][2] = {
+		{ 44100, 48000 },
+		{ 48000, 96000 },
+		{ 96000, 44100 },
+		{ 192000, 48000 },
+	};
+
+	for (const auto &r : rates) {
+		ReportPolyphaseBenchmark("16", r[0], r[1],
+					 BenchmarkPolyphase<int16_t>(SAMPLE_FORMAT_S16,
+								     r[0], r[1],
+								     Resample16));
+
+		ReportPolyphaseBenchmark("float", r[0], r[1],
+					 BenchmarkPolyphase<float>(SAMPLE_FORMAT_FLOAT,
+								   r[0], r[1],
+								   ResampleFloat));
+	}
+}
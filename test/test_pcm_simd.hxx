@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Helpers for the tests and benchmarks of the PCM SIMD kernels.
+ */
+
+#ifndef MPD_TEST_PCM_SIMD_HXX
+#define MPD_TEST_PCM_SIMD_HXX
+
+#include "pcm/PcmCpu.hxx"
+
+#include <glib.h>
+
+/**
+ * Invokes the function with each SIMD kernel table which this CPU
+ * supports.
+ *
+ * @param simd returns the table for one PCM_CPU_* flag
+ */
+template<typename T, typename F>
+static void
+ForEachPcmSimdKernels(const T *(*simd)(unsigned feature), F f)
+{
+	static constexpr unsigned features[] = {
+		PCM_CPU_SSE2, PCM_CPU_AVX2, PCM_CPU_NEON,
+	};
+
+	const unsigned supported = pcm_cpu_features();
+	for (unsigned feature : features) {
+		if ((supported & feature) == 0)
+			continue;
+
+		const T *kernels = simd(feature);
+		g_assert(kernels != nullptr);
+		f(*kernels);
+	}
+}
+
+/**
+ * Invokes the function the specified number of times.
+ *
+ * @return the duration in seconds
+ */
+template<typename F>
+static double
+BenchmarkRounds(unsigned rounds, F f)
+{
+	GTimer *timer = g_timer_new();
+	for (unsigned i = 0; i < rounds; ++i)
+		f();
+	const double elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+/**
+ * Reports one benchmark result (with "-m perf").
+ *
+ * @param name the kernel table or sample format
+ * @param function the function or sample rates which were measured
+ */
+static inline void
+ReportPcmBenchmark(const char *name, const char *function,
+		   double value, const char *unit)
+{
+	g_test_maximized_result(value, "%s %s: %.1f %s",
+				name, function, value, unit);
+}
+
+#endif
@@ -19,12 +19,15 @@
 
 #include "test_pcm_all.hxx"
 #include "pcm/PcmVolume.hxx"
+#include "pcm/PcmVolumeKernels.hxx"
 #include "test_pcm_util.hxx"
+#include "test_pcm_simd.hxx"
 
 #include <glib.h>
 
 #include <algorithm>
 
+#include <math.h>
 #include <string.h>
 
 void
@@ -169,3 +172,119 @@ test_pcm_volume_float()
 	for (unsigned i = 0; i < N; ++i)
 		g_assert_cmpfloat(dest[i], ==, src[i] / 2);
 }
+
+/**
+ * Compares one integer kernel with the generic implementation.  Each
+ * sample may differ by 1, because the dither values are different;
+ * on average, both must have the same error.
+ */
+template<typename T, typename G>
+static void
+TestPcmVolumeKernel(void (*simd)(T *, size_t, int),
+		    void (*generic)(T *, size_t, int),
+		    int volume, G g)
+{
+	/* odd, so the SIMD kernels handle a tail */
+	constexpr unsigned N = 4099;
+	const auto src = TestDataBuffer<T, N>(g);
+
+	auto expected = src, result = src;
+	generic(expected.begin(), N, volume);
+	simd(result.begin(), N, volume);
+	AssertEqualWithTolerance(result, expected, 1);
+
+	double error_generic = 0, error_simd = 0;
+	for (unsigned i = 0; i < N; ++i) {
+		const double exact = src[i] * (double)volume / PCM_VOLUME_1;
+		error_generic += expected[i] - exact;
+		error_simd += result[i] - exact;
+	}
+
+	g_assert_cmpfloat(fabs(error_simd - error_generic) / N, <, 0.05);
+}
+
+/**
+ * Compares each kernel of the table with the generic one.
+ */
+static void
+TestPcmVolumeKernels(const PcmVolumeKernels &k)
+{
+	const PcmVolumeKernels &generic = pcm_volume_kernels_generic;
+
+	static const int volumes[] = {
+		1, 300, PCM_VOLUME_1 / 2, PCM_VOLUME_1 - 1,
+		/* amplification, e.g. by replay gain */
+		3 * PCM_VOLUME_1, 40 * PCM_VOLUME_1,
+	};
+
+	for (int volume : volumes) {
+		TestPcmVolumeKernel(k.change_16, generic.change_16,
+				    volume, GlibRandomInt<int16_t>());
+		TestPcmVolumeKernel(k.change_24, generic.change_24,
+				    volume, GlibRandomInt24());
+		TestPcmVolumeKernel(k.change_32, generic.change_32,
+				    volume, GlibRandomInt<int32_t>());
+
+		constexpr unsigned N = 4099;
+		const auto src = TestDataBuffer<float, N>(GlibRandomFloat());
+		auto expected = src, result = src;
+		const float f = pcm_volume_to_float(volume);
+		generic.change_float(expected.begin(), N, f);
+		k.change_float(result.begin(), N, f);
+		g_assert_cmpint(memcmp(result.begin(), expected.begin(),
+				       sizeof(result)), ==, 0);
+	}
+}
+
+void
+test_pcm_volume_simd()
+{
+	ForEachPcmSimdKernels(pcm_volume_kernels_simd, TestPcmVolumeKernels);
+}
+
+template<typename T, typename V>
+static double
+BenchmarkPcmVolumeKernel(void (*kernel)(T *, size_t, V), V volume)
+{
+	/* one second of 48 kHz stereo, processed for one minute */
+	constexpr unsigned N = 2 * 48000, ROUNDS = 60;
+	static T buffer[N];
+
+	const double elapsed = BenchmarkRounds(ROUNDS, [&]() {
+			kernel(buffer, N, volume);
+		});
+
+	return ROUNDS * N / elapsed;
+}
+
+static void
+ReportPcmVolumeBenchmark(const PcmVolumeKernels &k, const char *function,
+			 double samples_per_second)
+{
+	ReportPcmBenchmark(k.name, function, samples_per_second / 1e6,
+			   "Msamples/s");
+}
+
+static void
+BenchmarkPcmVolumeKernels(const PcmVolumeKernels &k)
+{
+	const int volume = PCM_VOLUME_1 / 3;
+
+	ReportPcmVolumeBenchmark(k, "change_16",
+				 BenchmarkPcmVolumeKernel(k.change_16, volume));
+	ReportPcmVolumeBenchmark(k, "change_24",
+				 BenchmarkPcmVolumeKernel(k.change_24, volume));
+	ReportPcmVolumeBenchmark(k, "change_32",
+				 BenchmarkPcmVolumeKernel(k.change_32, volume));
+	ReportPcmVolumeBenchmark(k, "change_float",
+				 BenchmarkPcmVolumeKernel(k.change_float,
+							  pcm_volume_to_float(volume)));
+}
+
+void
+test_pcm_volume_benchmark()
+{
+	BenchmarkPcmVolumeKernels(pcm_volume_kernels_generic);
+	ForEachPcmSimdKernels(pcm_volume_kernels_simd,
+			      BenchmarkPcmVolumeKernels);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs a RaopTimeline against simulated clocks for 24 hours of
+ * virtual time, the way the RAOP output plugin drives it.
+ */
+
+#include "config.h"
+#include "RaopTimeline.hxx"
+
+#include <glib.h>
+
+#include <stdint.h>
+
+static constexpr unsigned FRAMES_PER_PACKET = 352;
+static constexpr unsigned PACKETS_PER_SYNC = 44100 / FRAMES_PER_PACKET + 1;
+static constexpr uint64_t DAY = UINT64_C(24) * 3600 * 1000000;
+
+static int64_t
+abs64(int64_t x)
+{
+	return x >= 0 ? x : -x;
+}
+
+static void
+test_raop_timeline_frames(void)
+{
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(0), ==, 0);
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(44100), ==,
+			 999999);
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(441), ==, 9999);
+
+	/* no accumulated rounding error after a day, and no
+	   overflow beyond 2^32 frames */
+	const uint64_t day_frames = UINT64_C(44100) * 86400;
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(day_frames),
+			 >=, DAY - 1);
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(day_frames),
+			 <=, DAY);
+
+	const uint64_t week_frames = day_frames * 7;
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(week_frames),
+			 >=, DAY * 7 - 10);
+	g_assert_cmpuint(RaopTimeline::FramesToMicroseconds(week_frames),
+			 <=, DAY * 7);
+}
+
+/**
+ * Simulates one day of playback.
+ *
+ * @param drift_ppm how much faster the wall clock runs than the
+ * monotonic clock
+ * @param step a wall clock step (in microseconds) in the middle of
+ * the day
+ * @param max_error_r the largest deviation of the announced wall
+ * clock time from the ideal one
+ */
+static void
+simulate_day(double drift_ppm, int64_t step, int64_t *max_error_r)
+{
+	RaopTimeline timeline;
+
+	/* start close to the wrap-around of the RTP time stamp */
+	const uint32_t rtp_base = 0xffffffff - 100 * FRAMES_PER_PACKET;
+	timeline.Reset(rtp_base);
+
+	const uint64_t monotonic0 = UINT64_C(1000000000);
+	const uint64_t realtime0 = UINT64_C(1380000000) * 1000000;
+
+	uint64_t monotonic = monotonic0;
+	int64_t stepped = 0;
+
+	auto realtime_at = [&](uint64_t m) -> uint64_t {
+		const int64_t elapsed = m - monotonic0;
+		return realtime0 + elapsed + (int64_t)(elapsed * drift_ppm / 1e6)
+			+ stepped;
+	};
+
+	timeline.Start(monotonic, realtime_at(monotonic));
+
+	uint64_t previous_deadline = 0;
+	uint32_t previous_rtp = timeline.GetRtpTime() - FRAMES_PER_PACKET;
+	int64_t max_error = 0;
+	bool wrapped = false;
+
+	for (unsigned seq = 1; monotonic - monotonic0 < DAY; ++seq) {
+		if (seq % PACKETS_PER_SYNC == 0) {
+			if (step != 0 && stepped == 0 &&
+			    monotonic - monotonic0 >= DAY / 2)
+				stepped = step;
+
+			timeline.Synchronize(monotonic,
+					     realtime_at(monotonic), 0);
+
+			/* this is what the sync packet announces; the
+			   receiver's clock follows ours, and it plays
+			   the frames at the nominal rate */
+			const uint64_t announced =
+				timeline.GetRealtime(timeline.GetPosition());
+			const uint64_t ideal = realtime0 + stepped +
+				RaopTimeline::FramesToMicroseconds(timeline.GetPosition());
+			const int64_t error = announced - ideal;
+			if (abs64(error) > max_error)
+				max_error = abs64(error);
+
+			/* the packet must be sent close to its wall
+			   clock time */
+			const int64_t early =
+				(int64_t)announced -
+				(int64_t)realtime_at(timeline.GetDeadline());
+			g_assert_cmpint(abs64(early), <, 2000);
+		}
+
+		const uint32_t rtp = timeline.GetRtpTime();
+		g_assert_cmpuint(rtp - previous_rtp, ==, FRAMES_PER_PACKET);
+		if (rtp < previous_rtp)
+			wrapped = true;
+		previous_rtp = rtp;
+
+		const uint64_t deadline = timeline.GetDeadline();
+		g_assert_cmpuint(deadline, >, previous_deadline);
+		previous_deadline = deadline;
+
+		/* the sender thread sends exactly at the deadline */
+		monotonic = deadline;
+		timeline.Advance(FRAMES_PER_PACKET);
+	}
+
+	g_assert(wrapped);
+
+	*max_error_r = max_error;
+}
+
+static void
+test_raop_timeline_nominal(void)
+{
+	int64_t max_error;
+	simulate_day(0, 0, &max_error);
+	g_assert_cmpint(max_error, <=, 1);
+}
+
+static void
+test_raop_timeline_drift(void)
+{
+	/* uncorrected, 100 ppm would be 8.6 seconds per day */
+	int64_t max_error;
+	simulate_day(100, 0, &max_error);
+	g_assert_cmpint(max_error, <=, 1);
+
+	simulate_day(-100, 0, &max_error);
+	g_assert_cmpint(max_error, <=, 1);
+}
+
+static void
+test_raop_timeline_step(void)
+{
+	/* the drift since the previous sync point cannot be told
+	   apart from the step, and goes with it */
+	int64_t max_error;
+	simulate_day(50, 2000000, &max_error);
+	g_assert_cmpint(max_error, <=, RaopTimeline::MAX_SLEW);
+
+	simulate_day(-50, -3600000000ll, &max_error);
+	g_assert_cmpint(max_error, <=, RaopTimeline::MAX_SLEW);
+}
+
+static void
+test_raop_timeline_send_lag(void)
+{
+	RaopTimeline timeline;
+	timeline.Reset(0);
+	timeline.Start(1000000, 5000000);
+
+	timeline.Advance(44100);
+	g_assert_cmpuint(timeline.GetDeadline(), ==, 1999999);
+
+	/* a small lag is caught up with */
+	timeline.Synchronize(2000000, 6000000, 1000);
+	g_assert_cmpuint(timeline.GetDeadline(), ==, 1999999);
+
+	/* a large lag moves the timeline */
+	timeline.Synchronize(2000000, 6000000, 300000);
+	g_assert_cmpuint(timeline.GetDeadline(), ==, 2299999);
+	g_assert_cmpuint(timeline.GetRealtime(timeline.GetPosition()), ==,
+			 6299999);
+}
+
+int
+main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/raop_timeline/frames", test_raop_timeline_frames);
+	g_test_add_func("/raop_timeline/nominal", test_raop_timeline_nominal);
+	g_test_add_func("/raop_timeline/drift", test_raop_timeline_drift);
+	g_test_add_func("/raop_timeline/step", test_raop_timeline_step);
+	g_test_add_func("/raop_timeline/send_lag",
+			test_raop_timeline_send_lag);
+
+	return g_test_run();
+}
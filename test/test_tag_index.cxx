@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2003-2013 The Music Player Daemon Project
+ * http://www.musicpd.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+#include "TagIndex.hxx"
+#include "Directory.hxx"
+#include "SongFilter.hxx"
+#include "DatabaseLock.hxx"
+#include "DatabasePlugin.hxx"
+#include "song.h"
+#include "tag.h"
+
+#include <glib.h>
+
+#include <algorithm>
+#include <string>
+
+static struct song *
+add_song(Directory *parent, const char *name,
+	 const char *artist, const char *album)
+{
+	struct song *song = song_file_new(name, parent);
+	song->tag = tag_new();
+	tag_add_item(song->tag, TAG_ARTIST, artist);
+	tag_add_item(song->tag, TAG_ALBUM, album);
+
+	parent->AddSong(song);
+	return song;
+}
+
+gcc_pure
+static bool
+contains(const TagIndex::SongList *songs, const struct song *song)
+{
+	return songs != nullptr &&
+		std::find(songs->begin(), songs->end(), song) != songs->end();
+}
+
+gcc_pure
+static size_t
+count(enum tag_type type, const char *value)
+{
+	const TagIndex::SongList *songs = db_tag_index.Find(type, value);
+	return songs != nullptr ? songs->size() : 0;
+}
+
+static void
+test_tag_index_build()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *a = root->CreateChild("a");
+	Directory *b = a->CreateChild("b");
+
+	/* not indexed yet */
+	struct song *s1 = add_song(a, "1.ogg", "Foo", "Bar");
+	struct song *s2 = add_song(b, "2.ogg", "Foo", "Baz");
+	struct song *s3 = add_song(root, "3.ogg", "Qux", "Bar");
+	g_assert(!db_tag_index.IsEnabled());
+
+	db_tag_index.Build(*root);
+	g_assert(db_tag_index.IsEnabled());
+
+	g_assert_cmpint(count(TAG_ARTIST, "Foo"), ==, 2);
+	g_assert(contains(db_tag_index.Find(TAG_ARTIST, "Foo"), s1));
+	g_assert(contains(db_tag_index.Find(TAG_ARTIST, "Foo"), s2));
+	g_assert_cmpint(count(TAG_ARTIST, "Qux"), ==, 1);
+	g_assert_cmpint(count(TAG_ALBUM, "Bar"), ==, 2);
+	g_assert(contains(db_tag_index.Find(TAG_ALBUM, "Bar"), s3));
+
+	/* the tag type is part of the key */
+	g_assert_cmpint(count(TAG_ALBUM, "Foo"), ==, 0);
+	g_assert_cmpint(count(TAG_ARTIST, "foo"), ==, 0);
+
+	/* incremental updates */
+	add_song(b, "4.ogg", "Foo", "Baz");
+	g_assert_cmpint(count(TAG_ARTIST, "Foo"), ==, 3);
+	g_assert_cmpint(count(TAG_ALBUM, "Baz"), ==, 2);
+
+	a->RemoveSong(s1);
+	song_free(s1);
+	g_assert_cmpint(count(TAG_ARTIST, "Foo"), ==, 2);
+	g_assert(!contains(db_tag_index.Find(TAG_ARTIST, "Foo"), s1));
+	g_assert_cmpint(count(TAG_ALBUM, "Bar"), ==, 1);
+
+	/* deleting a directory removes its songs */
+	a->Delete();
+	g_assert_cmpint(count(TAG_ARTIST, "Foo"), ==, 0);
+	g_assert_cmpint(count(TAG_ALBUM, "Baz"), ==, 0);
+	g_assert(contains(db_tag_index.Find(TAG_ARTIST, "Qux"), s3));
+
+	db_unlock();
+
+	db_tag_index.Clear();
+	g_assert(!db_tag_index.IsEnabled());
+	root->Free();
+}
+
+static void
+test_tag_index_lookup()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	add_song(root, "1.ogg", "Foo", "Bar");
+	add_song(root, "2.ogg", "Foo", "Baz");
+	add_song(root, "3.ogg", "Qux", "Bar");
+	db_tag_index.Build(*root);
+
+	const TagIndex::SongList *songs;
+
+	/* the most selective item is used */
+	SongFilter f1;
+	f1.Parse("artist", "Foo");
+	f1.Parse("album", "Baz");
+	g_assert(db_tag_index.Lookup(f1, songs));
+	g_assert_cmpint(songs->size(), ==, 1);
+
+	/* no song can match */
+	SongFilter f2;
+	f2.Parse("artist", "Foo");
+	f2.Parse("album", "Nothing");
+	g_assert(db_tag_index.Lookup(f2, songs));
+	g_assert(songs == nullptr);
+
+	/* case folding, "any", "file" and empty values need a walk */
+	g_assert(!db_tag_index.Lookup(SongFilter(TAG_ARTIST, "Foo", true),
+				      songs));
+	g_assert(!db_tag_index.Lookup(SongFilter(LOCATE_TAG_ANY_TYPE, "Foo"),
+				      songs));
+	g_assert(!db_tag_index.Lookup(SongFilter(LOCATE_TAG_FILE_TYPE,
+						 "1.ogg"),
+				      songs));
+	g_assert(!db_tag_index.Lookup(SongFilter(TAG_ARTIST, ""), songs));
+
+	db_unlock();
+
+	db_tag_index.Clear();
+	root->Free();
+}
+
+/**
+ * Returns the values reported by TagIndex::VisitUniqueTags(),
+ * separated by commas.
+ */
+static std::string
+unique_tags(enum tag_type type)
+{
+	std::string result;
+	bool first = true;
+	db_tag_index.VisitUniqueTags(type, [&](const char *value, GError **){
+			if (!first)
+				result.push_back(',');
+			first = false;
+			result.append(value);
+			return true;
+		}, nullptr);
+	return result;
+}
+
+static void
+test_tag_index_unique()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *a = root->CreateChild("a");
+	add_song(root, "1.ogg", "Foo", "Bar");
+	add_song(a, "2.ogg", "Qux", "Bar");
+	db_tag_index.Build(*root);
+
+	g_assert(unique_tags(TAG_ARTIST) == "Foo,Qux");
+	g_assert(unique_tags(TAG_ALBUM) == "Bar");
+
+	/* songs without the tag type report an empty value */
+	g_assert(unique_tags(TAG_GENRE) == "");
+	struct song *s3 = song_file_new("3.ogg", a);
+	s3->tag = tag_new();
+	tag_add_item(s3->tag, TAG_ARTIST, "Baz");
+	tag_add_item(s3->tag, TAG_GENRE, "Rock");
+	a->AddSong(s3);
+	g_assert(unique_tags(TAG_GENRE) == ",Rock");
+
+	/* songs without a tag are ignored */
+	a->AddSong(song_file_new("4.ogg", a));
+	g_assert(unique_tags(TAG_ARTIST) == "Baz,Foo,Qux");
+
+	/* incremental updates keep the order */
+	add_song(root, "5.ogg", "Aaa", "Zzz");
+	g_assert(unique_tags(TAG_ARTIST) == "Aaa,Baz,Foo,Qux");
+	/* 3.ogg has no album */
+	g_assert(unique_tags(TAG_ALBUM) == ",Bar,Zzz");
+
+	a->Delete();
+	g_assert(unique_tags(TAG_ARTIST) == "Aaa,Foo");
+	g_assert(unique_tags(TAG_GENRE) == "");
+
+	db_unlock();
+
+	db_tag_index.Clear();
+	root->Free();
+}
+
+static void
+test_tag_index_stats()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	Directory *a = root->CreateChild("a");
+	struct song *s1 = add_song(root, "1.ogg", "Foo", "Bar");
+	s1->tag->time = 60;
+	add_song(a, "2.ogg", "Qux", "Bar")->tag->time = 120;
+	a->AddSong(song_file_new("3.ogg", a));
+	db_tag_index.Build(*root);
+
+	/* the durations must not change while the songs are indexed,
+	   so the next one gets its tag before it is added */
+	struct song *s4 = song_file_new("4.ogg", root);
+	s4->tag = tag_new();
+	s4->tag->time = 30;
+	tag_add_item(s4->tag, TAG_ARTIST, "Foo");
+	tag_add_item(s4->tag, TAG_ALBUM, "Baz");
+
+	DatabaseStats stats;
+	db_tag_index.GetStats(stats);
+	g_assert_cmpint(stats.song_count, ==, 3);
+	g_assert_cmpint(stats.total_duration, ==, 180);
+	g_assert_cmpint(stats.artist_count, ==, 2);
+	g_assert_cmpint(stats.album_count, ==, 1);
+
+	root->AddSong(s4);
+	root->RemoveSong(s1);
+	song_free(s1);
+
+	db_tag_index.GetStats(stats);
+	g_assert_cmpint(stats.song_count, ==, 3);
+	g_assert_cmpint(stats.total_duration, ==, 150);
+	g_assert_cmpint(stats.artist_count, ==, 2);
+	g_assert_cmpint(stats.album_count, ==, 2);
+
+	a->Delete();
+	db_tag_index.GetStats(stats);
+	g_assert_cmpint(stats.song_count, ==, 1);
+	g_assert_cmpint(stats.total_duration, ==, 30);
+	g_assert_cmpint(stats.artist_count, ==, 1);
+	g_assert_cmpint(stats.album_count, ==, 1);
+
+	db_unlock();
+
+	db_tag_index.Clear();
+	root->Free();
+}
+
+/**
+ * Simulates a song whose file cannot be read anymore: the updater
+ * removes it from the index before reloading the tag, and
+ * Directory::RemoveSong() must not remove it a second time.
+ */
+static void
+test_tag_index_failed_update()
+{
+	db_lock();
+
+	Directory *root = Directory::NewRoot();
+	struct song *s1 = add_song(root, "1.ogg", "Foo", "Bar");
+	s1->tag->time = 60;
+	add_song(root, "2.ogg", "Qux", "Bar")->tag->time = 120;
+	db_tag_index.Build(*root);
+
+	/* what update_song_file2() does when song_file_update()
+	   fails: the tag is gone, and the song is deleted */
+	db_tag_index.Remove(*s1);
+	tag_free(s1->tag);
+	s1->tag = nullptr;
+	db_tag_index.Add(*s1);
+	root->RemoveSong(s1);
+	song_free(s1);
+
+	DatabaseStats stats;
+	db_tag_index.GetStats(stats);
+	g_assert_cmpint(stats.song_count, ==, 1);
+	g_assert_cmpint(stats.total_duration, ==, 120);
+	g_assert_cmpint(stats.artist_count, ==, 1);
+	g_assert_cmpint(stats.album_count, ==, 1);
+	g_assert_cmpint(count(TAG_ARTIST, "Foo"), ==, 0);
+	g_assert_cmpint(count(TAG_ARTIST, "Qux"), ==, 1);
+
+	db_unlock();
+
+	db_tag_index.Clear();
+	root->Free();
+}
+
+int
+main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/tag_index/build", test_tag_index_build);
+	g_test_add_func("/tag_index/lookup", test_tag_index_lookup);
+	g_test_add_func("/tag_index/unique", test_tag_index_unique);
+	g_test_add_func("/tag_index/stats", test_tag_index_stats);
+	g_test_add_func("/tag_index/failed_update",
+			test_tag_index_failed_update);
+
+	return g_test_run();
+}